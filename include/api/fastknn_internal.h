@@ -0,0 +1,29 @@
+#ifndef FASTKNN_INTERNAL_H
+#define FASTKNN_INTERNAL_H
+
+// Functions shared by the sources of libfastknn (not exported: the library is built with -fvisibility=hidden)
+
+#include "../../include/fastknn.h"
+
+/**
+ * Record the message of a failed call for `fastknn_last_error` of the calling thread.
+ *
+ * @param status            Status of the failure
+ * @param format            printf format of the message, followed by its arguments
+ *
+ * @return                  `status`
+ */
+fastknn_status_t fastknn_fail(fastknn_status_t status, const char* format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/**
+ * Get the generation of an index: a number that no other index of the process has, so results cached for
+ * an index never match another index (e.g. one rebuilt over a changed corpus at the same address).
+ *
+ * @param index             Index (not NULL)
+ *
+ * @return                  Generation of the index
+ */
+uint64_t fastknn_index_generation(const fastknn_index_t* index);
+
+#endif // FASTKNN_INTERNAL_H
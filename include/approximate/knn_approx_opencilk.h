@@ -11,6 +11,7 @@
 #include "../exact/knn_exact_serial.h"
 
 #include "../../include/utils/mem_info.h"
+#include "../../include/utils/blas_threads.h"
 
 /**
  * Function to perform k-NN search using OpenCilk for parallel computation.
@@ -26,7 +27,7 @@
  * 
  * @return                  None (results are stored in the pre-allocated arrays `indices` and `distances`)
  */
-void knn_approx_opencilk(const float* dataset, int k, int* indices, float* distances, 
-                         int dataset_length, int d, int num_of_threads, int accuracy);
+void knn_approx_opencilk(const float* dataset, int k, knn_idx_t* indices, float* distances, 
+                         size_t dataset_length, int d, int num_of_threads, int accuracy);
 
 #endif // KNN_APPROX_OPENCILK_H
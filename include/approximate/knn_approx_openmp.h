@@ -10,6 +10,7 @@
 #include "../exact/knn_exact_serial.h"
 
 #include "../../include/utils/mem_info.h"
+#include "../../include/utils/blas_threads.h"
 
 /**
  * Function to perform k-NN search using OpenMP for parallel computation.
@@ -25,7 +26,7 @@
  * 
  * @return                  None (results are stored in the pre-allocated arrays `indices` and `distances`)
  */
-void knn_approx_openmp(const float* dataset, int k, int* indices, float* distances,
-                       int dataset_length, int d, int num_of_threads, int accuracy);
+void knn_approx_openmp(const float* dataset, int k, knn_idx_t* indices, float* distances,
+                       size_t dataset_length, int d, int num_of_threads, int accuracy);
 
 #endif // KNN_APPROX_OPENMP_H
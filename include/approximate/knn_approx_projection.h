@@ -0,0 +1,145 @@
+#ifndef KNN_APPROX_PROJECTION_H
+#define KNN_APPROX_PROJECTION_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "../../include/utils/distance.h"
+#include "../../include/utils/blas_threads.h"
+#include "../../include/utils/data_gen.h"
+#include "../../include/utils/knn_heap.h"
+#include "../../include/utils/knn_hash.h"
+#include "../../include/utils/knn_snapshot.h"
+#include "../../include/utils/knn_parallel.h"
+#include "../../include/exact/knn_exact_pthread.h"
+
+// Default reduced dimension: d / KNN_PROJECTION_DEFAULT_RATIO, but at least KNN_PROJECTION_MIN_DIM (and at most d)
+#define KNN_PROJECTION_DEFAULT_RATIO    4
+#define KNN_PROJECTION_MIN_DIM          16
+
+// Default number of candidates per query, reranked in full dimension: KNN_PROJECTION_CANDIDATES x k
+#define KNN_PROJECTION_CANDIDATES       4
+
+// Rows of the corpus sample whose covariance the PCA is computed from
+#define KNN_PROJECTION_SAMPLE_ROWS      16384
+
+// Subspace iterations of the PCA (every one multiplies the basis by the covariance)
+#define KNN_PROJECTION_ITERATIONS       8
+
+// Seed of the random starting basis (the projection of a corpus is the same on every run)
+#define KNN_PROJECTION_SEED             0x9E3779B97F4A7C15ULL
+
+typedef enum {
+    KNN_PROJECTION_PCA,                 // The top principal components of the corpus (fewest dimensions for a recall)
+    KNN_PROJECTION_RANDOM               // A random orthogonal projection (no training, the distances shrink evenly)
+} knn_projection_method_t;
+
+// Projection of a corpus to `reduced_d` dimensions: the candidates of a query are its nearest corpus rows in the
+// reduced space, and they are reranked with their full-dimension distances.
+typedef struct {
+    const float*    corpus;             // The full-dimension corpus (not owned, it must outlive the projection)
+    size_t          corpus_length;
+    int             d;
+    int             reduced_d;
+    knn_projection_method_t method;
+    float*          basis;              // reduced_d x d, orthonormal rows
+    float*          reduced;            // corpus_length x reduced_d: the corpus rows projected on the basis
+    knn_snapshot_t* snapshot;           // Snapshot that the arrays point into (read-only), NULL if they are allocated
+} knn_projection_t;
+
+/**
+ * Learn the projection of a corpus and project the corpus. A PCA runs a subspace iteration on the covariance of
+ * `KNN_PROJECTION_SAMPLE_ROWS` evenly spaced corpus rows. The GEMMs use `num_of_threads` BLAS threads.
+ *
+ * @param corpus            Pointer to the corpus matrix (it is referenced by the projection, not copied)
+ * @param corpus_length     Number of rows (data points) in the corpus
+ * @param d                 Dimensionality of each data point
+ * @param reduced_d         Reduced dimension (0 for the default, see `KNN_PROJECTION_DEFAULT_RATIO`)
+ * @param method            `KNN_PROJECTION_PCA` or `KNN_PROJECTION_RANDOM`
+ * @param num_of_threads    Number of threads (<= 0 to use all the online cores)
+ *
+ * @return                  Pointer to the projection, or NULL on failure. Free it with `knn_projection_free`.
+ */
+knn_projection_t* knn_projection_build(const float* corpus, size_t corpus_length, int d, int reduced_d,
+                                       knn_projection_method_t method, int num_of_threads);
+
+/**
+ * Approximate k-nearest neighbor search: the queries are projected, their `candidates` nearest corpus rows in
+ * the reduced space are found with `knn_exact_pthread`, and the candidates are reranked by their full-dimension
+ * distance (computed in double precision; neighbors at equal distances are ordered by id). The distance of
+ * every returned neighbor is exact; a true neighbor is missed only when it is not among the candidates.
+ *
+ * @param projection        Projection of the corpus
+ * @param query             Pointer to the query matrix (data points to compare)
+ * @param k                 Number of nearest neighbors to find
+ * @param candidates        Candidates per query (0 for KNN_PROJECTION_CANDIDATES x k, clamped to [k, corpus_length])
+ * @param indices           Pre-allocated array to store indices of the k-nearest neighbors for each query (length `query_length x k`)
+ * @param distances         Pre-allocated array to store the Euclidean distances to the k-nearest neighbors (length `query_length x k`)
+ * @param query_length      Number of rows (data points) in the query
+ * @param num_of_threads    Number of threads (<= 0 to use all the online cores)
+ *
+ * @return                  0 on success, -1 on failure
+ */
+int knn_projection_search(const knn_projection_t* projection, const float* query, int k, int candidates,
+                          knn_idx_t* indices, float* distances, size_t query_length, int num_of_threads);
+
+/**
+ * Save a projection (the basis and the projected corpus) to a snapshot file (see include/utils/knn_snapshot.h),
+ * with a hash of the corpus it was learned from.
+ *
+ * @param projection        Projection
+ * @param filename          Path of the snapshot file
+ *
+ * @return                  0 on success, -1 on failure
+ */
+int knn_projection_save(const knn_projection_t* projection, const char* filename);
+
+/**
+ * Load a projection from a snapshot file, over the corpus it was learned from. The file is mapped and the basis
+ * and the projected corpus point into the mapping (no copy).
+ *
+ * @param filename          Path of the snapshot file
+ * @param corpus            Pointer to the corpus matrix (referenced by the projection, not copied)
+ * @param corpus_length     Number of rows (data points) in the corpus
+ * @param d                 Dimensionality of each data point
+ * @param verify            1 to check the checksums of the whole file, 0 to check only the header
+ * @param num_of_threads    Number of threads of the corpus hash (<= 0 to use all the online cores)
+ *
+ * @return                  Pointer to the projection, or NULL on failure (missing, corrupted or incompatible
+ *                          file, or another corpus). Free it with `knn_projection_free`.
+ */
+knn_projection_t* knn_projection_load(const char* filename, const float* corpus, size_t corpus_length, int d,
+                                      int verify, int num_of_threads);
+
+/**
+ * Free a projection (the corpus is not freed).
+ *
+ * @param projection        Pointer to the projection (NULL is ignored)
+ *
+ * @return                  None
+ */
+void knn_projection_free(knn_projection_t* projection);
+
+/**
+ * Approximate k-nearest neighbor search with a PCA prefilter: learn a PCA projection with the default reduced
+ * dimension, search it with the default number of candidates and free it. It has the same signature as the
+ * exact functions, so it can be used as a `knn_exact_t` (e.g. `approx_projection` in `knn_bench`).
+ *
+ * @param corpus            Pointer to the corpus matrix (reference data points)
+ * @param query             Pointer to the query matrix (data points to compare)
+ * @param k                 Number of nearest neighbors to find
+ * @param indices           Pre-allocated array to store indices of the k-nearest neighbors for each query (length `query_length x k`)
+ * @param distances         Pre-allocated array to store the Euclidean distances to the k-nearest neighbors (length `query_length x k`)
+ * @param corpus_length     Number of rows (data points) in the corpus
+ * @param query_length      Number of rows (data points) in the query
+ * @param d                 Dimensionality of each data point (number of columns in corpus/query)
+ * @param num_of_threads    Number of threads (<= 0 to use all the online cores)
+ *
+ * @return                  None (results are stored in the pre-allocated arrays `indices` and `distances`)
+ */
+void knn_approx_projection(const float* corpus, const float* query, int k, knn_idx_t* indices, float* distances, size_t corpus_length, size_t query_length, int d, int num_of_threads);
+
+#endif // KNN_APPROX_PROJECTION_H
@@ -11,6 +11,7 @@
 #include "../exact/knn_exact_serial.h"
 
 #include "../../include/utils/mem_info.h"
+#include "../../include/utils/blas_threads.h"
 
 
 // Thread function for processing subsets
@@ -19,8 +20,8 @@ void* knn_approx_thread(void* args);
 
 
 // Main function for approximate k-NN with pthreads
-void knn_approx_pthread(const float* dataset, int k, int* indices, float* distances, 
-                        int dataset_length, int d, int num_of_threads, int accuracy);
+void knn_approx_pthread(const float* dataset, int k, knn_idx_t* indices, float* distances, 
+                        size_t dataset_length, int d, int num_of_threads, int accuracy);
 
 
 
@@ -59,7 +60,7 @@ void knn_approx_pthread(const float* dataset, int k, int* indices, float* distan
 //  * each subset to a thread, and computes the k-NN for each subset in parallel using the `knn_approx_serial` 
 //  * function. The results from all subsets are combined to produce the final k-NN results.
 //  */
-// void knn_approx_pthread(const float* dataset, int k, int* indices, float* distances,
-//                         int dataset_length, int d, int num_of_threads, int accuracy);
+// void knn_approx_pthread(const float* dataset, int k, knn_idx_t* indices, float* distances,
+//                         size_t dataset_length, int d, int num_of_threads, int accuracy);
 
 #endif // KNN_APPROX_PTHREAD_H
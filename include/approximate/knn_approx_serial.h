@@ -5,6 +5,8 @@
 #include <math.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <pthread.h>
 #include "../../include/utils/data_io.h"
 #include "../../include/utils/distance.h"
 #include "../../include/utils/mem_info.h"
@@ -13,6 +15,203 @@
 
 #define __ZERO__ 1e-4
 
+// Partitions of a dataset laid out contiguously, so that the exact kernels run directly on slices of one buffer:
+// the partition p is the rows [offsets[p], offsets[p + 1]) of `data`, and the row r of `data` is the dataset row
+// `knn_partition_id(layout, r)`. Contiguous ranges of the dataset need no copy (`data` is the dataset itself).
+typedef struct {
+    int             num_parts;
+    size_t*         offsets;            // num_parts + 1
+    knn_idx_t*      ids;                // Dataset id of every row of `data` (NULL for the identity)
+    const float*    data;               // The rows in partition order
+    float*          own_data;           // Buffer of `data` if the rows were permuted (NULL otherwise)
+} knn_partition_t;
+
+// Tasks per thread that the partition scheduler aims for: a partition whose cost is above
+// total cost / (threads x KNN_PARTITION_TASKS_PER_THREAD) is split into several tasks
+#define KNN_PARTITION_TASKS_PER_THREAD  4
+
+// Fewest query rows of a task (fewer rows make the GEMMs of the exact kernel inefficient)
+#define KNN_PARTITION_MIN_TASK_ROWS     64
+
+// Task of the partition scheduler: the k-NN of the rows [query_start, query_start + query_count) of a partition
+// among all the rows of the partition
+typedef struct {
+    int             part;
+    size_t          query_start;        // Row of the layout
+    size_t          query_count;
+    double          cost;               // query_count x partition rows x d (multiply-adds of the GEMM)
+} knn_partition_task_t;
+
+// Shards of the row locks of an overlapping merge: the row r is guarded by the lock r % KNN_MERGE_LOCKS
+#define KNN_MERGE_LOCKS                 64
+
+// Longest neighbor list that `knn_merge_add` merges in a stack buffer (longer lists use a heap buffer)
+#define KNN_MERGE_STACK_K               64
+
+// Merge of the k-NN lists that the partitions find for the dataset rows. Every row of the result is a valid
+// k-NN list (sorted by distance, every neighbor once) of the first `counts[row]` entries. If every row is in one
+// partition, every row has one writer and the merges take no locks; if the partitions overlap, the merges of a
+// row are serialized by a sharded lock and the neighbors found by several partitions are kept once.
+typedef struct {
+    knn_idx_t*      indices;            // dataset_length x k
+    float*          distances;          // dataset_length x k
+    int*            counts;             // Valid neighbors of every row (the rest of the row is unset)
+    size_t          dataset_length;
+    int             k;
+    int             overlap;            // 1 if a row may be in several partitions
+    pthread_mutex_t locks[KNN_MERGE_LOCKS];
+} knn_merge_t;
+
+// Rows of the sample (evenly spaced) whose exact k-NN estimate the recall of an overlap band
+#define KNN_SPLIT_SAMPLE_ROWS           1024
+
+// Overlap band of a hyperplane split, chosen for a target recall. The two parts of the split are the rows at
+// signed distance h <= band and h >= -band from the hyperplane, so the rows of the band are in both parts and
+// get their neighbors on both sides. A row x misses a true neighbor y across the hyperplane only if both are
+// out of the band, i.e. if min(|h(x)|, |h(y)|) > band.
+typedef struct {
+    float           band;               // Half-width of the band (0 for two disjoint halves)
+    double          target_recall;      // Requested recall, in [0, 1]
+    double          expected_recall;    // Recall of the sample with the band (-1 without a sample)
+    double          recall_without_band;// Recall of the sample with two disjoint halves (-1 without a sample)
+    size_t          part_rows[2];       // Rows of the two parts
+    double          extra_cost;         // GEMM work added by the band, relative to the disjoint halves (0.25 = +25%)
+    size_t          sample_rows;        // Rows of the sample (0 if no sample was needed)
+} knn_split_plan_t;
+
+/**
+ * Dataset id of a row of a partition layout.
+ *
+ * @param layout            Partition layout
+ * @param row               Row of the layout
+ *
+ * @return                  Id of the row in the dataset
+ */
+static inline knn_idx_t knn_partition_id(const knn_partition_t* layout, size_t row) {
+    return layout->ids ? layout->ids[row] : (knn_idx_t)row;
+}
+
+/**
+ * Lay out a dataset split into `num_parts` contiguous ranges of (almost) equal sizes, without copying it.
+ *
+ * @param dataset           Pointer to the dataset matrix
+ * @param dataset_length    Number of rows (data points) in the dataset
+ * @param num_parts         Number of partitions
+ * @param layout            Pointer to the layout to fill (free it with `knn_partition_free`)
+ *
+ * @return                  0 on success, -1 on failure
+ */
+int knn_partition_ranges(const float* dataset, size_t dataset_length, int num_parts, knn_partition_t* layout);
+
+/**
+ * Lay out a dataset by the partitions of every row, where a row may be in several partitions (e.g. the rows of
+ * an overlap band): the rows are copied once per partition into one buffer, stable within every partition.
+ *
+ * @param dataset           Pointer to the dataset matrix
+ * @param dataset_length    Number of rows (data points) in the dataset
+ * @param d                 Dimensionality of each data point
+ * @param masks             Partitions of every row, as a bit mask (bit p for the partition p)
+ * @param num_parts         Number of partitions (at most 8)
+ * @param layout            Pointer to the layout to fill (free it with `knn_partition_free`)
+ *
+ * @return                  0 on success, -1 on failure
+ */
+int knn_partition_by_mask(const float* dataset, size_t dataset_length, int d, const unsigned char* masks,
+                          int num_parts, knn_partition_t* layout);
+
+/**
+ * Start the merge of the k-NN lists of a dataset into the result arrays (every row starts empty).
+ *
+ * @param merge             Pointer to the merge to initialize (free it with `knn_merge_free`)
+ * @param indices           Pre-allocated array (length `dataset_length x k`) of the merged neighbors
+ * @param distances         Pre-allocated array (length `dataset_length x k`) of their distances
+ * @param dataset_length    Number of rows (data points) in the dataset
+ * @param k                 Number of nearest neighbors to keep
+ * @param overlap           1 if a row may be merged from several partitions (and so by several threads at once)
+ *
+ * @return                  0 on success, -1 on failure
+ */
+int knn_merge_init(knn_merge_t* merge, knn_idx_t* indices, float* distances, size_t dataset_length, int k, int overlap);
+
+/**
+ * Merge a sorted list of neighbors into the k-NN list of a row: the two sorted lists are merged (neighbors at
+ * equal distances are ordered by id) and the k nearest are kept. It is safe to call concurrently for different
+ * rows, and for the same row if the merge was started with `overlap`.
+ *
+ * @param merge             Merge
+ * @param row               Row of the dataset
+ * @param ids               Dataset ids of the neighbors, sorted by distance
+ * @param dists             Their distances
+ * @param count             Number of neighbors in the list (it may be less than k)
+ *
+ * @return                  0 on success, -1 on failure
+ */
+int knn_merge_add(knn_merge_t* merge, size_t row, const knn_idx_t* ids, const float* dists, int count);
+
+/**
+ * Complete the rows that have fewer than k neighbors (e.g. rows of partitions smaller than k) with their exact
+ * k-NN in the whole dataset, found with `knn_exact_pthread`.
+ *
+ * @param merge             Merge
+ * @param dataset           Pointer to the dataset matrix
+ * @param d                 Dimensionality of each data point
+ * @param num_of_threads    Number of threads (<= 0 to use all the online cores)
+ *
+ * @return                  Number of rows completed, or -1 on failure
+ */
+long knn_merge_finish(knn_merge_t* merge, const float* dataset, int d, int num_of_threads);
+
+/**
+ * Free the locks and the counts of a merge (the result arrays are not freed).
+ *
+ * @param merge             Pointer to the merge
+ *
+ * @return                  None
+ */
+void knn_merge_free(knn_merge_t* merge);
+
+/**
+ * Exact k-NN of a slice of the rows of a partition among all the rows of the partition, merged into the result:
+ * the neighbors are mapped back to dataset ids and every row is merged with `knn_merge_add`. A partition with
+ * fewer than k rows gives all its rows (`knn_merge_finish` completes them).
+ *
+ * @param layout            Partition layout
+ * @param d                 Dimensionality of each data point
+ * @param part              Partition
+ * @param query_start       First query row (a row of the layout inside the partition)
+ * @param query_count       Number of query rows
+ * @param merge             Merge of the result
+ * @param num_workers       Number of concurrent callers (they share the usable memory of the distance matrices)
+ *
+ * @return                  0 on success, -1 on failure
+ */
+int knn_partition_search_rows(const knn_partition_t* layout, int d, int part, size_t query_start, size_t query_count,
+                              knn_merge_t* merge, int num_workers);
+
+/**
+ * All-to-all exact k-NN inside every partition of a layout, with all the threads busy until the end. Every
+ * partition becomes one task or, if its cost (rows^2 x d) is large, several tasks over slices of its rows, so a
+ * partition gets a number of workers proportional to its cost. The workers take the tasks from a shared queue,
+ * largest first, and run each one with `knn_partition_search_rows` (one BLAS thread per worker).
+ *
+ * @param layout            Partition layout
+ * @param d                 Dimensionality of each data point
+ * @param merge             Merge of the result (its `k` is the number of nearest neighbors to find)
+ * @param num_of_threads    Number of threads (<= 0 to use all the online cores)
+ *
+ * @return                  0 on success, -1 on failure
+ */
+int knn_partition_search(const knn_partition_t* layout, int d, knn_merge_t* merge, int num_of_threads);
+
+/**
+ * Free the arrays of a partition layout (the dataset is not freed).
+ *
+ * @param layout            Pointer to the layout
+ *
+ * @return                  None
+ */
+void knn_partition_free(knn_partition_t* layout);
+
 /**
  * Merges two sorted arrays of distances and their corresponding indices to retain only the k smallest values.
  * 
@@ -32,12 +231,12 @@
  * are still sorted, maintaining their order. It is commonly used to combine results from multiple 
  * subsets of k-NN calculations.
  */
-void merge_k_smallest(int k, const float* existing_distances, const int* existing_indices, 
-                      const float* new_distances, const int* new_indices, 
-                      float* final_distances, int* final_indices);
+void merge_k_smallest(int k, const float* existing_distances, const knn_idx_t* existing_indices, 
+                      const float* new_distances, const knn_idx_t* new_indices, 
+                      float* final_distances, knn_idx_t* final_indices);
 
 /**
- * Splits a dataset into three parts based on the distances of data points from a hyperplane.
+ * Computes the signed distance of every data point from the hyperplane that splits a dataset in two.
  * 
  * @param dataset           Pointer to the dataset matrix (reference data points).
  * @param distances_from_hyperplane
@@ -45,22 +244,37 @@ void merge_k_smallest(int k, const float* existing_distances, const int* existin
  * @param dataset_length    Number of rows (data points) in the dataset.
  * @param d                 Dimensionality of each data point (number of columns in the dataset).
  * @param num_of_threads    Number of threads available for parallel computation.
- * @param accuracy          Splitting depth (controls how many subsets the data will be divided into).
+ * @param accuracy          Unused (the overlap band of the split is chosen by `knn_split_band`).
  * @param _norm_            Pointer to a float variable where the norm of the hyperplane vector will be stored.
  * 
  * @return                  None (results are stored in `distances_from_hyperplane` and `_norm_`).
  * 
- * This function calculates a hyperplane that splits the dataset into three parts:
- * 1. Points that are on one side of the hyperplane.
- * 2. Points on the opposite side of the hyperplane.
- * 3. Points close to the hyperplane (based on a threshold).
- * 
- * The splitting is based on computing distances from the hyperplane for each data point. The `_norm_` 
- * value represents the norm of the hyperplane vector and is used to normalize the computed distances.
- * The function is fundamental for dividing the dataset into smaller, manageable subsets in 
- * approximate k-NN algorithms.
+ * The hyperplane is normal to the vector between the means of two halves of the dataset and passes through
+ * their midpoint. The distances are normalized by the norm of that vector, so they are Euclidean distances:
+ * two points whose distances from the hyperplane differ by `t` are at least `t` apart.
  */
-void split_dataset(const float* dataset, float* distances_from_hyperplane, int dataset_length, int d, int num_of_threads, int accuracy, float* _norm_);
+void split_dataset(const float* dataset, float* distances_from_hyperplane, size_t dataset_length, int d, int num_of_threads, int accuracy, float* _norm_);
+
+/**
+ * Choose the overlap band of a hyperplane split for a target recall. The exact k-NN of `KNN_SPLIT_SAMPLE_ROWS`
+ * evenly spaced rows (the row itself left out, as it is never missed) give, for every true neighbor across the
+ * hyperplane, the band it needs (the smaller of the distances of the row and of the neighbor from the hyperplane);
+ * the band is the narrowest one that leaves at most (1 - target_recall) of the sampled neighbors out. The extra cost follows from the rows of the two parts.
+ *
+ * @param dataset           Pointer to the dataset matrix
+ * @param distances_from_hyperplane
+ *                          Signed distances of the rows from the hyperplane (see `split_dataset`)
+ * @param dataset_length    Number of rows (data points) in the dataset
+ * @param d                 Dimensionality of each data point
+ * @param k                 Number of nearest neighbors
+ * @param target_recall     Target recall in [0, 1] (0 for two disjoint halves, without a sample)
+ * @param num_of_threads    Number of threads of the sample k-NN (<= 0 to use all the online cores)
+ * @param plan              Pointer to the plan to fill
+ *
+ * @return                  0 on success, -1 on failure
+ */
+int knn_split_band(const float* dataset, const float* distances_from_hyperplane, size_t dataset_length, int d, int k,
+                   double target_recall, int num_of_threads, knn_split_plan_t* plan);
 
 
 
@@ -76,18 +290,36 @@ void split_dataset(const float* dataset, float* distances_from_hyperplane, int d
  * @param dataset_length    Number of rows (data points) in the dataset.
  * @param d                 Dimensionality of each data point (number of columns in the dataset).
  * @param num_of_threads    Number of threads to use for parallel computation.
- * @param accuracy          Degree of approximation or tolerance level. Higher values allow for more 
- *                          subdivisions of the dataset, potentially increasing accuracy at the cost 
- *                          of additional computation time.
+ * @param accuracy          Target recall in percent (e.g. 95): the overlap band of the split is chosen to reach
+ *                          it (see `knn_split_band`). 0 splits the dataset in two disjoint halves; 100 asks
+ *                          for every sampled neighbor.
  * 
  * @return                  None (results are stored in the pre-allocated arrays `indices` and `distances`).
  * 
- * This function calculates approximate k-NN by dividing the dataset into subsets based on hyperplane 
- * splitting. The splitting process creates smaller chunks of the dataset that are processed individually, 
- * reducing computational complexity while maintaining reasonable accuracy. The `accuracy` parameter 
- * controls the trade-off between approximation and speed.
+ * This function calculates approximate k-NN by dividing the dataset into two halves by a hyperplane, which
+ * overlap in a band around it. The rows of the band are in both halves, so their neighbors across the
+ * hyperplane are found, and the exact k-NN of every half run concurrently. A higher `accuracy` widens the
+ * band, at the cost of larger halves.
+ */
+void knn_approx_serial(const float* dataset, int k, knn_idx_t* indices, float* distances, size_t dataset_length, int d, int num_of_threads, int accuracy);
+
+/**
+ * `knn_approx_serial` that also returns the overlap band it used and its expected recall and extra cost.
+ *
+ * @param dataset           Pointer to the dataset matrix (corpus == query matrix)
+ * @param k                 Number of nearest neighbors to find for each data point
+ * @param indices           Pre-allocated array (length `dataset_length x k`) of the neighbors
+ * @param distances         Pre-allocated array (length `dataset_length x k`) of their distances
+ * @param dataset_length    Number of rows (data points) in the dataset
+ * @param d                 Dimensionality of each data point
+ * @param num_of_threads    Number of threads to use for parallel computation
+ * @param accuracy          Target recall in percent (see `knn_approx_serial`)
+ * @param plan              Pointer to the plan of the split to fill (NULL to ignore it)
+ *
+ * @return                  0 on success, -1 on failure
  */
-void knn_approx_serial(const float* dataset, int k, int* indices, float* distances, int dataset_length, int d, int num_of_threads, int accuracy);
+int knn_approx_serial_plan(const float* dataset, int k, knn_idx_t* indices, float* distances, size_t dataset_length,
+                           int d, int num_of_threads, int accuracy, knn_split_plan_t* plan);
 
 
 #endif // KNN_APPROX_SERIAL_H
@@ -0,0 +1,121 @@
+#ifndef KNN_EXACT_FILTERED_H
+#define KNN_EXACT_FILTERED_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "../../include/utils/distance.h"
+#include "../../include/utils/blas_threads.h"
+#include "../../include/utils/knn_heap.h"
+#include "../../include/utils/perf_counters.h"
+#include "../../include/utils/knn_parallel.h"
+#include "../../include/exact/knn_exact_pthread.h"
+
+// Filtered k-NN: the neighbors of every query are searched only among the allowed corpus rows, given as a bitmap
+// (bit i % 64 of the word i / 64 is set if the corpus row i is allowed), e.g. the items of a label or a tenant.
+
+// Corpus rows per tile of the scan plan (a multiple of 64, so a tile is a range of whole bitmap words): a tile
+// with no allowed row is skipped, the other ones are multiplied with one GEMM
+#define KNN_FILTER_TILE_ROWS        1024
+
+// Number of query rows that share the GEMMs of one pass over the tiles
+#define KNN_FILTER_QUERY_TILE       64
+
+// A tile with at most this fraction of allowed rows gathers them before its GEMM (the masked rows are not computed)
+#define KNN_FILTER_SPARSE_TILE      0.5
+
+// Filters with at most this fraction of allowed rows use the gather plan: the allowed rows are copied into a
+// compact corpus that is searched with `knn_exact_pthread`
+#define KNN_FILTER_GATHER_RATIO     0.05
+
+typedef enum {
+    KNN_FILTER_PLAN_SCAN,           // Tiles of the corpus, the masked tiles skipped and the sparse ones gathered
+    KNN_FILTER_PLAN_GATHER          // The allowed rows copied and searched by brute force
+} knn_filter_plan_t;
+
+// Counters of a filtered search
+typedef struct {
+    knn_filter_plan_t plan;
+    size_t          allowed;            // Allowed corpus rows
+    size_t          tile_visits;        // (query tile, corpus tile) pairs of the scan plan
+    size_t          tiles_skipped;      // Pairs skipped because the tile has no allowed row
+    size_t          tiles_gathered;     // Pairs whose allowed rows were gathered before the GEMM
+    size_t          distances;          // Query-corpus distances computed
+    size_t          brute_force;        // Query-corpus distances of an unfiltered search (query_length x corpus_length)
+} knn_filter_stats_t;
+
+/**
+ * Number of 64-bit words of the bitmap of a corpus.
+ *
+ * @param corpus_length     Number of rows (data points) in the corpus
+ *
+ * @return                  Number of words
+ */
+static inline size_t knn_filter_words(size_t corpus_length) {
+    return (corpus_length + 63) / 64;
+}
+
+/**
+ * Check if a corpus row is allowed by a bitmap.
+ *
+ * @param bitmap            Bitmap of the allowed rows
+ * @param row               Row of the corpus
+ *
+ * @return                  1 if the row is allowed, 0 otherwise
+ */
+static inline int knn_filter_test(const uint64_t* bitmap, size_t row) {
+    return (int)((bitmap[row >> 6] >> (row & 63)) & 1);
+}
+
+/**
+ * Build the bitmap of the corpus rows whose label is in a set of allowed labels.
+ *
+ * @param labels            Label of every corpus row
+ * @param corpus_length     Number of rows (data points) in the corpus
+ * @param allowed_labels    Allowed labels
+ * @param num_allowed       Number of allowed labels
+ *
+ * @return                  Pointer to the bitmap (`knn_filter_words(corpus_length)` words), or NULL on failure.
+ *                          Free it with `free`.
+ */
+uint64_t* knn_filter_from_labels(const int32_t* labels, size_t corpus_length, const int32_t* allowed_labels, int num_allowed);
+
+/**
+ * Count the allowed rows of a bitmap (the bits past the last corpus row are ignored).
+ *
+ * @param bitmap            Bitmap of the allowed rows
+ * @param corpus_length     Number of rows (data points) in the corpus
+ *
+ * @return                  Number of allowed rows
+ */
+size_t knn_filter_count(const uint64_t* bitmap, size_t corpus_length);
+
+/**
+ * Exact k-nearest neighbor search among the allowed corpus rows. Filters with at most `KNN_FILTER_GATHER_RATIO`
+ * allowed rows copy them and search them by brute force; the other ones scan the corpus by tiles, skip the tiles
+ * with no allowed row, gather the allowed rows of the sparse tiles and select only allowed rows of the dense ones.
+ * If fewer than k rows are allowed, the last neighbors of every query are -1 at distance INFINITY.
+ *
+ * @param corpus            Pointer to the corpus matrix (reference data points)
+ * @param query             Pointer to the query matrix (data points to compare)
+ * @param k                 Number of nearest neighbors to find
+ * @param indices           Pre-allocated array to store indices of the k-nearest neighbors for each query (length `query_length x k`)
+ * @param distances         Pre-allocated array to store the Euclidean distances to the k-nearest neighbors (length `query_length x k`)
+ * @param corpus_length     Number of rows (data points) in the corpus
+ * @param query_length      Number of rows (data points) in the query
+ * @param d                 Dimensionality of each data point (number of columns in corpus/query)
+ * @param bitmap            Bitmap of the allowed corpus rows (`knn_filter_words(corpus_length)` words)
+ * @param num_of_threads    Number of threads (<= 0 to use all the online cores)
+ * @param stats             Pointer to store the counters of the search (NULL to ignore them)
+ *
+ * @return                  0 on success, -1 on failure
+ */
+int knn_exact_filtered(const float* corpus, const float* query, int k, knn_idx_t* indices, float* distances,
+                       size_t corpus_length, size_t query_length, int d, const uint64_t* bitmap, int num_of_threads,
+                       knn_filter_stats_t* stats);
+
+#endif // KNN_EXACT_FILTERED_H
@@ -4,14 +4,38 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <float.h>
+#include <string.h>
 #include <cilk/cilk.h>
+#include <cilk/cilk_api.h>
 #include <math.h>
 #include "../../include/exact/knn_exact_serial.h"
+#include "../../include/utils/blas_threads.h"
+
+// Corpus tiles per thread of the corpus-parallel decomposition (more tiles balance the strands better)
+#define KNN_CILK_TILES_PER_THREAD   4
+
+// Fewest corpus rows of a tile (smaller tiles make the merging of the top-k lists dominate)
+#define KNN_CILK_MIN_CORPUS_TILE    4096
+
+// Top-k lists of a query batch: the view of the top-k reducer of the corpus-parallel decomposition. Every strand
+// merges the lists of its corpus tiles into its own view and the views are merged pairwise when strands join.
+typedef struct {
+    knn_idx_t*  indices;            // query_length x k, sorted by distance (NULL for an empty view)
+    float*      distances;
+    size_t      query_length;
+    int         k;
+    int         failed;             // Set if a merge into the view failed (its lists are then incomplete)
+} knn_topk_view_t;
 
 /**
  * Wrapper function to perform k-nearest neighbor search using an OpenCilk-based parallel approach,
  * handling memory constraints by processing in blocks (if necessary).
  * 
+ * Large query batches are split by queries: one task per memory-sized query chunk. A batch with fewer than
+ * `num_of_threads x BLAS_MIN_ROWS_PER_WORKER` queries over a corpus of at least two `KNN_CILK_MIN_CORPUS_TILE`
+ * tiles is split by corpus tiles instead: every tile is a task that searches all the queries, and its top-k
+ * lists go to a reducer that merges the sorted lists of the strands (neighbors at equal distances ordered by id).
+ * 
  * @param corpus            Pointer to the corpus matrix (reference data points)
  * @param query             Pointer to the query matrix (data points to compare)
  * @param k                 Number of nearest neighbors to find
@@ -20,11 +44,32 @@
  * @param corpus_length     Number of rows (data points) in the corpus
  * @param query_length      Number of rows (data points) in the query
  * @param d                 Dimensionality of each data point (number of columns in corpus/query)
- * @param num_of_threads    Number of threads to run the parallel search (not directly used in OpenCilk).
+ * @param num_of_threads    Number of threads to run the parallel search (the workers are set by `CILK_NWORKERS`,
+ *                          it sizes the tasks and their memory).
  * 
  * @return                  None (results are stored in the pre-allocated arrays `indices` and `distances`)
  */
-void knn_exact_opencilk(const float* corpus, const float* query, int k, int* indices, float* distances, int corpus_length, int query_length, int d, int num_of_threads);
+void knn_exact_opencilk(const float* corpus, const float* query, int k, knn_idx_t* indices, float* distances, size_t corpus_length, size_t query_length, int d, int num_of_threads);
+
+/**
+ * `knn_exact_opencilk` with the settings of a search (query tile, memory budget and BLAS strategy) and a status.
+ *
+ * @param corpus            Pointer to the corpus matrix (reference data points)
+ * @param query             Pointer to the query matrix (data points to compare)
+ * @param k                 Number of nearest neighbors to find
+ * @param indices           Pre-allocated array to store indices of the k-nearest neighbors for each query (length `query_length x k`)
+ * @param distances         Pre-allocated array to store the Euclidean distances to the k-nearest neighbors (length `query_length x k`)
+ * @param corpus_length     Number of rows (data points) in the corpus
+ * @param query_length      Number of rows (data points) in the query
+ * @param d                 Dimensionality of each data point (number of columns in corpus/query)
+ * @param num_of_threads    Number of threads to run the parallel search (it sizes the tasks and their memory)
+ * @param config            Settings of the search (NULL for the defaults)
+ *
+ * @return                  0 on success, -1 on failure
+ */
+int knn_exact_opencilk_with_config(const float* corpus, const float* query, int k, knn_idx_t* indices, float* distances,
+                                   size_t corpus_length, size_t query_length, int d, int num_of_threads,
+                                   const knn_exact_config_t* config);
 
 
 #endif // KNN_EXACT_OPENCILK_H
@@ -0,0 +1,152 @@
+#ifndef KNN_EXACT_PIVOT_H
+#define KNN_EXACT_PIVOT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "../../include/utils/distance.h"
+#include "../../include/utils/blas_threads.h"
+#include "../../include/utils/knn_heap.h"
+#include "../../include/utils/perf_counters.h"
+#include "../../include/utils/knn_snapshot.h"
+#include "../../include/utils/knn_parallel.h"
+#include "../../include/utils/knn_hash.h"
+
+// Default number of pivots (selected farthest-first) of `knn_exact_pivot`
+#define KNN_PIVOT_DEFAULT_PIVOTS    32
+
+// Default number of corpus rows per block: a block is either skipped as a whole, or multiplied with one GEMM
+#define KNN_PIVOT_BLOCK_ROWS        256
+
+// Number of query rows that share the block bounds and the GEMMs of one pass over the blocks
+#define KNN_PIVOT_QUERY_TILE        64
+
+// Pivot index of a corpus: the corpus rows are grouped in blocks of nearby rows (by their nearest pivot and
+// their distance to it), and every block keeps the range of the distances of its rows to every pivot.
+typedef struct {
+    const float*    corpus;             // The indexed corpus (not owned, it must outlive the index)
+    size_t          corpus_length;
+    int             d;
+    int             num_pivots;
+    float*          pivots;             // num_pivots x d, copies of corpus rows
+    size_t          block_rows;
+    size_t          num_blocks;
+    knn_idx_t*      order;              // Corpus ids in block order: block b is order[b * block_rows, ...)
+    float*          bounds;             // num_blocks x num_pivots x 2: min and max distance of the block rows to each pivot
+    float*          max_norms;          // num_blocks: largest squared norm of the block rows
+    knn_snapshot_t* snapshot;           // Snapshot that the arrays point into (read-only), NULL if they are allocated
+} knn_pivot_index_t;
+
+// Pruning counters of a search
+typedef struct {
+    size_t          block_visits;       // (query tile, block) pairs
+    size_t          blocks_searched;    // Pairs that were not skipped (one GEMM each)
+    size_t          distances;          // Query-corpus distances computed
+    size_t          brute_force;        // Query-corpus distances of a brute-force search (query_length x corpus_length)
+} knn_pivot_stats_t;
+
+/**
+ * Build the pivot index of a corpus: select the pivots farthest-first, compute the distance of every corpus row
+ * to every pivot and summarize them per block.
+ *
+ * @param corpus            Pointer to the corpus matrix (it is referenced by the index, not copied)
+ * @param corpus_length     Number of rows (data points) in the corpus
+ * @param d                 Dimensionality of each data point
+ * @param num_pivots        Number of pivots (<= 0 for `KNN_PIVOT_DEFAULT_PIVOTS`)
+ * @param block_rows        Number of corpus rows per block (0 for `KNN_PIVOT_BLOCK_ROWS`)
+ * @param num_of_threads    Number of threads (<= 0 to use all the online cores)
+ *
+ * @return                  Pointer to the index, or NULL on failure. Free it with `knn_pivot_free`.
+ */
+knn_pivot_index_t* knn_pivot_build(const float* corpus, size_t corpus_length, int d, int num_pivots, size_t block_rows, int num_of_threads);
+
+/**
+ * Exact k-nearest neighbor search with a pivot index. For every query, a block is skipped when the triangle
+ * inequality bound |d(q, p) - d(c, p)| of all its rows is larger than the current k-th distance of the query;
+ * the other blocks are searched with a GEMM, like `knn_exact_serial`. Both re-rank the k + `KNN_RERANK_MARGIN`
+ * nearest candidates of the GEMM with `distance_rerank`, so the results are the same as the brute-force ones, bit
+ * for bit (neighbors at equal distances are ordered by id), unless the GEMM rounding moves a neighbor by more than
+ * `KNN_RERANK_MARGIN` places.
+ *
+ * @param index             Pivot index of the corpus
+ * @param query             Pointer to the query matrix (data points to compare)
+ * @param k                 Number of nearest neighbors to find
+ * @param indices           Pre-allocated array to store indices of the k-nearest neighbors for each query (length `query_length x k`)
+ * @param distances         Pre-allocated array to store the Euclidean distances to the k-nearest neighbors (length `query_length x k`)
+ * @param query_length      Number of rows (data points) in the query
+ * @param num_of_threads    Number of threads (<= 0 to use all the online cores)
+ * @param stats             Pointer to store the pruning counters (NULL to ignore them)
+ *
+ * @return                  0 on success, -1 on failure
+ */
+int knn_pivot_search(const knn_pivot_index_t* index, const float* query, int k, knn_idx_t* indices, float* distances,
+                     size_t query_length, int num_of_threads, knn_pivot_stats_t* stats);
+
+/**
+ * Save a pivot index to a snapshot file (see include/utils/knn_snapshot.h). The corpus is not saved, only
+ * its hash, so that the index is never loaded over another corpus.
+ *
+ * @param index             Pivot index
+ * @param filename          Path of the snapshot file
+ *
+ * @return                  0 on success, -1 on failure
+ */
+int knn_pivot_save(const knn_pivot_index_t* index, const char* filename);
+
+/**
+ * Load a pivot index from a snapshot file, over the corpus it was built for. The file is mapped and the
+ * arrays of the index point into the mapping (no copy); only the corpus is hashed, to check it.
+ *
+ * @param filename          Path of the snapshot file
+ * @param corpus            Pointer to the corpus matrix (referenced by the index, not copied)
+ * @param corpus_length     Number of rows (data points) in the corpus
+ * @param d                 Dimensionality of each data point
+ * @param verify            1 to check the checksums of the whole file, 0 to check only the header
+ * @param num_of_threads    Number of threads of the corpus hash (<= 0 to use all the online cores)
+ *
+ * @return                  Pointer to the index, or NULL on failure (missing, corrupted or incompatible file,
+ *                          or another corpus). Free it with `knn_pivot_free`.
+ */
+knn_pivot_index_t* knn_pivot_load(const char* filename, const float* corpus, size_t corpus_length, int d,
+                                  int verify, int num_of_threads);
+
+/**
+ * Free a pivot index (the corpus is not freed).
+ *
+ * @param index             Pointer to the index (NULL is ignored)
+ *
+ * @return                  None
+ */
+void knn_pivot_free(knn_pivot_index_t* index);
+
+/**
+ * Exact k-nearest neighbor search with triangle-inequality pruning: build a pivot index with the default
+ * parameters, search it and free it. It has the same signature as the other exact functions, so it can be
+ * used as a `knn_exact_t`.
+ *
+ * @param corpus            Pointer to the corpus matrix (reference data points)
+ * @param query             Pointer to the query matrix (data points to compare)
+ * @param k                 Number of nearest neighbors to find
+ * @param indices           Pre-allocated array to store indices of the k-nearest neighbors for each query (length `query_length x k`)
+ * @param distances         Pre-allocated array to store the Euclidean distances to the k-nearest neighbors (length `query_length x k`)
+ * @param corpus_length     Number of rows (data points) in the corpus
+ * @param query_length      Number of rows (data points) in the query
+ * @param d                 Dimensionality of each data point (number of columns in corpus/query)
+ * @param num_of_threads    Number of threads (<= 0 to use all the online cores)
+ *
+ * @return                  None (results are stored in the pre-allocated arrays `indices` and `distances`)
+ */
+void knn_exact_pivot(const float* corpus, const float* query, int k, knn_idx_t* indices, float* distances, size_t corpus_length, size_t query_length, int d, int num_of_threads);
+
+/**
+ * Get the pruning counters of the last `knn_exact_pivot` call.
+ *
+ * @return                  Pointer to the counters
+ */
+const knn_pivot_stats_t* knn_exact_pivot_last_stats(void);
+
+#endif // KNN_EXACT_PIVOT_H
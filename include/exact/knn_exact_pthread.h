@@ -6,23 +6,24 @@
 #include <stdlib.h>
 #include <string.h>
 #include "../../include/exact/knn_exact_serial.h"
+#include "../../include/utils/blas_threads.h"
 
 // Structure to hold arguments for each thread
 typedef struct {
     const float*    corpus;
     const float*    query;
     int             k;
-    int*            indices;
+    knn_idx_t*      indices;
     float*          distances;
-    int             corpus_length;
-    int             query_length;
+    size_t          corpus_length;
+    size_t          query_length;
     int             d;
     int             thread_id;
     int             num_of_threads;
+    const knn_exact_config_t* config;   // Settings of the search (NULL for the defaults)
+    int             status;             // 0, or -1 if the chunk of the thread failed
 } knn_thread_args_t;
 
-void partial_sort(float* distances, int* indices, int length, int k);
-
 // Thread function to perform k-NN search on a subset of queries
 void* knn_exact_pthread_core(void* args);
 
@@ -43,6 +44,26 @@ void* knn_exact_pthread_core(void* args);
  * 
  * @return                  None (results are stored in the pre-allocated arrays `indices` and `distances`)
  */
-void knn_exact_pthread(const float* corpus, const float* query, int k, int* indices, float* distances, int corpus_length, int query_length, int d, int num_of_threads);
+void knn_exact_pthread(const float* corpus, const float* query, int k, knn_idx_t* indices, float* distances, size_t corpus_length, size_t query_length, int d, int num_of_threads);
+
+/**
+ * `knn_exact_pthread` with the settings of a search (query tile, memory budget and BLAS strategy) and a status.
+ *
+ * @param corpus            Pointer to the corpus matrix (reference data points)
+ * @param query             Pointer to the query matrix (data points to compare)
+ * @param k                 Number of nearest neighbors to find
+ * @param indices           Pre-allocated array to store indices of the k-nearest neighbors for each query (length `query_length x k`)
+ * @param distances         Pre-allocated array to store the Euclidean distances to the k-nearest neighbors (length `query_length x k`)
+ * @param corpus_length     Number of rows (data points) in the corpus
+ * @param query_length      Number of rows (data points) in the query
+ * @param d                 Dimensionality of each data point (number of columns in corpus/query)
+ * @param num_of_threads    Number of threads to use for parallel processing
+ * @param config            Settings of the search (NULL for the defaults)
+ *
+ * @return                  0 on success, -1 on failure
+ */
+int knn_exact_pthread_with_config(const float* corpus, const float* query, int k, knn_idx_t* indices, float* distances,
+                                  size_t corpus_length, size_t query_length, int d, int num_of_threads,
+                                  const knn_exact_config_t* config);
 
 #endif // KNN_EXACT_PTHREAD_H
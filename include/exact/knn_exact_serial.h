@@ -3,11 +3,49 @@
 
 #include "../../include/utils/distance.h"
 #include "../../include/utils/mem_info.h"
+#include "../../include/utils/perf_counters.h"
+#include "../../include/utils/blas_threads.h"
 #include <float.h>
 #include <string.h>
 #include <math.h>
 #include <gsl/gsl_sort_float.h>  // sudo apt-get install libgsl-dev
 
+// Settings of one exact search, passed down to the kernels with the call (there is no process-wide setting,
+// so concurrent searches can use different tiles and budgets). A NULL config selects all the defaults.
+typedef struct {
+    size_t              query_tile;     // Maximum query rows per distance matrix (0 to use only the memory limit)
+    size_t              memory_budget;  // Bytes that the search may use with all its threads (0 for the usable memory)
+    knn_blas_strategy_t strategy;       // `KNN_BLAS_INHERIT` to select it by the batch shape (`select_blas_strategy`)
+} knn_exact_config_t;
+
+/**
+ * Evaluate the maximum number of query rows that fit in one chunk, based on the memory budget and
+ * all the memory allocations which are done inside `knn_exact_serial_core` by every thread.
+ * 
+ * @param corpus_length     Number of rows (data points) in the corpus
+ * @param k                 Number of nearest neighbors to find
+ * @param num_of_threads    Number of threads which allocate their chunks simultaneously
+ * @param memory_ratio      Part of the memory budget to be used (e.g. 0.9)
+ * @param config            Settings of the search (NULL for the usable memory and no query tile)
+ * 
+ * @return                  Maximum chunk length (<= 0 if there is not enough usable memory)
+ */
+long knn_exact_max_chunk_length(size_t corpus_length, int k, int num_of_threads, double memory_ratio,
+                                const knn_exact_config_t* config);
+
+/**
+ * Get the BLAS strategy of a parallel exact search: the one of the config, or the one selected by the batch shape.
+ *
+ * @param config            Settings of the search (NULL to select the strategy)
+ * @param corpus_length     Number of rows (data points) in the corpus
+ * @param query_length      Number of rows (data points) in the query
+ * @param num_of_threads    Number of threads of the search
+ *
+ * @return                  The strategy to run
+ */
+knn_blas_strategy_t knn_exact_strategy(const knn_exact_config_t* config, size_t corpus_length, size_t query_length,
+                                       int num_of_threads);
+
 /**
  * Compute the k-nearest neighbors using a brute-force method between corpus and query data points.
  * 
@@ -20,9 +58,9 @@
  * @param query_length  Number of rows (data points) in the query
  * @param d             Dimensionality of each data point (number of columns in corpus/query)
  * 
- * @return              None (results are stored in the pre-allocated arrays indices and distances)
+ * @return              0 on success, -1 on failure (results are stored in the pre-allocated arrays indices and distances)
  */
-void knn_exact_serial_core(const float* corpus, const float* query, int k, int* indices, float* distances, int corpus_length, int query_length, int d);
+int knn_exact_serial_core(const float* corpus, const float* query, int k, knn_idx_t* indices, float* distances, size_t corpus_length, size_t query_length, int d);
 
 
 /**
@@ -41,6 +79,26 @@ void knn_exact_serial_core(const float* corpus, const float* query, int k, int*
  * 
  * @return                  None (results are stored in the pre-allocated arrays `indices` and `distances`)
  */
-void knn_exact_serial(const float* corpus, const float* query, int k, int* indices, float* distances, int corpus_length, int query_length, int d, int num_of_threads);
+void knn_exact_serial(const float* corpus, const float* query, int k, knn_idx_t* indices, float* distances, size_t corpus_length, size_t query_length, int d, int num_of_threads);
+
+/**
+ * `knn_exact_serial` with the settings of a search (query tile and memory budget) and a status.
+ *
+ * @param corpus            Pointer to the corpus matrix (reference data points)
+ * @param query             Pointer to the query matrix (data points to compare)
+ * @param k                 Number of nearest neighbors to find
+ * @param indices           Pre-allocated array to store indices of the k-nearest neighbors for each query (length `query_length x k`)
+ * @param distances         Pre-allocated array to store the Euclidean distances to the k-nearest neighbors (length `query_length x k`)
+ * @param corpus_length     Number of rows (data points) in the corpus
+ * @param query_length      Number of rows (data points) in the query
+ * @param d                 Dimensionality of each data point (number of columns in corpus/query)
+ * @param num_of_threads    Number of threads which run this function simultaneously (they share the memory budget)
+ * @param config            Settings of the search (NULL for the defaults)
+ *
+ * @return                  0 on success, -1 on failure
+ */
+int knn_exact_serial_with_config(const float* corpus, const float* query, int k, knn_idx_t* indices, float* distances,
+                                 size_t corpus_length, size_t query_length, int d, int num_of_threads,
+                                 const knn_exact_config_t* config);
 
 #endif // KNN_EXACT_SERIAL_H
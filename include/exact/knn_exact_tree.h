@@ -0,0 +1,144 @@
+#ifndef KNN_EXACT_TREE_H
+#define KNN_EXACT_TREE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "../../include/utils/knn_types.h"
+#include "../../include/utils/knn_heap.h"
+#include "../../include/utils/knn_stats.h"
+#include "../../include/utils/knn_snapshot.h"
+#include "../../include/utils/knn_parallel.h"
+#include "../../include/exact/knn_search.h"
+
+// Default number of corpus rows per leaf: the rows of a leaf are contiguous and they fit in the L1 cache for d <= 32
+#define KNN_TREE_LEAF_ROWS          64
+
+// The tree pays off for low dimensions; above this the bounds of the balls rarely prune and brute force is faster
+#define KNN_TREE_MAX_USEFUL_DIM     20
+
+// Node of a ball tree: the rows [start, end) of the tree order, within `radius` of the node's center
+typedef struct {
+    size_t          start, end;
+    size_t          right;              // Index of the right child (the left child is the next node), 0 for a leaf
+    float           radius;
+} knn_tree_node_t;
+
+// Ball tree of a corpus, with the nodes in pre-order. Every node splits its rows at the median of the
+// dimension with the largest spread, so the shape of the tree depends only on the corpus length.
+typedef struct {
+    size_t          corpus_length;
+    int             d;
+    size_t          leaf_rows;
+    size_t          num_nodes;
+    knn_tree_node_t* nodes;
+    float*          centers;            // num_nodes x d: mean of the rows of every node
+    float*          points;             // corpus_length x d: the corpus rows in tree order (every leaf is contiguous)
+    knn_idx_t*      ids;                // corpus_length: the corpus ids in tree order
+    knn_snapshot_t* snapshot;           // Snapshot that the arrays point into (read-only), NULL if they are allocated
+} knn_tree_t;
+
+// Pruning counters of a search
+typedef struct {
+    size_t          leaves_searched;
+    size_t          distances;          // Query-corpus distances computed
+    size_t          brute_force;        // Query-corpus distances of a brute-force search (query_length x corpus_length)
+} knn_tree_stats_t;
+
+/**
+ * Build a ball tree over a corpus in parallel (the top levels are split serially, then the subtrees are built
+ * by the threads). The corpus is copied in tree order, so it can be freed after the build.
+ *
+ * @param corpus            Pointer to the corpus matrix
+ * @param corpus_length     Number of rows (data points) in the corpus
+ * @param d                 Dimensionality of each data point
+ * @param leaf_rows         Maximum number of rows per leaf (0 for `KNN_TREE_LEAF_ROWS`)
+ * @param num_of_threads    Number of threads (<= 0 to use all the online cores)
+ *
+ * @return                  Pointer to the tree, or NULL on failure. Free it with `knn_tree_free`.
+ */
+knn_tree_t* knn_tree_build(const float* corpus, size_t corpus_length, int d, size_t leaf_rows, int num_of_threads);
+
+/**
+ * Exact k-nearest neighbor search with a ball tree, parallel over the queries. Every query visits the nodes
+ * best-first (by the lower bound |q - center| - radius) and stops when the nearest unvisited node is farther
+ * than its k-th neighbor. The distances are computed in double precision; neighbors at equal distances are
+ * ordered by id.
+ *
+ * @param tree              Ball tree of the corpus
+ * @param query             Pointer to the query matrix (data points to compare)
+ * @param k                 Number of nearest neighbors to find
+ * @param indices           Pre-allocated array to store indices of the k-nearest neighbors for each query (length `query_length x k`)
+ * @param distances         Pre-allocated array to store the Euclidean distances to the k-nearest neighbors (length `query_length x k`)
+ * @param query_length      Number of rows (data points) in the query
+ * @param num_of_threads    Number of threads (<= 0 to use all the online cores)
+ * @param stats             Pointer to store the pruning counters (NULL to ignore them)
+ *
+ * @return                  0 on success, -1 on failure
+ */
+int knn_tree_search(const knn_tree_t* tree, const float* query, int k, knn_idx_t* indices, float* distances,
+                    size_t query_length, int num_of_threads, knn_tree_stats_t* stats);
+
+/**
+ * Save a ball tree to a snapshot file (see include/utils/knn_snapshot.h).
+ *
+ * @param tree              Ball tree
+ * @param filename          Path of the snapshot file
+ *
+ * @return                  0 on success, -1 on failure
+ */
+int knn_tree_save(const knn_tree_t* tree, const char* filename);
+
+/**
+ * Load a ball tree from a snapshot file. The file is mapped and the arrays of the tree point into the mapping,
+ * so the load costs no copy and the pages are shared by the processes that load the same file. The tree is
+ * self-contained (it holds the corpus rows), so the corpus is not needed.
+ *
+ * @param filename          Path of the snapshot file
+ * @param verify            1 to check the checksums of the whole file, 0 to check only the header
+ *
+ * @return                  Pointer to the tree, or NULL on failure (missing, corrupted or incompatible file).
+ *                          Free it with `knn_tree_free`.
+ */
+knn_tree_t* knn_tree_load(const char* filename, int verify);
+
+/**
+ * Free a ball tree.
+ *
+ * @param tree              Pointer to the tree (NULL is ignored)
+ *
+ * @return                  None
+ */
+void knn_tree_free(knn_tree_t* tree);
+
+/**
+ * Exact k-nearest neighbor search with a ball tree: build the tree with the default leaf size, search it and
+ * free it. For d > `KNN_TREE_MAX_USEFUL_DIM` it runs `knn_search` instead. It has the same signature as the
+ * other exact functions, so it can be used as a `knn_exact_t`.
+ *
+ * @param corpus            Pointer to the corpus matrix (reference data points)
+ * @param query             Pointer to the query matrix (data points to compare)
+ * @param k                 Number of nearest neighbors to find
+ * @param indices           Pre-allocated array to store indices of the k-nearest neighbors for each query (length `query_length x k`)
+ * @param distances         Pre-allocated array to store the Euclidean distances to the k-nearest neighbors (length `query_length x k`)
+ * @param corpus_length     Number of rows (data points) in the corpus
+ * @param query_length      Number of rows (data points) in the query
+ * @param d                 Dimensionality of each data point (number of columns in corpus/query)
+ * @param num_of_threads    Number of threads (<= 0 to use all the online cores)
+ *
+ * @return                  None (results are stored in the pre-allocated arrays `indices` and `distances`)
+ */
+void knn_exact_tree(const float* corpus, const float* query, int k, knn_idx_t* indices, float* distances, size_t corpus_length, size_t query_length, int d, int num_of_threads);
+
+/**
+ * Get the pruning counters of the last `knn_exact_tree` call.
+ *
+ * @return                  Pointer to the counters
+ */
+const knn_tree_stats_t* knn_exact_tree_last_stats(void);
+
+#endif // KNN_EXACT_TREE_H
@@ -0,0 +1,127 @@
+#ifndef KNN_SEARCH_H
+#define KNN_SEARCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <unistd.h>
+#include "../../include/exact/knn_exact_serial.h"
+#include "../../include/utils/blas_threads.h"
+#include "../../include/utils/knn_profile.h"
+#include "../../include/utils/mem_info.h"
+
+// The parallel backends available in this build (`Makefile.clang` builds only the OpenCilk ones)
+#ifdef __cilk
+#include <cilk/cilk_api.h>
+#include "../../include/exact/knn_exact_opencilk.h"
+#else
+#include "../../include/exact/knn_exact_pthread.h"
+#endif
+
+// Smallest corpus tile that the planner considers (smaller tiles make the merging dominate)
+#define KNN_SEARCH_MIN_CORPUS_TILE 4096
+
+// The exact backends that `knn_search` can select
+typedef enum {
+    KNN_BACKEND_SERIAL = 0,         // knn_exact_serial, single thread
+    KNN_BACKEND_BLAS,               // knn_exact_serial, few big GEMMs with multi-threaded BLAS
+    KNN_BACKEND_PTHREAD,            // knn_exact_pthread, one worker per query block
+    KNN_BACKEND_OPENCILK            // knn_exact_opencilk, one task per query tile
+} knn_backend_t;
+
+// Configuration selected by the planner
+typedef struct {
+    knn_backend_t   backend;
+    int             num_of_threads;     // Workers (or BLAS threads for `KNN_BACKEND_BLAS`)
+    size_t          query_tile;         // Maximum query rows per distance matrix
+    size_t          corpus_tile;        // Corpus rows per pass (== corpus_length if the corpus is not tiled)
+    size_t          memory_budget;      // Bytes that the tiles were sized for (all the threads)
+    double          predicted_time;     // Predicted running time in seconds (cost model)
+} knn_plan_t;
+
+/**
+ * Select the backend, the query/corpus tile sizes and the number of threads for an exact k-NN problem,
+ * by evaluating the cost model (calibrated on this host) over the valid configurations. When OpenBLAS is pinned
+ * to a single thread (`blas_pin_single_thread`) the multi-threaded BLAS backend is not considered.
+ *
+ * @param corpus_length     Number of rows (data points) in the corpus
+ * @param query_length      Number of rows (data points) in the query
+ * @param d                 Dimensionality of each data point
+ * @param k                 Number of nearest neighbors to find
+ * @param cores             Maximum number of threads to use
+ * @param memory_budget     Usable memory in bytes (for all the threads)
+ * @param profile           Measured costs of this host (see `knn_profile_get`)
+ * @param plan              Pointer to the plan to fill
+ *
+ * @return                  0 on success, -1 if no configuration fits in the memory budget
+ *                          (`plan` is then the configuration with the smallest tiles)
+ */
+int knn_search_plan(size_t corpus_length, size_t query_length, int d, int k, int cores, size_t memory_budget,
+                    const knn_profile_t* profile, knn_plan_t* plan);
+
+/**
+ * Perform an exact k-nearest neighbor search with a given plan. The tiles and the memory budget of the plan
+ * are passed down to the backend with the call (see `knn_exact_config_t`), so searches with different plans
+ * may run concurrently; they change the BLAS threads of the process unless OpenBLAS is pinned to a single thread.
+ *
+ * @param corpus            Pointer to the corpus matrix (reference data points)
+ * @param query             Pointer to the query matrix (data points to compare)
+ * @param k                 Number of nearest neighbors to find
+ * @param indices           Pre-allocated array to store indices of the k-nearest neighbors for each query (length `query_length x k`)
+ * @param distances         Pre-allocated array to store the Euclidean distances to the k-nearest neighbors (length `query_length x k`)
+ * @param corpus_length     Number of rows (data points) in the corpus
+ * @param query_length      Number of rows (data points) in the query
+ * @param d                 Dimensionality of each data point (number of columns in corpus/query)
+ * @param plan              Configuration to run (see `knn_search_plan`)
+ *
+ * @return                  0 on success, -1 on failure
+ */
+int knn_search_with_plan(const float* corpus, const float* query, int k, knn_idx_t* indices, float* distances,
+                         size_t corpus_length, size_t query_length, int d, const knn_plan_t* plan);
+
+/**
+ * Select the plan that `knn_search` runs: the cores (at most `num_of_threads`), the usable memory and the
+ * profile of this host go to `knn_search_plan`.
+ *
+ * @param corpus_length     Number of rows (data points) in the corpus
+ * @param query_length      Number of rows (data points) in the query
+ * @param d                 Dimensionality of each data point
+ * @param k                 Number of nearest neighbors to find
+ * @param num_of_threads    Maximum number of threads to use (<= 0 to use all the online cores)
+ * @param plan              Pointer to the plan to fill
+ *
+ * @return                  0 on success, -1 if no configuration fits in the usable memory (see `knn_search_plan`)
+ */
+int knn_search_select(size_t corpus_length, size_t query_length, int d, int k, int num_of_threads, knn_plan_t* plan);
+
+/**
+ * Unified exact k-nearest neighbor search: it selects the backend, the tile sizes and the number of threads
+ * from the problem size, the cores, the usable memory and the host's profile, and runs the selected plan.
+ * It has the same signature as the other exact functions, so it can be used as a `knn_exact_t`
+ * (`knn_search_select` returns the plan it runs).
+ *
+ * @param corpus            Pointer to the corpus matrix (reference data points)
+ * @param query             Pointer to the query matrix (data points to compare)
+ * @param k                 Number of nearest neighbors to find
+ * @param indices           Pre-allocated array to store indices of the k-nearest neighbors for each query (length `query_length x k`)
+ * @param distances         Pre-allocated array to store the Euclidean distances to the k-nearest neighbors (length `query_length x k`)
+ * @param corpus_length     Number of rows (data points) in the corpus
+ * @param query_length      Number of rows (data points) in the query
+ * @param d                 Dimensionality of each data point (number of columns in corpus/query)
+ * @param num_of_threads    Maximum number of threads to use (<= 0 to use all the online cores)
+ *
+ * @return                  None (results are stored in the pre-allocated arrays `indices` and `distances`)
+ */
+void knn_search(const float* corpus, const float* query, int k, knn_idx_t* indices, float* distances, size_t corpus_length, size_t query_length, int d, int num_of_threads);
+
+/**
+ * Get a printable name of a backend.
+ *
+ * @param backend           Backend
+ *
+ * @return                  Constant string with the name of the backend
+ */
+const char* knn_backend_name(knn_backend_t backend);
+
+#endif // KNN_SEARCH_H
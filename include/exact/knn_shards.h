@@ -0,0 +1,98 @@
+#ifndef KNN_SHARDS_H
+#define KNN_SHARDS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "../../include/exact/knn_exact_pthread.h"
+#include "../../include/utils/knn_types.h"
+
+// Default number of shards (worker processes) of `knn_exact_sharded`
+#define KNN_SHARDS_DEFAULT_SHARDS   4
+
+// Maximum number of query rows broadcast to the workers at once (the size of the shared query buffer)
+#define KNN_SHARDS_BATCH_ROWS       4096
+
+// Sharded exact search: a coordinator (the calling process) and one worker process per corpus shard. The workers
+// are forked once and keep their shard; every query batch is broadcast through a shared memory buffer, each worker
+// writes the top-k of its shard (with global ids) to its own shared result slot, and the coordinator merges them.
+// The commands and replies go through a socket pair per worker, so a worker could be a remote node.
+typedef struct {
+    int             num_shards;
+    size_t          corpus_length;
+    int             d;
+    int             max_k;              // Largest k that the result slots can hold
+    size_t          max_batch;          // Query rows per broadcast
+    size_t*         shard_start;        // num_shards + 1: the shard s has the corpus rows [shard_start[s], shard_start[s + 1])
+    pid_t*          pids;
+    int*            channels;           // Coordinator end of the socket pair of every worker
+    void*           shared;             // Shared memory: the query buffer, then one result slot per shard
+    size_t          shared_bytes;
+} knn_shards_t;
+
+/**
+ * Split a corpus into shards of (almost) equal length and start one worker process per shard.
+ * The workers see the corpus copy-on-write, so the corpus must not change while the shards exist.
+ *
+ * @param corpus            Pointer to the corpus matrix
+ * @param corpus_length     Number of rows (data points) in the corpus
+ * @param d                 Dimensionality of each data point
+ * @param num_shards        Number of shards (<= 0 for `KNN_SHARDS_DEFAULT_SHARDS`, at most `corpus_length`)
+ * @param threads_per_shard Number of threads of every worker (`knn_exact_pthread`)
+ * @param max_k             Largest k that will be searched
+ * @param max_batch         Query rows per broadcast (0 for `KNN_SHARDS_BATCH_ROWS`)
+ *
+ * @return                  Pointer to the shards, or NULL on failure. Stop them with `knn_shards_destroy`.
+ */
+knn_shards_t* knn_shards_create(const float* corpus, size_t corpus_length, int d, int num_shards, int threads_per_shard,
+                                int max_k, size_t max_batch);
+
+/**
+ * Exact k-nearest neighbor search over the shards: the queries are broadcast in batches of `max_batch` rows
+ * and the per-shard top-k lists are k-way merged (neighbors at equal distances are ordered by id).
+ *
+ * @param shards            Shards of the corpus
+ * @param query             Pointer to the query matrix (data points to compare)
+ * @param k                 Number of nearest neighbors to find (<= `max_k`)
+ * @param indices           Pre-allocated array to store indices of the k-nearest neighbors for each query (length `query_length x k`)
+ * @param distances         Pre-allocated array to store the Euclidean distances to the k-nearest neighbors (length `query_length x k`)
+ * @param query_length      Number of rows (data points) in the query
+ *
+ * @return                  0 on success, -1 on failure (e.g. a worker died)
+ */
+int knn_shards_search(knn_shards_t* shards, const float* query, int k, knn_idx_t* indices, float* distances, size_t query_length);
+
+/**
+ * Stop the worker processes and free the shards.
+ *
+ * @param shards            Pointer to the shards (NULL is ignored)
+ *
+ * @return                  None
+ */
+void knn_shards_destroy(knn_shards_t* shards);
+
+/**
+ * Sharded exact k-nearest neighbor search: start `KNN_SHARDS_DEFAULT_SHARDS` workers that share the threads,
+ * search and stop them. It has the same signature as the other exact functions, so it can be used as a `knn_exact_t`.
+ *
+ * @param corpus            Pointer to the corpus matrix (reference data points)
+ * @param query             Pointer to the query matrix (data points to compare)
+ * @param k                 Number of nearest neighbors to find
+ * @param indices           Pre-allocated array to store indices of the k-nearest neighbors for each query (length `query_length x k`)
+ * @param distances         Pre-allocated array to store the Euclidean distances to the k-nearest neighbors (length `query_length x k`)
+ * @param corpus_length     Number of rows (data points) in the corpus
+ * @param query_length      Number of rows (data points) in the query
+ * @param d                 Dimensionality of each data point (number of columns in corpus/query)
+ * @param num_of_threads    Total number of threads of the workers (<= 0 to use all the online cores)
+ *
+ * @return                  None (results are stored in the pre-allocated arrays `indices` and `distances`)
+ */
+void knn_exact_sharded(const float* corpus, const float* query, int k, knn_idx_t* indices, float* distances, size_t corpus_length, size_t query_length, int d, int num_of_threads);
+
+#endif // KNN_SHARDS_H
@@ -0,0 +1,418 @@
+#ifndef FASTKNN_H
+#define FASTKNN_H
+
+// Public C API of libfastknn (`make -f Makefile.gcc lib`). This header is self-contained: it does not include
+// the internal headers, and the types below keep their layout within a major version.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FASTKNN_VERSION_MAJOR 1
+#define FASTKNN_VERSION_MINOR 0
+#define FASTKNN_VERSION_PATCH 0
+
+#if defined(FASTKNN_BUILD) && defined(__GNUC__)
+#define FASTKNN_API __attribute__((visibility("default")))
+#else
+#define FASTKNN_API
+#endif
+
+// Status of every call that can fail
+typedef enum {
+    FASTKNN_OK                  =  0,
+    FASTKNN_ERR_INVALID_ARGUMENT = -1,  // NULL pointer, d <= 0, k out of [1, corpus_length], ...
+    FASTKNN_ERR_OUT_OF_MEMORY   = -2,
+    FASTKNN_ERR_UNSUPPORTED     = -3,   // The index type is not available in this build
+    FASTKNN_ERR_INTERNAL        = -4    // An engine failed (see `fastknn_last_error`)
+} fastknn_status_t;
+
+// Neighbor ids are always 64-bit in the API, whatever the id width of the engines
+typedef int64_t fastknn_id_t;
+
+// Search structure of an index
+typedef enum {
+    FASTKNN_INDEX_AUTO = 0,             // Ball tree for d <= 20, brute force otherwise
+    FASTKNN_INDEX_BRUTE_FORCE,          // Brute force (GEMM), backend and tiles selected per search by the planner
+    FASTKNN_INDEX_PIVOT,                // Brute force with triangle-inequality pruning of corpus blocks
+    FASTKNN_INDEX_TREE                  // Ball tree (low dimensions)
+} fastknn_index_type_t;
+
+// Options of `fastknn_index_create`. Initialize them with `fastknn_index_options_init` and change the fields
+// you need: new fields are only appended, and `struct_size` tells the library which ones the caller knows.
+typedef struct {
+    size_t                  struct_size;
+    fastknn_index_type_t    type;
+    int                     num_threads;    // <= 0 to use all the online cores
+    int                     copy_corpus;    // 1: the index keeps its own copy, 0: the corpus must outlive the index
+    size_t                  memory_budget;  // Bytes that a search may use (0 for the usable memory of the host)
+    int                     num_pivots;     // FASTKNN_INDEX_PIVOT (<= 0 for the default)
+    size_t                  leaf_rows;      // Rows per tree leaf / pivot block (0 for the default)
+    const char*             profile_path;   // Cost profile file of the planner (NULL to calibrate in memory, no file I/O)
+    const char*             snapshot_path;  // FASTKNN_INDEX_PIVOT / TREE: load the index from this snapshot file if it
+                                            // was saved for the same corpus, else build it and save it there (NULL: build;
+                                            // `fastknn_index_create` fails if the snapshot cannot be written)
+} fastknn_index_options_t;
+
+// Opaque index handle
+typedef struct fastknn_index fastknn_index_t;
+
+/**
+ * Get the version of the library (it may differ from the header version the caller was compiled with).
+ *
+ * @param major             Pointer to store the major version (NULL to ignore)
+ * @param minor             Pointer to store the minor version (NULL to ignore)
+ * @param patch             Pointer to store the patch version (NULL to ignore)
+ *
+ * @return                  None
+ */
+FASTKNN_API void fastknn_version(int* major, int* minor, int* patch);
+
+/**
+ * Get a printable description of a status.
+ *
+ * @param status            Status
+ *
+ * @return                  Constant string
+ */
+FASTKNN_API const char* fastknn_status_string(fastknn_status_t status);
+
+/**
+ * Get the message of the last failed call of the calling thread.
+ *
+ * @return                  Constant string (empty if no call failed), valid until the next call of this thread
+ */
+FASTKNN_API const char* fastknn_last_error(void);
+
+/**
+ * Fill the index options with the defaults.
+ *
+ * @param options           Pointer to the options
+ *
+ * @return                  None
+ */
+FASTKNN_API void fastknn_index_options_init(fastknn_index_options_t* options);
+
+/**
+ * Create an index over a row-major `corpus_length x d` corpus. The first call sets OpenBLAS to a single thread
+ * for the rest of the process (its thread count is process-wide): the searches run their own workers instead.
+ *
+ * @param corpus            Pointer to the corpus matrix
+ * @param corpus_length     Number of rows (data points) in the corpus
+ * @param d                 Dimensionality of each data point
+ * @param options           Options (NULL for the defaults)
+ * @param index             Pointer to store the index handle
+ *
+ * @return                  FASTKNN_OK, or the reason of the failure (`*index` is then NULL)
+ */
+FASTKNN_API fastknn_status_t fastknn_index_create(const float* corpus, size_t corpus_length, int d,
+                                                  const fastknn_index_options_t* options, fastknn_index_t** index);
+
+/**
+ * Exact k-nearest neighbor search of a row-major `query_length x d` query matrix. The results of the query q are
+ * `indices[q * k, ..., q * k + k - 1]` (corpus row ids) and the matching Euclidean `distances`, nearest first.
+ * Searches on the same index may run concurrently: the query tile, memory budget and plan of a search are passed with
+ * the call (no process-wide setting changes), and BLAS is pinned to one thread per worker (see test 5 of `knn_project`).
+ *
+ * @param index             Index of the corpus
+ * @param query             Pointer to the query matrix
+ * @param query_length      Number of rows (data points) in the query
+ * @param k                 Number of nearest neighbors to find
+ * @param indices           Caller buffer of `query_length x k` ids
+ * @param distances         Caller buffer of `query_length x k` distances
+ *
+ * @return                  FASTKNN_OK, or the reason of the failure
+ */
+FASTKNN_API fastknn_status_t fastknn_index_search(const fastknn_index_t* index, const float* query, size_t query_length, int k,
+                                                  fastknn_id_t* indices, float* distances);
+
+/**
+ * Exact k-nearest neighbor search among the allowed corpus rows only (e.g. the items of a tenant or a label). The
+ * filter is a bitmap: bit `i % 64` of the word `i / 64` is set if the corpus row i is allowed. Selective filters
+ * copy the allowed rows and search them by brute force, the other ones scan the corpus and skip the blocks with
+ * no allowed row. If fewer than k rows are allowed, the last results of every query are -1 at distance INFINITY.
+ *
+ * @param index             Index of the corpus (any type: the filtered search always scans the corpus)
+ * @param query             Pointer to the query matrix
+ * @param query_length      Number of rows (data points) in the query
+ * @param k                 Number of nearest neighbors to find
+ * @param allowed           Bitmap of the allowed corpus rows (`(corpus_length + 63) / 64` words)
+ * @param indices           Caller buffer of `query_length x k` ids
+ * @param distances         Caller buffer of `query_length x k` distances
+ *
+ * @return                  FASTKNN_OK, or the reason of the failure
+ */
+FASTKNN_API fastknn_status_t fastknn_index_search_filtered(const fastknn_index_t* index, const float* query, size_t query_length, int k,
+                                                           const uint64_t* allowed, fastknn_id_t* indices, float* distances);
+
+/**
+ * Build the filter bitmap of the corpus rows whose label is in a set of allowed labels.
+ *
+ * @param labels            Label of every corpus row
+ * @param corpus_length     Number of rows (data points) in the corpus
+ * @param allowed_labels    Allowed labels
+ * @param num_allowed       Number of allowed labels
+ * @param allowed           Caller buffer of `(corpus_length + 63) / 64` words to store the bitmap
+ *
+ * @return                  FASTKNN_OK, or the reason of the failure
+ */
+FASTKNN_API fastknn_status_t fastknn_filter_from_labels(const int32_t* labels, size_t corpus_length, const int32_t* allowed_labels,
+                                                        int num_allowed, uint64_t* allowed);
+
+/**
+ * All-to-all k-nearest neighbors of the corpus of an index (every corpus row is a query, and it is its own
+ * nearest neighbor). With `accuracy` < 100 it runs the approximate all-to-all search, whose hyperplane split
+ * overlaps in a band chosen for a recall of `accuracy` percent on a sample of the corpus.
+ *
+ * @param index             Index of the corpus
+ * @param k                 Number of nearest neighbors to find
+ * @param accuracy          Target recall in percent of the approximate search, in [1, 100) (100 for the exact search)
+ * @param indices           Caller buffer of `corpus_length x k` ids
+ * @param distances         Caller buffer of `corpus_length x k` distances
+ *
+ * @return                  FASTKNN_OK, or the reason of the failure
+ */
+FASTKNN_API fastknn_status_t fastknn_index_all_knn(const fastknn_index_t* index, int k, int accuracy,
+                                                   fastknn_id_t* indices, float* distances);
+
+/**
+ * Get the shape of the corpus of an index.
+ *
+ * @param index             Index
+ * @param corpus_length     Pointer to store the number of rows (NULL to ignore)
+ * @param d                 Pointer to store the dimensionality (NULL to ignore)
+ *
+ * @return                  FASTKNN_OK, or FASTKNN_ERR_INVALID_ARGUMENT for a NULL index
+ */
+FASTKNN_API fastknn_status_t fastknn_index_shape(const fastknn_index_t* index, size_t* corpus_length, int* d);
+
+// Default number of query rows per tile of `fastknn_submit`
+#define FASTKNN_DEFAULT_TILE_ROWS 256
+
+// Opaque handle of a submitted search
+typedef struct fastknn_ticket fastknn_ticket_t;
+
+// Called by a pool thread when a tile of a submitted search finished: the results of the queries
+// [query_start, query_start + query_count) are in the output buffers. It runs before the ticket completes,
+// so it must not wait for or release the ticket, and it should return quickly (the thread serves other tiles).
+typedef void (*fastknn_callback_t)(fastknn_ticket_t* ticket, size_t query_start, size_t query_count,
+                                   fastknn_status_t status, void* user_data);
+
+/**
+ * Submit an exact search and return immediately. The queries are split into tiles of `tile_rows` rows that run
+ * on the search pool of the index (`num_threads` threads, started by the first submit, one tile per thread).
+ * The pool serves the tiles of the pending searches round-robin, so a small search is not queued behind every
+ * tile of a large one. The query and the output buffers must stay valid until the ticket completes.
+ *
+ * @param index             Index of the corpus
+ * @param query             Pointer to the query matrix
+ * @param query_length      Number of rows (data points) in the query
+ * @param k                 Number of nearest neighbors to find
+ * @param indices           Caller buffer of `query_length x k` ids
+ * @param distances         Caller buffer of `query_length x k` distances
+ * @param tile_rows         Query rows per tile, i.e. per callback (0 for `FASTKNN_DEFAULT_TILE_ROWS`)
+ * @param callback          Function called after every tile (NULL for none)
+ * @param user_data         Pointer passed to the callback
+ * @param ticket            Pointer to store the ticket, to poll, wait and release
+ *
+ * @return                  FASTKNN_OK if the search was queued, or the reason of the failure (`*ticket` is then NULL)
+ */
+FASTKNN_API fastknn_status_t fastknn_submit(fastknn_index_t* index, const float* query, size_t query_length, int k,
+                                            fastknn_id_t* indices, float* distances, size_t tile_rows,
+                                            fastknn_callback_t callback, void* user_data, fastknn_ticket_t** ticket);
+
+/**
+ * Check a submitted search without blocking.
+ *
+ * @param ticket            Ticket of the search
+ * @param queries_done      Pointer to store the number of queries with results (NULL to ignore)
+ *
+ * @return                  1 if the search completed, 0 if it is running, -1 for a NULL ticket
+ */
+FASTKNN_API int fastknn_poll(const fastknn_ticket_t* ticket, size_t* queries_done);
+
+/**
+ * Wait until a submitted search completes (all its tiles finished and their callbacks returned).
+ *
+ * @param ticket            Ticket of the search
+ *
+ * @return                  FASTKNN_OK, or the first failure of its tiles
+ */
+FASTKNN_API fastknn_status_t fastknn_wait(fastknn_ticket_t* ticket);
+
+/**
+ * Wait for a submitted search and free its ticket. Every ticket must be released before its index is destroyed.
+ *
+ * @param ticket            Ticket (NULL is ignored)
+ *
+ * @return                  None
+ */
+FASTKNN_API void fastknn_ticket_release(fastknn_ticket_t* ticket);
+
+// Defaults of `fastknn_coalescer_create`: a batch runs when it has 64 query rows or 200 us after its first request
+#define FASTKNN_COALESCER_MAX_BATCH     64
+#define FASTKNN_COALESCER_DEADLINE_US   200
+
+// Opaque handle of a query coalescer
+typedef struct fastknn_coalescer fastknn_coalescer_t;
+
+// Counters of a coalescer
+typedef struct {
+    size_t  requests;           // Requests that went through a batch
+    size_t  queries;            // Query rows of these requests
+    size_t  batches;            // Batches searched
+    size_t  full_batches;       // Batches that ran with `max_batch` rows (the others reached their deadline or
+                                // had no room for the next request)
+    size_t  direct;             // Requests of at least `max_batch` rows, searched directly
+} fastknn_coalescer_stats_t;
+
+/**
+ * Create a query coalescer in front of an index, for many concurrent callers with few queries each. A single
+ * query makes the distance GEMM a GEMV, so the coalescer gathers the queries of concurrent requests in batches
+ * of up to `max_batch` rows and searches every batch at once. The first request of a batch waits for at most
+ * `deadline_us` microseconds for other requests, then it searches the batch and copies the results of every
+ * request to its buffers. A larger `max_batch` or `deadline_us` gives more throughput and more latency.
+ *
+ * @param index             Index of the corpus (it must outlive the coalescer)
+ * @param max_batch         Maximum query rows per batch (0 for `FASTKNN_COALESCER_MAX_BATCH`)
+ * @param deadline_us       Maximum wait of the first request of a batch (0 for `FASTKNN_COALESCER_DEADLINE_US`)
+ * @param coalescer         Pointer to store the coalescer handle
+ *
+ * @return                  FASTKNN_OK, or the reason of the failure (`*coalescer` is then NULL)
+ */
+FASTKNN_API fastknn_status_t fastknn_coalescer_create(const fastknn_index_t* index, size_t max_batch, unsigned int deadline_us,
+                                                      fastknn_coalescer_t** coalescer);
+
+/**
+ * Exact search through a coalescer: like `fastknn_index_search`, but the queries are searched in a batch with
+ * the queries of the concurrent requests. It blocks until the results are in the buffers.
+ *
+ * @param coalescer         Coalescer of the index
+ * @param query             Pointer to the query matrix
+ * @param query_length      Number of rows (data points) in the query
+ * @param k                 Number of nearest neighbors to find
+ * @param indices           Caller buffer of `query_length x k` ids
+ * @param distances         Caller buffer of `query_length x k` distances
+ *
+ * @return                  FASTKNN_OK, or the reason of the failure (the failure of the whole batch)
+ */
+FASTKNN_API fastknn_status_t fastknn_coalescer_search(fastknn_coalescer_t* coalescer, const float* query, size_t query_length, int k,
+                                                      fastknn_id_t* indices, float* distances);
+
+/**
+ * Get the counters of a coalescer.
+ *
+ * @param coalescer         Coalescer
+ * @param stats             Pointer to store the counters
+ *
+ * @return                  FASTKNN_OK, or FASTKNN_ERR_INVALID_ARGUMENT for NULL pointers
+ */
+FASTKNN_API fastknn_status_t fastknn_coalescer_get_stats(fastknn_coalescer_t* coalescer, fastknn_coalescer_stats_t* stats);
+
+/**
+ * Destroy a coalescer. No request may be in progress.
+ *
+ * @param coalescer         Coalescer handle (NULL is ignored)
+ *
+ * @return                  None
+ */
+FASTKNN_API void fastknn_coalescer_destroy(fastknn_coalescer_t* coalescer);
+
+// Defaults of `fastknn_cache_create`
+#define FASTKNN_CACHE_MAX_ENTRIES   65536
+#define FASTKNN_CACHE_SHARDS        16
+
+// Opaque handle of a query result cache
+typedef struct fastknn_cache fastknn_cache_t;
+
+// Counters of a cache
+typedef struct {
+    size_t  hits;               // Query rows answered from the cache
+    size_t  misses;             // Query rows searched
+    size_t  insertions;
+    size_t  evictions;          // Entries replaced by CLOCK (stale entries included)
+    size_t  entries;            // Entries in the cache
+    size_t  bytes;              // Memory of the entries
+} fastknn_cache_stats_t;
+
+/**
+ * Create a bounded cache of search results. An entry holds the results of one query row for one index and k,
+ * keyed by a hash of the query (quantized to multiples of `quantization_step` if it is positive, so that
+ * near-identical queries share the results of the first one; a row with a NaN, an infinity or a value beyond
+ * 2^31 steps is keyed by its exact values instead). The cache is split into `num_shards` shards with their own
+ * lock and CLOCK eviction, so concurrent searches rarely contend.
+ *
+ * @param max_entries       Maximum number of entries (0 for `FASTKNN_CACHE_MAX_ENTRIES`), about
+ *                          `d x 4 + k x 12 + 64` bytes each
+ * @param num_shards        Number of shards (<= 0 for `FASTKNN_CACHE_SHARDS`, rounded up to a power of 2)
+ * @param quantization_step Step of the query quantization (0 for exact queries)
+ * @param cache             Pointer to store the cache handle
+ *
+ * @return                  FASTKNN_OK, or the reason of the failure (`*cache` is then NULL)
+ */
+FASTKNN_API fastknn_status_t fastknn_cache_create(size_t max_entries, int num_shards, float quantization_step,
+                                                  fastknn_cache_t** cache);
+
+/**
+ * Exact search through a cache: like `fastknn_index_search`, but the query rows with cached results are
+ * copied from the cache and only the others are searched (in one batch) and then cached. The entries of
+ * an index never match another index, so the entries of a destroyed or rebuilt index just age out.
+ *
+ * @param cache             Cache
+ * @param index             Index of the corpus
+ * @param query             Pointer to the query matrix
+ * @param query_length      Number of rows (data points) in the query
+ * @param k                 Number of nearest neighbors to find
+ * @param indices           Caller buffer of `query_length x k` ids
+ * @param distances         Caller buffer of `query_length x k` distances
+ *
+ * @return                  FASTKNN_OK, or the reason of the failure
+ */
+FASTKNN_API fastknn_status_t fastknn_cache_search(fastknn_cache_t* cache, const fastknn_index_t* index, const float* query,
+                                                  size_t query_length, int k, fastknn_id_t* indices, float* distances);
+
+/**
+ * Invalidate all the entries of a cache, e.g. after changing a corpus that an index references (`copy_corpus = 0`).
+ *
+ * @param cache             Cache
+ *
+ * @return                  FASTKNN_OK, or FASTKNN_ERR_INVALID_ARGUMENT for a NULL cache
+ */
+FASTKNN_API fastknn_status_t fastknn_cache_invalidate(fastknn_cache_t* cache);
+
+/**
+ * Get the counters of a cache.
+ *
+ * @param cache             Cache
+ * @param stats             Pointer to store the counters
+ *
+ * @return                  FASTKNN_OK, or FASTKNN_ERR_INVALID_ARGUMENT for NULL pointers
+ */
+FASTKNN_API fastknn_status_t fastknn_cache_get_stats(fastknn_cache_t* cache, fastknn_cache_stats_t* stats);
+
+/**
+ * Destroy a cache. No search may be in progress.
+ *
+ * @param cache             Cache handle (NULL is ignored)
+ *
+ * @return                  None
+ */
+FASTKNN_API void fastknn_cache_destroy(fastknn_cache_t* cache);
+
+/**
+ * Destroy an index (after the pending searches of its pool finished).
+ *
+ * @param index             Index handle (NULL is ignored)
+ *
+ * @return                  None
+ */
+FASTKNN_API void fastknn_index_destroy(fastknn_index_t* index);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FASTKNN_H
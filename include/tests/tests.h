@@ -1,15 +1,39 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
 #include <sys/time.h>
 #include <math.h>
 #include "../../include/utils/data_io.h"
+#include "../../include/utils/blas_threads.h"
+#include "../../include/utils/knn_stats.h"
+#include "../../include/utils/perf_counters.h"
+#include "../../include/utils/knn_hash.h"
 
 // Define the tolerance for comparison
 #define ZERO 0.01
 
+// Exact k-NN results cache (see `generate_knn_exact_results_cached`)
+#define KNN_CACHE_DIR       "results/data_knn/cache"
+#define KNN_CACHE_METRIC    "euclidean"
+#define KNN_CACHE_VERSION   2
+
 // Generic function pointer type for k-NN exact search
-typedef void (*knn_exact_t)(const float* corpus, const float* query, int k, int* indices, float* distances, int corpus_length, int query_length, int d, int num_of_threads);
-typedef void (*knn_approx_t)(const float* dataset, int k, int* indices, float* distances, int dataset_length, int d, int num_of_threads, int accuracy);
+typedef void (*knn_exact_t)(const float* corpus, const float* query, int k, knn_idx_t* indices, float* distances, size_t corpus_length, size_t query_length, int d, int num_of_threads);
+typedef void (*knn_approx_t)(const float* dataset, int k, knn_idx_t* indices, float* distances, size_t dataset_length, int d, int num_of_threads, int accuracy);
+
+// Quality of (approximate) k-NN results against a ground truth
+typedef struct {
+    size_t  query_length;
+    int     k;
+    double  recall;             // recall@k: fraction of the true k-NN that are found
+    double* recall_at;          // recall@r for r = 1..k (recall_at[r - 1]): overlap of the top-r of both lists
+    double  distance_ratio;     // Sum of the approximate k-NN distances / sum of the exact ones (-1 without distances)
+    double  rank_weighted;      // Recall where the true neighbor of rank i weighs 1/log2(i + 2), normalized per query
+    double  min_query_recall;   // Worst recall@k of a single query
+    long    perfect_queries;    // Queries with recall@k == 1
+} knn_eval_t;
 
 /**
  * Function to exact (one by one) compare k-NN results of 2 datasets.
@@ -26,7 +50,8 @@ int compare_knn_exact_results(const char* data_path1, const char* neighbors_name
 /**
  * Function to approximate compare k-NN results of 2 datasets.
  * Instead of comparing the values one by one, it checks how many of data_results1 are in
- * data_results2. We assume that data_results1 are the ground truth values.
+ * data_results2 (see `knn_evaluate`). We assume that data_results1 are the ground truth values.
+ * The full evaluation is also saved as JSON next to data_results2 (`<data_path2 without .hdf5>_eval.json`).
  *
  * @param data_path1         Path to the .hdf5 file containing the ground truth dataset.
  * @param neighbors_name1    Dataset name for the ground truth neighbors.
@@ -41,6 +66,47 @@ int compare_knn_approx_results(const char* data_path1, const char* neighbors_nam
                                 const char* data_path2, const char* neighbors_name2, const char* distances_name2);
 
 
+/**
+ * Evaluate k-NN results against a ground truth in one parallel pass. The approximate ids of every query are put
+ * in a hash set, so the cost is O(query_length * k) instead of O(query_length * k^2).
+ *
+ * @param truth_idx          Ground truth neighbor ids (length `query_length x truth_k`)
+ * @param truth_dst          Ground truth distances (same layout, or NULL)
+ * @param truth_k            Neighbors per query in the ground truth (>= approx_k, only the first approx_k are used)
+ * @param approx_idx         Evaluated neighbor ids (length `query_length x approx_k`)
+ * @param approx_dst         Evaluated distances (same layout, or NULL)
+ * @param approx_k           Neighbors per query in the evaluated results
+ * @param query_length       Number of queries
+ * @param num_of_threads     Number of threads (<= 0 to use all the online cores)
+ * @param eval               Pointer to the results (free them with `knn_eval_free`)
+ *
+ * @return                   -1 if the inputs are not compatible or there's an error in memory allocation, 0 otherwise
+ */
+int knn_evaluate(const knn_idx_t* truth_idx, const float* truth_dst, int truth_k,
+                 const knn_idx_t* approx_idx, const float* approx_dst, int approx_k,
+                 size_t query_length, int num_of_threads, knn_eval_t* eval);
+
+/**
+ * Free the memory of an evaluation.
+ *
+ * @param eval               Evaluation filled by `knn_evaluate`
+ *
+ * @return                   None
+ */
+void knn_eval_free(knn_eval_t* eval);
+
+/**
+ * Save an evaluation as a JSON object (all the metrics and the recall@1..k curve).
+ *
+ * @param filename           Path to the .json file to create or overwrite
+ * @param name               Name of the evaluated results (e.g. the path to their .hdf5 file)
+ * @param eval               Evaluation filled by `knn_evaluate`
+ *
+ * @return                   -1 if the file cannot be created, 0 otherwise
+ */
+int knn_eval_save_json(const char* filename, const char* name, const knn_eval_t* eval);
+
+
 /**
  * Function to calculate exact k-NN results and store them in data_knn using a specified k-NN search function.
  *
@@ -59,6 +125,10 @@ int compare_knn_approx_results(const char* data_path1, const char* neighbors_nam
  *                           6 -> knn_approx_pthread
  *                           7 -> knn_approx_openmp
  *                           8 -> knn_approx_opencilk
+ *                           9 -> knn_search
+ *                          10 -> knn_exact_pivot
+ *                          11 -> knn_exact_tree
+ *                          12 -> knn_exact_sharded
  *
  * @return                  -1 if there's an error in loading data or memory allocation, 0 otherwise
  */
@@ -86,4 +156,130 @@ int generate_knn_exact_results(knn_exact_t knnsearch, const char* data_path, con
  *
  * @return                  -1 if there's an error in loading data or memory allocation, 0 otherwise
  */
-int generate_knn_approx_results(knn_approx_t knnsearch, const char* data_path, const char* dataset_name, int k, int num_of_threads, int accuracy, int id);
\ No newline at end of file
+int generate_knn_approx_results(knn_approx_t knnsearch, const char* data_path, const char* dataset_name, int k, int num_of_threads, int accuracy, int id);
+
+/**
+ * Same as `generate_knn_exact_results`, but the exact results are cached in `KNN_CACHE_DIR`, addressed by a hash
+ * of the corpus content (not the file name) and the metric:
+ *  - if the cache has at least k neighbors for a prefix of the queries, only the remaining queries are computed
+ *    (e.g. a query set that grew), and the cache entry is extended with them,
+ *  - if the cache has fewer than k neighbors (or other queries), everything is computed and the entry is replaced.
+ * The results (first k neighbors) are stored in the same `results/data_knn` file as the uncached function.
+ *
+ * @param knnsearch         Function pointer to the exact k-NN search implementation used on a cache miss.
+ * @param data_path         Path to the .hdf5 file containing the dataset.
+ * @param corpus_name       Dataset name for the corpus (training set).
+ * @param query_name        Dataset name for the query (test set).
+ * @param k                 Evaluate k - NN
+ * @param num_of_threads    Number of threads to use in the k-NN search function (and for the hashing).
+ * @param id                Identifier to the `knnsearch` (see `generate_knn_exact_results`)
+ *
+ * @return                  -1 if there's an error in loading data or memory allocation, 0 otherwise
+ */
+int generate_knn_exact_results_cached(knn_exact_t knnsearch, const char* data_path, const char* corpus_name, const char* query_name, int k, int num_of_threads, int id);
+
+/**
+ * Path of the results file of a k-NN function in `results/data_knn`.
+ *
+ * @param id                Identifier to the k-NN function (see `generate_knn_exact_results`)
+ *
+ * @return                  Constant string with the path, or NULL for an unknown id
+ */
+const char* knn_results_path(int id);
+
+/**
+ * Test an exact k-NN function on a corpus with more than 2^31 floats (n x d > 2^31), where 32-bit sizes and offsets
+ * overflow. The corpus is a virtual array: a block of far away rows is mapped over and over, so only the distance
+ * matrices of the search need real memory. The k neighbors of every query are planted in the last rows of the corpus,
+ * at known distances, and the results must match them exactly.
+ *
+ * @param knnsearch         Function pointer to the exact k-NN search implementation to be tested.
+ * @param corpus_length     Number of rows (data points) in the corpus (e.g. 2^31 / d + 2^16).
+ * @param d                 Dimensionality of each data point.
+ * @param k                 Evaluate k - NN
+ * @param query_length      Number of queries (<= d).
+ * @param num_of_threads    Number of threads to use in the k-NN search function.
+ *
+ * @return                  -1 if there's an error in memory allocation or the results do not match, 0 otherwise
+ */
+int test_knn_large_extents(knn_exact_t knnsearch, size_t corpus_length, int d, int k, size_t query_length, int num_of_threads);
+
+
+/**
+ * Test concurrent searches of libfastknn (`Makefile.gcc` only): for a brute-force, a pivot and a tree index,
+ * `2 x num_of_threads` threads search at the same time, directly or through the pool of the index (`fastknn_submit`),
+ * with different k and query slices, and every result must match a sequential search of the same index.
+ *
+ * @param corpus_length     Number of rows (data points) in the corpus (a seeded Gaussian mixture)
+ * @param d                 Dimensionality of each data point
+ * @param k                 Evaluate k - NN (the searches use 1, k and 2k)
+ * @param num_of_threads    Number of threads of every index
+ *
+ * @return                  -1 if a search failed or the results do not match, 0 otherwise
+ */
+int test_fastknn_concurrent(size_t corpus_length, int d, int k, int num_of_threads);
+
+
+/**
+ * Test the filtered exact k-NN (`Makefile.gcc` only) against brute force over all the rows followed by dropping the
+ * rows that are not allowed: a label filter of about 3% of the rows (gather plan), a bitmap whose corpus tiles have
+ * no allowed row, a quarter of them or all of them (scan plan with skipped, gathered and dense tiles), and fewer than
+ * k allowed rows with both plans, where the missing neighbors must be -1 at distance INFINITY.
+ *
+ * @param corpus_length     Number of rows (data points) in the corpus (a seeded Gaussian mixture, at least 3 tiles)
+ * @param d                 Dimensionality of each data point
+ * @param k                 Evaluate k - NN
+ * @param num_of_threads    Number of threads of the searches
+ *
+ * @return                  -1 if a search failed or the results do not match, 0 otherwise
+ */
+int test_knn_filtered(size_t corpus_length, int d, int k, int num_of_threads);
+
+
+/**
+ * Test the snapshots of the tree, the pivot index and the projection (`Makefile.gcc` only): a saved and loaded
+ * structure must give the same results as the fresh one, and a snapshot with a corrupted section, of another corpus
+ * (pivot and projection; a tree index rebuilds a tree of another corpus) or of another id width (tree and pivot,
+ * the projection stores no ids) must be rejected.
+ *
+ * @param corpus_length     Number of rows (data points) in the corpus (a seeded Gaussian mixture)
+ * @param d                 Dimensionality of each data point
+ * @param k                 Evaluate k - NN
+ * @param num_of_threads    Number of threads of the builds and the searches
+ *
+ * @return                  -1 if a save, load or search failed, the results differ or a snapshot was not rejected, 0 otherwise
+ */
+int test_knn_snapshots(size_t corpus_length, int d, int k, int num_of_threads);
+
+
+/**
+ * Test the query coalescer of libfastknn (`Makefile.gcc` only): `2 x num_of_threads + 2` threads send requests of
+ * 1 to 3 rows with k = 1, k and 2k to the coalescer of a brute-force index at the same time, so requests of different
+ * k share batches, and one request of a whole batch is searched directly. Every result must match a direct
+ * `fastknn_index_search`, and the counters must add up to the requests and rows that were sent.
+ *
+ * @param corpus_length     Number of rows (data points) in the corpus (a seeded Gaussian mixture)
+ * @param d                 Dimensionality of each data point
+ * @param k                 Evaluate k - NN (the requests use 1, k and 2k)
+ * @param num_of_threads    Number of threads of the index
+ *
+ * @return                  -1 if a search failed, the results do not match or the counters are wrong, 0 otherwise
+ */
+int test_fastknn_coalescer(size_t corpus_length, int d, int k, int num_of_threads);
+
+
+/**
+ * Test the query result cache of libfastknn (`Makefile.gcc` only): the rows missed by a cold cache must match a fresh
+ * `fastknn_index_search` and be cached, the same rows must then hit and return the cached results bit for bit, and
+ * another k, another index of the same corpus and an invalidated cache (no entries or bytes left) must miss. Rows
+ * within a fraction of the step of a quantized row must hit its entry, and a bounded cache must evict the rows past
+ * its capacity and still return the right results.
+ *
+ * @param corpus_length     Number of rows (data points) in the corpus (a seeded Gaussian mixture)
+ * @param d                 Dimensionality of each data point
+ * @param k                 Evaluate k - NN (and 2k)
+ * @param num_of_threads    Number of threads of the index
+ *
+ * @return                  -1 if a search failed, the results do not match or the counters are wrong, 0 otherwise
+ */
+int test_fastknn_cache(size_t corpus_length, int d, int k, int num_of_threads);
@@ -0,0 +1,92 @@
+#ifndef BLAS_THREADS_H
+#define BLAS_THREADS_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <cblas.h>    //sudo apt-get install libopenblas-dev
+
+// Minimum number of query rows that each worker should own so that its `cblas_sgemm` is still a
+// real matrix-matrix product. Below `num_of_threads * BLAS_MIN_ROWS_PER_WORKER` query rows the
+// per-worker GEMMs degrade to (almost) GEMVs, so it is faster to run a few big GEMMs and let
+// OpenBLAS spread each one over all the threads.
+#define BLAS_MIN_ROWS_PER_WORKER 64
+
+// How the BLAS threads are combined with the threads of a parallel k-NN backend.
+typedef enum {
+    KNN_BLAS_INHERIT = 0,           // The backend did not touch BLAS (serial functions use whatever the caller set)
+    KNN_BLAS_SINGLE_PER_WORKER,     // Every worker runs its own GEMMs with a single-threaded BLAS
+    KNN_BLAS_MULTI_FEW_GEMMS        // No workers, a few big GEMMs with a multi-threaded BLAS
+} knn_blas_strategy_t;
+
+/**
+ * Set the number of threads that OpenBLAS uses for every following BLAS call (process-wide). It does nothing
+ * once `blas_pin_single_thread` has been called.
+ *
+ * @param num_of_threads    Number of BLAS threads (values < 1 are treated as 1)
+ *
+ * @return                  None
+ */
+void blas_set_threads(int num_of_threads);
+
+/**
+ * Run OpenBLAS single-threaded for the rest of the process: the following `blas_set_threads` calls do nothing and
+ * every backend runs its GEMMs one per worker. The BLAS thread count is process-wide, so a process that runs
+ * searches concurrently (e.g. libfastknn) calls it once, before the first search, instead of letting every
+ * search save, change and restore it.
+ *
+ * @return                  None
+ */
+void blas_pin_single_thread(void);
+
+/**
+ * Check if `blas_pin_single_thread` has been called.
+ *
+ * @return                  1 if OpenBLAS is pinned to a single thread, 0 otherwise
+ */
+int blas_threads_pinned(void);
+
+/**
+ * Get the number of threads that OpenBLAS currently uses.
+ *
+ * @return                  Number of BLAS threads
+ */
+int blas_get_threads(void);
+
+/**
+ * Select how a parallel backend should combine its workers with the BLAS threads, based on the batch shape.
+ *
+ * @param corpus_length     Number of rows (data points) in the corpus
+ * @param query_length      Number of rows (data points) in the query
+ * @param num_of_threads    Number of threads the backend was asked to use
+ *
+ * @return                  `KNN_BLAS_MULTI_FEW_GEMMS` for small query batches, `KNN_BLAS_SINGLE_PER_WORKER` otherwise
+ *                          (always `KNN_BLAS_SINGLE_PER_WORKER` when BLAS is pinned to a single thread)
+ */
+knn_blas_strategy_t select_blas_strategy(size_t corpus_length, size_t query_length, int num_of_threads);
+
+/**
+ * Record the strategy used by the last k-NN call (so that it can be reported in the timing output).
+ *
+ * @param strategy          Strategy to record
+ *
+ * @return                  None
+ */
+void blas_set_last_strategy(knn_blas_strategy_t strategy);
+
+/**
+ * Get the strategy recorded by the last k-NN call.
+ *
+ * @return                  The last recorded strategy
+ */
+knn_blas_strategy_t blas_get_last_strategy(void);
+
+/**
+ * Get a printable name of a strategy.
+ *
+ * @param strategy          Strategy
+ *
+ * @return                  Constant string with the name of the strategy
+ */
+const char* blas_strategy_name(knn_blas_strategy_t strategy);
+
+#endif // BLAS_THREADS_H
@@ -0,0 +1,135 @@
+#ifndef DATA_GEN_H
+#define DATA_GEN_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "../../include/utils/data_io.h"
+
+// Seed of the random datasets of `main.c` (the same seed gives the same dataset on every run)
+#define KNN_GEN_DEFAULT_SEED 42
+
+// Rows per HDF5 chunk / write when streaming to disk
+#define KNN_GEN_CHUNK_ROWS 65536
+
+// The distributions of the generated data points
+typedef enum {
+    KNN_GEN_UNIFORM = 0,        // Uniform in [low, high)^d
+    KNN_GEN_MIXTURE,            // Gaussian mixture: `clusters` centers uniform in [low, high)^d, std `cluster_std`
+    KNN_GEN_ANISOTROPIC,        // Gaussian with std `scale / (j + 1)^anisotropy` along the j-th axis
+    KNN_GEN_LOW_DIM             // Points on a random `intrinsic_dim`-dimensional subspace, plus Gaussian `noise`
+} knn_gen_dist_t;
+
+// Parameters of a generated dataset (see `knn_gen_default_config` for the defaults)
+typedef struct {
+    knn_gen_dist_t  distribution;
+    uint64_t        seed;
+    size_t          n;                      // Number of rows (data points)
+    int             d;                      // Dimensionality of each data point
+    float           low, high;              // Range of the uniform data and of the mixture centers
+    int             clusters;               // KNN_GEN_MIXTURE
+    float           cluster_std;            // KNN_GEN_MIXTURE
+    float           scale;                  // KNN_GEN_ANISOTROPIC and KNN_GEN_LOW_DIM
+    float           anisotropy;             // KNN_GEN_ANISOTROPIC
+    int             intrinsic_dim;          // KNN_GEN_LOW_DIM
+    float           noise;                  // KNN_GEN_LOW_DIM
+    float           duplicate_fraction;     // Fraction of the rows that are exact copies of an earlier row
+} knn_gen_config_t;
+
+/**
+ * Counter-based random number generator: the value depends only on (seed, counter), so any element of a
+ * dataset can be generated independently (in parallel, or in chunks) and reproducibly.
+ *
+ * @param seed          Seed of the stream
+ * @param counter       Position in the stream
+ *
+ * @return              64 random bits
+ */
+uint64_t knn_gen_random(uint64_t seed, uint64_t counter);
+
+/**
+ * Fill a configuration with the default parameters of a distribution.
+ *
+ * @param config        Pointer to the configuration to fill
+ * @param distribution  Distribution of the data points
+ * @param n             Number of rows (data points)
+ * @param d             Dimensionality of each data point
+ * @param seed          Seed of the dataset
+ *
+ * @return              None
+ */
+void knn_gen_default_config(knn_gen_config_t* config, knn_gen_dist_t distribution, size_t n, int d, uint64_t seed);
+
+/**
+ * Generate the rows [row_start, row_start + rows) of a dataset in parallel. The rows are the same regardless of
+ * the number of threads and of the chunking.
+ *
+ * @param config            Parameters of the dataset
+ * @param data              Pre-allocated array for the rows (length `rows x d`)
+ * @param row_start         First row to generate
+ * @param rows              Number of rows to generate
+ * @param num_of_threads    Number of threads (<= 0 to use all the online cores)
+ *
+ * @return                  0 on success, -1 on failure
+ */
+int knn_gen_fill(const knn_gen_config_t* config, float* data, size_t row_start, size_t rows, int num_of_threads);
+
+/**
+ * Generate a whole dataset in memory.
+ *
+ * @param config            Parameters of the dataset
+ * @param num_of_threads    Number of threads (<= 0 to use all the online cores)
+ *
+ * @return                  Pointer to the `n x d` dataset, or NULL on failure. The caller is responsible for freeing the memory.
+ */
+float* knn_gen_dataset(const knn_gen_config_t* config, int num_of_threads);
+
+/**
+ * Generate a dataset straight into a chunked HDF5 dataset, `KNN_GEN_CHUNK_ROWS` rows at a time
+ * (the dataset never needs to fit in memory). An existing dataset with the same name is replaced.
+ *
+ * @param config            Parameters of the dataset
+ * @param filename          Path to the HDF5 file (created if it does not exist)
+ * @param dataset_name      Name of the dataset within the HDF5 file
+ * @param num_of_threads    Number of threads (<= 0 to use all the online cores)
+ *
+ * @return                  0 on success, -1 on failure
+ */
+int knn_gen_to_hdf5(const knn_gen_config_t* config, const char* filename, const char* dataset_name, int num_of_threads);
+
+/**
+ * Generate a dataset straight into a binary `.fbin` file (uint32 n, uint32 d, then the n x d float32 rows),
+ * `KNN_GEN_CHUNK_ROWS` rows at a time.
+ *
+ * @param config            Parameters of the dataset
+ * @param filename          Path to the file to create or overwrite
+ * @param num_of_threads    Number of threads (<= 0 to use all the online cores)
+ *
+ * @return                  0 on success, -1 on failure
+ */
+int knn_gen_to_fbin(const knn_gen_config_t* config, const char* filename, int num_of_threads);
+
+/**
+ * Parse the name of a distribution ("uniform", "mixture", "anisotropic", "lowdim").
+ *
+ * @param name          Name of the distribution
+ * @param distribution  Pointer to store the distribution
+ *
+ * @return              0 on success, -1 for an unknown name
+ */
+int knn_gen_parse_distribution(const char* name, knn_gen_dist_t* distribution);
+
+/**
+ * Get a printable name of a distribution.
+ *
+ * @param distribution  Distribution
+ *
+ * @return              Constant string with the name of the distribution
+ */
+const char* knn_gen_distribution_name(knn_gen_dist_t distribution);
+
+#endif // DATA_GEN_H
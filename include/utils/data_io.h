@@ -5,6 +5,14 @@
 #include <stdio.h>
 #include <hdf5/serial/hdf5.h>  //sudo apt-get install libhdf5-dev
 #include <sys/stat.h>
+#include "../../include/utils/knn_types.h"
+
+// HDF5 type of the neighbor ids (`knn_idx_t`)
+#if KNN_INDEX_32
+#define KNN_IDX_H5T H5T_NATIVE_INT32
+#else
+#define KNN_IDX_H5T H5T_NATIVE_INT64
+#endif
 
 /**
  * Loads data from an HDF5 file.
@@ -17,7 +25,33 @@
  * @return              Pointer to a dynamically allocated array containing the loaded data,
  *                      or NULL if an error occurs. The caller is responsible for freeing the memory.
  */
-float* load_hdf5(const char* filename, const char* dataset_name, int* n, int* d);
+float* load_hdf5(const char* filename, const char* dataset_name, size_t* n, int* d);
+
+/**
+ * Loads integer data (e.g. neighbor ids) from an HDF5 file, without a conversion to float.
+ * 
+ * @param filename      Path to the HDF5 file.
+ * @param dataset_name  Name of the dataset within the HDF5 file to load.
+ * @param n             Pointer to store the number of rows loaded.
+ * @param d             Pointer to store the dimensionality (number of columns) of each row.
+ * 
+ * @return              Pointer to a dynamically allocated array containing the loaded data,
+ *                      or NULL if an error occurs. The caller is responsible for freeing the memory.
+ */
+int* load_int_hdf5(const char* filename, const char* dataset_name, size_t* n, int* d);
+
+/**
+ * Loads neighbor ids from an HDF5 file as `knn_idx_t` (any stored integer type is converted).
+ * 
+ * @param filename      Path to the HDF5 file.
+ * @param dataset_name  Name of the dataset within the HDF5 file to load.
+ * @param n             Pointer to store the number of rows loaded.
+ * @param d             Pointer to store the dimensionality (number of columns) of each row.
+ * 
+ * @return              Pointer to a dynamically allocated array containing the loaded data,
+ *                      or NULL if an error occurs. The caller is responsible for freeing the memory.
+ */
+knn_idx_t* load_idx_hdf5(const char* filename, const char* dataset_name, size_t* n, int* d);
 
 /**
  * Save data to an HDF5 file.
@@ -30,7 +64,7 @@ float* load_hdf5(const char* filename, const char* dataset_name, int* n, int* d)
  * 
  * @return              0 on success, -1 on failure.
  */
-int save_float_hdf5(const char* filename, const char* dataset_name, const float* data, int n, int d);
+int save_float_hdf5(const char* filename, const char* dataset_name, const float* data, size_t n, int d);
 
 
 /**
@@ -44,6 +78,20 @@ int save_float_hdf5(const char* filename, const char* dataset_name, const float*
  * 
  * @return              0 on success, -1 on failure.
  */
-int save_int_hdf5(const char* filename, const char* dataset_name, const int* data, int n, int d);
+int save_int_hdf5(const char* filename, const char* dataset_name, const int* data, size_t n, int d);
+
+
+/**
+ * Save neighbor ids to an HDF5 file (stored as `knn_idx_t`, i.e. 64-bit integers unless built with `IDX32=1`).
+ * 
+ * @param filename      Path to the HDF5 file to create or overwrite.
+ * @param dataset_name  Name of the dataset within the HDF5 file to save.
+ * @param data          Pointer to the ids to save, organized as a 1D-array.
+ * @param n             Number of rows in the dataset.
+ * @param d             Dimensionality (number of columns) of each row in the dataset.
+ * 
+ * @return              0 on success, -1 on failure.
+ */
+int save_idx_hdf5(const char* filename, const char* dataset_name, const knn_idx_t* data, size_t n, int d);
 
 #endif // DATA_IO_H
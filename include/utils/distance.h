@@ -4,6 +4,16 @@
 #include <cblas.h>    //sudo apt-get install libopenblas-dev
 #include <math.h>
 #include <stdlib.h>
+#include <limits.h>
+#include "../../include/utils/knn_stats.h"
+#include "../../include/utils/knn_types.h"
+
+// Largest size (and leading dimension) of one `cblas_sgemm` call, whose integer arguments are int
+#define KNN_BLAS_MAX_DIM ((size_t)INT_MAX)
+
+// Candidates beyond the k nearest that a GEMM-based selection passes to `distance_rerank`: the GEMM rounds the
+// distances differently with its blocking, so a neighbor may be ranked a few places off
+#define KNN_RERANK_MARGIN 4
 
 /**
  * Computes the squared Euclidean distances between each pair of rows from two matrices (`corpus` and `query`) 
@@ -18,6 +28,35 @@
  * 
  * @return              None (results are stored in the pre-allocated matrix D)
  */
-void distance_square_matrix(const float* corpus, const float* query, float* D, int corpus_length, int query_length, int d);
+void distance_square_matrix(const float* corpus, const float* query, float* D, size_t corpus_length, size_t query_length, int d);
+
+/**
+ * Squared Euclidean distance of two rows, accumulated in double precision and rounded to float. This is the
+ * distance of the results of the exact searches: unlike the GEMM-based distances, it does not depend on how the
+ * corpus and the queries are tiled.
+ *
+ * @param a             Pointer to the first row
+ * @param b             Pointer to the second row
+ * @param d             Dimensionality of the rows
+ *
+ * @return              The squared distance
+ */
+float distance_square_exact(const float* a, const float* b, int d);
+
+/**
+ * Re-rank the candidate neighbors of a query: recompute their distances with `distance_square_exact` and sort
+ * them nearest first (neighbors at equal distances are ordered by id). The k nearest candidates of a GEMM-based
+ * selection of k + `KNN_RERANK_MARGIN` are then the same for every tiling of the search.
+ *
+ * @param corpus        Pointer to the corpus matrix
+ * @param query         Pointer to the query row
+ * @param d             Dimensionality of each data point
+ * @param ids           Ids of the candidates (sorted in place)
+ * @param distances     Array (length `candidates`) to store their Euclidean distances
+ * @param candidates    Number of candidates
+ *
+ * @return              None
+ */
+void distance_rerank(const float* corpus, const float* query, int d, knn_idx_t* ids, float* distances, int candidates);
 
 #endif // DISTANCE_H
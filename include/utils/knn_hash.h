@@ -0,0 +1,36 @@
+#ifndef KNN_HASH_H
+#define KNN_HASH_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+// The data is hashed in chunks of this size and the chunk hashes are combined in order,
+// so the hash does not depend on the number of threads.
+#define KNN_HASH_CHUNK (1 << 20)
+
+/**
+ * 64-bit content hash of a buffer (not cryptographic), computed in parallel over fixed-size chunks.
+ *
+ * @param data              Pointer to the data
+ * @param bytes             Size of the data in bytes
+ * @param num_of_threads    Number of threads (<= 0 to use all the online cores)
+ *
+ * @return                  Hash of the data
+ */
+uint64_t knn_hash_bytes(const void* data, size_t bytes, int num_of_threads);
+
+/**
+ * Combine a hash with a 64-bit value (e.g. the dimensions of a matrix or k).
+ *
+ * @param hash              Hash so far
+ * @param value             Value to add
+ *
+ * @return                  Combined hash
+ */
+uint64_t knn_hash_combine(uint64_t hash, uint64_t value);
+
+#endif // KNN_HASH_H
@@ -0,0 +1,88 @@
+#ifndef KNN_HEAP_H
+#define KNN_HEAP_H
+
+#include <math.h>
+#include "../../include/utils/knn_types.h"
+
+// Bounded max-heap of the k nearest candidates of a query (the farthest candidate at the root), used by the
+// index-based exact searches. Candidates at equal distances are ordered by id, like the brute-force selection.
+
+/**
+ * Check if the candidate (dist_a, id_a) is farther than (dist_b, id_b).
+ *
+ * @return                  1 if `a` is farther, 0 otherwise
+ */
+static inline int knn_heap_farther(float dist_a, knn_idx_t id_a, float dist_b, knn_idx_t id_b) {
+    return (dist_a > dist_b) || (dist_a == dist_b && id_a > id_b);
+}
+
+static inline void knn_heap_sift_down(float* dist, knn_idx_t* ids, int size, int i) {
+    while (1) {
+        int l = 2 * i + 1, r = l + 1, top = i;
+        if (l < size && knn_heap_farther(dist[l], ids[l], dist[top], ids[top])) { top = l; }
+        if (r < size && knn_heap_farther(dist[r], ids[r], dist[top], ids[top])) { top = r; }
+        if (top == i) { return; }
+        float     td = dist[i]; dist[i] = dist[top]; dist[top] = td;
+        knn_idx_t ti = ids[i];  ids[i]  = ids[top];  ids[top]  = ti;
+        i = top;
+    }
+}
+
+/**
+ * Add a candidate to the heap of a query, if it is nearer than the farthest of the k candidates so far.
+ *
+ * @param dist              Distances of the heap (length k)
+ * @param ids               Ids of the heap (length k)
+ * @param size              Pointer to the number of candidates in the heap (0 for an empty heap)
+ * @param k                 Capacity of the heap
+ * @param candidate         Distance of the candidate
+ * @param id                Id of the candidate
+ *
+ * @return                  None
+ */
+static inline void knn_heap_push(float* dist, knn_idx_t* ids, int* size, int k, float candidate, knn_idx_t id) {
+    if (*size < k) {
+        int i = (*size)++;
+        while (i > 0) {
+            int parent = (i - 1) / 2;
+            if (!knn_heap_farther(candidate, id, dist[parent], ids[parent])) { break; }
+            dist[i] = dist[parent];
+            ids[i]  = ids[parent];
+            i = parent;
+        }
+        dist[i] = candidate;
+        ids[i]  = id;
+    } else if (knn_heap_farther(dist[0], ids[0], candidate, id)) {
+        dist[0] = candidate;
+        ids[0]  = id;
+        knn_heap_sift_down(dist, ids, k, 0);
+    }
+}
+
+/**
+ * Distance bound of the heap: a candidate farther than this cannot enter it.
+ *
+ * @return                  The distance of the farthest candidate, or INFINITY if the heap has less than k candidates
+ */
+static inline float knn_heap_bound(const float* dist, int size, int k) {
+    return (size < k) ? INFINITY : dist[0];
+}
+
+/**
+ * Sort a heap in place, nearest candidate first (the heap is no longer valid).
+ *
+ * @param dist              Distances of the heap
+ * @param ids               Ids of the heap
+ * @param size              Number of candidates in the heap
+ *
+ * @return                  None
+ */
+static inline void knn_heap_sort(float* dist, knn_idx_t* ids, int size) {
+    for (int last = size - 1; last > 0; last--) {
+        float     td = dist[0]; dist[0] = dist[last]; dist[last] = td;
+        knn_idx_t ti = ids[0];  ids[0]  = ids[last];  ids[last]  = ti;
+        knn_heap_sift_down(dist, ids, last, 0);
+    }
+}
+
+#endif // KNN_HEAP_H
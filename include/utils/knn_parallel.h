@@ -0,0 +1,35 @@
+#ifndef KNN_PARALLEL_H
+#define KNN_PARALLEL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+// A function over the items [start, end) of a problem, run by the worker `t`
+typedef void (*knn_range_fn)(void* ctx, int t, size_t start, size_t end);
+
+/**
+ * Number of threads to run: `num_of_threads`, or all the online cores if it is <= 0.
+ *
+ * @param num_of_threads    Requested number of threads (<= 0 to use all the online cores)
+ *
+ * @return                  Number of threads (at least 1)
+ */
+int knn_resolve_threads(int num_of_threads);
+
+/**
+ * Run `fn` over [0, items) split in `num_of_threads` contiguous ranges, one pthread per range (the last range
+ * runs on the calling thread, and so does a range whose thread could not be created). The worker `t` gets
+ * the items [items x t / threads, items x (t + 1) / threads).
+ *
+ * @param fn                Function of a range
+ * @param ctx               Context passed to every call of `fn`
+ * @param items             Number of items
+ * @param num_of_threads    Number of ranges (at most `items`, <= 0 to use all the online cores)
+ *
+ * @return                  0 on success, -1 on failure (then `fn` did not run)
+ */
+int knn_parallel_ranges(knn_range_fn fn, void* ctx, size_t items, int num_of_threads);
+
+#endif // KNN_PARALLEL_H
@@ -0,0 +1,80 @@
+#ifndef KNN_PROFILE_H
+#define KNN_PROFILE_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <gsl/gsl_sort_float.h>  // sudo apt-get install libgsl-dev
+#include "../../include/utils/blas_threads.h"
+
+// Default path of the profile file (it can be changed with the `KNN_PROFILE_PATH` environment variable).
+#define KNN_PROFILE_PATH "results/knn_profile.txt"
+
+// Increase it whenever the fields of `knn_profile_t` change, so that old profile files are re-calibrated.
+#define KNN_PROFILE_VERSION 1
+
+// Measured costs of the building blocks of the exact k-NN on this host.
+typedef struct {
+    int     version;
+    int     cores;                  // Online cores when the profile was calibrated
+    double  gemm_gflops_thin;       // Single-threaded BLAS, thin GEMM (8 query rows)
+    double  gemm_gflops_fat;        // Single-threaded BLAS, fat GEMM (256 query rows)
+    double  gemm_gflops_thin_multi; // Multi-threaded BLAS (all cores), thin GEMM
+    double  gemm_gflops_fat_multi;  // Multi-threaded BLAS (all cores), fat GEMM
+    double  select_ns_base;         // Selection cost per distance: `select_ns_base + select_ns_per_k * k`
+    double  select_ns_per_k;
+    double  copy_ns;                // Cost per float of a streaming pass (norms addition, memcpy, merge)
+    double  spawn_us;               // Cost to create and join one thread
+} knn_profile_t;
+
+/**
+ * Run a short micro-benchmark (well below a second) to measure the GEMM, selection, copy and
+ * thread creation costs on this host.
+ *
+ * @param profile   Pointer to the profile to fill
+ *
+ * @return          0 on success, -1 on failure (memory allocation)
+ */
+int knn_profile_calibrate(knn_profile_t* profile);
+
+/**
+ * Fill a profile with conservative defaults, for when the calibration is not possible.
+ *
+ * @param profile   Pointer to the profile to fill
+ *
+ * @return          None
+ */
+void knn_profile_defaults(knn_profile_t* profile);
+
+/**
+ * Load a profile from a text file.
+ *
+ * @param filename  Path to the profile file
+ * @param profile   Pointer to the profile to fill
+ *
+ * @return          0 on success, -1 if the file does not exist, is incomplete or has an other version
+ */
+int knn_profile_load(const char* filename, knn_profile_t* profile);
+
+/**
+ * Save a profile to a text file.
+ *
+ * @param filename  Path to the profile file to create or overwrite
+ * @param profile   Pointer to the profile to save
+ *
+ * @return          0 on success, -1 on failure
+ */
+int knn_profile_save(const char* filename, const knn_profile_t* profile);
+
+/**
+ * Get the profile of this host: it is loaded from `KNN_PROFILE_PATH` (or `$KNN_PROFILE_PATH`) and, if there is
+ * no valid profile file yet, it is calibrated once and saved there. The result is cached for the whole process.
+ *
+ * @return          Pointer to the (process-wide) profile
+ */
+const knn_profile_t* knn_profile_get(void);
+
+#endif // KNN_PROFILE_H
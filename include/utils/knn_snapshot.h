@@ -0,0 +1,123 @@
+#ifndef KNN_SNAPSHOT_H
+#define KNN_SNAPSHOT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Snapshot files keep built structures (ball trees, pivot indexes, projections) across runs:
+//
+//   header (64 bytes) | section table (32 bytes per section) | section 0 | section 1 | ...
+//
+// Every section starts at a multiple of `KNN_SNAPSHOT_ALIGN` bytes, so a loaded snapshot maps the file and
+// the structures point straight into the mapping (no parsing or copy). The header and every section carry
+// a CRC-32. The data is in the byte order of the host that wrote it, so the files are not portable between
+// big- and little-endian hosts (the header detects it).
+
+#define KNN_SNAPSHOT_MAGIC      "KNNSNAP"
+
+// Increase it whenever the layout of the header, of the table or of a section changes
+#define KNN_SNAPSHOT_VERSION    1
+
+#define KNN_SNAPSHOT_ALIGN      64
+
+// Section types (a snapshot has at most one section of every type)
+typedef enum {
+    KNN_SNAPSHOT_META = 1,          // Parameters of the structure (struct defined by its module)
+    KNN_SNAPSHOT_TREE_NODES,
+    KNN_SNAPSHOT_TREE_CENTERS,
+    KNN_SNAPSHOT_TREE_POINTS,
+    KNN_SNAPSHOT_TREE_IDS,
+    KNN_SNAPSHOT_PIVOT_PIVOTS,
+    KNN_SNAPSHOT_PIVOT_ORDER,
+    KNN_SNAPSHOT_PIVOT_BOUNDS,
+    KNN_SNAPSHOT_PIVOT_NORMS,
+    KNN_SNAPSHOT_PROJECTION_BASIS,
+    KNN_SNAPSHOT_PROJECTION_CORPUS
+} knn_snapshot_type_t;
+
+// Kinds of structures (the `kind` of the header), so a file is never loaded as another structure
+typedef enum {
+    KNN_SNAPSHOT_KIND_TREE = 1,
+    KNN_SNAPSHOT_KIND_PIVOT,
+    KNN_SNAPSHOT_KIND_PROJECTION
+} knn_snapshot_kind_t;
+
+// Section to write
+typedef struct {
+    uint32_t        type;
+    const void*     data;
+    size_t          bytes;
+} knn_snapshot_section_t;
+
+// Snapshot mapped in memory
+typedef struct {
+    void*           mapping;
+    size_t          bytes;
+    uint32_t        kind;
+    uint32_t        num_sections;
+    const void*     table;          // Section table inside the mapping
+} knn_snapshot_t;
+
+/**
+ * CRC-32 (the polynomial of zlib and PNG) of a buffer.
+ *
+ * @param crc               CRC of the previous data (0 for the first buffer)
+ * @param data              Pointer to the data
+ * @param bytes             Size of the data in bytes
+ *
+ * @return                  CRC of the previous data followed by this buffer
+ */
+uint32_t knn_crc32(uint32_t crc, const void* data, size_t bytes);
+
+/**
+ * Write a snapshot. The file is written next to `filename` and renamed at the end, so a reader never sees
+ * a partial snapshot.
+ *
+ * @param filename          Path of the snapshot file
+ * @param kind              Kind of the structure (`knn_snapshot_kind_t`)
+ * @param sections          Sections to write
+ * @param num_sections      Number of sections
+ *
+ * @return                  0 on success, -1 on failure (after printing the reason to stderr)
+ */
+int knn_snapshot_save(const char* filename, uint32_t kind, const knn_snapshot_section_t* sections, int num_sections);
+
+/**
+ * Map a snapshot file (read-only) and validate its header, its section table and, if `verify` is set,
+ * the CRC-32 of every section.
+ *
+ * @param filename          Path of the snapshot file
+ * @param kind              Expected kind of the structure
+ * @param verify            1 to check the CRC of the sections (it reads the whole file), 0 to map it lazily
+ *
+ * @return                  Pointer to the snapshot, or NULL on failure. Close it with `knn_snapshot_close`.
+ */
+knn_snapshot_t* knn_snapshot_open(const char* filename, uint32_t kind, int verify);
+
+/**
+ * Get a section of a snapshot.
+ *
+ * @param snapshot          Snapshot
+ * @param type              Section type
+ * @param bytes             Expected size of the section in bytes
+ *
+ * @return                  Pointer to the section inside the mapping, or NULL if it is missing or its size differs
+ */
+const void* knn_snapshot_section(const knn_snapshot_t* snapshot, uint32_t type, size_t bytes);
+
+/**
+ * Unmap a snapshot. The structures that point into it must not be used afterwards.
+ *
+ * @param snapshot          Snapshot (NULL is ignored)
+ *
+ * @return                  None
+ */
+void knn_snapshot_close(knn_snapshot_t* snapshot);
+
+#endif // KNN_SNAPSHOT_H
@@ -0,0 +1,125 @@
+#ifndef KNN_STATS_H
+#define KNN_STATS_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+// - If KNN_STATS == 0: the instrumentation macros below expand to nothing (no overhead at all).
+// - If KNN_STATS == 1: every thread accumulates the time, the bytes moved and the calls of each phase
+//   of the search. Build with `make -f Makefile.gcc STATS=1` to enable it.
+#ifndef KNN_STATS
+#define KNN_STATS 0
+#endif
+
+// The phases of the exact k-NN search
+typedef enum {
+    KNN_PHASE_GEMM = 0,     // -2 * Q * C^T (cblas_sgemm)
+    KNN_PHASE_NORMS,        // Squared norms of the query and corpus rows
+    KNN_PHASE_NORM_ADD,     // D += query_norms + corpus_norms
+    KNN_PHASE_COPY,         // memcpy of a distance row into `tmp_distances`
+    KNN_PHASE_SELECT,       // GSL selection of the k smallest distances
+    KNN_PHASE_WRITEBACK,    // sqrt and write of the k-NN into `indices` and `distances`
+    KNN_PHASE_MERGE,        // Merging of sorted k-NN lists (corpus tiles, approximate parts)
+    KNN_NUM_PHASES
+} knn_phase_t;
+
+typedef struct {
+    double      seconds;        // Sum over all the threads
+    double      max_seconds;    // Maximum of a single thread (critical path estimation)
+    uint64_t    bytes;          // Bytes read and written
+    uint64_t    calls;
+} knn_phase_stats_t;
+
+typedef struct {
+    knn_phase_stats_t   phase[KNN_NUM_PHASES];
+    int                 threads;    // Threads which recorded at least one phase
+} knn_stats_t;
+
+#if KNN_STATS
+#define KNN_STATS_BEGIN(phase)          uint64_t knn_stats_start_##phase = knn_stats_now()
+#define KNN_STATS_END(phase, bytes)     knn_stats_add((phase), knn_stats_now() - knn_stats_start_##phase, (uint64_t)(bytes))
+#else
+#define KNN_STATS_BEGIN(phase)
+#define KNN_STATS_END(phase, bytes)
+#endif
+
+/**
+ * Monotonic time in nanoseconds.
+ *
+ * @return          Current time in nanoseconds
+ */
+static inline uint64_t knn_stats_now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+/**
+ * Add a measurement to the counters of the calling thread (use the `KNN_STATS_*` macros instead).
+ *
+ * @param phase     Phase of the measurement
+ * @param ns        Elapsed time in nanoseconds
+ * @param bytes     Bytes read and written
+ *
+ * @return          None
+ */
+void knn_stats_add(knn_phase_t phase, uint64_t ns, uint64_t bytes);
+
+/**
+ * Check if the instrumentation has been compiled in.
+ *
+ * @return          KNN_STATS
+ */
+int knn_stats_enabled(void);
+
+/**
+ * Zero the counters of all the threads. Call it between searches (not while a search runs).
+ *
+ * @return          None
+ */
+void knn_stats_reset(void);
+
+/**
+ * Collect the counters of all the threads (including the threads that have already exited).
+ *
+ * @param stats     Pointer to the stats to fill
+ *
+ * @return          None
+ */
+void knn_stats_snapshot(knn_stats_t* stats);
+
+/**
+ * Print the stats as a table (one line per phase).
+ *
+ * @param file      Output stream (e.g. stdout)
+ * @param stats     Stats to print
+ *
+ * @return          None
+ */
+void knn_stats_print(FILE* file, const knn_stats_t* stats);
+
+/**
+ * Save the stats in an HDF5 file, as a `phase_stats` dataset of `KNN_NUM_PHASES x 4` floats
+ * (seconds, max seconds of a thread, bytes, calls), next to the k-NN results.
+ *
+ * @param filename  Path to the HDF5 file
+ * @param stats     Stats to save
+ *
+ * @return          0 on success, -1 on failure
+ */
+int knn_stats_save_hdf5(const char* filename, const knn_stats_t* stats);
+
+/**
+ * Get a printable name of a phase.
+ *
+ * @param phase     Phase
+ *
+ * @return          Constant string with the name of the phase
+ */
+const char* knn_phase_name(knn_phase_t phase);
+
+#endif // KNN_STATS_H
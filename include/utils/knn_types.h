@@ -0,0 +1,48 @@
+#ifndef KNN_TYPES_H
+#define KNN_TYPES_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// Type of the neighbor ids in the results. The ids are 64-bit by default; build with `IDX32=1` (`-DKNN_INDEX_32=1`)
+// to halve the memory of the `indices` arrays when the corpus has less than 2^31 rows.
+#ifndef KNN_INDEX_32
+#define KNN_INDEX_32 0
+#endif
+
+#if KNN_INDEX_32
+typedef int32_t knn_idx_t;
+#define KNN_IDX_MAX INT32_MAX
+#else
+typedef int64_t knn_idx_t;
+#define KNN_IDX_MAX INT64_MAX
+#endif
+
+/**
+ * Check the extents of a k-NN problem before any memory is touched: k must be in [1, corpus_length],
+ * d must be positive and the corpus ids must fit in `knn_idx_t`.
+ *
+ * @param caller            Name of the calling function (for the error message)
+ * @param corpus_length     Number of rows (data points) in the corpus
+ * @param d                 Dimensionality of each data point
+ * @param k                 Number of nearest neighbors to find
+ *
+ * @return                  0 if the problem is valid, -1 otherwise (after printing the reason to stderr)
+ */
+static inline int knn_check_extents(const char* caller, size_t corpus_length, int d, int k) {
+    if (d <= 0 || k <= 0 || (size_t)k > corpus_length) {
+        fprintf(stderr, "%s: Invalid extents: corpus_length = %zu, d = %d, k = %d\n", caller, corpus_length, d, k);
+        return -1;
+    }
+#if KNN_INDEX_32
+    if (corpus_length - 1 > (size_t)KNN_IDX_MAX) {
+        fprintf(stderr, "%s: The corpus has %zu rows, which do not fit in 32-bit ids (rebuild without IDX32=1)\n",
+                caller, corpus_length);
+        return -1;
+    }
+#endif
+    return 0;
+}
+
+#endif // KNN_TYPES_H
@@ -0,0 +1,143 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "../../include/utils/knn_stats.h"
+
+// - If KNN_PERF == 0: the counter macros below expand to nothing.
+// - If KNN_PERF == 1: every thread reads its hardware counters (perf_event_open) around the distance, selection
+//   and merge phases. Build with `make -f Makefile.gcc PERF=1` to enable it. If the kernel does not permit the
+//   counters (see /proc/sys/kernel/perf_event_paranoid) or the CPU does not expose them, they are reported as n/a.
+#ifndef KNN_PERF
+#define KNN_PERF 0
+#endif
+
+// Bytes moved from memory per last level cache miss (used for the bandwidth proxy)
+#define KNN_PERF_CACHE_LINE 64
+
+// The phases that the counters bracket
+typedef enum {
+    KNN_PERF_DISTANCE = 0,      // distance_square_matrix (GEMM, norms)
+    KNN_PERF_SELECTION,         // Copy, selection and write-back of the k-NN of every query
+    KNN_PERF_MERGE,             // Merging/write-back of partial k-NN lists
+    KNN_PERF_NUM_PHASES
+} knn_perf_phase_t;
+
+// The hardware events that are counted
+typedef enum {
+    KNN_PERF_CYCLES = 0,
+    KNN_PERF_INSTRUCTIONS,
+    KNN_PERF_CACHE_REFERENCES,  // Last level cache references
+    KNN_PERF_CACHE_MISSES,      // Last level cache misses
+    KNN_PERF_NUM_EVENTS
+} knn_perf_event_t;
+
+typedef struct {
+    uint64_t    count[KNN_PERF_NUM_PHASES][KNN_PERF_NUM_EVENTS];   // Sum over all the threads
+    double      seconds[KNN_PERF_NUM_PHASES];                       // Thread-seconds of each phase
+    int         available[KNN_PERF_NUM_EVENTS];                     // 1 if the event could be counted
+    int         threads;                                            // Threads which recorded at least one phase
+} knn_perf_t;
+
+#if KNN_PERF
+#define KNN_PERF_BEGIN(phase)   knn_perf_begin(phase)
+#define KNN_PERF_END(phase)     knn_perf_end(phase)
+#else
+#define KNN_PERF_BEGIN(phase)
+#define KNN_PERF_END(phase)
+#endif
+
+/**
+ * Start counting a phase on the calling thread (use the `KNN_PERF_*` macros instead).
+ * The counters of a thread are opened on its first call.
+ *
+ * @param phase     Phase to start
+ *
+ * @return          None
+ */
+void knn_perf_begin(knn_perf_phase_t phase);
+
+/**
+ * Stop counting a phase on the calling thread and add the counts (use the `KNN_PERF_*` macros instead).
+ *
+ * @param phase     Phase to stop
+ *
+ * @return          None
+ */
+void knn_perf_end(knn_perf_phase_t phase);
+
+/**
+ * Check if the counters have been compiled in.
+ *
+ * @return          KNN_PERF
+ */
+int knn_perf_enabled(void);
+
+/**
+ * Zero the counts of all the threads. Call it between searches (not while a search runs).
+ *
+ * @return          None
+ */
+void knn_perf_reset(void);
+
+/**
+ * Collect the counts of all the threads (including the threads that have already exited).
+ *
+ * @param perf      Pointer to the counts to fill
+ *
+ * @return          None
+ */
+void knn_perf_snapshot(knn_perf_t* perf);
+
+/**
+ * Instructions per cycle of a phase.
+ *
+ * @param perf      Counts (see `knn_perf_snapshot`)
+ * @param phase     Phase, or -1 for all the phases
+ *
+ * @return          IPC, or -1 if the cycles/instructions are not available
+ */
+double knn_perf_ipc(const knn_perf_t* perf, int phase);
+
+/**
+ * Last level cache misses per query.
+ *
+ * @param perf      Counts (see `knn_perf_snapshot`)
+ * @param phase     Phase, or -1 for all the phases
+ * @param queries   Number of queries of the measured searches
+ *
+ * @return          Misses per query, or -1 if the misses are not available
+ */
+double knn_perf_misses_per_query(const knn_perf_t* perf, int phase, long queries);
+
+/**
+ * Print the counts, the IPC, the misses per query and the memory bandwidth proxy
+ * (misses x cache line / thread-seconds) of every phase.
+ *
+ * @param file      Output stream (e.g. stdout)
+ * @param perf      Counts to print
+ * @param queries   Number of queries of the measured searches
+ *
+ * @return          None
+ */
+void knn_perf_print(FILE* file, const knn_perf_t* perf, long queries);
+
+/**
+ * Get a printable name of a phase.
+ *
+ * @param phase     Phase
+ *
+ * @return          Constant string with the name of the phase
+ */
+const char* knn_perf_phase_name(knn_perf_phase_t phase);
+
+#endif // PERF_COUNTERS_H
@@ -0,0 +1,195 @@
+# Julia bindings of libfastknn (`make -f Makefile.gcc lib`, see include/fastknn.h).
+#
+# The C engines read row-major `n x d` matrices, which have exactly the memory layout of a column-major Julia
+# `d x n` matrix. So the points are the COLUMNS of a `Matrix{Float32}` (the convention of the Julia packages, and
+# the layout of an HDF5 dataset written by the C code and read with HDF5.jl) and they are passed without copying.
+# A transposed `d x n` matrix (`transpose(X)` or `X'`, an `n x d` view whose rows are the points) is passed as its
+# parent, also without copying. Any other matrix is converted to a `d x n` `Matrix{Float32}` first.
+#
+# The results are `k x m` matrices (the neighbors of the query j are the column j, nearest first), written by
+# the C code directly into Julia arrays, with 1-based ids.
+module FastKNN
+
+using Libdl
+using LinearAlgebra
+
+export KNNIndex, FastKNNError, knn, allknn
+
+# Major version of include/fastknn.h that these bindings follow
+const FASTKNN_VERSION_MAJOR = 1
+
+const LIBFASTKNN = Ref{Ptr{Cvoid}}(C_NULL)
+
+# Index types of `fastknn_index_type_t`
+const INDEX_TYPES = Dict(:auto => 0, :brute_force => 1, :pivot => 2, :tree => 3)
+
+# Mirror of `fastknn_index_options_t`
+struct IndexOptions
+    struct_size::Csize_t
+    type::Cint
+    num_threads::Cint
+    copy_corpus::Cint
+    memory_budget::Csize_t
+    num_pivots::Cint
+    leaf_rows::Csize_t
+    profile_path::Ptr{UInt8}
+    snapshot_path::Ptr{UInt8}
+end
+
+
+# Loads libfastknn from `$FASTKNN_LIB`, or from the root of the repository, and checks its major version.
+function __init__()
+    path = get(ENV, "FASTKNN_LIB", joinpath(@__DIR__, "..", "..", "..", "libfastknn.so"))
+    LIBFASTKNN[] = Libdl.dlopen(path)
+
+    major = Ref{Cint}(0)
+    ccall(sym(:fastknn_version), Cvoid, (Ref{Cint}, Ptr{Cint}, Ptr{Cint}), major, C_NULL, C_NULL)
+    if major[] != FASTKNN_VERSION_MAJOR
+        error("FastKNN: $path has version $(major[]), the bindings need version $FASTKNN_VERSION_MAJOR")
+    end
+end
+
+sym(name::Symbol) = Libdl.dlsym(LIBFASTKNN[], name)
+
+
+# Error of a libfastknn call: the `fastknn_status_t` and the message of `fastknn_last_error`.
+struct FastKNNError <: Exception
+    status::Int
+    message::String
+end
+
+Base.showerror(io::IO, e::FastKNNError) = print(io, "FastKNNError(", e.status, "): ", e.message)
+
+function check(status::Cint)
+    status == 0 && return nothing
+    throw(FastKNNError(status, unsafe_string(ccall(sym(:fastknn_last_error), Cstring, ()))))
+end
+
+
+# Returns the `d x n` Float32 buffer of the points (the same memory whenever the layout allows it).
+# `points`  Matrix with the points as columns, or a transposed matrix with the points as rows.
+points_buffer(points::Matrix{Float32}) = points
+points_buffer(points::Union{Transpose{Float32, Matrix{Float32}}, Adjoint{Float32, Matrix{Float32}}}) = parent(points)
+points_buffer(points::AbstractMatrix{<:Real}) = Matrix{Float32}(points)
+
+
+# Index of a corpus. The C index references the corpus buffer, which the index keeps alive; the corpus must
+# not be modified while the index is in use. The C index is freed by `close` or by the garbage collector.
+# `points`         Corpus, see `points_buffer`.
+# `type`           `:auto` (ball tree for d <= 20, brute force otherwise), `:brute_force`, `:pivot` or `:tree`.
+# `threads`        Number of threads (0 for all the online cores).
+# `memory_budget`  Bytes that a search may use (0 for the usable memory).
+# `num_pivots`     Number of pivots of `:pivot` (0 for the default).
+# `leaf_rows`      Rows per tree leaf / pivot block (0 for the default).
+# `snapshot`       Snapshot file of a `:pivot` or `:tree` index: loaded if it matches the corpus, else written.
+mutable struct KNNIndex
+    handle::Ptr{Cvoid}
+    points::Matrix{Float32}
+
+    function KNNIndex(points::AbstractMatrix; type::Symbol = :auto, threads::Integer = 0, memory_budget::Integer = 0,
+                      num_pivots::Integer = 0, leaf_rows::Integer = 0,
+                      snapshot::Union{Nothing, AbstractString} = nothing)
+        haskey(INDEX_TYPES, type) || throw(ArgumentError("FastKNN: Unknown index type $type"))
+        buffer = points_buffer(points)
+        d, n = size(buffer)
+
+        path = snapshot === nothing ? "" : String(snapshot)
+        handle = Ref{Ptr{Cvoid}}(C_NULL)
+        GC.@preserve path begin
+            options = IndexOptions(sizeof(IndexOptions), INDEX_TYPES[type], threads, 0, memory_budget, num_pivots,
+                                   leaf_rows, C_NULL, snapshot === nothing ? C_NULL : pointer(path))
+            check(ccall(sym(:fastknn_index_create), Cint,
+                        (Ptr{Float32}, Csize_t, Cint, Ref{IndexOptions}, Ref{Ptr{Cvoid}}),
+                        buffer, n, d, options, handle))
+        end
+
+        index = new(handle[], buffer)
+        finalizer(close, index)
+        return index
+    end
+end
+
+function Base.close(index::KNNIndex)
+    if index.handle != C_NULL
+        ccall(sym(:fastknn_index_destroy), Cvoid, (Ptr{Cvoid},), index.handle)
+        index.handle = C_NULL
+    end
+    return nothing
+end
+
+# (d, n) of the corpus
+Base.size(index::KNNIndex) = size(index.points)
+
+
+# Exact k-nearest neighbors of the queries in the corpus of an index.
+# `index`    Index of the corpus.
+# `queries`  Queries, in the layout of the corpus (see `points_buffer`).
+# `k`        Number of nearest neighbors to find.
+# `allowed`  Optional `Bool` vector of the corpus points that may be returned (filtered search); if fewer than k
+#            points are allowed, the last ids of every query are 0 at distance `Inf32`.
+# Returns:
+#  - `k x m` matrix of 1-based corpus ids (column j: the neighbors of the query j, nearest first).
+#  - `k x m` matrix of the Euclidean distances.
+function knn(index::KNNIndex, queries::AbstractMatrix, k::Integer;
+             allowed::Union{Nothing, AbstractVector{Bool}} = nothing)
+    buffer = points_buffer(queries)
+    d, m = size(buffer)
+    d == size(index.points, 1) || throw(DimensionMismatch("FastKNN: The queries have d = $d, the corpus has d = $(size(index.points, 1))"))
+
+    ids = Matrix{Int64}(undef, k, m)
+    distances = Matrix{Float32}(undef, k, m)
+    if allowed === nothing
+        GC.@preserve index begin
+            check(ccall(sym(:fastknn_index_search), Cint,
+                        (Ptr{Cvoid}, Ptr{Float32}, Csize_t, Cint, Ptr{Int64}, Ptr{Float32}),
+                        index.handle, buffer, m, k, ids, distances))
+        end
+    else
+        n = size(index.points, 2)
+        length(allowed) == n || throw(DimensionMismatch("FastKNN: The filter has $(length(allowed)) points, the corpus has $n"))
+        bitmap = zeros(UInt64, cld(n, 64))
+        for (i, ok) in enumerate(allowed)
+            ok && (bitmap[(i - 1) >> 6 + 1] |= UInt64(1) << ((i - 1) & 63))
+        end
+        GC.@preserve index begin
+            check(ccall(sym(:fastknn_index_search_filtered), Cint,
+                        (Ptr{Cvoid}, Ptr{Float32}, Csize_t, Cint, Ptr{UInt64}, Ptr{Int64}, Ptr{Float32}),
+                        index.handle, buffer, m, k, bitmap, ids, distances))
+        end
+    end
+    ids .+= 1
+    return ids, distances
+end
+
+# Same as above, with a temporary index of the corpus (`allowed` as above, the other keywords as in `KNNIndex`).
+function knn(points::AbstractMatrix, queries::AbstractMatrix, k::Integer;
+             allowed::Union{Nothing, AbstractVector{Bool}} = nothing, kwargs...)
+    index = KNNIndex(points; kwargs...)
+    try
+        return knn(index, queries, k; allowed = allowed)
+    finally
+        close(index)
+    end
+end
+
+
+# All-to-all k-nearest neighbors of the corpus of an index (every point is its own nearest neighbor).
+# `index`     Index of the corpus.
+# `k`         Number of nearest neighbors to find.
+# `accuracy`  Accuracy level in [1, 100): approximate search, 100: exact search.
+# Returns:
+#  - `k x n` matrix of 1-based corpus ids and `k x n` matrix of the Euclidean distances.
+function allknn(index::KNNIndex, k::Integer; accuracy::Integer = 100)
+    n = size(index.points, 2)
+    ids = Matrix{Int64}(undef, k, n)
+    distances = Matrix{Float32}(undef, k, n)
+    GC.@preserve index begin
+        check(ccall(sym(:fastknn_index_all_knn), Cint,
+                    (Ptr{Cvoid}, Cint, Cint, Ptr{Int64}, Ptr{Float32}),
+                    index.handle, k, accuracy, ids, distances))
+    end
+    ids .+= 1
+    return ids, distances
+end
+
+end # module
@@ -9,12 +9,14 @@
 # Ex: ./run_knn.sh 0 4 data/sift-128-euclidean.hdf5 train test 100 data/sift-128-euclidean.hdf5 neighbors distances
 # Ex: ./run_knn.sh 1 4 null null null 100
 # Ex: ./run_knn.sh 2 5 null null null 100
+# Ex: ./run_knn.sh 4 4 null null null 10
 
 #  0 - Run all the *exact* knn functions and evaluate/compare the results based on the given dataset
 #  1 - Run all the *approx* knn functions and evaluate/compare the results (based on the exact results of an exact knn)
 #      Keep in mind that the approximate solutions solve only the all-to-all k-NN problem in which C == Q
 #  2 - Random Data Test for knn_approx_pthread (Playground)
 #  3 - You can add your own custom tests here (we already have extra tests for the approximate methods using the sift-128-euclidean.hdf5 dataset)
+#  4 - Run the exact knn functions on a corpus with more than 2^31 floats (64-bit sizes and indices)
 
 # Check the number of arguments
 if [ "$#" -lt 6 ]; then
@@ -53,7 +55,7 @@ $COMMAND
 echo " "
 
 # Determine which executable to run
-if [[ "$METHOD" -eq 0 || "$METHOD" -eq 1 || "$METHOD" -eq 3 ]]; then
+if [[ "$METHOD" -eq 0 || "$METHOD" -eq 1 || "$METHOD" -eq 3 || "$METHOD" -eq 4 ]]; then
     # Build project with Clang
     echo "Building Project with Makefile.clang..."
     make -f Makefile.clang clean
@@ -0,0 +1,635 @@
+#define FASTKNN_BUILD
+#include "../../include/fastknn.h"
+#include "../../include/api/fastknn_internal.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "../../include/exact/knn_search.h"
+#include "../../include/exact/knn_exact_pivot.h"
+#include "../../include/exact/knn_exact_tree.h"
+#include "../../include/exact/knn_exact_filtered.h"
+#include "../../include/approximate/knn_approx_serial.h"
+#include "../../include/utils/knn_profile.h"
+#include "../../include/utils/knn_types.h"
+#include "../../include/utils/mem_info.h"
+
+struct fastknn_index {
+    uint64_t                generation;     // Unique per index of the process (keys of the query caches)
+    size_t                  corpus_length;
+    int                     d;
+    fastknn_index_type_t    type;           // Never FASTKNN_INDEX_AUTO
+    int                     num_threads;
+    size_t                  memory_budget;
+    const float*            corpus;         // The caller's corpus, or `own_corpus`
+    float*                  own_corpus;
+    knn_pivot_index_t*      pivot;
+    knn_tree_t*             tree;
+    knn_profile_t           profile;        // Cost profile of the planner (FASTKNN_INDEX_BRUTE_FORCE)
+
+    // Search pool of the asynchronous API, started by the first `fastknn_submit`
+    pthread_mutex_t         pool_lock;      // Protects the pool, the queue and the progress of the tickets
+    pthread_cond_t          work_ready;     // A ticket was queued, or the pool is stopping
+    pthread_cond_t          ticket_done;    // A ticket completed
+    pthread_t*              workers;
+    int                     num_workers;
+    int                     stop;
+    fastknn_ticket_t*       queue_head;     // Tickets with tiles left to hand out, served round-robin
+    fastknn_ticket_t*       queue_tail;
+};
+
+struct fastknn_ticket {
+    fastknn_index_t*        index;
+    const float*            query;
+    size_t                  query_length;
+    int                     k;
+    fastknn_id_t*           indices;
+    float*                  distances;
+    size_t                  tile_rows;
+    fastknn_callback_t      callback;
+    void*                   user_data;
+    size_t                  next_row;       // First query of the next tile to hand out
+    size_t                  rows_done;      // Queries whose tile finished and whose callback returned
+    fastknn_status_t        status;         // First failure of a tile
+    char                    message[256];   // Its `fastknn_last_error` (set by the pool thread)
+    int                     complete;
+    fastknn_ticket_t*       next;           // Next ticket of the queue
+};
+
+// Generation of the last created index
+static uint64_t last_generation;
+
+// Message of the last failed call of every thread
+static __thread char last_error[256];
+
+// The planner profile of the library is calibrated in memory once per process: unlike `knn_profile_get`,
+// the library never reads or writes a profile file unless the caller gives its path
+static knn_profile_t   library_profile;
+static pthread_once_t  library_profile_once = PTHREAD_ONCE_INIT;
+
+static void library_profile_init(void) {
+    if (knn_profile_calibrate(&library_profile) != 0) {
+        knn_profile_defaults(&library_profile);
+    }
+}
+
+// Searches of the library may run concurrently and the OpenBLAS thread count is process-wide, so it is set once,
+// before the first index exists: single-threaded, the parallelism comes from the workers of every search
+static pthread_once_t  library_blas_once = PTHREAD_ONCE_INIT;
+
+static void library_blas_init(void) {
+    blas_pin_single_thread();
+}
+
+
+fastknn_status_t fastknn_fail(fastknn_status_t status, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    vsnprintf(last_error, sizeof(last_error), format, args);
+    va_end(args);
+    return status;
+}
+
+
+static fastknn_status_t api_check_k(const char* caller, const fastknn_index_t* index, int k, const void* indices, const float* distances) {
+    if (index == NULL) {
+        return fastknn_fail(FASTKNN_ERR_INVALID_ARGUMENT, "%s: The index is NULL", caller);
+    }
+    if (k <= 0 || (size_t)k > index->corpus_length) {
+        return fastknn_fail(FASTKNN_ERR_INVALID_ARGUMENT, "%s: k = %d is not in [1, %zu]", caller, k, index->corpus_length);
+    }
+    if (indices == NULL || distances == NULL) {
+        return fastknn_fail(FASTKNN_ERR_INVALID_ARGUMENT, "%s: The result buffers are NULL", caller);
+    }
+    return FASTKNN_OK;
+}
+
+
+// Exact search of the queries with the engine of the index, into engine-width ids
+static fastknn_status_t api_search(const fastknn_index_t* index, const float* query, size_t query_length, int k,
+                                   knn_idx_t* indices, float* distances, int num_threads, size_t memory_budget) {
+    switch (index->type) {
+        case FASTKNN_INDEX_PIVOT:
+            if (knn_pivot_search(index->pivot, query, k, indices, distances, query_length, num_threads, NULL) != 0) {
+                return fastknn_fail(FASTKNN_ERR_INTERNAL, "fastknn_index_search: The pivot search failed");
+            }
+            return FASTKNN_OK;
+
+        case FASTKNN_INDEX_TREE:
+            if (knn_tree_search(index->tree, query, k, indices, distances, query_length, num_threads, NULL) != 0) {
+                return fastknn_fail(FASTKNN_ERR_INTERNAL, "fastknn_index_search: The tree search failed");
+            }
+            return FASTKNN_OK;
+
+        default: {
+            knn_plan_t plan;
+            if (knn_search_plan(index->corpus_length, query_length, index->d, k, num_threads, memory_budget,
+                                &index->profile, &plan) != 0) {
+                return fastknn_fail(FASTKNN_ERR_OUT_OF_MEMORY, "fastknn_index_search: The search does not fit in the memory budget of %zu bytes",
+                                memory_budget);
+            }
+            if (knn_search_with_plan(index->corpus, query, k, indices, distances, index->corpus_length, query_length,
+                                     index->d, &plan) != 0) {
+                return fastknn_fail(FASTKNN_ERR_INTERNAL, "fastknn_index_search: The brute-force search failed");
+            }
+            return FASTKNN_OK;
+        }
+    }
+}
+
+
+// Search (exact, or approximate all-to-all with a target recall of `accuracy` percent if it is < 100) into the caller's 64-bit ids: directly when the
+// engine ids are 64-bit, through a buffer of engine ids otherwise
+static fastknn_status_t api_run_widened(const fastknn_index_t* index, const float* query, size_t query_length, int k, int accuracy,
+                                        fastknn_id_t* indices, float* distances, int num_threads, size_t memory_budget) {
+#if KNN_INDEX_32
+    knn_idx_t* ids = (knn_idx_t*)malloc(query_length * k * sizeof(knn_idx_t));
+    if (ids == NULL) {
+        return fastknn_fail(FASTKNN_ERR_OUT_OF_MEMORY, "fastknn: Failed to allocate %zu ids", query_length * k);
+    }
+#else
+    knn_idx_t* ids = (knn_idx_t*)indices;
+#endif
+
+    fastknn_status_t status = FASTKNN_OK;
+    if (accuracy < 100) {
+        // The overlap band of the hyperplane split is chosen for a recall of `accuracy` percent
+        if (knn_approx_serial_plan(query, k, ids, distances, query_length, index->d, num_threads, accuracy, NULL) != 0) {
+            status = fastknn_fail(FASTKNN_ERR_INTERNAL, "fastknn_index_all_knn: The approximate search failed");
+        }
+    } else {
+        status = api_search(index, query, query_length, k, ids, distances, num_threads, memory_budget);
+    }
+
+#if KNN_INDEX_32
+    for (size_t i = 0; i < query_length * k; i++) {
+        indices[i] = (fastknn_id_t)ids[i];
+    }
+    free(ids);
+#endif
+    return status;
+}
+
+
+// Whether a loaded tree holds exactly the rows of the corpus (the tree is self-contained, so its snapshot
+// does not reference the corpus)
+static int api_tree_matches(const knn_tree_t* tree, const float* corpus, size_t corpus_length, int d) {
+    if (tree->corpus_length != corpus_length || tree->d != d) {
+        return 0;
+    }
+    for (size_t i = 0; i < corpus_length; i++) {
+        if ((size_t)tree->ids[i] >= corpus_length ||
+            memcmp(&tree->points[i * d], &corpus[(size_t)tree->ids[i] * d], d * sizeof(float)) != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+void fastknn_version(int* major, int* minor, int* patch) {
+    if (major) { *major = FASTKNN_VERSION_MAJOR; }
+    if (minor) { *minor = FASTKNN_VERSION_MINOR; }
+    if (patch) { *patch = FASTKNN_VERSION_PATCH; }
+}
+
+
+const char* fastknn_status_string(fastknn_status_t status) {
+    switch (status) {
+        case FASTKNN_OK:                    return "success";
+        case FASTKNN_ERR_INVALID_ARGUMENT:  return "invalid argument";
+        case FASTKNN_ERR_OUT_OF_MEMORY:     return "out of memory";
+        case FASTKNN_ERR_UNSUPPORTED:       return "unsupported";
+        case FASTKNN_ERR_INTERNAL:          return "internal error";
+        default:                            return "unknown status";
+    }
+}
+
+
+const char* fastknn_last_error(void) {
+    return last_error;
+}
+
+
+void fastknn_index_options_init(fastknn_index_options_t* options) {
+    if (options == NULL) { return; }
+    memset(options, 0, sizeof(*options));
+    options->struct_size = sizeof(*options);
+    options->type        = FASTKNN_INDEX_AUTO;
+    options->copy_corpus = 1;
+}
+
+
+fastknn_status_t fastknn_index_create(const float* corpus, size_t corpus_length, int d,
+                                      const fastknn_index_options_t* options, fastknn_index_t** index) {
+    if (index == NULL) {
+        return fastknn_fail(FASTKNN_ERR_INVALID_ARGUMENT, "fastknn_index_create: The index pointer is NULL");
+    }
+    *index = NULL;
+    if (corpus == NULL || corpus_length == 0 || d <= 0) {
+        return fastknn_fail(FASTKNN_ERR_INVALID_ARGUMENT, "fastknn_index_create: Invalid corpus (%zu x %d)", corpus_length, d);
+    }
+#if KNN_INDEX_32
+    if (corpus_length - 1 > (size_t)KNN_IDX_MAX) {
+        return fastknn_fail(FASTKNN_ERR_UNSUPPORTED, "fastknn_index_create: %zu rows do not fit in the 32-bit ids of this build", corpus_length);
+    }
+#endif
+
+    pthread_once(&library_blas_once, library_blas_init);
+
+    // Options of an older header keep the defaults of the fields they do not know
+    fastknn_index_options_t opts;
+    fastknn_index_options_init(&opts);
+    if (options != NULL) {
+        if (options->struct_size > sizeof(opts)) {
+            return fastknn_fail(FASTKNN_ERR_UNSUPPORTED, "fastknn_index_create: The options are newer than the library (%zu > %zu bytes)",
+                            options->struct_size, sizeof(opts));
+        }
+        memcpy(&opts, options, options->struct_size);
+        opts.struct_size = sizeof(opts);
+    }
+    if (opts.type < FASTKNN_INDEX_AUTO || opts.type > FASTKNN_INDEX_TREE) {
+        return fastknn_fail(FASTKNN_ERR_INVALID_ARGUMENT, "fastknn_index_create: Unknown index type %d", (int)opts.type);
+    }
+    if (opts.type == FASTKNN_INDEX_AUTO) {
+        opts.type = (d <= KNN_TREE_MAX_USEFUL_DIM) ? FASTKNN_INDEX_TREE : FASTKNN_INDEX_BRUTE_FORCE;
+    }
+    if (opts.num_threads <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        opts.num_threads = (cores > 0) ? (int)cores : 1;
+    }
+
+    fastknn_index_t* new_index = (fastknn_index_t*)calloc(1, sizeof(fastknn_index_t));
+    if (new_index == NULL) {
+        return fastknn_fail(FASTKNN_ERR_OUT_OF_MEMORY, "fastknn_index_create: Memory allocation failed");
+    }
+    new_index->generation    = __atomic_add_fetch(&last_generation, 1, __ATOMIC_RELAXED);
+    new_index->corpus_length = corpus_length;
+    new_index->d             = d;
+    new_index->type          = opts.type;
+    new_index->num_threads   = opts.num_threads;
+    new_index->memory_budget = opts.memory_budget ? opts.memory_budget : get_usable_memory();
+    new_index->corpus        = corpus;
+    pthread_mutex_init(&new_index->pool_lock, NULL);
+    pthread_cond_init(&new_index->work_ready, NULL);
+    pthread_cond_init(&new_index->ticket_done, NULL);
+
+    if (opts.copy_corpus) {
+        new_index->own_corpus = (float*)malloc(corpus_length * d * sizeof(float));
+        if (new_index->own_corpus == NULL) {
+            fastknn_index_destroy(new_index);
+            return fastknn_fail(FASTKNN_ERR_OUT_OF_MEMORY, "fastknn_index_create: Failed to copy the corpus (%zu bytes)",
+                            corpus_length * d * sizeof(float));
+        }
+        memcpy(new_index->own_corpus, corpus, corpus_length * d * sizeof(float));
+        new_index->corpus = new_index->own_corpus;
+    }
+
+    // A snapshot that cannot be loaded (missing, corrupted, or of another corpus) is rebuilt and overwritten
+    int warm_start = (opts.snapshot_path != NULL && access(opts.snapshot_path, R_OK) == 0);
+    switch (new_index->type) {
+        case FASTKNN_INDEX_PIVOT:
+            if (warm_start) {
+                new_index->pivot = knn_pivot_load(opts.snapshot_path, new_index->corpus, corpus_length, d, 1, opts.num_threads);
+            }
+            if (new_index->pivot == NULL) {
+                new_index->pivot = knn_pivot_build(new_index->corpus, corpus_length, d, opts.num_pivots, opts.leaf_rows, opts.num_threads);
+                if (new_index->pivot == NULL) {
+                    fastknn_index_destroy(new_index);
+                    return fastknn_fail(FASTKNN_ERR_INTERNAL, "fastknn_index_create: Failed to build the pivot index");
+                }
+                if (opts.snapshot_path != NULL && knn_pivot_save(new_index->pivot, opts.snapshot_path) != 0) {
+                    fastknn_index_destroy(new_index);
+                    return fastknn_fail(FASTKNN_ERR_INTERNAL, "fastknn_index_create: Failed to save the pivot index to %s",
+                                        opts.snapshot_path);
+                }
+            }
+            break;
+
+        case FASTKNN_INDEX_TREE:
+            if (warm_start) {
+                new_index->tree = knn_tree_load(opts.snapshot_path, 1);
+                if (new_index->tree != NULL && !api_tree_matches(new_index->tree, new_index->corpus, corpus_length, d)) {
+                    knn_tree_free(new_index->tree);
+                    new_index->tree = NULL;
+                }
+            }
+            if (new_index->tree == NULL) {
+                new_index->tree = knn_tree_build(new_index->corpus, corpus_length, d, opts.leaf_rows, opts.num_threads);
+                if (new_index->tree == NULL) {
+                    fastknn_index_destroy(new_index);
+                    return fastknn_fail(FASTKNN_ERR_INTERNAL, "fastknn_index_create: Failed to build the tree");
+                }
+                if (opts.snapshot_path != NULL && knn_tree_save(new_index->tree, opts.snapshot_path) != 0) {
+                    fastknn_index_destroy(new_index);
+                    return fastknn_fail(FASTKNN_ERR_INTERNAL, "fastknn_index_create: Failed to save the tree to %s",
+                                        opts.snapshot_path);
+                }
+            }
+            break;
+
+        default:
+            if (opts.profile_path == NULL || knn_profile_load(opts.profile_path, &new_index->profile) != 0) {
+                pthread_once(&library_profile_once, library_profile_init);
+                new_index->profile = library_profile;
+            }
+            break;
+    }
+
+    *index = new_index;
+    return FASTKNN_OK;
+}
+
+
+fastknn_status_t fastknn_index_search(const fastknn_index_t* index, const float* query, size_t query_length, int k,
+                                      fastknn_id_t* indices, float* distances) {
+    fastknn_status_t status = api_check_k("fastknn_index_search", index, k, indices, distances);
+    if (status != FASTKNN_OK) {
+        return status;
+    }
+    if (query_length == 0) {
+        return FASTKNN_OK;
+    }
+    if (query == NULL) {
+        return fastknn_fail(FASTKNN_ERR_INVALID_ARGUMENT, "fastknn_index_search: The query is NULL");
+    }
+    return api_run_widened(index, query, query_length, k, 100, indices, distances, index->num_threads, index->memory_budget);
+}
+
+
+fastknn_status_t fastknn_index_search_filtered(const fastknn_index_t* index, const float* query, size_t query_length, int k,
+                                               const uint64_t* allowed, fastknn_id_t* indices, float* distances) {
+    fastknn_status_t status = api_check_k("fastknn_index_search_filtered", index, k, indices, distances);
+    if (status != FASTKNN_OK) {
+        return status;
+    }
+    if (allowed == NULL) {
+        return fastknn_fail(FASTKNN_ERR_INVALID_ARGUMENT, "fastknn_index_search_filtered: The filter is NULL");
+    }
+    if (query_length == 0) {
+        return FASTKNN_OK;
+    }
+    if (query == NULL) {
+        return fastknn_fail(FASTKNN_ERR_INVALID_ARGUMENT, "fastknn_index_search_filtered: The query is NULL");
+    }
+
+#if KNN_INDEX_32
+    knn_idx_t* ids = (knn_idx_t*)malloc(query_length * k * sizeof(knn_idx_t));
+    if (ids == NULL) {
+        return fastknn_fail(FASTKNN_ERR_OUT_OF_MEMORY, "fastknn: Failed to allocate %zu ids", query_length * k);
+    }
+#else
+    knn_idx_t* ids = (knn_idx_t*)indices;
+#endif
+
+    if (knn_exact_filtered(index->corpus, query, k, ids, distances, index->corpus_length, query_length, index->d,
+                           allowed, index->num_threads, NULL) != 0) {
+        status = fastknn_fail(FASTKNN_ERR_INTERNAL, "fastknn_index_search_filtered: The filtered search failed");
+    }
+
+#if KNN_INDEX_32
+    for (size_t i = 0; i < query_length * k; i++) {
+        indices[i] = (fastknn_id_t)ids[i];
+    }
+    free(ids);
+#endif
+    return status;
+}
+
+
+fastknn_status_t fastknn_filter_from_labels(const int32_t* labels, size_t corpus_length, const int32_t* allowed_labels,
+                                            int num_allowed, uint64_t* allowed) {
+    if ((labels == NULL && corpus_length > 0) || (allowed_labels == NULL && num_allowed > 0) || num_allowed < 0 || allowed == NULL) {
+        return fastknn_fail(FASTKNN_ERR_INVALID_ARGUMENT, "fastknn_filter_from_labels: Invalid labels or bitmap");
+    }
+    if (corpus_length == 0) {
+        return FASTKNN_OK;
+    }
+    uint64_t* bitmap = knn_filter_from_labels(labels, corpus_length, allowed_labels, num_allowed);
+    if (bitmap == NULL) {
+        return fastknn_fail(FASTKNN_ERR_OUT_OF_MEMORY, "fastknn_filter_from_labels: Failed to allocate the bitmap");
+    }
+    memcpy(allowed, bitmap, knn_filter_words(corpus_length) * sizeof(uint64_t));
+    free(bitmap);
+    return FASTKNN_OK;
+}
+
+
+fastknn_status_t fastknn_index_all_knn(const fastknn_index_t* index, int k, int accuracy,
+                                       fastknn_id_t* indices, float* distances) {
+    fastknn_status_t status = api_check_k("fastknn_index_all_knn", index, k, indices, distances);
+    if (status != FASTKNN_OK) {
+        return status;
+    }
+    if (accuracy < 1 || accuracy > 100) {
+        return fastknn_fail(FASTKNN_ERR_INVALID_ARGUMENT, "fastknn_index_all_knn: accuracy = %d is not in [1, 100]", accuracy);
+    }
+    return api_run_widened(index, index->corpus, index->corpus_length, k, accuracy, indices, distances,
+                           index->num_threads, index->memory_budget);
+}
+
+
+uint64_t fastknn_index_generation(const fastknn_index_t* index) {
+    return index->generation;
+}
+
+
+fastknn_status_t fastknn_index_shape(const fastknn_index_t* index, size_t* corpus_length, int* d) {
+    if (index == NULL) {
+        return fastknn_fail(FASTKNN_ERR_INVALID_ARGUMENT, "fastknn_index_shape: The index is NULL");
+    }
+    if (corpus_length) { *corpus_length = index->corpus_length; }
+    if (d) { *d = index->d; }
+    return FASTKNN_OK;
+}
+
+
+// Pool thread: hand out the next tile of the ticket at the head of the queue (then move the ticket to the tail),
+// search it single-threaded and report it, until the pool stops and the queue is empty
+static void* pool_worker(void* args) {
+    fastknn_index_t* index = (fastknn_index_t*)args;
+    // The threads search at the same time, so each one gets its share of the memory budget
+    size_t memory_budget = index->memory_budget / index->num_threads;
+
+    pthread_mutex_lock(&index->pool_lock);
+    for (;;) {
+        while (!index->stop && index->queue_head == NULL) {
+            pthread_cond_wait(&index->work_ready, &index->pool_lock);
+        }
+        fastknn_ticket_t* ticket = index->queue_head;
+        if (ticket == NULL) {
+            break;
+        }
+        size_t start = ticket->next_row;
+        size_t rows  = (ticket->tile_rows < ticket->query_length - start) ? ticket->tile_rows : (ticket->query_length - start);
+        ticket->next_row += rows;
+
+        index->queue_head = ticket->next;
+        if (index->queue_head == NULL) { index->queue_tail = NULL; }
+        ticket->next = NULL;
+        if (ticket->next_row < ticket->query_length) {
+            if (index->queue_tail) { index->queue_tail->next = ticket; } else { index->queue_head = ticket; }
+            index->queue_tail = ticket;
+        }
+        pthread_mutex_unlock(&index->pool_lock);
+
+        size_t k = (size_t)ticket->k;
+        fastknn_status_t status = api_run_widened(index, &ticket->query[start * index->d], rows, ticket->k, 100,
+                                                  &ticket->indices[start * k], &ticket->distances[start * k], 1, memory_budget);
+        if (ticket->callback) {
+            ticket->callback(ticket, start, rows, status, ticket->user_data);
+        }
+
+        pthread_mutex_lock(&index->pool_lock);
+        if (status != FASTKNN_OK && ticket->status == FASTKNN_OK) {
+            ticket->status = status;
+            snprintf(ticket->message, sizeof(ticket->message), "%s", last_error);
+        }
+        ticket->rows_done += rows;
+        if (ticket->rows_done == ticket->query_length) {
+            ticket->complete = 1;
+            pthread_cond_broadcast(&index->ticket_done);
+        }
+    }
+    pthread_mutex_unlock(&index->pool_lock);
+    return NULL;
+}
+
+
+// Start the pool threads of an index (called with `pool_lock` held). A pool with fewer threads than requested still works.
+static fastknn_status_t pool_start(fastknn_index_t* index) {
+    if (index->workers != NULL) {
+        return FASTKNN_OK;
+    }
+    index->workers = (pthread_t*)malloc(index->num_threads * sizeof(pthread_t));
+    if (index->workers == NULL) {
+        return fastknn_fail(FASTKNN_ERR_OUT_OF_MEMORY, "fastknn_submit: Failed to allocate the search pool");
+    }
+    while (index->num_workers < index->num_threads &&
+           pthread_create(&index->workers[index->num_workers], NULL, pool_worker, index) == 0) {
+        index->num_workers++;
+    }
+    if (index->num_workers == 0) {
+        free(index->workers);
+        index->workers = NULL;
+        return fastknn_fail(FASTKNN_ERR_INTERNAL, "fastknn_submit: Failed to start the search pool");
+    }
+    return FASTKNN_OK;
+}
+
+
+fastknn_status_t fastknn_submit(fastknn_index_t* index, const float* query, size_t query_length, int k,
+                                fastknn_id_t* indices, float* distances, size_t tile_rows,
+                                fastknn_callback_t callback, void* user_data, fastknn_ticket_t** ticket) {
+    if (ticket == NULL) {
+        return fastknn_fail(FASTKNN_ERR_INVALID_ARGUMENT, "fastknn_submit: The ticket pointer is NULL");
+    }
+    *ticket = NULL;
+    fastknn_status_t status = api_check_k("fastknn_submit", index, k, indices, distances);
+    if (status != FASTKNN_OK) {
+        return status;
+    }
+    if (query == NULL && query_length > 0) {
+        return fastknn_fail(FASTKNN_ERR_INVALID_ARGUMENT, "fastknn_submit: The query is NULL");
+    }
+
+    fastknn_ticket_t* new_ticket = (fastknn_ticket_t*)calloc(1, sizeof(fastknn_ticket_t));
+    if (new_ticket == NULL) {
+        return fastknn_fail(FASTKNN_ERR_OUT_OF_MEMORY, "fastknn_submit: Memory allocation failed");
+    }
+    new_ticket->index        = index;
+    new_ticket->query        = query;
+    new_ticket->query_length = query_length;
+    new_ticket->k            = k;
+    new_ticket->indices      = indices;
+    new_ticket->distances    = distances;
+    new_ticket->tile_rows    = tile_rows ? tile_rows : FASTKNN_DEFAULT_TILE_ROWS;
+    new_ticket->callback     = callback;
+    new_ticket->user_data    = user_data;
+    new_ticket->status       = FASTKNN_OK;
+    new_ticket->complete     = (query_length == 0);
+
+    pthread_mutex_lock(&index->pool_lock);
+    if (!new_ticket->complete) {
+        status = pool_start(index);
+        if (status != FASTKNN_OK) {
+            pthread_mutex_unlock(&index->pool_lock);
+            free(new_ticket);
+            return status;
+        }
+        if (index->queue_tail) { index->queue_tail->next = new_ticket; } else { index->queue_head = new_ticket; }
+        index->queue_tail = new_ticket;
+        pthread_cond_broadcast(&index->work_ready);
+    }
+    pthread_mutex_unlock(&index->pool_lock);
+
+    *ticket = new_ticket;
+    return FASTKNN_OK;
+}
+
+
+int fastknn_poll(const fastknn_ticket_t* ticket, size_t* queries_done) {
+    if (ticket == NULL) {
+        return -1;
+    }
+    pthread_mutex_lock(&ticket->index->pool_lock);
+    int complete = ticket->complete;
+    if (queries_done) { *queries_done = ticket->rows_done; }
+    pthread_mutex_unlock(&ticket->index->pool_lock);
+    return complete;
+}
+
+
+static fastknn_status_t ticket_wait(fastknn_ticket_t* ticket) {
+    pthread_mutex_lock(&ticket->index->pool_lock);
+    while (!ticket->complete) {
+        pthread_cond_wait(&ticket->index->ticket_done, &ticket->index->pool_lock);
+    }
+    fastknn_status_t status = ticket->status;
+    pthread_mutex_unlock(&ticket->index->pool_lock);
+    return status;
+}
+
+
+fastknn_status_t fastknn_wait(fastknn_ticket_t* ticket) {
+    if (ticket == NULL) {
+        return fastknn_fail(FASTKNN_ERR_INVALID_ARGUMENT, "fastknn_wait: The ticket is NULL");
+    }
+    fastknn_status_t status = ticket_wait(ticket);
+    if (status != FASTKNN_OK) {
+        return fastknn_fail(status, "%s", ticket->message);
+    }
+    return FASTKNN_OK;
+}
+
+
+void fastknn_ticket_release(fastknn_ticket_t* ticket) {
+    if (ticket == NULL) { return; }
+    ticket_wait(ticket);
+    free(ticket);
+}
+
+
+void fastknn_index_destroy(fastknn_index_t* index) {
+    if (index == NULL) { return; }
+    if (index->workers != NULL) {
+        pthread_mutex_lock(&index->pool_lock);
+        index->stop = 1;
+        pthread_cond_broadcast(&index->work_ready);
+        pthread_mutex_unlock(&index->pool_lock);
+        for (int t = 0; t < index->num_workers; t++) {
+            pthread_join(index->workers[t], NULL);
+        }
+        free(index->workers);
+    }
+    pthread_mutex_destroy(&index->pool_lock);
+    pthread_cond_destroy(&index->work_ready);
+    pthread_cond_destroy(&index->ticket_done);
+    knn_pivot_free(index->pivot);
+    knn_tree_free(index->tree);
+    free(index->own_corpus);
+    free(index);
+}
@@ -0,0 +1,369 @@
+#define FASTKNN_BUILD
+#include "../../include/fastknn.h"
+#include "../../include/api/fastknn_internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "../../include/utils/knn_hash.h"
+
+// The metric is part of the key; the indexes only search Euclidean distances for now
+#define CACHE_METRIC_EUCLIDEAN 1
+
+// Results of one query row. The query key (d 32-bit words: the float bits, or the quantized values), the ids
+// and the distances follow the entry in the same allocation.
+typedef struct cache_entry {
+    uint64_t                hash;
+    uint64_t                generation;     // Generation of the index
+    uint64_t                epoch;          // Epoch of the cache when the results were searched
+    int                     d;
+    int                     k;
+    int                     quantized;      // 1 if the key holds quantized values, 0 if it holds the float bits
+    size_t                  slot;
+    struct cache_entry*     next;           // Next entry of the bucket
+} cache_entry_t;
+
+typedef struct {
+    pthread_mutex_t         lock;
+    cache_entry_t**         buckets;
+    size_t                  num_buckets;    // Power of 2
+    cache_entry_t**         slots;          // CLOCK ring of the entries (NULL: free)
+    unsigned char*          referenced;     // CLOCK reference bit of every slot
+    size_t                  num_slots;
+    size_t                  hand;
+    fastknn_cache_stats_t   stats;
+} cache_shard_t;
+
+struct fastknn_cache {
+    int                     num_shards;     // Power of 2
+    cache_shard_t*          shards;
+    float                   quantization_step;
+    uint64_t                epoch;          // Increased by `fastknn_cache_invalidate`
+};
+
+
+static fastknn_id_t* entry_ids(cache_entry_t* entry) {
+    return (fastknn_id_t*)(entry + 1);
+}
+
+
+static float* entry_distances(cache_entry_t* entry) {
+    return (float*)(entry_ids(entry) + entry->k);
+}
+
+
+static uint32_t* entry_key(cache_entry_t* entry) {
+    return (uint32_t*)(entry_distances(entry) + entry->k);
+}
+
+
+static size_t entry_bytes(int d, int k) {
+    return sizeof(cache_entry_t) + (size_t)k * (sizeof(fastknn_id_t) + sizeof(float)) + (size_t)d * sizeof(uint32_t);
+}
+
+
+// Key of a query row: its values rounded to multiples of the quantization step, or its float bits if there is no
+// step or a value is not a finite multiple of it within int32 (NaN, infinity, or too large)
+static int query_key(const fastknn_cache_t* cache, const float* row, int d, uint32_t* key) {
+    int quantized = (cache->quantization_step > 0.0f);
+    for (int j = 0; j < d && quantized; j++) {
+        float level = row[j] / cache->quantization_step;
+        quantized = (fabsf(level) < 2147483648.0f);     // False for NaN
+    }
+
+    if (quantized) {
+        for (int j = 0; j < d; j++) {
+            int32_t level = (int32_t)lrintf(row[j] / cache->quantization_step);
+            memcpy(&key[j], &level, sizeof(uint32_t));
+        }
+    } else {
+        memcpy(key, row, d * sizeof(float));
+        // -0.0 and 0.0 give the same distances
+        for (int j = 0; j < d; j++) {
+            if (row[j] == 0.0f) { key[j] = 0; }
+        }
+    }
+    return quantized;
+}
+
+
+// Unlink and free the entry of a slot (called with the shard lock held)
+static void shard_remove(cache_shard_t* shard, size_t slot) {
+    cache_entry_t* entry = shard->slots[slot];
+    cache_entry_t** link = &shard->buckets[entry->hash & (shard->num_buckets - 1)];
+    while (*link != entry) {
+        link = &(*link)->next;
+    }
+    *link = entry->next;
+
+    shard->stats.entries--;
+    shard->stats.bytes -= entry_bytes(entry->d, entry->k);
+    shard->slots[slot] = NULL;
+    free(entry);
+}
+
+
+// Entry of a key, or NULL (called with the shard lock held). Stale entries are removed on the way.
+static cache_entry_t* shard_find(cache_shard_t* shard, uint64_t hash, uint64_t generation, uint64_t epoch, int d, int k,
+                                 int quantized, const uint32_t* key) {
+    cache_entry_t* entry = shard->buckets[hash & (shard->num_buckets - 1)];
+    while (entry != NULL) {
+        cache_entry_t* next = entry->next;
+        if (entry->epoch != epoch) {
+            shard->stats.evictions++;
+            shard_remove(shard, entry->slot);
+        } else if (entry->hash == hash && entry->generation == generation && entry->d == d && entry->k == k &&
+                   entry->quantized == quantized && memcmp(entry_key(entry), key, d * sizeof(uint32_t)) == 0) {
+            return entry;
+        }
+        entry = next;
+    }
+    return NULL;
+}
+
+
+// Slot for a new entry: the next free one, or the first unreferenced one of the CLOCK sweep (evicted)
+static size_t shard_victim(cache_shard_t* shard) {
+    for (;;) {
+        size_t slot = shard->hand;
+        shard->hand = (shard->hand + 1) % shard->num_slots;
+        if (shard->slots[slot] == NULL) {
+            return slot;
+        }
+        if (shard->referenced[slot]) {
+            shard->referenced[slot] = 0;
+        } else {
+            shard->stats.evictions++;
+            shard_remove(shard, slot);
+            return slot;
+        }
+    }
+}
+
+
+fastknn_status_t fastknn_cache_create(size_t max_entries, int num_shards, float quantization_step, fastknn_cache_t** cache) {
+    if (cache == NULL) {
+        return fastknn_fail(FASTKNN_ERR_INVALID_ARGUMENT, "fastknn_cache_create: The cache pointer is NULL");
+    }
+    *cache = NULL;
+    if (!(quantization_step >= 0.0f) || isinf(quantization_step)) {
+        return fastknn_fail(FASTKNN_ERR_INVALID_ARGUMENT, "fastknn_cache_create: Invalid quantization step %g", quantization_step);
+    }
+    if (max_entries == 0) { max_entries = FASTKNN_CACHE_MAX_ENTRIES; }
+    if (num_shards <= 0) { num_shards = FASTKNN_CACHE_SHARDS; }
+    int shards = 1;
+    while (shards < num_shards) { shards *= 2; }
+    if ((size_t)shards > max_entries) { shards = 1; }
+
+    fastknn_cache_t* new_cache = (fastknn_cache_t*)calloc(1, sizeof(fastknn_cache_t));
+    if (new_cache == NULL) {
+        return fastknn_fail(FASTKNN_ERR_OUT_OF_MEMORY, "fastknn_cache_create: Memory allocation failed");
+    }
+    new_cache->quantization_step = quantization_step;
+    new_cache->shards = (cache_shard_t*)calloc(shards, sizeof(cache_shard_t));
+    if (new_cache->shards == NULL) {
+        free(new_cache);
+        return fastknn_fail(FASTKNN_ERR_OUT_OF_MEMORY, "fastknn_cache_create: Memory allocation failed");
+    }
+
+    for (int s = 0; s < shards; s++) {
+        cache_shard_t* shard = &new_cache->shards[s];
+        shard->num_slots   = max_entries / shards;
+        shard->num_buckets = 1;
+        while (shard->num_buckets < shard->num_slots) { shard->num_buckets *= 2; }
+        shard->buckets    = (cache_entry_t**)calloc(shard->num_buckets, sizeof(cache_entry_t*));
+        shard->slots      = (cache_entry_t**)calloc(shard->num_slots, sizeof(cache_entry_t*));
+        shard->referenced = (unsigned char*)calloc(shard->num_slots, 1);
+        pthread_mutex_init(&shard->lock, NULL);
+        new_cache->num_shards = s + 1;
+        if (!shard->buckets || !shard->slots || !shard->referenced) {
+            fastknn_cache_destroy(new_cache);
+            return fastknn_fail(FASTKNN_ERR_OUT_OF_MEMORY, "fastknn_cache_create: Failed to allocate %zu entries", max_entries);
+        }
+    }
+
+    *cache = new_cache;
+    return FASTKNN_OK;
+}
+
+
+fastknn_status_t fastknn_cache_search(fastknn_cache_t* cache, const fastknn_index_t* index, const float* query,
+                                      size_t query_length, int k, fastknn_id_t* indices, float* distances) {
+    if (cache == NULL) {
+        return fastknn_fail(FASTKNN_ERR_INVALID_ARGUMENT, "fastknn_cache_search: The cache is NULL");
+    }
+    size_t corpus_length;
+    int d;
+    fastknn_status_t status = fastknn_index_shape(index, &corpus_length, &d);
+    if (status != FASTKNN_OK) {
+        return status;
+    }
+    if (k <= 0 || (size_t)k > corpus_length) {
+        return fastknn_fail(FASTKNN_ERR_INVALID_ARGUMENT, "fastknn_cache_search: k = %d is not in [1, %zu]", k, corpus_length);
+    }
+    if (indices == NULL || distances == NULL || (query == NULL && query_length > 0)) {
+        return fastknn_fail(FASTKNN_ERR_INVALID_ARGUMENT, "fastknn_cache_search: NULL query or result buffers");
+    }
+    if (query_length == 0) {
+        return FASTKNN_OK;
+    }
+
+    uint64_t  generation = fastknn_index_generation(index);
+    uint64_t  epoch      = __atomic_load_n(&cache->epoch, __ATOMIC_ACQUIRE);
+    uint32_t* keys       = (uint32_t*)malloc(query_length * d * sizeof(uint32_t));
+    uint64_t* hashes     = (uint64_t*)malloc(query_length * sizeof(uint64_t));
+    size_t*   misses     = (size_t*)malloc(query_length * sizeof(size_t));
+    unsigned char* quantized = (unsigned char*)malloc(query_length);
+    if (!keys || !hashes || !misses || !quantized) {
+        free(keys);
+        free(hashes);
+        free(misses);
+        free(quantized);
+        return fastknn_fail(FASTKNN_ERR_OUT_OF_MEMORY, "fastknn_cache_search: Failed to allocate the keys of %zu queries", query_length);
+    }
+
+    // Copy the cached results and list the other rows
+    size_t num_misses = 0;
+    for (size_t q = 0; q < query_length; q++) {
+        uint32_t* key = &keys[q * d];
+        quantized[q] = (unsigned char)query_key(cache, &query[q * d], d, key);
+        uint64_t hash = knn_hash_bytes(key, d * sizeof(uint32_t), 1);
+        hash = knn_hash_combine(knn_hash_combine(knn_hash_combine(hash, (uint64_t)k), CACHE_METRIC_EUCLIDEAN), generation);
+        hash = knn_hash_combine(hash, quantized[q]);
+        hashes[q] = hash;
+
+        // The high bits select the shard, the low bits the bucket
+        cache_shard_t* shard = &cache->shards[(hash >> 48) & (cache->num_shards - 1)];
+        pthread_mutex_lock(&shard->lock);
+        cache_entry_t* entry = shard_find(shard, hash, generation, epoch, d, k, quantized[q], key);
+        if (entry != NULL) {
+            memcpy(&indices[q * k], entry_ids(entry), k * sizeof(fastknn_id_t));
+            memcpy(&distances[q * k], entry_distances(entry), k * sizeof(float));
+            shard->referenced[entry->slot] = 1;
+            shard->stats.hits++;
+        } else {
+            misses[num_misses++] = q;
+            shard->stats.misses++;
+        }
+        pthread_mutex_unlock(&shard->lock);
+    }
+
+    if (num_misses > 0) {
+        float*        miss_query     = (float*)malloc(num_misses * d * sizeof(float));
+        fastknn_id_t* miss_indices   = (fastknn_id_t*)malloc(num_misses * k * sizeof(fastknn_id_t));
+        float*        miss_distances = (float*)malloc(num_misses * k * sizeof(float));
+        if (!miss_query || !miss_indices || !miss_distances) {
+            status = fastknn_fail(FASTKNN_ERR_OUT_OF_MEMORY, "fastknn_cache_search: Failed to allocate %zu missed queries", num_misses);
+        } else {
+            for (size_t i = 0; i < num_misses; i++) {
+                memcpy(&miss_query[i * d], &query[misses[i] * d], d * sizeof(float));
+            }
+            status = fastknn_index_search(index, miss_query, num_misses, k, miss_indices, miss_distances);
+        }
+
+        for (size_t i = 0; status == FASTKNN_OK && i < num_misses; i++) {
+            size_t q = misses[i];
+            memcpy(&indices[q * k], &miss_indices[i * k], k * sizeof(fastknn_id_t));
+            memcpy(&distances[q * k], &miss_distances[i * k], k * sizeof(float));
+
+            cache_shard_t* shard = &cache->shards[(hashes[q] >> 48) & (cache->num_shards - 1)];
+            cache_entry_t* entry = (cache_entry_t*)malloc(entry_bytes(d, k));
+            if (entry == NULL) {
+                continue;
+            }
+            *entry = (cache_entry_t){ .hash = hashes[q], .generation = generation, .epoch = epoch, .d = d, .k = k,
+                                      .quantized = quantized[q] };
+            memcpy(entry_ids(entry), &miss_indices[i * k], k * sizeof(fastknn_id_t));
+            memcpy(entry_distances(entry), &miss_distances[i * k], k * sizeof(float));
+            memcpy(entry_key(entry), &keys[q * d], d * sizeof(uint32_t));
+
+            pthread_mutex_lock(&shard->lock);
+            // A duplicate row of this batch (or a concurrent search) may have cached it already
+            if (shard_find(shard, entry->hash, generation, epoch, d, k, entry->quantized, entry_key(entry)) != NULL ||
+                epoch != __atomic_load_n(&cache->epoch, __ATOMIC_ACQUIRE)) {
+                free(entry);
+            } else {
+                entry->slot = shard_victim(shard);
+                cache_entry_t** bucket = &shard->buckets[entry->hash & (shard->num_buckets - 1)];
+                entry->next = *bucket;
+                *bucket = entry;
+                shard->slots[entry->slot] = entry;
+                shard->referenced[entry->slot] = 0;
+                shard->stats.insertions++;
+                shard->stats.entries++;
+                shard->stats.bytes += entry_bytes(d, k);
+            }
+            pthread_mutex_unlock(&shard->lock);
+        }
+
+        free(miss_query);
+        free(miss_indices);
+        free(miss_distances);
+    }
+
+    free(keys);
+    free(hashes);
+    free(misses);
+    free(quantized);
+    return status;
+}
+
+
+fastknn_status_t fastknn_cache_invalidate(fastknn_cache_t* cache) {
+    if (cache == NULL) {
+        return fastknn_fail(FASTKNN_ERR_INVALID_ARGUMENT, "fastknn_cache_invalidate: The cache is NULL");
+    }
+    // Searches that started before keep their epoch, so their results are not cached
+    __atomic_add_fetch(&cache->epoch, 1, __ATOMIC_ACQ_REL);
+    for (int s = 0; s < cache->num_shards; s++) {
+        cache_shard_t* shard = &cache->shards[s];
+        pthread_mutex_lock(&shard->lock);
+        for (size_t slot = 0; slot < shard->num_slots; slot++) {
+            if (shard->slots[slot] != NULL) {
+                shard->stats.evictions++;
+                shard_remove(shard, slot);
+            }
+        }
+        pthread_mutex_unlock(&shard->lock);
+    }
+    return FASTKNN_OK;
+}
+
+
+fastknn_status_t fastknn_cache_get_stats(fastknn_cache_t* cache, fastknn_cache_stats_t* stats) {
+    if (cache == NULL || stats == NULL) {
+        return fastknn_fail(FASTKNN_ERR_INVALID_ARGUMENT, "fastknn_cache_get_stats: NULL cache or stats");
+    }
+    memset(stats, 0, sizeof(*stats));
+    for (int s = 0; s < cache->num_shards; s++) {
+        cache_shard_t* shard = &cache->shards[s];
+        pthread_mutex_lock(&shard->lock);
+        stats->hits       += shard->stats.hits;
+        stats->misses     += shard->stats.misses;
+        stats->insertions += shard->stats.insertions;
+        stats->evictions  += shard->stats.evictions;
+        stats->entries    += shard->stats.entries;
+        stats->bytes      += shard->stats.bytes;
+        pthread_mutex_unlock(&shard->lock);
+    }
+    return FASTKNN_OK;
+}
+
+
+void fastknn_cache_destroy(fastknn_cache_t* cache) {
+    if (cache == NULL) { return; }
+    for (int s = 0; s < cache->num_shards; s++) {
+        cache_shard_t* shard = &cache->shards[s];
+        for (size_t slot = 0; shard->slots && slot < shard->num_slots; slot++) {
+            free(shard->slots[slot]);
+        }
+        free(shard->buckets);
+        free(shard->slots);
+        free(shard->referenced);
+        pthread_mutex_destroy(&shard->lock);
+    }
+    free(cache->shards);
+    free(cache);
+}
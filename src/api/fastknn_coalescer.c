@@ -0,0 +1,260 @@
+#define FASTKNN_BUILD
+#include "../../include/fastknn.h"
+#include "../../include/api/fastknn_internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+// Request of a caller, on the caller's stack: its rows are copied into a batch, and the leader of the batch
+// copies the results back into its buffers
+typedef struct {
+    size_t                  query_length;
+    int                     k;
+    fastknn_id_t*           indices;
+    float*                  distances;
+    fastknn_status_t        status;
+    char                    message[256];
+    int                     done;
+} coalescer_request_t;
+
+// Batch of requests: the first request is its leader, which searches it
+typedef struct {
+    float*                  queries;        // max_batch x d
+    size_t                  rows;
+    int                     k;              // Largest k of the requests (the others take a prefix of its results)
+    size_t                  num_requests;
+    coalescer_request_t**   requests;       // max_batch (every request has at least one row)
+    int                     closed;         // No more requests: full, or the leader's deadline passed
+} coalescer_batch_t;
+
+struct fastknn_coalescer {
+    const fastknn_index_t*  index;
+    int                     d;
+    size_t                  max_batch;
+    unsigned int            deadline_us;
+    pthread_mutex_t         lock;
+    pthread_cond_t          batch_closed;   // A batch was closed (its leader waits for it, on CLOCK_MONOTONIC)
+    pthread_cond_t          request_done;   // The results of a batch were copied to its requests
+    coalescer_batch_t*      open;           // Batch that takes new requests (NULL if none)
+    fastknn_coalescer_stats_t stats;
+};
+
+
+static coalescer_batch_t* batch_create(const fastknn_coalescer_t* coalescer) {
+    coalescer_batch_t* batch = (coalescer_batch_t*)calloc(1, sizeof(coalescer_batch_t));
+    if (batch == NULL) {
+        return NULL;
+    }
+    batch->queries  = (float*)malloc(coalescer->max_batch * coalescer->d * sizeof(float));
+    batch->requests = (coalescer_request_t**)malloc(coalescer->max_batch * sizeof(coalescer_request_t*));
+    if (!batch->queries || !batch->requests) {
+        free(batch->queries);
+        free(batch->requests);
+        free(batch);
+        return NULL;
+    }
+    return batch;
+}
+
+
+static void batch_free(coalescer_batch_t* batch) {
+    free(batch->queries);
+    free(batch->requests);
+    free(batch);
+}
+
+
+// Close the open batch (called with the lock held)
+static void batch_close(fastknn_coalescer_t* coalescer, coalescer_batch_t* batch, int full) {
+    batch->closed = 1;
+    if (coalescer->open == batch) {
+        coalescer->open = NULL;
+    }
+    if (full) {
+        coalescer->stats.full_batches++;
+    }
+    pthread_cond_broadcast(&coalescer->batch_closed);
+}
+
+
+// Search a closed batch and copy the results to its requests (called by the leader, without the lock)
+static void batch_run(fastknn_coalescer_t* coalescer, coalescer_batch_t* batch) {
+    size_t k = (size_t)batch->k;
+    fastknn_id_t* ids = (fastknn_id_t*)malloc(batch->rows * k * sizeof(fastknn_id_t));
+    float* dist = (float*)malloc(batch->rows * k * sizeof(float));
+
+    fastknn_status_t status;
+    if (!ids || !dist) {
+        status = fastknn_fail(FASTKNN_ERR_OUT_OF_MEMORY, "fastknn_coalescer_search: Failed to allocate the results of a batch of %zu rows", batch->rows);
+    } else {
+        status = fastknn_index_search(coalescer->index, batch->queries, batch->rows, batch->k, ids, dist);
+    }
+
+    size_t row = 0;
+    for (size_t r = 0; r < batch->num_requests; r++) {
+        coalescer_request_t* request = batch->requests[r];
+        request->status = status;
+        if (status != FASTKNN_OK) {
+            snprintf(request->message, sizeof(request->message), "%s", fastknn_last_error());
+            continue;
+        }
+        for (size_t q = 0; q < request->query_length; q++, row++) {
+            memcpy(&request->indices[q * request->k], &ids[row * k], request->k * sizeof(fastknn_id_t));
+            memcpy(&request->distances[q * request->k], &dist[row * k], request->k * sizeof(float));
+        }
+    }
+    free(ids);
+    free(dist);
+
+    pthread_mutex_lock(&coalescer->lock);
+    for (size_t r = 0; r < batch->num_requests; r++) {
+        batch->requests[r]->done = 1;
+    }
+    pthread_cond_broadcast(&coalescer->request_done);
+    pthread_mutex_unlock(&coalescer->lock);
+}
+
+
+fastknn_status_t fastknn_coalescer_create(const fastknn_index_t* index, size_t max_batch, unsigned int deadline_us,
+                                          fastknn_coalescer_t** coalescer) {
+    if (coalescer == NULL) {
+        return fastknn_fail(FASTKNN_ERR_INVALID_ARGUMENT, "fastknn_coalescer_create: The coalescer pointer is NULL");
+    }
+    *coalescer = NULL;
+    int d;
+    fastknn_status_t status = fastknn_index_shape(index, NULL, &d);
+    if (status != FASTKNN_OK) {
+        return status;
+    }
+
+    fastknn_coalescer_t* new_coalescer = (fastknn_coalescer_t*)calloc(1, sizeof(fastknn_coalescer_t));
+    if (new_coalescer == NULL) {
+        return fastknn_fail(FASTKNN_ERR_OUT_OF_MEMORY, "fastknn_coalescer_create: Memory allocation failed");
+    }
+    new_coalescer->index       = index;
+    new_coalescer->d           = d;
+    new_coalescer->max_batch   = max_batch ? max_batch : FASTKNN_COALESCER_MAX_BATCH;
+    new_coalescer->deadline_us = deadline_us ? deadline_us : FASTKNN_COALESCER_DEADLINE_US;
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_mutex_init(&new_coalescer->lock, NULL);
+    pthread_cond_init(&new_coalescer->batch_closed, &attr);
+    pthread_cond_init(&new_coalescer->request_done, NULL);
+    pthread_condattr_destroy(&attr);
+
+    *coalescer = new_coalescer;
+    return FASTKNN_OK;
+}
+
+
+fastknn_status_t fastknn_coalescer_search(fastknn_coalescer_t* coalescer, const float* query, size_t query_length, int k,
+                                          fastknn_id_t* indices, float* distances) {
+    if (coalescer == NULL) {
+        return fastknn_fail(FASTKNN_ERR_INVALID_ARGUMENT, "fastknn_coalescer_search: The coalescer is NULL");
+    }
+    size_t corpus_length;
+    fastknn_index_shape(coalescer->index, &corpus_length, NULL);
+    if (k <= 0 || (size_t)k > corpus_length) {
+        return fastknn_fail(FASTKNN_ERR_INVALID_ARGUMENT, "fastknn_coalescer_search: k = %d is not in [1, %zu]", k, corpus_length);
+    }
+    if (indices == NULL || distances == NULL || (query == NULL && query_length > 0)) {
+        return fastknn_fail(FASTKNN_ERR_INVALID_ARGUMENT, "fastknn_coalescer_search: NULL query or result buffers");
+    }
+    if (query_length == 0) {
+        return FASTKNN_OK;
+    }
+
+    // A request that fills a batch by itself gains nothing from waiting
+    if (query_length >= coalescer->max_batch) {
+        pthread_mutex_lock(&coalescer->lock);
+        coalescer->stats.direct++;
+        pthread_mutex_unlock(&coalescer->lock);
+        return fastknn_index_search(coalescer->index, query, query_length, k, indices, distances);
+    }
+
+    coalescer_request_t request = { .query_length = query_length, .k = k, .indices = indices, .distances = distances,
+                                    .status = FASTKNN_OK, .done = 0 };
+    int d = coalescer->d;
+
+    pthread_mutex_lock(&coalescer->lock);
+    coalescer_batch_t* batch = coalescer->open;
+    if (batch != NULL && batch->rows + query_length > coalescer->max_batch) {
+        batch_close(coalescer, batch, 0);       // Not full: it has no room for this request
+        batch = NULL;
+    }
+
+    int leader = (batch == NULL);
+    if (leader) {
+        batch = batch_create(coalescer);
+        if (batch == NULL) {
+            pthread_mutex_unlock(&coalescer->lock);
+            return fastknn_fail(FASTKNN_ERR_OUT_OF_MEMORY, "fastknn_coalescer_search: Failed to allocate a batch");
+        }
+        coalescer->open = batch;
+    }
+
+    memcpy(&batch->queries[batch->rows * d], query, query_length * d * sizeof(float));
+    batch->rows += query_length;
+    batch->k = (k > batch->k) ? k : batch->k;
+    batch->requests[batch->num_requests++] = &request;
+    coalescer->stats.requests++;
+    coalescer->stats.queries += query_length;
+    if (batch->rows == coalescer->max_batch) {
+        batch_close(coalescer, batch, 1);
+    }
+
+    if (leader) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_nsec += (long)(coalescer->deadline_us % 1000000) * 1000;
+        deadline.tv_sec  += coalescer->deadline_us / 1000000 + deadline.tv_nsec / 1000000000;
+        deadline.tv_nsec %= 1000000000;
+
+        while (!batch->closed) {
+            if (pthread_cond_timedwait(&coalescer->batch_closed, &coalescer->lock, &deadline) == ETIMEDOUT && !batch->closed) {
+                batch_close(coalescer, batch, 0);
+            }
+        }
+        coalescer->stats.batches++;
+        pthread_mutex_unlock(&coalescer->lock);
+
+        batch_run(coalescer, batch);
+        batch_free(batch);
+    } else {
+        while (!request.done) {
+            pthread_cond_wait(&coalescer->request_done, &coalescer->lock);
+        }
+        pthread_mutex_unlock(&coalescer->lock);
+    }
+
+    if (request.status != FASTKNN_OK) {
+        return fastknn_fail(request.status, "%s", request.message);
+    }
+    return FASTKNN_OK;
+}
+
+
+fastknn_status_t fastknn_coalescer_get_stats(fastknn_coalescer_t* coalescer, fastknn_coalescer_stats_t* stats) {
+    if (coalescer == NULL || stats == NULL) {
+        return fastknn_fail(FASTKNN_ERR_INVALID_ARGUMENT, "fastknn_coalescer_get_stats: NULL coalescer or stats");
+    }
+    pthread_mutex_lock(&coalescer->lock);
+    *stats = coalescer->stats;
+    pthread_mutex_unlock(&coalescer->lock);
+    return FASTKNN_OK;
+}
+
+
+void fastknn_coalescer_destroy(fastknn_coalescer_t* coalescer) {
+    if (coalescer == NULL) { return; }
+    pthread_mutex_destroy(&coalescer->lock);
+    pthread_cond_destroy(&coalescer->batch_closed);
+    pthread_cond_destroy(&coalescer->request_done);
+    free(coalescer);
+}
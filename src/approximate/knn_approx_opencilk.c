@@ -1,75 +1,39 @@
 #include "../../include/approximate/knn_approx_opencilk.h"
 
 // OpenCilk implementation of the approximate k-NN
-void knn_approx_opencilk(const float* dataset, int k, int* indices, float* distances, 
-                         int dataset_length, int d, int num_of_threads, int accuracy) {
-    // Initialize distances and indices arrays
-    cilk_for (int i = 0; i < dataset_length * k; i++) {
-        distances[i] = FLT_MAX; // Initialize distances to large values
-        indices[i] = -1;        // Initialize indices to invalid values
+void knn_approx_opencilk(const float* dataset, int k, knn_idx_t* indices, float* distances, 
+                         size_t dataset_length, int d, int num_of_threads, int accuracy) {
+    if (knn_check_extents("knn_approx_opencilk", dataset_length, d, k) != 0) {
+        return;
     }
 
-    // Define the block size for each task based on dataset size and number of threads
-    int block_size = (dataset_length + num_of_threads - 1) / num_of_threads;
-
-    // Create a loop to divide the dataset and handle each chunk in parallel
-    cilk_for (int t = 0; t < num_of_threads; t++) {
-        int start = t * block_size;
-        int end = (start + block_size > dataset_length) ? dataset_length : (start + block_size);
-
-        // Allocate memory for the subset of the dataset
-        int subset_count = end - start;
-        float* subset_data = (float*)malloc(subset_count * d * sizeof(float));
-        int* subset_knn_indices = (int*)malloc(subset_count * k * sizeof(int));
-        float* subset_knn_distances = (float*)malloc(subset_count * k * sizeof(float));
-
-        if (!subset_data || !subset_knn_indices || !subset_knn_distances) {
-            fprintf(stderr, "Memory allocation failed for task %d.\n", t);
-            free(subset_data);
-            free(subset_knn_indices);
-            free(subset_knn_distances);
-        }
+    // Divide the dataset into one contiguous slice per task: the exact kernel runs on it without a copy
+    knn_partition_t layout;
+    knn_merge_t merge;
+    if (knn_partition_ranges(dataset, dataset_length, num_of_threads, &layout) != 0) {
+        return;
+    }
+    if (knn_merge_init(&merge, indices, distances, dataset_length, k, 0) != 0) {
+        knn_partition_free(&layout);
+        return;
+    }
 
-        // Copy subset data
-        for (int i = 0; i < subset_count; i++) {
-            memcpy(&subset_data[i * d], &dataset[(start + i) * d], d * sizeof(float));
-        }
+    // Every task calls `cblas_sgemm`, so BLAS must not spawn its own threads (oversubscription)
+    blas_set_last_strategy(KNN_BLAS_SINGLE_PER_WORKER);
+    int blas_threads = blas_get_threads();
+    blas_set_threads(1);
 
-        // Perform exact k-NN search for the subset using a serial method
-        knn_exact_serial(subset_data, subset_data, 
-                         k, subset_knn_indices, subset_knn_distances, 
-                         subset_count, subset_count, d, 1);
+    // Every task owns the rows of its subset, so it merges them into the result without a race
+    cilk_for (int part = 0; part < layout.num_parts; part++) {
+        knn_partition_search_rows(&layout, d, part, layout.offsets[part],
+                                  layout.offsets[part + 1] - layout.offsets[part], &merge, num_of_threads);
+    }
 
-        // Write results back to the global distances and indices arrays
-        for (int i = 0; i < subset_count; i++) {
-            int original_idx = start + i;
-            for (int j = 0; j < k; j++) {
-                int offset = original_idx * k + j;
-                // Use a lock-free update mechanism to ensure thread safety
-                if (subset_knn_distances[i * k + j] < distances[offset]) {
-                    distances[offset] = subset_knn_distances[i * k + j];
-                    indices[offset] = start + subset_knn_indices[i * k + j];
-                }
-            }
-        }
+    blas_set_threads(blas_threads);
 
-        // Cleanup
-        free(subset_data);
-        free(subset_knn_indices);
-        free(subset_knn_distances);
-    }
+    // The rows of subsets smaller than k (or of failed tasks) get their exact k-NN
+    knn_merge_finish(&merge, dataset, d, num_of_threads);
 
-    // After parallel processing, perform a final pass to ensure correct distance comparisons
-    for (int i = 0; i < dataset_length; i++) {
-        for (int j = 0; j < k; j++) {
-            // Check all tasks for potential better values
-            for (int t = 0; t < num_of_threads; t++) {
-                int offset = i * k + j;
-                if (distances[offset] > distances[offset]) {
-                    distances[offset] = distances[offset];
-                    indices[offset] = indices[offset];
-                }
-            }
-        }
-    }
+    knn_merge_free(&merge);
+    knn_partition_free(&layout);
 }
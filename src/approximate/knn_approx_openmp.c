@@ -1,65 +1,40 @@
 #include "../../include/approximate/knn_approx_openmp.h"
 
-void knn_approx_openmp(const float* dataset, int k, int* indices, float* distances, 
-                       int dataset_length, int d, int num_of_threads, int accuracy) {
-    // Initialize distances and indices arrays
-    #pragma omp parallel for num_threads(num_of_threads)
-    for (int i = 0; i < dataset_length * k; i++) {
-        distances[i] = FLT_MAX; // Initialize distances to large values
-        indices[i] = -1;        // Initialize indices to invalid values
+void knn_approx_openmp(const float* dataset, int k, knn_idx_t* indices, float* distances, 
+                       size_t dataset_length, int d, int num_of_threads, int accuracy) {
+    if (knn_check_extents("knn_approx_openmp", dataset_length, d, k) != 0) {
+        return;
     }
 
-    // Parallel processing with OpenMP
-    #pragma omp parallel num_threads(num_of_threads)
-    {
-        int thread_id = omp_get_thread_num();
-        int total_threads = omp_get_num_threads();
-        int block_size = (dataset_length + total_threads - 1) / total_threads;
-
-        int start = thread_id * block_size;
-        int end = (start + block_size > dataset_length) ? dataset_length : (start + block_size);
-
-        // Allocate memory for the subset of the dataset
-        int subset_count = end - start;
-        float* subset_data = (float*)malloc(subset_count * d * sizeof(float));
-        int* subset_knn_indices = (int*)malloc(subset_count * k * sizeof(int));
-        float* subset_knn_distances = (float*)malloc(subset_count * k * sizeof(float));
-
-        if (!subset_data || !subset_knn_indices || !subset_knn_distances) {
-            fprintf(stderr, "Memory allocation failed for thread %d.\n", thread_id);
-            free(subset_data);
-            free(subset_knn_indices);
-            free(subset_knn_distances);
-        }
+    // The subsets are contiguous slices of the dataset: the exact kernel runs on them without a copy
+    knn_partition_t layout;
+    knn_merge_t merge;
+    if (knn_partition_ranges(dataset, dataset_length, num_of_threads, &layout) != 0) {
+        return;
+    }
+    if (knn_merge_init(&merge, indices, distances, dataset_length, k, 0) != 0) {
+        knn_partition_free(&layout);
+        return;
+    }
 
-        // Copy subset data
-        for (int i = 0; i < subset_count; i++) {
-            memcpy(&subset_data[i * d], &dataset[(start + i) * d], d * sizeof(float));
-        }
+    // Every OpenMP thread calls `cblas_sgemm`, so BLAS must not spawn its own threads (oversubscription)
+    blas_set_last_strategy(KNN_BLAS_SINGLE_PER_WORKER);
+    int blas_threads = blas_get_threads();
+    blas_set_threads(1);
+
+    // Parallel processing with OpenMP: every subset is searched by one thread, which owns its rows and merges
+    // them into the result without synchronization
+    #pragma omp parallel for schedule(dynamic, 1) num_threads(num_of_threads)
+    for (int part = 0; part < layout.num_parts; part++) {
+        knn_partition_search_rows(&layout, d, part, layout.offsets[part],
+                                  layout.offsets[part + 1] - layout.offsets[part], &merge, num_of_threads);
+    }
 
-        // Perform exact k-NN search for the subset
-        knn_exact_serial(subset_data, subset_data, 
-                         k, subset_knn_indices, subset_knn_distances, 
-                         subset_count, subset_count, d, 1);
+    blas_set_threads(blas_threads);
 
-        // Write results back to the global distances and indices arrays
-        for (int i = 0; i < subset_count; i++) {
-            int original_idx = start + i;
-            for (int j = 0; j < k; j++) {
-                int offset = original_idx * k + j;
-                #pragma omp critical
-                {
-                    if (subset_knn_distances[i * k + j] < distances[offset]) {
-                        distances[offset] = subset_knn_distances[i * k + j];
-                        indices[offset] = start + subset_knn_indices[i * k + j];
-                    }
-                }
-            }
-        }
+    // The rows of subsets smaller than k (or of failed threads) get their exact k-NN
+    knn_merge_finish(&merge, dataset, d, num_of_threads);
 
-        // Cleanup
-        free(subset_data);
-        free(subset_knn_indices);
-        free(subset_knn_distances);
-    }
+    knn_merge_free(&merge);
+    knn_partition_free(&layout);
 }
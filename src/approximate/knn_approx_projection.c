@@ -0,0 +1,388 @@
+#include "../../include/approximate/knn_approx_projection.h"
+
+// Basis rows shorter than this (relative to their length before the orthogonalization) are linearly dependent
+// on the previous ones (e.g. a corpus of lower rank) and are replaced with random directions
+#define PROJECTION_DEPENDENT_ROW 1e-6
+
+typedef struct {
+    const knn_projection_t* projection;
+    const float*    query;
+    int             k;
+    int             candidates;
+    const knn_idx_t* candidate_ids;     // query_length x candidates
+    knn_idx_t*      indices;
+    float*          distances;
+    float*          heap_dist;          // num_of_threads x k
+    knn_idx_t*      heap_ids;           // num_of_threads x k
+} projection_rerank_ctx_t;
+
+
+// Standard normal (Box-Muller) of the counter-based generator, so the random basis is the same on every run
+static double projection_normal(uint64_t counter) {
+    double u1 = 1.0 - (knn_gen_random(KNN_PROJECTION_SEED, 2 * counter) >> 11) * (1.0 / 9007199254740992.0);
+    double u2 = (knn_gen_random(KNN_PROJECTION_SEED, 2 * counter + 1) >> 11) * (1.0 / 9007199254740992.0);
+    return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+
+// Orthonormalize the rows of `basis` (rows x d) with the modified Gram-Schmidt process, in double precision.
+// Every row is orthogonalized twice, which keeps it orthogonal to the previous rows to the rounding error.
+static int orthonormalize(float* basis, int rows, int d, uint64_t* counter) {
+    double* v = (double*)malloc(d * sizeof(double));
+    if (v == NULL) {
+        fprintf(stderr, "knn_projection_build: Memory allocation failed\n");
+        return -1;
+    }
+
+    for (int i = 0; i < rows; i++) {
+        float* row = &basis[(size_t)i * d];
+        for (int attempt = 0; ; attempt++) {
+            double length = 0.0;
+            for (int c = 0; c < d; c++) {
+                v[c] = row[c];
+                length += v[c] * v[c];
+            }
+            for (int pass = 0; pass < 2; pass++) {
+                for (int j = 0; j < i; j++) {
+                    const float* prev = &basis[(size_t)j * d];
+                    double dot = 0.0;
+                    for (int c = 0; c < d; c++) { dot += v[c] * prev[c]; }
+                    for (int c = 0; c < d; c++) { v[c] -= dot * prev[c]; }
+                }
+            }
+            double norm = 0.0;
+            for (int c = 0; c < d; c++) { norm += v[c] * v[c]; }
+
+            if (norm > 0.0 && norm > PROJECTION_DEPENDENT_ROW * PROJECTION_DEPENDENT_ROW * length) {
+                double scale = 1.0 / sqrt(norm);
+                for (int c = 0; c < d; c++) { row[c] = (float)(v[c] * scale); }
+                break;
+            }
+            if (attempt == 8) {
+                fprintf(stderr, "knn_projection_build: Failed to orthonormalize the basis\n");
+                free(v);
+                return -1;
+            }
+            for (int c = 0; c < d; c++) { row[c] = (float)projection_normal((*counter)++); }
+        }
+    }
+
+    free(v);
+    return 0;
+}
+
+
+// out (rows x reduced_d) = points (rows x d) x basis^T, in blocks whose sizes fit the int arguments of `cblas_sgemm`
+static void project_rows(const float* points, size_t rows, int d, const float* basis, int reduced_d, float* out) {
+    for (size_t r = 0; r < rows; r += KNN_BLAS_MAX_DIM) {
+        size_t length = (r + KNN_BLAS_MAX_DIM < rows) ? KNN_BLAS_MAX_DIM : (rows - r);
+        cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans,
+                    (int)length, reduced_d, d,
+                    1.0f, &points[r * d], d, basis, d,
+                    0.0f, &out[r * reduced_d], reduced_d);
+    }
+}
+
+
+// Top `reduced_d` principal directions of the corpus: subspace iteration on the covariance of a corpus sample
+static int learn_pca(const float* corpus, size_t corpus_length, int d, float* basis, int reduced_d, uint64_t* counter) {
+    size_t samples = (corpus_length < KNN_PROJECTION_SAMPLE_ROWS) ? corpus_length : KNN_PROJECTION_SAMPLE_ROWS;
+    float*  centered   = (float*)malloc(samples * d * sizeof(float));
+    float*  covariance = (float*)malloc((size_t)d * d * sizeof(float));
+    float*  product    = (float*)malloc((size_t)reduced_d * d * sizeof(float));
+    double* mean       = (double*)calloc(d, sizeof(double));
+    if (!centered || !covariance || !product || !mean) {
+        fprintf(stderr, "knn_projection_build: Memory allocation failed for the covariance (d = %d)\n", d);
+        free(centered);
+        free(covariance);
+        free(product);
+        free(mean);
+        return -1;
+    }
+
+    // Evenly spaced rows, so a sorted or clustered corpus is sampled over its whole range
+    for (size_t s = 0; s < samples; s++) {
+        const float* row = &corpus[(s * corpus_length / samples) * d];
+        memcpy(&centered[s * d], row, d * sizeof(float));
+        for (int c = 0; c < d; c++) { mean[c] += row[c]; }
+    }
+    for (int c = 0; c < d; c++) { mean[c] /= (double)samples; }
+    for (size_t s = 0; s < samples; s++) {
+        for (int c = 0; c < d; c++) { centered[s * d + c] -= (float)mean[c]; }
+    }
+
+    // covariance = centered^T x centered (the scale does not matter, the basis is normalized)
+    cblas_sgemm(CblasRowMajor, CblasTrans, CblasNoTrans, d, d, (int)samples,
+                1.0f / (float)samples, centered, d, centered, d, 0.0f, covariance, d);
+
+    // Every iteration multiplies the basis by the covariance: the directions of large variance grow fastest
+    int status = orthonormalize(basis, reduced_d, d, counter);
+    for (int it = 0; status == 0 && it < KNN_PROJECTION_ITERATIONS; it++) {
+        cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, reduced_d, d, d,
+                    1.0f, basis, d, covariance, d, 0.0f, product, d);
+        memcpy(basis, product, (size_t)reduced_d * d * sizeof(float));
+        status = orthonormalize(basis, reduced_d, d, counter);
+    }
+
+    free(centered);
+    free(covariance);
+    free(product);
+    free(mean);
+    return status;
+}
+
+
+knn_projection_t* knn_projection_build(const float* corpus, size_t corpus_length, int d, int reduced_d,
+                                       knn_projection_method_t method, int num_of_threads) {
+    if (knn_check_extents("knn_projection_build", corpus_length, d, 1) != 0) {
+        return NULL;
+    }
+    if (reduced_d <= 0) {
+        reduced_d = d / KNN_PROJECTION_DEFAULT_RATIO;
+        if (reduced_d < KNN_PROJECTION_MIN_DIM) { reduced_d = KNN_PROJECTION_MIN_DIM; }
+    }
+    if (reduced_d > d) { reduced_d = d; }
+    num_of_threads = knn_resolve_threads(num_of_threads);
+
+    knn_projection_t* projection = (knn_projection_t*)calloc(1, sizeof(knn_projection_t));
+    if (projection) {
+        projection->basis   = (float*)malloc((size_t)reduced_d * d * sizeof(float));
+        projection->reduced = (float*)malloc(corpus_length * reduced_d * sizeof(float));
+    }
+    if (!projection || !projection->basis || !projection->reduced) {
+        fprintf(stderr, "knn_projection_build: Memory allocation failed\n");
+        knn_projection_free(projection);
+        return NULL;
+    }
+    projection->corpus        = corpus;
+    projection->corpus_length = corpus_length;
+    projection->d             = d;
+    projection->reduced_d     = reduced_d;
+    projection->method        = method;
+
+    // A few big GEMMs: OpenBLAS uses the threads
+    int blas_threads = blas_get_threads();
+    blas_set_threads(num_of_threads);
+
+    uint64_t counter = 0;
+    for (size_t i = 0; i < (size_t)reduced_d * d; i++) {
+        projection->basis[i] = (float)projection_normal(counter++);
+    }
+    int status = (method == KNN_PROJECTION_PCA) ? learn_pca(corpus, corpus_length, d, projection->basis, reduced_d, &counter)
+                                                : orthonormalize(projection->basis, reduced_d, d, &counter);
+    if (status == 0) {
+        project_rows(corpus, corpus_length, d, projection->basis, reduced_d, projection->reduced);
+    }
+
+    blas_set_threads(blas_threads);
+    if (status != 0) {
+        knn_projection_free(projection);
+        return NULL;
+    }
+    return projection;
+}
+
+
+// Full-dimension distances of the candidates of the queries [start, end), and their k nearest
+static void rerank_queries(void* ctx, int t, size_t start, size_t end) {
+    projection_rerank_ctx_t* c = (projection_rerank_ctx_t*)ctx;
+    const knn_projection_t* projection = c->projection;
+    int d = projection->d;
+    int k = c->k;
+    float*     heap_dist = &c->heap_dist[(size_t)t * k];
+    knn_idx_t* heap_ids  = &c->heap_ids[(size_t)t * k];
+
+    for (size_t q = start; q < end; q++) {
+        const float* query = &c->query[q * d];
+        const knn_idx_t* candidates = &c->candidate_ids[q * c->candidates];
+        int size = 0;
+        for (int j = 0; j < c->candidates; j++) {
+            const float* row = &projection->corpus[(size_t)candidates[j] * d];
+            double sum = 0.0;
+            for (int x = 0; x < d; x++) {
+                double diff = (double)query[x] - row[x];
+                sum += diff * diff;
+            }
+            knn_heap_push(heap_dist, heap_ids, &size, k, (float)sum, candidates[j]);
+        }
+        knn_heap_sort(heap_dist, heap_ids, size);
+        for (int j = 0; j < k; j++) {
+            c->indices[q * k + j]   = heap_ids[j];
+            c->distances[q * k + j] = sqrtf(heap_dist[j]);
+        }
+    }
+}
+
+
+int knn_projection_search(const knn_projection_t* projection, const float* query, int k, int candidates,
+                          knn_idx_t* indices, float* distances, size_t query_length, int num_of_threads) {
+    if (projection == NULL || knn_check_extents("knn_projection_search", projection->corpus_length, projection->d, k) != 0) {
+        return -1;
+    }
+    if (query_length == 0) {
+        return 0;
+    }
+    if (candidates <= 0) { candidates = KNN_PROJECTION_CANDIDATES * k; }
+    if (candidates < k) { candidates = k; }
+    if ((size_t)candidates > projection->corpus_length) { candidates = (int)projection->corpus_length; }
+    num_of_threads = knn_resolve_threads(num_of_threads);
+
+    int reduced_d = projection->reduced_d;
+    float*     reduced_query = (float*)malloc(query_length * reduced_d * sizeof(float));
+    knn_idx_t* candidate_ids = (knn_idx_t*)malloc(query_length * candidates * sizeof(knn_idx_t));
+    float*     candidate_dst = (float*)malloc(query_length * candidates * sizeof(float));
+    float*     heap_dist     = (float*)malloc((size_t)num_of_threads * k * sizeof(float));
+    knn_idx_t* heap_ids      = (knn_idx_t*)malloc((size_t)num_of_threads * k * sizeof(knn_idx_t));
+    if (!reduced_query || !candidate_ids || !candidate_dst || !heap_dist || !heap_ids) {
+        fprintf(stderr, "knn_projection_search: Memory allocation failed for %zu queries\n", query_length);
+        free(reduced_query);
+        free(candidate_ids);
+        free(candidate_dst);
+        free(heap_dist);
+        free(heap_ids);
+        return -1;
+    }
+
+    int blas_threads = blas_get_threads();
+    blas_set_threads(num_of_threads);
+    project_rows(query, query_length, projection->d, projection->basis, reduced_d, reduced_query);
+    blas_set_threads(blas_threads);
+
+    // Candidates: the GEMM over the corpus runs in the reduced dimension
+    int status = knn_exact_pthread_with_config(projection->reduced, reduced_query, candidates, candidate_ids,
+                                               candidate_dst, projection->corpus_length, query_length, reduced_d,
+                                               num_of_threads, NULL);
+    if (status != 0) {
+        fprintf(stderr, "knn_projection_search: The search in the reduced space failed\n");
+        free(reduced_query);
+        free(candidate_ids);
+        free(candidate_dst);
+        free(heap_dist);
+        free(heap_ids);
+        return -1;
+    }
+
+    projection_rerank_ctx_t ctx = {
+        .projection     = projection,
+        .query          = query,
+        .k              = k,
+        .candidates     = candidates,
+        .candidate_ids  = candidate_ids,
+        .indices        = indices,
+        .distances      = distances,
+        .heap_dist      = heap_dist,
+        .heap_ids       = heap_ids,
+    };
+    status = knn_parallel_ranges(rerank_queries, &ctx, query_length, num_of_threads);
+
+    free(reduced_query);
+    free(candidate_ids);
+    free(candidate_dst);
+    free(heap_dist);
+    free(heap_ids);
+    return status;
+}
+
+
+// Parameters of a saved projection (the META section)
+typedef struct {
+    int32_t         d;
+    int32_t         reduced_d;
+    int32_t         method;
+    int32_t         reserved;
+    uint64_t        corpus_length;
+    uint64_t        corpus_hash;        // knn_hash_bytes of the corpus the projection was learned from
+} projection_snapshot_meta_t;
+
+
+int knn_projection_save(const knn_projection_t* projection, const char* filename) {
+    projection_snapshot_meta_t meta = {
+        .d             = projection->d,
+        .reduced_d     = projection->reduced_d,
+        .method        = projection->method,
+        .corpus_length = projection->corpus_length,
+        .corpus_hash   = knn_hash_bytes(projection->corpus, projection->corpus_length * projection->d * sizeof(float), 0),
+    };
+    knn_snapshot_section_t sections[] = {
+        { KNN_SNAPSHOT_META,              &meta,               sizeof(meta) },
+        { KNN_SNAPSHOT_PROJECTION_BASIS,  projection->basis,   (size_t)projection->reduced_d * projection->d * sizeof(float) },
+        { KNN_SNAPSHOT_PROJECTION_CORPUS, projection->reduced, projection->corpus_length * projection->reduced_d * sizeof(float) },
+    };
+    return knn_snapshot_save(filename, KNN_SNAPSHOT_KIND_PROJECTION, sections, (int)(sizeof(sections) / sizeof(sections[0])));
+}
+
+
+knn_projection_t* knn_projection_load(const char* filename, const float* corpus, size_t corpus_length, int d,
+                                      int verify, int num_of_threads) {
+    if (knn_check_extents("knn_projection_load", corpus_length, d, 1) != 0) {
+        return NULL;
+    }
+    knn_snapshot_t* snapshot = knn_snapshot_open(filename, KNN_SNAPSHOT_KIND_PROJECTION, verify);
+    if (snapshot == NULL) {
+        return NULL;
+    }
+    const projection_snapshot_meta_t* meta = (const projection_snapshot_meta_t*)knn_snapshot_section(snapshot, KNN_SNAPSHOT_META, sizeof(projection_snapshot_meta_t));
+    const char* error = NULL;
+    if (meta == NULL) {
+        error = "missing parameters";
+    } else if (meta->corpus_length != corpus_length || meta->d != d) {
+        error = "learned from a corpus of another shape";
+    } else if (meta->reduced_d <= 0 || meta->reduced_d > d) {
+        error = "inconsistent parameters";
+    } else if (meta->corpus_hash != knn_hash_bytes(corpus, corpus_length * d * sizeof(float), num_of_threads)) {
+        error = "learned from another corpus";
+    }
+    if (error != NULL) {
+        fprintf(stderr, "knn_projection_load: %s: %s\n", filename, error);
+        knn_snapshot_close(snapshot);
+        return NULL;
+    }
+
+    knn_projection_t* projection = (knn_projection_t*)calloc(1, sizeof(knn_projection_t));
+    if (projection == NULL) {
+        fprintf(stderr, "knn_projection_load: Memory allocation failed\n");
+        knn_snapshot_close(snapshot);
+        return NULL;
+    }
+    projection->corpus        = corpus;
+    projection->corpus_length = corpus_length;
+    projection->d             = d;
+    projection->reduced_d     = meta->reduced_d;
+    projection->method        = (knn_projection_method_t)meta->method;
+    projection->snapshot      = snapshot;
+
+    // The arrays are read-only: the search never writes them
+    projection->basis   = (float*)knn_snapshot_section(snapshot, KNN_SNAPSHOT_PROJECTION_BASIS, (size_t)projection->reduced_d * d * sizeof(float));
+    projection->reduced = (float*)knn_snapshot_section(snapshot, KNN_SNAPSHOT_PROJECTION_CORPUS, corpus_length * projection->reduced_d * sizeof(float));
+    if (!projection->basis || !projection->reduced) {
+        fprintf(stderr, "knn_projection_load: %s: inconsistent sections\n", filename);
+        knn_projection_free(projection);
+        return NULL;
+    }
+    return projection;
+}
+
+
+void knn_projection_free(knn_projection_t* projection) {
+    if (projection == NULL) { return; }
+    if (projection->snapshot != NULL) {
+        knn_snapshot_close(projection->snapshot);
+    } else {
+        free(projection->basis);
+        free(projection->reduced);
+    }
+    free(projection);
+}
+
+
+void knn_approx_projection(const float* corpus, const float* query, int k, knn_idx_t* indices, float* distances, size_t corpus_length, size_t query_length, int d, int num_of_threads) {
+    if (knn_check_extents("knn_approx_projection", corpus_length, d, k) != 0) {
+        return;
+    }
+    knn_projection_t* projection = knn_projection_build(corpus, corpus_length, d, 0, KNN_PROJECTION_PCA, num_of_threads);
+    if (projection == NULL) {
+        return;
+    }
+    knn_projection_search(projection, query, k, 0, indices, distances, query_length, num_of_threads);
+    knn_projection_free(projection);
+}
@@ -1,124 +1,84 @@
 #include "../../include/approximate/knn_approx_pthread.h"
 
 typedef struct {
-    const float* dataset;
-    int* indices;
-    float* distances;
-    int* subset_indices;
-    int subset_count;
-    int k;
+    const knn_partition_t* layout;
+    knn_merge_t* merge;
+    int part;
     int d;
+    int num_of_threads;
+    int status;
 } knn_approx_thread_args_t;
 
 void* knn_approx_thread(void* args) {
     knn_approx_thread_args_t* thread_args = (knn_approx_thread_args_t*)args;
-
-    // Allocate space for reduced dataset
-    float* subset_data = (float*)malloc(thread_args->subset_count * thread_args->d * sizeof(float));
-    if (!subset_data) {
-        fprintf(stderr, "Memory allocation failed for subset data.\n");
-        pthread_exit(NULL);
-    }
-
-    // Copy subset data
-    for (int i = 0; i < thread_args->subset_count; i++) {
-        memcpy(&subset_data[i * thread_args->d], 
-               &thread_args->dataset[thread_args->subset_indices[i] * thread_args->d], 
-               thread_args->d * sizeof(float));
-    }
-
-    // Allocate memory for k-NN results for this subset
-    int* subset_knn_indices = (int*)malloc(thread_args->subset_count * thread_args->k * sizeof(int));
-    float* subset_knn_distances = (float*)malloc(thread_args->subset_count * thread_args->k * sizeof(float));
-    if (!subset_knn_indices || !subset_knn_distances) {
-        fprintf(stderr, "Memory allocation failed for k-NN results.\n");
-        free(subset_data);
-        pthread_exit(NULL);
-    }
-
-    // Initialize distances to large values
-    for (int i = 0; i < thread_args->subset_count * thread_args->k; i++) {
-        subset_knn_distances[i] = FLT_MAX;
-        subset_knn_indices[i] = -1;
-    }
-
-    // Perform exact k-NN search for the subset
-    knn_exact_serial(subset_data, subset_data, 
-                     thread_args->k, subset_knn_indices, subset_knn_distances, 
-                     thread_args->subset_count, thread_args->subset_count, 
-                     thread_args->d, 1); // Use serial computation for each thread
-
-    // Map the subset results back to global indices and distances
-    for (int i = 0; i < thread_args->subset_count; i++) {
-        int original_idx = thread_args->subset_indices[i];
-        for (int j = 0; j < thread_args->k; j++) {
-            thread_args->indices[original_idx * thread_args->k + j] = 
-                thread_args->subset_indices[subset_knn_indices[i * thread_args->k + j]];
-            thread_args->distances[original_idx * thread_args->k + j] = 
-                subset_knn_distances[i * thread_args->k + j];
-        }
-    }
-
-    // Cleanup
-    free(subset_data);
-    free(subset_knn_indices);
-    free(subset_knn_distances);
+    const knn_partition_t* layout = thread_args->layout;
+    int part = thread_args->part;
+
+    // Perform exact k-NN search for the subset (a contiguous slice of the layout, so without a copy). Every
+    // thread owns the rows of its subset, so it merges them into the result without locks.
+    thread_args->status = knn_partition_search_rows(layout, thread_args->d, part, layout->offsets[part],
+                                                    layout->offsets[part + 1] - layout->offsets[part],
+                                                    thread_args->merge, thread_args->num_of_threads);
     pthread_exit(NULL);
 }
 
-void knn_approx_pthread(const float* dataset, int k, int* indices, float* distances, 
-                        int dataset_length, int d, int num_of_threads, int accuracy) {
-    // Allocate memory for distances and indices arrays
-    for (int i = 0; i < dataset_length * k; i++) {
-        distances[i] = FLT_MAX; // Initialize distances to large values
-        indices[i] = -1;        // Initialize indices to invalid values
+void knn_approx_pthread(const float* dataset, int k, knn_idx_t* indices, float* distances, 
+                        size_t dataset_length, int d, int num_of_threads, int accuracy) {
+    if (knn_check_extents("knn_approx_pthread", dataset_length, d, k) != 0) {
+        return;
     }
 
-    // Split dataset into subsets for threads
-    int block_size = (dataset_length + num_of_threads - 1) / num_of_threads;
+    // Split dataset into subsets for threads (contiguous ranges, so the layout is the dataset itself)
+    knn_partition_t layout;
+    knn_merge_t merge;
     pthread_t* threads = (pthread_t*)malloc(num_of_threads * sizeof(pthread_t));
     knn_approx_thread_args_t* thread_args = (knn_approx_thread_args_t*)malloc(num_of_threads * sizeof(knn_approx_thread_args_t));
+    if (!threads || !thread_args || knn_partition_ranges(dataset, dataset_length, num_of_threads, &layout) != 0) {
+        fprintf(stderr, "Memory allocation failed for the threads.\n");
+        free(threads);
+        free(thread_args);
+        return;
+    }
+    if (knn_merge_init(&merge, indices, distances, dataset_length, k, 0) != 0) {
+        free(threads);
+        free(thread_args);
+        knn_partition_free(&layout);
+        return;
+    }
 
-    for (int t = 0; t < num_of_threads; t++) {
-        int start = t * block_size;
-        int end = (start + block_size > dataset_length) ? dataset_length : (start + block_size);
+    // Every thread calls `cblas_sgemm`, so BLAS must not spawn its own threads (oversubscription)
+    blas_set_last_strategy(KNN_BLAS_SINGLE_PER_WORKER);
+    int blas_threads = blas_get_threads();
+    blas_set_threads(1);
 
-        thread_args[t].dataset = dataset;
-        thread_args[t].indices = indices;
-        thread_args[t].distances = distances;
-        thread_args[t].subset_count = end - start;
-        thread_args[t].subset_indices = (int*)malloc(thread_args[t].subset_count * sizeof(int));
-        thread_args[t].k = k;
+    int created = 0;
+    for (int t = 0; t < num_of_threads; t++) {
+        thread_args[t].layout = &layout;
+        thread_args[t].merge = &merge;
+        thread_args[t].part = t;
         thread_args[t].d = d;
+        thread_args[t].num_of_threads = num_of_threads;
+        thread_args[t].status = 0;
 
-        for (int i = 0; i < thread_args[t].subset_count; i++) {
-            thread_args[t].subset_indices[i] = start + i;
+        if (pthread_create(&threads[created], NULL, knn_approx_thread, &thread_args[t]) == 0) {
+            created++;
+        } else {
+            fprintf(stderr, "Failed to create thread %d (its subset is searched exactly).\n", t);
         }
-
-        pthread_create(&threads[t], NULL, knn_approx_thread, &thread_args[t]);
     }
 
     // Wait for all threads to complete
-    for (int t = 0; t < num_of_threads; t++) {
+    for (int t = 0; t < created; t++) {
         pthread_join(threads[t], NULL);
-        free(thread_args[t].subset_indices); // Free the subset indices
     }
+    blas_set_threads(blas_threads);
 
-    // Verification step (single-threaded)
-    for (int i = 0; i < dataset_length; i++) {
-        for (int j = 0; j < k; j++) {
-            // Ensure correct distance comparisons
-            for (int t = 0; t < num_of_threads; t++) {
-                int offset = i * k + j;
-                if (thread_args[t].distances[offset] < distances[offset]) {
-                    distances[offset] = thread_args[t].distances[offset];
-                    indices[offset] = thread_args[t].indices[offset];
-                }
-            }
-        }
-    }
+    // The rows of subsets smaller than k (or of failed threads) get their exact k-NN
+    knn_merge_finish(&merge, dataset, d, num_of_threads);
 
     // Cleanup
     free(threads);
     free(thread_args);
-}
\ No newline at end of file
+    knn_merge_free(&merge);
+    knn_partition_free(&layout);
+}
@@ -1,10 +1,11 @@
 #include "../../include/approximate/knn_approx_serial.h"
 
-void merge_k_smallest(int k, const float* existing_distances, const int* existing_indices, 
-                      const float* new_distances, const int* new_indices, 
-                      float* final_distances, int* final_indices) {
+void merge_k_smallest(int k, const float* existing_distances, const knn_idx_t* existing_indices, 
+                      const float* new_distances, const knn_idx_t* new_indices, 
+                      float* final_distances, knn_idx_t* final_indices) {
     int i = 0, j = 0, l = 0;
 
+    KNN_STATS_BEGIN(KNN_PHASE_MERGE);
     while (l < k) {
         if (i < k && (j >= k || existing_distances[i] <= new_distances[j])) {
             final_distances[l] = existing_distances[i];
@@ -17,10 +18,11 @@ void merge_k_smallest(int k, const float* existing_distances, const int* existin
         }
         l++;
     }
+    KNN_STATS_END(KNN_PHASE_MERGE, 3 * (size_t)k * (sizeof(knn_idx_t) + sizeof(float)));
 }
 
 void split_dataset(const float* dataset, float* distances_from_hyperplane, 
-                            int dataset_length, int d, int num_of_threads, int accuracy, float* _norm_) {
+                            size_t dataset_length, int d, int num_of_threads, int accuracy, float* _norm_) {
     // Allocate space for midpoints
     float* mean_points = (float*)malloc(3 * d * sizeof(float));
     if (!mean_points) {
@@ -47,7 +49,7 @@ void split_dataset(const float* dataset, float* distances_from_hyperplane,
         }
 
         // Compute mean of the first half of the dataset
-        for (int i = 0; i < dataset_length / tmp; i++) {
+        for (size_t i = 0; i < dataset_length / tmp; i++) {
             for (int j = 0; j < d; j++) {
                 mean_points[j] += dataset[i * d + j];
             }
@@ -57,7 +59,7 @@ void split_dataset(const float* dataset, float* distances_from_hyperplane,
         }
 
         // Compute mean of the second half of the dataset
-        for (int i = dataset_length / 2; i < dataset_length / 2 + dataset_length / tmp; i++) {
+        for (size_t i = dataset_length / 2; i < dataset_length / 2 + dataset_length / tmp; i++) {
             for (int j = 0; j < d; j++) {
                 mean_points[d + j] += dataset[i * d + j];
             }
@@ -83,13 +85,14 @@ void split_dataset(const float* dataset, float* distances_from_hyperplane,
     }
 
     // Compute the distance of each point from the hyperplane
-    for (int i = 0; i < dataset_length; i++) {
+    for (size_t i = 0; i < dataset_length; i++) {
         float dot_product = 0;
         for (int j = 0; j < d; j++) {
             dot_product += v[j] * (dataset[i * d + j] - mean_points[2 * d + j]);
         }
-        distances_from_hyperplane[i] = dot_product / v_norm;  // Store distance
+        distances_from_hyperplane[i] = (v_norm > 0) ? dot_product / v_norm : 0;  // Store distance
     }
+    *_norm_ = v_norm;
 
     // Cleanup
     free(mean_points);
@@ -97,154 +100,568 @@ void split_dataset(const float* dataset, float* distances_from_hyperplane,
 }
 
 
-void knn_approx_serial(const float* dataset, int k, int* indices, float* distances, 
-                       int dataset_length, int d, int num_of_threads, int accuracy) {
-    float* distances_from_hyperplane = (float*)malloc(dataset_length * sizeof(float));
-    if (!distances_from_hyperplane) {
-        fprintf(stderr, "Memory allocation failed for distances_from_hyperplane.\n");
-        return;
+int knn_partition_ranges(const float* dataset, size_t dataset_length, int num_parts, knn_partition_t* layout) {
+    memset(layout, 0, sizeof(*layout));
+    layout->offsets = (size_t*)malloc((num_parts + 1) * sizeof(size_t));
+    if (!layout->offsets) {
+        fprintf(stderr, "Memory allocation failed for the partition layout.\n");
+        return -1;
     }
+    layout->num_parts = num_parts;
+    layout->data      = dataset;
+
+    // Same ranges as the blocks of ceil(dataset_length / num_parts) rows of the parallel backends
+    size_t block_size = (dataset_length + num_parts - 1) / num_parts;
+    for (int p = 0; p <= num_parts; p++) {
+        size_t offset = (size_t)p * block_size;
+        layout->offsets[p] = (offset > dataset_length) ? dataset_length : offset;
+    }
+    return 0;
+}
 
-    // Step 2: Calculate n_norm (distance of helper midpoints)
-    float n_norm = 0;
-
-    // Step 1: Split dataset into three parts using `split_dataset`
-    split_dataset(dataset, distances_from_hyperplane, dataset_length, d, num_of_threads, accuracy, &n_norm);
 
-    // Step 3: Partition dataset based on the distances from the hyperplane
-    int* part1_indices = (int*)malloc(dataset_length * sizeof(int));
-    int* part2_indices = (int*)malloc(dataset_length * sizeof(int));
-    int* part3_indices = (int*)malloc(dataset_length * sizeof(int));
-    if (!part1_indices || !part2_indices || !part3_indices) {
-        fprintf(stderr, "Memory allocation failed for subsets.\n");
-        free(distances_from_hyperplane);
-        free(part1_indices);
-        free(part2_indices);
-        free(part3_indices);
-        return;
+int knn_merge_init(knn_merge_t* merge, knn_idx_t* indices, float* distances, size_t dataset_length, int k, int overlap) {
+    memset(merge, 0, sizeof(*merge));
+    merge->counts = (int*)calloc(dataset_length > 0 ? dataset_length : 1, sizeof(int));
+    if (!merge->counts) {
+        fprintf(stderr, "Memory allocation failed for the merge of the k-NN lists.\n");
+        return -1;
+    }
+    merge->indices        = indices;
+    merge->distances      = distances;
+    merge->dataset_length = dataset_length;
+    merge->k              = k;
+    merge->overlap        = overlap;
+    if (overlap) {
+        for (int l = 0; l < KNN_MERGE_LOCKS; l++) {
+            pthread_mutex_init(&merge->locks[l], NULL);
+        }
     }
+    return 0;
+}
 
-    int part1_count = 0, part2_count = 0, part3_count = 0;
-    for (int i = 0; i < dataset_length; i++) {
-        if (distances_from_hyperplane[i] < -n_norm) {
-            part1_indices[part1_count++] = i;
+
+int knn_merge_add(knn_merge_t* merge, size_t row, const knn_idx_t* ids, const float* dists, int count) {
+    int k = merge->k;
+    knn_idx_t stack_ids[KNN_MERGE_STACK_K];
+    float     stack_dists[KNN_MERGE_STACK_K];
+    knn_idx_t* merged_ids   = stack_ids;
+    float*     merged_dists = stack_dists;
+    if (k > KNN_MERGE_STACK_K) {
+        merged_ids   = (knn_idx_t*)malloc(k * sizeof(knn_idx_t));
+        merged_dists = (float*)malloc(k * sizeof(float));
+        if (!merged_ids || !merged_dists) {
+            fprintf(stderr, "knn_merge_add: Memory allocation failed\n");
+            free(merged_ids);
+            free(merged_dists);
+            return -1;
         }
-        if (distances_from_hyperplane[i] > n_norm) {
-            part2_indices[part2_count++] = i;
+    }
+
+    KNN_STATS_BEGIN(KNN_PHASE_MERGE);
+    pthread_mutex_t* lock = merge->overlap ? &merge->locks[row % KNN_MERGE_LOCKS] : NULL;
+    if (lock) { pthread_mutex_lock(lock); }
+
+    knn_idx_t* row_ids   = &merge->indices[row * k];
+    float*     row_dists = &merge->distances[row * k];
+    int have = merge->counts[row];
+    int i = 0, j = 0, l = 0;
+    while (l < k && (i < have || j < count)) {
+        int existing = (j >= count) ||
+                       (i < have && (row_dists[i] < dists[j] || (row_dists[i] == dists[j] && row_ids[i] <= ids[j])));
+        knn_idx_t id   = existing ? row_ids[i]   : ids[j];
+        float     dist = existing ? row_dists[i] : dists[j];
+        if (existing) { i++; } else { j++; }
+
+        // Overlapping partitions find a neighbor more than once (at distances that may differ by rounding)
+        int duplicate = 0;
+        for (int s = l - 1; merge->overlap && s >= 0 && !duplicate; s--) {
+            duplicate = (merged_ids[s] == id);
         }
-        if (fabs(distances_from_hyperplane[i]) <= n_norm) {
-            part3_indices[part3_count++] = i;
+        if (!duplicate) {
+            merged_ids[l]   = id;
+            merged_dists[l] = dist;
+            l++;
         }
     }
+    memcpy(row_ids, merged_ids, l * sizeof(knn_idx_t));
+    memcpy(row_dists, merged_dists, l * sizeof(float));
+    merge->counts[row] = l;
 
-    // Create reduced datasets for each part
-    float* part1_data = (float*)malloc(part1_count * d * sizeof(float));
-    float* part2_data = (float*)malloc(part2_count * d * sizeof(float));
-    float* part3_data = (float*)malloc(part3_count * d * sizeof(float));
+    if (lock) { pthread_mutex_unlock(lock); }
+    KNN_STATS_END(KNN_PHASE_MERGE, 3 * (size_t)(have + count) * (sizeof(knn_idx_t) + sizeof(float)));
 
-    if (!part1_data || !part2_data || !part3_data) {
-        fprintf(stderr, "Memory allocation failed for reduced datasets.\n");
-        free(distances_from_hyperplane);
-        free(part1_indices);
-        free(part2_indices);
-        free(part3_indices);
-        free(part1_data);
-        free(part2_data);
-        free(part3_data);
-        return;
+    if (merged_ids != stack_ids) {
+        free(merged_ids);
+        free(merged_dists);
+    }
+    return 0;
+}
+
+
+long knn_merge_finish(knn_merge_t* merge, const float* dataset, int d, int num_of_threads) {
+    int k = merge->k;
+    size_t missing = 0;
+    for (size_t i = 0; i < merge->dataset_length; i++) {
+        missing += (merge->counts[i] < k);
+    }
+    if (missing == 0) {
+        return 0;
     }
 
-    for (int i = 0; i < part1_count; i++) {
-        memcpy(&part1_data[i * d], &dataset[part1_indices[i] * d], d * sizeof(float));
+    size_t* rows = (size_t*)malloc(missing * sizeof(size_t));
+    float* query = (float*)malloc(missing * d * sizeof(float));
+    knn_idx_t* exact_indices = (knn_idx_t*)malloc(missing * k * sizeof(knn_idx_t));
+    float* exact_distances = (float*)malloc(missing * k * sizeof(float));
+    if (!rows || !query || !exact_indices || !exact_distances) {
+        fprintf(stderr, "knn_merge_finish: Memory allocation failed for %zu rows\n", missing);
+        free(rows);
+        free(query);
+        free(exact_indices);
+        free(exact_distances);
+        return -1;
     }
 
-    for (int i = 0; i < part2_count; i++) {
-        memcpy(&part2_data[i * d], &dataset[part2_indices[i] * d], d * sizeof(float));
+    size_t m = 0;
+    for (size_t i = 0; i < merge->dataset_length; i++) {
+        if (merge->counts[i] < k) {
+            rows[m] = i;
+            memcpy(&query[m * d], &dataset[i * d], d * sizeof(float));
+            m++;
+        }
+    }
+    if (knn_exact_pthread_with_config(dataset, query, k, exact_indices, exact_distances, merge->dataset_length, missing,
+                                      d, num_of_threads, NULL) != 0) {
+        fprintf(stderr, "knn_merge_finish: The exact search of %zu rows failed\n", missing);
+        free(rows);
+        free(query);
+        free(exact_indices);
+        free(exact_distances);
+        return -1;
     }
 
-    for (int i = 0; i < part3_count; i++) {
-        memcpy(&part3_data[i * d], &dataset[part3_indices[i] * d], d * sizeof(float));
+    for (size_t r = 0; r < missing; r++) {
+        memcpy(&merge->indices[rows[r] * k], &exact_indices[r * k], k * sizeof(knn_idx_t));
+        memcpy(&merge->distances[rows[r] * k], &exact_distances[r * k], k * sizeof(float));
+        merge->counts[rows[r]] = k;
+    }
+
+    free(rows);
+    free(query);
+    free(exact_indices);
+    free(exact_distances);
+    return (long)missing;
+}
+
+
+void knn_merge_free(knn_merge_t* merge) {
+    if (merge->overlap) {
+        for (int l = 0; l < KNN_MERGE_LOCKS; l++) {
+            pthread_mutex_destroy(&merge->locks[l]);
+        }
     }
+    free(merge->counts);
+    merge->counts = NULL;
+}
 
-    // Step 4: Process each subset using exact k-NN
-    int* part1_knn_indices = (int*)malloc(part1_count * k * sizeof(int));
-    float* part1_knn_distances = (float*)malloc(part1_count * k * sizeof(float));
-    knn_exact_pthread(part1_data, part1_data, k, part1_knn_indices, part1_knn_distances, 
-                     part1_count, part1_count, d, 2);
 
-    int* part2_knn_indices = (int*)malloc(part2_count * k * sizeof(int));
-    float* part2_knn_distances = (float*)malloc(part2_count * k * sizeof(float));
-    knn_exact_pthread(part2_data, part2_data, k, part2_knn_indices, part2_knn_distances, 
-                     part2_count, part2_count, d, 2);
+int knn_partition_search_rows(const knn_partition_t* layout, int d, int part, size_t query_start, size_t query_count,
+                              knn_merge_t* merge, int num_workers) {
+    size_t start = layout->offsets[part];
+    size_t rows  = layout->offsets[part + 1] - start;
+    if (query_count == 0 || rows == 0) {
+        return 0;
+    }
 
-    int* part3_knn_indices = (int*)malloc(part3_count * k * sizeof(int));
-    float* part3_knn_distances = (float*)malloc(part3_count * k * sizeof(float));
-    knn_exact_pthread(part3_data, part3_data, k, part3_knn_indices, part3_knn_distances, 
-                     part3_count, part3_count, d, 2);
+    // A partition smaller than k gives all its rows
+    int k = ((size_t)merge->k < rows) ? merge->k : (int)rows;
+    knn_idx_t* local_indices = (knn_idx_t*)malloc(query_count * k * sizeof(knn_idx_t));
+    float* local_distances = (float*)malloc(query_count * k * sizeof(float));
+    if (!local_indices || !local_distances) {
+        fprintf(stderr, "knn_partition_search_rows: Memory allocation failed for %zu rows\n", query_count);
+        free(local_indices);
+        free(local_distances);
+        return -1;
+    }
 
-    // Step 5: Assign results directly from the subsets
+    // Every worker may hold a distance matrix: `num_workers` splits the usable memory between them
+    knn_exact_serial(&layout->data[start * d], &layout->data[query_start * d], k, local_indices, local_distances,
+                     rows, query_count, d, num_workers);
 
-    // Assign results for Part 1
-    for (int i = 0; i < part1_count; i++) {
-        int original_idx = part1_indices[i]; // Map back to the original dataset index of the sample
+    int status = 0;
+    KNN_PERF_BEGIN(KNN_PERF_MERGE);
+    for (size_t i = 0; i < query_count; i++) {
+        knn_idx_t* neighbors = &local_indices[i * k];
         for (int j = 0; j < k; j++) {
-            indices[original_idx * k + j] = part1_indices[ part1_knn_indices[i * k + j] ]; // Map back to the original dataset index of the sample's neighbor
-            distances[original_idx * k + j] = part1_knn_distances[i * k + j];
+            neighbors[j] = knn_partition_id(layout, start + (size_t)neighbors[j]);
+        }
+        if (knn_merge_add(merge, (size_t)knn_partition_id(layout, query_start + i), neighbors,
+                          &local_distances[i * k], k) != 0) {
+            status = -1;
+            break;
         }
     }
+    KNN_PERF_END(KNN_PERF_MERGE);
 
-    // Assign results for Part 2
-    for (int i = 0; i < part2_count; i++) {
-        int original_idx = part2_indices[i];
-        for (int j = 0; j < k; j++) {
-            indices[original_idx * k + j] = part2_indices[ part2_knn_indices[i * k + j] ];
-            distances[original_idx * k + j] = part2_knn_distances[i * k + j];
+    free(local_indices);
+    free(local_distances);
+    return status;
+}
+
+
+int knn_partition_by_mask(const float* dataset, size_t dataset_length, int d, const unsigned char* masks,
+                          int num_parts, knn_partition_t* layout) {
+    memset(layout, 0, sizeof(*layout));
+    layout->offsets = (size_t*)calloc(num_parts + 1, sizeof(size_t));
+    size_t* cursor  = (size_t*)malloc(num_parts * sizeof(size_t));
+    if (!layout->offsets || !cursor) {
+        fprintf(stderr, "Memory allocation failed for the partition layout.\n");
+        free(cursor);
+        knn_partition_free(layout);
+        return -1;
+    }
+    layout->num_parts = num_parts;
+
+    for (size_t i = 0; i < dataset_length; i++) {
+        for (int p = 0; p < num_parts; p++) {
+            layout->offsets[p + 1] += (masks[i] >> p) & 1;
+        }
+    }
+    for (int p = 0; p < num_parts; p++) {
+        layout->offsets[p + 1] += layout->offsets[p];
+        cursor[p] = layout->offsets[p];
+    }
+
+    size_t rows = layout->offsets[num_parts];
+    layout->ids      = (knn_idx_t*)malloc((rows > 0 ? rows : 1) * sizeof(knn_idx_t));
+    layout->own_data = (float*)malloc((rows > 0 ? rows : 1) * d * sizeof(float));
+    if (!layout->ids || !layout->own_data) {
+        fprintf(stderr, "Memory allocation failed for the partition layout (%zu rows).\n", rows);
+        free(cursor);
+        knn_partition_free(layout);
+        return -1;
+    }
+    layout->data = layout->own_data;
+
+    for (size_t i = 0; i < dataset_length; i++) {
+        for (int p = 0; p < num_parts; p++) {
+            if ((masks[i] >> p) & 1) {
+                size_t row = cursor[p]++;
+                layout->ids[row] = (knn_idx_t)i;
+                memcpy(&layout->own_data[row * d], &dataset[i * d], d * sizeof(float));
+            }
+        }
+    }
+
+    free(cursor);
+    return 0;
+}
+
+
+static int compare_floats(const void* a, const void* b) {
+    float x = *(const float*)a;
+    float y = *(const float*)b;
+    return (x > y) - (x < y);
+}
+
+
+int knn_split_band(const float* dataset, const float* distances_from_hyperplane, size_t dataset_length, int d, int k,
+                   double target_recall, int num_of_threads, knn_split_plan_t* plan) {
+    const float* h = distances_from_hyperplane;
+    memset(plan, 0, sizeof(*plan));
+    plan->target_recall = (target_recall < 0.0) ? 0.0 : (target_recall > 1.0) ? 1.0 : target_recall;
+    plan->expected_recall = plan->recall_without_band = -1.0;
+
+    if (plan->target_recall > 0.0) {
+        // Every sampled row is its own nearest neighbor, and it is never missed: search one more and drop it
+        size_t sample_rows = (dataset_length < KNN_SPLIT_SAMPLE_ROWS) ? dataset_length : KNN_SPLIT_SAMPLE_ROWS;
+        int k_search = ((size_t)k < dataset_length) ? k + 1 : k;
+        size_t* rows = (size_t*)malloc(sample_rows * sizeof(size_t));
+        float* sample = (float*)calloc(sample_rows * d, sizeof(float));
+        knn_idx_t* sample_indices = (knn_idx_t*)malloc(sample_rows * k_search * sizeof(knn_idx_t));
+        float* sample_distances = (float*)malloc(sample_rows * k_search * sizeof(float));
+        float* needed = (float*)malloc(sample_rows * k * sizeof(float));
+        if (!rows || !sample || !sample_indices || !sample_distances || !needed) {
+            fprintf(stderr, "knn_split_band: Memory allocation failed for the sample.\n");
+            free(rows);
+            free(sample);
+            free(sample_indices);
+            free(sample_distances);
+            free(needed);
+            return -1;
         }
+
+        for (size_t i = 0; i < sample_rows; i++) {
+            rows[i] = i * dataset_length / sample_rows;
+            memcpy(&sample[i * d], &dataset[rows[i] * d], d * sizeof(float));
+        }
+        if (knn_exact_pthread_with_config(dataset, sample, k_search, sample_indices, sample_distances, dataset_length,
+                                          sample_rows, d, num_of_threads, NULL) != 0) {
+            fprintf(stderr, "knn_split_band: The exact search of the sample failed.\n");
+            free(rows);
+            free(sample);
+            free(sample_indices);
+            free(sample_distances);
+            free(needed);
+            return -1;
+        }
+
+        // The band that every true neighbor across the hyperplane needs: it is found if the row or the neighbor
+        // is in the band
+        size_t crossing = 0, total = 0;
+        for (size_t i = 0; i < sample_rows; i++) {
+            float hx = h[rows[i]];
+            int neighbors = 0;
+            for (int j = 0; j < k_search && neighbors < k; j++) {
+                knn_idx_t id = sample_indices[i * k_search + j];
+                if ((size_t)id == rows[i]) {
+                    continue;
+                }
+                float hy = h[id];
+                if ((hx < 0) != (hy < 0)) {
+                    needed[crossing++] = fminf(fabsf(hx), fabsf(hy));
+                }
+                neighbors++;
+            }
+            total += neighbors;
+        }
+        qsort(needed, crossing, sizeof(float), compare_floats);
+
+        // The narrowest band that misses at most (1 - target) of the sampled neighbors
+        size_t allowed = (size_t)floor((1.0 - plan->target_recall) * (double)total + 1e-9);
+        plan->band = (crossing > allowed) ? needed[crossing - allowed - 1] : 0.0f;
+
+        size_t missed = 0, missed_without_band = 0;
+        for (size_t c = 0; c < crossing; c++) {
+            missed += (needed[c] > plan->band);
+            missed_without_band += (needed[c] > 0.0f);
+        }
+        plan->expected_recall     = (total > 0) ? 1.0 - (double)missed / (double)total : 1.0;
+        plan->recall_without_band = (total > 0) ? 1.0 - (double)missed_without_band / (double)total : 1.0;
+        plan->sample_rows         = sample_rows;
+
+        free(rows);
+        free(sample);
+        free(sample_indices);
+        free(sample_distances);
+        free(needed);
+    }
+
+    // Cost of the exact k-NN of the parts: rows^2 x d each
+    size_t halves[2] = { 0, 0 };
+    for (size_t i = 0; i < dataset_length; i++) {
+        plan->part_rows[0] += (h[i] <= plan->band);
+        plan->part_rows[1] += (h[i] >= -plan->band);
+        halves[0] += (h[i] <= 0.0f);
+        halves[1] += (h[i] >= 0.0f);
+    }
+    double cost = (double)plan->part_rows[0] * plan->part_rows[0] + (double)plan->part_rows[1] * plan->part_rows[1];
+    double cost_without_band = (double)halves[0] * halves[0] + (double)halves[1] * halves[1];
+    plan->extra_cost = (cost_without_band > 0.0) ? cost / cost_without_band - 1.0 : 0.0;
+    return 0;
+}
+
+
+typedef struct {
+    const knn_partition_t*      layout;
+    int                         d;
+    knn_merge_t*                merge;
+    const knn_partition_task_t* tasks;
+    size_t                      num_tasks;
+    size_t                      next_task;      // Shared queue: the next task to take (atomic)
+    int                         num_workers;
+    int                         failed;         // Set (atomic) if a task failed
+} partition_search_ctx_t;
+
+
+static void* partition_worker(void* args) {
+    partition_search_ctx_t* c = (partition_search_ctx_t*)args;
+    size_t t;
+    while ((t = __atomic_fetch_add(&c->next_task, 1, __ATOMIC_RELAXED)) < c->num_tasks) {
+        const knn_partition_task_t* task = &c->tasks[t];
+        if (knn_partition_search_rows(c->layout, c->d, task->part, task->query_start, task->query_count,
+                                      c->merge, c->num_workers) != 0) {
+            __atomic_store_n(&c->failed, 1, __ATOMIC_RELAXED);
+        }
+    }
+    return NULL;
+}
+
+
+static int compare_tasks(const void* a, const void* b) {
+    double cost_a = ((const knn_partition_task_t*)a)->cost;
+    double cost_b = ((const knn_partition_task_t*)b)->cost;
+    return (cost_a < cost_b) - (cost_a > cost_b);      // Largest first
+}
+
+
+int knn_partition_search(const knn_partition_t* layout, int d, knn_merge_t* merge, int num_of_threads) {
+    if (num_of_threads <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        num_of_threads = (cores > 0) ? (int)cores : 1;
     }
 
-    // Updated the Part 3 assignment
-    for (int i = 0; i < part3_count; i++) {
-        int original_idx = part3_indices[i];  // Index in the original dataset
+    double total_cost = 0.0;
+    size_t max_tasks = 0;
+    for (int p = 0; p < layout->num_parts; p++) {
+        size_t rows = layout->offsets[p + 1] - layout->offsets[p];
+        total_cost += (double)rows * rows * d;
+        max_tasks  += (rows + KNN_PARTITION_MIN_TASK_ROWS - 1) / KNN_PARTITION_MIN_TASK_ROWS;
+    }
 
-        // Allocate arrays to hold merged distances and indices
-        float* merged_distances = (float*)malloc(k * sizeof(float));
-        int* merged_indices = (int*)malloc(k * sizeof(int));
+    knn_partition_task_t* tasks = (knn_partition_task_t*)malloc((max_tasks > 0 ? max_tasks : 1) * sizeof(knn_partition_task_t));
+    pthread_t* threads = (pthread_t*)malloc(num_of_threads * sizeof(pthread_t));
+    if (!tasks || !threads) {
+        fprintf(stderr, "knn_partition_search: Memory allocation failed for the tasks.\n");
+        free(tasks);
+        free(threads);
+        return -1;
+    }
 
-        if (!merged_distances || !merged_indices) {
-            fprintf(stderr, "Memory allocation failed during result merging.\n");
-            free(merged_distances);
-            free(merged_indices);
+    // Split the partitions whose cost is above the target task cost into slices of (almost) equal rows
+    double target_cost = total_cost / ((double)num_of_threads * KNN_PARTITION_TASKS_PER_THREAD);
+    size_t num_tasks = 0;
+    for (int p = 0; p < layout->num_parts; p++) {
+        size_t start = layout->offsets[p];
+        size_t rows  = layout->offsets[p + 1] - start;
+        if (rows == 0) {
             continue;
         }
+        double cost = (double)rows * rows * d;
+        size_t pieces = (target_cost > 0.0) ? (size_t)ceil(cost / target_cost) : 1;
+        size_t max_pieces = (rows + KNN_PARTITION_MIN_TASK_ROWS - 1) / KNN_PARTITION_MIN_TASK_ROWS;
+        if (pieces > max_pieces) { pieces = max_pieces; }
+        if (pieces < 1) { pieces = 1; }
+
+        for (size_t i = 0; i < pieces; i++) {
+            size_t first = rows * i / pieces;
+            size_t last  = rows * (i + 1) / pieces;
+            tasks[num_tasks++] = (knn_partition_task_t){
+                .part        = p,
+                .query_start = start + first,
+                .query_count = last - first,
+                .cost        = (double)(last - first) * rows * d,
+            };
+        }
+    }
+    qsort(tasks, num_tasks, sizeof(knn_partition_task_t), compare_tasks);
+
+    int num_workers = ((size_t)num_of_threads < num_tasks) ? num_of_threads : (int)num_tasks;
+    if (num_workers < 1) { num_workers = 1; }
+    partition_search_ctx_t ctx = {
+        .layout         = layout,
+        .d              = d,
+        .merge          = merge,
+        .tasks          = tasks,
+        .num_tasks      = num_tasks,
+        .next_task      = 0,
+        .num_workers    = num_workers,
+        .failed         = 0,
+    };
+
+    // Every worker calls `cblas_sgemm`, so BLAS must not spawn its own threads (oversubscription)
+    blas_set_last_strategy(KNN_BLAS_SINGLE_PER_WORKER);
+    int blas_threads = blas_get_threads();
+    blas_set_threads(1);
+
+    // The calling thread is the last worker
+    int created = 0;
+    for (int t = 0; t < num_workers - 1; t++) {
+        if (pthread_create(&threads[created], NULL, partition_worker, &ctx) == 0) {
+            created++;
+        }
+    }
+    partition_worker(&ctx);
+    for (int t = 0; t < created; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    blas_set_threads(blas_threads);
+    free(tasks);
+    free(threads);
+    return ctx.failed ? -1 : 0;
+}
+
+
+void knn_partition_free(knn_partition_t* layout) {
+    free(layout->offsets);
+    free(layout->ids);
+    free(layout->own_data);
+    memset(layout, 0, sizeof(*layout));
+}
 
-        // Merge the k smallest values between the existing and new distances
-        merge_k_smallest(k, 
-                        &distances[original_idx * k], &indices[original_idx * k], 
-                        &part3_knn_distances[i * k], &part3_knn_indices[i * k], 
-                        merged_distances, merged_indices);
 
-        // Update the indices and distances with the merged results
-        memcpy(&distances[original_idx * k], merged_distances, k * sizeof(float));
-        memcpy(&indices[original_idx * k], merged_indices, k * sizeof(int));
+int knn_approx_serial_plan(const float* dataset, int k, knn_idx_t* indices, float* distances, size_t dataset_length,
+                           int d, int num_of_threads, int accuracy, knn_split_plan_t* plan) {
+    if (knn_check_extents("knn_approx_serial", dataset_length, d, k) != 0) {
+        return -1;
+    }
 
-        // Free temporary arrays
-        free(merged_distances);
-        free(merged_indices);
+    float* distances_from_hyperplane = (float*)malloc(dataset_length * sizeof(float));
+    unsigned char* masks = (unsigned char*)malloc(dataset_length * sizeof(unsigned char));
+    if (!distances_from_hyperplane || !masks) {
+        fprintf(stderr, "Memory allocation failed for distances_from_hyperplane.\n");
+        free(distances_from_hyperplane);
+        free(masks);
+        return -1;
     }
 
+    // Step 1: Compute the distances of the rows from the splitting hyperplane
+    float h_norm = 0;
+    split_dataset(dataset, distances_from_hyperplane, dataset_length, d, num_of_threads, accuracy, &h_norm);
 
-    // Step 6: Cleanup
+    // Step 2: Choose the overlap band around the hyperplane for the target recall
+    knn_split_plan_t split;
+    if (knn_split_band(dataset, distances_from_hyperplane, dataset_length, d, k, accuracy / 100.0, num_of_threads,
+                       &split) != 0) {
+        free(distances_from_hyperplane);
+        free(masks);
+        return -1;
+    }
+
+    // Step 3: Partition dataset based on the distances from the hyperplane: part 1 is the rows up to `band` past
+    // it, part 2 the rows from `band` before it, so the rows of the band are in both. The rows are copied once
+    // into one buffer, so every part is a contiguous slice.
+    for (size_t i = 0; i < dataset_length; i++) {
+        masks[i] = (unsigned char)((distances_from_hyperplane[i] <= split.band ? 1 : 0) |
+                                   (distances_from_hyperplane[i] >= -split.band ? 2 : 0));
+    }
     free(distances_from_hyperplane);
-    free(part1_indices);
-    free(part2_indices);
-    free(part3_indices);
-    free(part1_data);
-    free(part2_data);
-    free(part3_data);
-    free(part1_knn_indices);
-    free(part1_knn_distances);
-    free(part2_knn_indices);
-    free(part2_knn_distances);
-    free(part3_knn_indices);
-    free(part3_knn_distances);
+
+    knn_partition_t layout;
+    int status = knn_partition_by_mask(dataset, dataset_length, d, masks, 2, &layout);
+    free(masks);
+    if (status != 0) {
+        return -1;
+    }
+
+    // Step 4: Process each part using exact k-NN, directly on its slice. The two parts run concurrently, with
+    // threads in proportion to their costs, and every row is merged into the result as soon as its task ends
+    // (the rows of the band merge the neighbors of both parts).
+    knn_merge_t merge;
+    if (knn_merge_init(&merge, indices, distances, dataset_length, k, layout.offsets[2] > dataset_length) != 0) {
+        knn_partition_free(&layout);
+        return -1;
+    }
+    // A failed task is not repaired: the rows of the band already hold the k neighbors of their other part
+    status = knn_partition_search(&layout, d, &merge, num_of_threads);
+
+    // Step 5: Complete the rows of the parts smaller than k exactly
+    if (status == 0 && knn_merge_finish(&merge, dataset, d, num_of_threads) < 0) {
+        status = -1;
+    }
+    if (plan != NULL) {
+        *plan = split;
+    }
+
+    // Step 6: Cleanup
+    knn_merge_free(&merge);
+    knn_partition_free(&layout);
+    return status;
+}
+
+
+void knn_approx_serial(const float* dataset, int k, knn_idx_t* indices, float* distances, 
+                       size_t dataset_length, int d, int num_of_threads, int accuracy) {
+    knn_approx_serial_plan(dataset, k, indices, distances, dataset_length, d, num_of_threads, accuracy, NULL);
 }
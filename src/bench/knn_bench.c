@@ -0,0 +1,546 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include "../../include/utils/data_io.h"
+#include "../../include/utils/data_gen.h"
+#include "../../include/utils/blas_threads.h"
+#include "../../include/utils/knn_stats.h"
+#include "../../include/utils/perf_counters.h"
+#include "../../include/exact/knn_exact_serial.h"
+#include "../../include/exact/knn_exact_pthread.h"
+#include "../../include/exact/knn_exact_openmp.h"
+#include "../../include/exact/knn_search.h"
+#include "../../include/exact/knn_exact_pivot.h"
+#include "../../include/exact/knn_exact_tree.h"
+#include "../../include/exact/knn_shards.h"
+#include "../../include/approximate/knn_approx_serial.h"
+#include "../../include/approximate/knn_approx_pthread.h"
+#include "../../include/approximate/knn_approx_openmp.h"
+#include "../../include/approximate/knn_approx_projection.h"
+#include "../../include/tests/tests.h"
+
+// Benchmark of the k-NN functions over parameter sweeps, with machine-readable (CSV/JSON) output.
+//
+// Usage examples:
+//   ./knn_bench --n 20000,50000 --d 64,128 --k 10,100 --threads 1,2,4,8 --backend exact_pthread,exact_openmp,search
+//   ./knn_bench --dataset data/sift-128-euclidean.hdf5:train:test --n 100000,1000000 --k 100 --threads 4,8
+//   ./knn_bench --backend approx_pthread,approx_openmp --n 50000 --threads 2,4,8 --trials 3
+//
+// Every configuration is run `--warmup` times (not measured) and `--trials` times (measured). The results
+// (median/p95 time, QPS, recall against an exact ground truth and peak RSS) are appended as rows to
+// `[out].csv` and `[out].json` (default `results/bench/knn_bench`), which `julia/timestampsPlots.jl` can plot.
+
+#define BENCH_MAX_VALUES 32
+
+typedef enum { BENCH_EXACT, BENCH_APPROX } bench_kind_t;
+
+typedef struct {
+    const char*     name;
+    bench_kind_t    kind;
+    knn_exact_t     exact;
+    knn_approx_t    approx;
+    int             parallel;   // 0 if the function ignores `num_of_threads`
+} bench_backend_t;
+
+static const bench_backend_t bench_backends[] = {
+    { "exact_serial",   BENCH_EXACT,  knn_exact_serial,  NULL,               0 },
+    { "exact_pthread",  BENCH_EXACT,  knn_exact_pthread, NULL,               1 },
+    { "exact_openmp",   BENCH_EXACT,  knn_exact_openmp,  NULL,               1 },
+    { "search",         BENCH_EXACT,  knn_search,        NULL,               1 },
+    { "exact_pivot",    BENCH_EXACT,  knn_exact_pivot,   NULL,               1 },
+    { "exact_tree",     BENCH_EXACT,  knn_exact_tree,    NULL,               1 },
+    { "sharded",        BENCH_EXACT,  knn_exact_sharded, NULL,               1 },
+    { "approx_projection", BENCH_EXACT, knn_approx_projection, NULL,         1 },
+    { "approx_serial",  BENCH_APPROX, NULL,              knn_approx_serial,  1 },
+    { "approx_pthread", BENCH_APPROX, NULL,              knn_approx_pthread, 1 },
+    { "approx_openmp",  BENCH_APPROX, NULL,              knn_approx_openmp,  1 },
+};
+#define BENCH_NUM_BACKENDS (int)(sizeof(bench_backends) / sizeof(bench_backends[0]))
+
+// One row of the output
+typedef struct {
+    const char*     backend;
+    const char*     dataset;
+    size_t          n, m;
+    int             d, k, threads;
+    unsigned long   seed;
+    int             trials;
+    double          median_time;
+    double          p95_time;
+    double          qps;
+    double          ipc;                // Instructions per cycle (-1 if n/a)
+    double          misses_per_query;   // Last level cache misses per query (-1 if n/a)
+    double          recall;
+    long            peak_rss_kb;
+    const char*     blas_strategy;
+    double          phase_time[KNN_NUM_PHASES];     // Thread-seconds per trial of each phase (0 without `KNN_STATS`)
+} bench_record_t;
+
+
+static double wall_time(void) {
+    struct timeval t;
+    gettimeofday(&t, NULL);
+    return t.tv_sec + t.tv_usec / 1e6;
+}
+
+
+// Parse a comma separated list of integers, returns the number of values
+static int parse_int_list(const char* list, int* values) {
+    int count = 0;
+    char* copy = strdup(list);
+    for (char* token = strtok(copy, ","); token != NULL && count < BENCH_MAX_VALUES; token = strtok(NULL, ",")) {
+        values[count++] = atoi(token);
+    }
+    free(copy);
+    return count;
+}
+
+
+// Same as `parse_int_list` for sizes (the number of rows may exceed 2^31)
+static int parse_size_list(const char* list, size_t* values) {
+    int count = 0;
+    char* copy = strdup(list);
+    for (char* token = strtok(copy, ","); token != NULL && count < BENCH_MAX_VALUES; token = strtok(NULL, ",")) {
+        values[count++] = strtoull(token, NULL, 10);
+    }
+    free(copy);
+    return count;
+}
+
+
+// Reset the peak RSS of the process (Linux >= 4.0), so that it can be measured per trial
+static int reset_peak_rss(void) {
+    FILE* file = fopen("/proc/self/clear_refs", "w");
+    if (file == NULL) {
+        return -1;
+    }
+    int ok = (fputs("5", file) >= 0);
+    return (fclose(file) == 0 && ok) ? 0 : -1;
+}
+
+
+static long read_peak_rss_kb(void) {
+    FILE* file = fopen("/proc/self/status", "r");
+    if (file != NULL) {
+        char line[256];
+        long peak = -1;
+        while (fgets(line, sizeof(line), file)) {
+            if (sscanf(line, "VmHWM: %ld kB", &peak) == 1) {
+                break;
+            }
+        }
+        fclose(file);
+        if (peak >= 0) {
+            return peak;
+        }
+    }
+
+    // Fallback: peak RSS of the whole process
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+
+static int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+
+// Fraction of the ground truth neighbors which are found in the results
+static double recall_at_k(const knn_idx_t* truth, const knn_idx_t* result, size_t query_length, int k) {
+    knn_eval_t eval;
+    if (knn_evaluate(truth, NULL, k, result, NULL, k, query_length, 0, &eval) != 0) {
+        return -1;
+    }
+
+    double recall = eval.recall;
+    knn_eval_free(&eval);
+    return recall;
+}
+
+
+static void write_csv_header(FILE* file) {
+    fprintf(file, "backend,dataset,n,m,d,k,threads,seed,trials,median_time,p95_time,qps,ipc,misses_per_query,recall,peak_rss_kb,blas_strategy");
+    for (int p = 0; p < KNN_NUM_PHASES; p++) {
+        fprintf(file, ",%s_time", knn_phase_name((knn_phase_t)p));
+    }
+    fprintf(file, "\n");
+}
+
+
+// Counter values are written as n/a (CSV) or null (JSON) when they are not available
+static void format_counter(char* buffer, size_t size, double value, const char* missing) {
+    if (value < 0) {
+        snprintf(buffer, size, "%s", missing);
+    } else {
+        snprintf(buffer, size, "%lf", value);
+    }
+}
+
+
+static void write_csv(FILE* file, const bench_record_t* r) {
+    char ipc[32], misses[32];
+    format_counter(ipc, sizeof(ipc), r->ipc, "n/a");
+    format_counter(misses, sizeof(misses), r->misses_per_query, "n/a");
+
+    fprintf(file, "%s,%s,%zu,%zu,%d,%d,%d,%lu,%d,%lf,%lf,%lf,%s,%s,%lf,%ld,%s",
+            r->backend, r->dataset, r->n, r->m, r->d, r->k, r->threads, r->seed, r->trials,
+            r->median_time, r->p95_time, r->qps, ipc, misses, r->recall, r->peak_rss_kb, r->blas_strategy);
+    for (int p = 0; p < KNN_NUM_PHASES; p++) {
+        fprintf(file, ",%lf", r->phase_time[p]);
+    }
+    fprintf(file, "\n");
+}
+
+
+static void write_json(FILE* file, const bench_record_t* r, int first) {
+    char ipc[32], misses[32];
+    format_counter(ipc, sizeof(ipc), r->ipc, "null");
+    format_counter(misses, sizeof(misses), r->misses_per_query, "null");
+
+    fprintf(file, "%s  {\"backend\": \"%s\", \"dataset\": \"%s\", \"n\": %zu, \"m\": %zu, \"d\": %d, \"k\": %d, \"threads\": %d, "
+                  "\"seed\": %lu, \"trials\": %d, \"median_time\": %lf, \"p95_time\": %lf, \"qps\": %lf, \"ipc\": %s, "
+                  "\"misses_per_query\": %s, \"recall\": %lf, \"peak_rss_kb\": %ld, \"blas_strategy\": \"%s\", \"phase_time\": {",
+            first ? "" : ",\n", r->backend, r->dataset, r->n, r->m, r->d, r->k, r->threads, r->seed, r->trials,
+            r->median_time, r->p95_time, r->qps, ipc, misses, r->recall, r->peak_rss_kb, r->blas_strategy);
+    for (int p = 0; p < KNN_NUM_PHASES; p++) {
+        fprintf(file, "%s\"%s\": %lf", p ? ", " : "", knn_phase_name((knn_phase_t)p), r->phase_time[p]);
+    }
+    fprintf(file, "}}");
+}
+
+
+static void usage(const char* name) {
+    fprintf(stderr, "Usage: %s [--n list] [--d list] [--k list] [--threads list] [--backend list] [--queries m]\n"
+                    "          [--dataset file.hdf5:corpus:query] [--dist uniform|mixture|anisotropic|lowdim] [--duplicates fraction]\n"
+                    "          [--seed s] [--warmup w] [--trials t] [--accuracy a] [--out prefix]\n"
+                    "Backends:", name);
+    for (int b = 0; b < BENCH_NUM_BACKENDS; b++) {
+        fprintf(stderr, " %s", bench_backends[b].name);
+    }
+    fprintf(stderr, "\n");
+}
+
+
+int main(int argc, char* argv[]) {
+    size_t          n_values[BENCH_MAX_VALUES]          = { 20000 };
+    int             d_values[BENCH_MAX_VALUES]          = { 128 };
+    int             k_values[BENCH_MAX_VALUES]          = { 10 };
+    int             thread_values[BENCH_MAX_VALUES]     = { 1, 2, 4 };
+    int             num_n = 1, num_d = 1, num_k = 1, num_threads = 3;
+    int             backends[BENCH_NUM_BACKENDS]        = { 1, 2, 3 };
+    int             num_backends = 3;
+    size_t          query_length = 1000;
+    unsigned long   seed = 42;
+    knn_gen_dist_t  distribution = KNN_GEN_UNIFORM;
+    float           duplicates = 0.0f;
+    int             warmup = 1, trials = 5;
+    int             accuracy = 0;
+    const char*     out_prefix = "results/bench/knn_bench";
+    char*           dataset_spec = NULL;
+
+    static struct option options[] = {
+        { "n",       required_argument, 0, 'n' },
+        { "d",       required_argument, 0, 'd' },
+        { "k",       required_argument, 0, 'k' },
+        { "threads", required_argument, 0, 't' },
+        { "backend", required_argument, 0, 'b' },
+        { "queries", required_argument, 0, 'q' },
+        { "dataset", required_argument, 0, 'f' },
+        { "seed",    required_argument, 0, 's' },
+        { "dist",       required_argument, 0, 'g' },
+        { "duplicates", required_argument, 0, 'u' },
+        { "warmup",  required_argument, 0, 'w' },
+        { "trials",  required_argument, 0, 'r' },
+        { "out",     required_argument, 0, 'o' },
+        { "accuracy", required_argument, 0, 'a' },
+        { "help",    no_argument,       0, 'h' },
+        { 0, 0, 0, 0 }
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "n:d:k:t:b:q:f:s:g:u:w:r:o:a:h", options, NULL)) != -1) {
+        switch (opt) {
+            case 'n': num_n = parse_size_list(optarg, n_values); break;
+            case 'd': num_d = parse_int_list(optarg, d_values); break;
+            case 'k': num_k = parse_int_list(optarg, k_values); break;
+            case 't': num_threads = parse_int_list(optarg, thread_values); break;
+            case 'q': query_length = strtoull(optarg, NULL, 10); break;
+            case 'f': dataset_spec = strdup(optarg); break;
+            case 's': seed = strtoul(optarg, NULL, 10); break;
+            case 'u': duplicates = atof(optarg); break;
+            case 'g':
+                if (knn_gen_parse_distribution(optarg, &distribution) != 0) {
+                    fprintf(stderr, "knn_bench: Unknown distribution: %s\n", optarg);
+                    usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'w': warmup = atoi(optarg); break;
+            case 'r': trials = atoi(optarg); break;
+            case 'o': out_prefix = optarg; break;
+            case 'a': accuracy = atoi(optarg); break;
+            case 'b': {
+                num_backends = 0;
+                char* copy = strdup(optarg);
+                for (char* token = strtok(copy, ","); token != NULL; token = strtok(NULL, ",")) {
+                    int found = 0;
+                    for (int b = 0; b < BENCH_NUM_BACKENDS; b++) {
+                        if (strcmp(token, bench_backends[b].name) == 0 && num_backends < BENCH_NUM_BACKENDS) {
+                            backends[num_backends++] = b;
+                            found = 1;
+                        }
+                    }
+                    if (!found) {
+                        fprintf(stderr, "knn_bench: Unknown backend: %s\n", token);
+                        usage(argv[0]);
+                        free(copy);
+                        return EXIT_FAILURE;
+                    }
+                }
+                free(copy);
+                break;
+            }
+            default:
+                usage(argv[0]);
+                return (opt == 'h') ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    if (trials < 1) { trials = 1; }
+
+    // HDF5 dataset: `file:corpus:query`, the n values select the first n rows of the corpus
+    const char* data_path = NULL;
+    const char* corpus_name = NULL;
+    const char* query_name = NULL;
+    float*      file_corpus = NULL;
+    float*      file_query = NULL;
+    size_t      file_corpus_length = 0, file_query_length = 0;
+    int         file_d = 0;
+
+    if (dataset_spec != NULL) {
+        data_path   = strtok(dataset_spec, ":");
+        corpus_name = strtok(NULL, ":");
+        query_name  = strtok(NULL, ":");
+        if (data_path == NULL || corpus_name == NULL) {
+            fprintf(stderr, "knn_bench: --dataset must be given as file.hdf5:corpus[:query]\n");
+            return EXIT_FAILURE;
+        }
+
+        file_corpus = load_hdf5(data_path, corpus_name, &file_corpus_length, &file_d);
+        if (file_corpus == NULL) {
+            return EXIT_FAILURE;
+        }
+        if (query_name != NULL) {
+            file_query = load_hdf5(data_path, query_name, &file_query_length, &file_d);
+            if (file_query == NULL) {
+                free(file_corpus);
+                return EXIT_FAILURE;
+            }
+        }
+
+        d_values[0] = file_d;
+        num_d = 1;
+    }
+
+    // Open the output files (rows are appended, so that runs of different commits can be compared)
+    char csv_path[512], json_path[512];
+    snprintf(csv_path, sizeof(csv_path), "%s.csv", out_prefix);
+    snprintf(json_path, sizeof(json_path), "%s.json", out_prefix);
+
+    // Create the output directory (its parent must exist)
+    char out_dir[512];
+    snprintf(out_dir, sizeof(out_dir), "%s", out_prefix);
+    char* slash = strrchr(out_dir, '/');
+    if (slash != NULL) {
+        *slash = '\0';
+        mkdir(out_dir, 0755);
+    }
+
+    struct stat buffer;
+    int new_csv = (stat(csv_path, &buffer) != 0);
+    FILE* csv = fopen(csv_path, "a");
+    FILE* json = fopen(json_path, "w");
+    if (csv == NULL || json == NULL) {
+        fprintf(stderr, "knn_bench: Error opening the output files: %s, %s\n", csv_path, json_path);
+        return EXIT_FAILURE;
+    }
+    if (new_csv) {
+        write_csv_header(csv);
+    }
+    fprintf(json, "[\n");
+    int first_record = 1;
+
+    double* times = (double*)malloc(trials * sizeof(double));
+
+    for (int ni = 0; ni < num_n; ni++) {
+        for (int di = 0; di < num_d; di++) {
+            size_t n = n_values[ni];
+            int d = d_values[di];
+            float* corpus = NULL;
+            float* query = NULL;
+            size_t m = query_length;
+            int owns_data = 1;
+
+            if (file_corpus != NULL) {
+                if (n > file_corpus_length) { n = file_corpus_length; }
+                corpus = file_corpus;
+                query = (file_query != NULL) ? file_query : file_corpus;
+                m = (file_query != NULL) ? file_query_length : n;
+                if (m > query_length && file_query == NULL) { m = query_length; }
+                owns_data = 0;
+            } else {
+                // The corpus and the queries are the first n and the next m rows of the same dataset (same clusters/subspace)
+                knn_gen_config_t config;
+                knn_gen_default_config(&config, distribution, n + m, d, seed + 2 * ni + 1000 * di);
+                config.duplicate_fraction = duplicates;
+                corpus = (float*)malloc(n * d * sizeof(float));
+                query  = (float*)malloc(m * d * sizeof(float));
+                if (corpus == NULL || query == NULL ||
+                    knn_gen_fill(&config, corpus, 0, n, 0) != 0 || knn_gen_fill(&config, query, n, m, 0) != 0) {
+                    fprintf(stderr, "knn_bench: Memory allocation failed for the dataset n=%zu, d=%d\n", n, d);
+                    free(corpus);
+                    free(query);
+                    continue;
+                }
+            }
+
+            for (int ki = 0; ki < num_k; ki++) {
+                int k = k_values[ki];
+
+                // Exact ground truths (for the query set and for the all-to-all problem), computed on demand
+                knn_idx_t* truth_query = NULL;
+                knn_idx_t* truth_all = NULL;
+                knn_idx_t* idx = (knn_idx_t*)malloc(((n > m) ? n : m) * k * sizeof(knn_idx_t));
+                float*     dst = (float*)malloc(((n > m) ? n : m) * k * sizeof(float));
+                if (idx == NULL || dst == NULL) {
+                    fprintf(stderr, "knn_bench: Memory allocation failed for the k-NN results\n");
+                    free(idx);
+                    free(dst);
+                    continue;
+                }
+
+                for (int bi = 0; bi < num_backends; bi++) {
+                    const bench_backend_t* backend = &bench_backends[backends[bi]];
+                    size_t rows = (backend->kind == BENCH_EXACT) ? m : n;
+
+                    knn_idx_t** truth = (backend->kind == BENCH_EXACT) ? &truth_query : &truth_all;
+                    if (*truth == NULL) {
+                        *truth = (knn_idx_t*)malloc(rows * k * sizeof(knn_idx_t));
+                        float* truth_dst = (float*)malloc(rows * k * sizeof(float));
+                        if (*truth == NULL || truth_dst == NULL) {
+                            fprintf(stderr, "knn_bench: Memory allocation failed for the ground truth\n");
+                            free(*truth);
+                            free(truth_dst);
+                            *truth = NULL;     // Never compare with an uncomputed ground truth
+                            continue;
+                        }
+                        knn_search(corpus, (backend->kind == BENCH_EXACT) ? query : corpus, k, *truth, truth_dst, n, rows, d, 0);
+                        free(truth_dst);
+                    }
+
+                    for (int ti = 0; ti < num_threads; ti++) {
+                        int threads = thread_values[ti];
+                        if (!backend->parallel && ti > 0) { break; }   // Serial functions run once
+                        if (!backend->parallel) { threads = 1; }
+
+                        long peak_rss = 0;
+                        for (int r = -warmup; r < trials; r++) {
+                            int rss_reset = (reset_peak_rss() == 0);
+                            blas_set_last_strategy(KNN_BLAS_INHERIT);
+                            if (r == 0) { knn_stats_reset(); knn_perf_reset(); }   // The phase timers and counters count only the trials
+
+                            double start = wall_time();
+                            if (backend->kind == BENCH_EXACT) {
+                                backend->exact(corpus, query, k, idx, dst, n, m, d, threads);
+                            } else {
+                                backend->approx(corpus, k, idx, dst, n, d, threads, accuracy);
+                            }
+                            double elapsed = wall_time() - start;
+
+                            if (r >= 0) {
+                                times[r] = elapsed;
+                                long rss = read_peak_rss_kb();
+                                if (rss > peak_rss || !rss_reset) { peak_rss = rss; }
+                            }
+                        }
+
+                        qsort(times, trials, sizeof(double), compare_doubles);
+                        int p95_index = (int)(0.95 * trials + 0.999999) - 1;
+                        if (p95_index < 0) { p95_index = 0; }
+
+                        bench_record_t record = {
+                            .backend        = backend->name,
+                            .dataset        = (data_path != NULL) ? data_path : knn_gen_distribution_name(distribution),
+                            .n = n, .m = rows, .d = d, .k = k, .threads = threads,
+                            .seed           = seed,
+                            .trials         = trials,
+                            .median_time    = (trials % 2) ? times[trials / 2] : 0.5 * (times[trials / 2 - 1] + times[trials / 2]),
+                            .p95_time       = times[p95_index],
+                            .recall         = recall_at_k(*truth, idx, rows, k),
+                            .peak_rss_kb    = peak_rss,
+                            .blas_strategy  = blas_strategy_name(blas_get_last_strategy()),
+                        };
+                        record.qps = rows / record.median_time;
+
+                        // Counters of all the trials (n/a if they are not compiled in or not permitted)
+                        knn_perf_t perf;
+                        knn_perf_snapshot(&perf);
+                        record.ipc              = knn_perf_enabled() ? knn_perf_ipc(&perf, -1) : -1;
+                        record.misses_per_query = knn_perf_enabled() ? knn_perf_misses_per_query(&perf, -1, (long)rows * trials) : -1;
+
+                        knn_stats_t stats;
+                        knn_stats_snapshot(&stats);
+                        for (int p = 0; p < KNN_NUM_PHASES; p++) {
+                            record.phase_time[p] = stats.phase[p].seconds / trials;
+                        }
+
+                        printf("%-15s n=%-8zu m=%-8zu d=%-4d k=%-4d threads=%-3d median=%lfs p95=%lfs QPS=%lf recall=%lf peak RSS=%ldkB\n",
+                               record.backend, record.n, record.m, record.d, record.k, record.threads,
+                               record.median_time, record.p95_time, record.qps, record.recall, record.peak_rss_kb);
+
+                        if (knn_stats_enabled()) {
+                            knn_stats_print(stdout, &stats);
+                        }
+                        if (knn_perf_enabled()) {
+                            knn_perf_print(stdout, &perf, (long)rows * trials);
+                        }
+
+                        write_csv(csv, &record);
+                        write_json(json, &record, first_record);
+                        first_record = 0;
+                        fflush(csv);
+                    }
+                }
+
+                free(truth_query);
+                free(truth_all);
+                free(idx);
+                free(dst);
+            }
+
+            if (owns_data) {
+                free(corpus);
+                free(query);
+            }
+        }
+    }
+
+    fprintf(json, "\n]\n");
+    fclose(json);
+    fclose(csv);
+
+    free(times);
+    free(file_corpus);
+    free(file_query);
+    free(dataset_spec);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,315 @@
+#include "../../include/exact/knn_exact_filtered.h"
+
+typedef struct {
+    const float*    corpus;
+    const float*    query;
+    size_t          corpus_length;
+    size_t          query_length;
+    int             d;
+    int             k;
+    knn_idx_t*      indices;
+    float*          distances;
+    const uint64_t* bitmap;
+    const size_t*   tile_allowed;       // Allowed rows of every corpus tile
+    size_t          num_tiles;
+    knn_filter_stats_t* stats;          // One per worker
+    int*            status;             // One per worker
+} filter_scan_ctx_t;
+
+// Allowed rows of the corpus rows [start, end)
+static size_t count_allowed(const uint64_t* bitmap, size_t start, size_t end) {
+    size_t count = 0;
+    for (size_t w = start / 64; w * 64 < end; w++) {
+        uint64_t word = bitmap[w];
+        if (w * 64 < start)   { word &= ~0ULL << (start - w * 64); }
+        if (w * 64 + 64 > end) { word &= ~0ULL >> (w * 64 + 64 - end); }
+        count += (size_t)__builtin_popcountll(word);
+    }
+    return count;
+}
+
+
+static int compare_labels(const void* a, const void* b) {
+    int32_t x = *(const int32_t*)a;
+    int32_t y = *(const int32_t*)b;
+    return (x > y) - (x < y);
+}
+
+
+uint64_t* knn_filter_from_labels(const int32_t* labels, size_t corpus_length, const int32_t* allowed_labels, int num_allowed) {
+    uint64_t* bitmap = (uint64_t*)calloc(knn_filter_words(corpus_length) > 0 ? knn_filter_words(corpus_length) : 1, sizeof(uint64_t));
+    int32_t*  sorted = (int32_t*)malloc((num_allowed > 0 ? num_allowed : 1) * sizeof(int32_t));
+    if (bitmap == NULL || sorted == NULL) {
+        fprintf(stderr, "knn_filter_from_labels: Memory allocation failed for the bitmap\n");
+        free(bitmap);
+        free(sorted);
+        return NULL;
+    }
+
+    // The allowed set is sorted once, every label is then a binary search
+    if (num_allowed > 0) {
+        memcpy(sorted, allowed_labels, num_allowed * sizeof(int32_t));
+        qsort(sorted, num_allowed, sizeof(int32_t), compare_labels);
+    }
+    for (size_t i = 0; i < corpus_length && num_allowed > 0; i++) {
+        if (bsearch(&labels[i], sorted, num_allowed, sizeof(int32_t), compare_labels) != NULL) {
+            bitmap[i >> 6] |= 1ULL << (i & 63);
+        }
+    }
+
+    free(sorted);
+    return bitmap;
+}
+
+
+size_t knn_filter_count(const uint64_t* bitmap, size_t corpus_length) {
+    return count_allowed(bitmap, 0, corpus_length);
+}
+
+
+// Write the heap of a query (sorted, nearest first) and pad it past the allowed rows
+static void write_heap(float* heap_dist, knn_idx_t* heap_ids, int size, int k, knn_idx_t* indices, float* distances) {
+    knn_heap_sort(heap_dist, heap_ids, size);
+    for (int j = 0; j < k; j++) {
+        indices[j]   = (j < size) ? heap_ids[j] : -1;
+        distances[j] = (j < size) ? (float)sqrt( heap_dist[j] ) : INFINITY;
+    }
+}
+
+
+// Search the query tiles [start, end): every tile visits all the corpus tiles, skips the ones with no allowed row,
+// gathers the allowed rows of the sparse ones and multiplies the dense ones in place
+static void scan_query_tiles(void* ctx, int t, size_t start, size_t end) {
+    filter_scan_ctx_t* c = (filter_scan_ctx_t*)ctx;
+    int    d  = c->d;
+    int    k  = c->k;
+    size_t QT = KNN_FILTER_QUERY_TILE;
+    size_t R  = KNN_FILTER_TILE_ROWS;
+    knn_filter_stats_t* stats = &c->stats[t];
+
+    float*      heap_dist = (float*)malloc(QT * k * sizeof(float));
+    knn_idx_t*  heap_ids  = (knn_idx_t*)malloc(QT * k * sizeof(knn_idx_t));
+    int*        heap_size = (int*)malloc(QT * sizeof(int));
+    float*      block     = (float*)malloc(R * d * sizeof(float));
+    knn_idx_t*  block_ids = (knn_idx_t*)malloc(R * sizeof(knn_idx_t));
+    float*      D         = (float*)malloc(QT * R * sizeof(float));
+    if (!heap_dist || !heap_ids || !heap_size || !block || !block_ids || !D) {
+        fprintf(stderr, "knn_exact_filtered: Memory allocation failed for the tile buffers\n");
+        c->status[t] = -1;
+        start = end;
+    }
+
+    for (size_t tile = start; tile < end; tile++) {
+        size_t q_start  = tile * QT;
+        size_t q_length = (q_start + QT < c->query_length) ? QT : (c->query_length - q_start);
+        const float* queries = &c->query[q_start * d];
+
+        for (size_t i = 0; i < q_length; i++) { heap_size[i] = 0; }
+
+        for (size_t ct = 0; ct < c->num_tiles; ct++) {
+            size_t row_start = ct * R;
+            size_t rows      = (row_start + R < c->corpus_length) ? R : (c->corpus_length - row_start);
+            size_t allowed   = c->tile_allowed[ct];
+            stats->tile_visits++;
+            if (allowed == 0) {
+                stats->tiles_skipped++;
+                continue;
+            }
+
+            // Sparse tile: only its allowed rows are multiplied
+            int gathered = (allowed < rows && allowed <= (size_t)(KNN_FILTER_SPARSE_TILE * rows));
+            const float* tile_rows = &c->corpus[row_start * d];
+            size_t cols = rows;
+            if (gathered) {
+                cols = 0;
+                for (size_t r = 0; r < rows; r++) {
+                    if (knn_filter_test(c->bitmap, row_start + r)) {
+                        memcpy(&block[cols * d], &c->corpus[(row_start + r) * d], d * sizeof(float));
+                        block_ids[cols++] = (knn_idx_t)(row_start + r);
+                    }
+                }
+                tile_rows = block;
+                stats->tiles_gathered++;
+            }
+
+            KNN_PERF_BEGIN(KNN_PERF_DISTANCE);
+            distance_square_matrix(tile_rows, queries, D, cols, q_length, d);
+            KNN_PERF_END(KNN_PERF_DISTANCE);
+            stats->distances += cols * q_length;
+
+            // Dense tile: its masked rows are computed but never selected
+            KNN_PERF_BEGIN(KNN_PERF_SELECTION);
+            KNN_STATS_BEGIN(KNN_PHASE_SELECT);
+            int masked = !gathered && allowed < rows;
+            for (size_t i = 0; i < q_length; i++) {
+                for (size_t r = 0; r < cols; r++) {
+                    knn_idx_t id = gathered ? block_ids[r] : (knn_idx_t)(row_start + r);
+                    if (masked && !knn_filter_test(c->bitmap, (size_t)id)) {
+                        continue;
+                    }
+                    knn_heap_push(&heap_dist[i * k], &heap_ids[i * k], &heap_size[i], k, D[i * cols + r], id);
+                }
+            }
+            KNN_STATS_END(KNN_PHASE_SELECT, q_length * cols * sizeof(float));
+            KNN_PERF_END(KNN_PERF_SELECTION);
+        }
+
+        KNN_STATS_BEGIN(KNN_PHASE_WRITEBACK);
+        for (size_t i = 0; i < q_length; i++) {
+            write_heap(&heap_dist[i * k], &heap_ids[i * k], heap_size[i], k,
+                       &c->indices[(q_start + i) * k], &c->distances[(q_start + i) * k]);
+        }
+        KNN_STATS_END(KNN_PHASE_WRITEBACK, q_length * k * (2 * sizeof(float) + 2 * sizeof(knn_idx_t)));
+    }
+
+    free(heap_dist);
+    free(heap_ids);
+    free(heap_size);
+    free(block);
+    free(block_ids);
+    free(D);
+}
+
+
+// Gather plan: the allowed rows are copied into a compact corpus, searched with `knn_exact_pthread`
+static int filter_gather(const float* corpus, const float* query, int k, knn_idx_t* indices, float* distances,
+                         size_t corpus_length, size_t query_length, int d, const uint64_t* bitmap, size_t allowed,
+                         int num_of_threads, knn_filter_stats_t* stats) {
+    int allowed_k = ((size_t)k < allowed) ? k : (int)allowed;
+    float*     compact     = (float*)malloc((allowed > 0 ? allowed : 1) * d * sizeof(float));
+    knn_idx_t* compact_ids = (knn_idx_t*)malloc((allowed > 0 ? allowed : 1) * sizeof(knn_idx_t));
+    knn_idx_t* found_ids   = (knn_idx_t*)malloc((allowed_k > 0 ? query_length * allowed_k : 1) * sizeof(knn_idx_t));
+    float*     found_dist  = (float*)malloc((allowed_k > 0 ? query_length * allowed_k : 1) * sizeof(float));
+    if (!compact || !compact_ids || !found_ids || !found_dist) {
+        fprintf(stderr, "knn_exact_filtered: Memory allocation failed for the %zu allowed rows\n", allowed);
+        free(compact);
+        free(compact_ids);
+        free(found_ids);
+        free(found_dist);
+        return -1;
+    }
+
+    size_t m = 0;
+    for (size_t w = 0; w < knn_filter_words(corpus_length); w++) {
+        for (uint64_t word = bitmap[w]; word != 0; word &= word - 1) {
+            size_t row = w * 64 + (size_t)__builtin_ctzll(word);
+            if (row >= corpus_length) { break; }
+            memcpy(&compact[m * d], &corpus[row * d], d * sizeof(float));
+            compact_ids[m++] = (knn_idx_t)row;
+        }
+    }
+
+    if (allowed_k > 0) {
+        if (knn_exact_pthread_with_config(compact, query, allowed_k, found_ids, found_dist, allowed, query_length, d,
+                                          num_of_threads, NULL) != 0) {
+            fprintf(stderr, "knn_exact_filtered: The search of the %zu allowed rows failed\n", allowed);
+            free(compact);
+            free(compact_ids);
+            free(found_ids);
+            free(found_dist);
+            return -1;
+        }
+        stats->distances += allowed * query_length;
+    }
+    for (size_t q = 0; q < query_length; q++) {
+        for (int j = 0; j < k; j++) {
+            indices[q * k + j]   = (j < allowed_k) ? compact_ids[found_ids[q * allowed_k + j]] : -1;
+            distances[q * k + j] = (j < allowed_k) ? found_dist[q * allowed_k + j] : INFINITY;
+        }
+    }
+
+    free(compact);
+    free(compact_ids);
+    free(found_ids);
+    free(found_dist);
+    return 0;
+}
+
+
+int knn_exact_filtered(const float* corpus, const float* query, int k, knn_idx_t* indices, float* distances,
+                       size_t corpus_length, size_t query_length, int d, const uint64_t* bitmap, int num_of_threads,
+                       knn_filter_stats_t* stats) {
+    if (knn_check_extents("knn_exact_filtered", corpus_length, d, k) != 0) {
+        return -1;
+    }
+    if (bitmap == NULL) {
+        fprintf(stderr, "knn_exact_filtered: The bitmap is NULL\n");
+        return -1;
+    }
+    num_of_threads = knn_resolve_threads(num_of_threads);
+
+    knn_filter_stats_t total = {
+        .allowed        = knn_filter_count(bitmap, corpus_length),
+        .brute_force    = query_length * corpus_length,
+    };
+    int status = 0;
+
+    if (query_length == 0) {
+        // Nothing to search
+    } else if ((double)total.allowed <= KNN_FILTER_GATHER_RATIO * corpus_length) {
+        total.plan = KNN_FILTER_PLAN_GATHER;
+        status = filter_gather(corpus, query, k, indices, distances, corpus_length, query_length, d, bitmap,
+                               total.allowed, num_of_threads, &total);
+    } else {
+        total.plan = KNN_FILTER_PLAN_SCAN;
+        size_t num_tiles       = (corpus_length + KNN_FILTER_TILE_ROWS - 1) / KNN_FILTER_TILE_ROWS;
+        size_t num_query_tiles = (query_length + KNN_FILTER_QUERY_TILE - 1) / KNN_FILTER_QUERY_TILE;
+        int    workers         = ((size_t)num_of_threads < num_query_tiles) ? num_of_threads : (int)num_query_tiles;
+
+        size_t* tile_allowed = (size_t*)malloc(num_tiles * sizeof(size_t));
+        filter_scan_ctx_t ctx = {
+            .corpus         = corpus,
+            .query          = query,
+            .corpus_length  = corpus_length,
+            .query_length   = query_length,
+            .d              = d,
+            .k              = k,
+            .indices        = indices,
+            .distances      = distances,
+            .bitmap         = bitmap,
+            .tile_allowed   = tile_allowed,
+            .num_tiles      = num_tiles,
+            .stats          = (knn_filter_stats_t*)calloc(workers, sizeof(knn_filter_stats_t)),
+            .status         = (int*)calloc(workers, sizeof(int)),
+        };
+        if (!tile_allowed || !ctx.stats || !ctx.status) {
+            fprintf(stderr, "knn_exact_filtered: Memory allocation failed\n");
+            status = -1;
+        }
+
+        if (status == 0) {
+            for (size_t ct = 0; ct < num_tiles; ct++) {
+                size_t row_start = ct * KNN_FILTER_TILE_ROWS;
+                size_t row_end   = (row_start + KNN_FILTER_TILE_ROWS < corpus_length) ? row_start + KNN_FILTER_TILE_ROWS : corpus_length;
+                tile_allowed[ct] = count_allowed(bitmap, row_start, row_end);
+            }
+
+            // Every worker calls `cblas_sgemm`, so BLAS must not spawn its own threads (oversubscription)
+            int blas_threads = blas_get_threads();
+            if (workers > 1) {
+                blas_set_threads(1);
+                blas_set_last_strategy(KNN_BLAS_SINGLE_PER_WORKER);
+            }
+            // Scan plan: the query tiles split in `workers` contiguous ranges
+            status = knn_parallel_ranges(scan_query_tiles, &ctx, num_query_tiles, workers);
+            blas_set_threads(blas_threads);
+
+            for (int t = 0; t < workers; t++) {
+                if (ctx.status[t] != 0) { status = -1; }
+                total.tile_visits    += ctx.stats[t].tile_visits;
+                total.tiles_skipped  += ctx.stats[t].tiles_skipped;
+                total.tiles_gathered += ctx.stats[t].tiles_gathered;
+                total.distances      += ctx.stats[t].distances;
+            }
+        }
+
+        free(tile_allowed);
+        free(ctx.stats);
+        free(ctx.status);
+    }
+
+    if (stats) {
+        *stats = total;
+    }
+    return status;
+}
@@ -1,34 +1,200 @@
 #include "../../include/exact/knn_exact_opencilk.h"
 
-void knn_exact_opencilk(const float* corpus, const float* query, int k, int* indices, float* distances, int corpus_length, int query_length, int d, int num_of_threads) {
-    int q_chunk_length = 0;
-    int q_start = 0;
-
-    while (q_start < query_length) {
-        // Calculate max_chunk_length based on available memory
-        long max_chunk_length = (0.9 * get_usable_memory() / num_of_threads - 2 * corpus_length * sizeof(float) - k * sizeof(size_t)) / ((corpus_length + 1) * sizeof(float));
-
-        // Ensure max_chunk_length is valid
-        if (max_chunk_length <= 0) {
-            max_chunk_length = 1;
-            fprintf(stderr, "knn_exact_opencilk: Run out of usable memory (usable memory has a margin, so the program may not fail)\n");
+// Merge the sorted lists `src` into the sorted lists `dst` (both full, k per query), keeping the k nearest
+static void topk_merge_lists(knn_idx_t* dst_indices, float* dst_distances, const knn_idx_t* src_indices,
+                             const float* src_distances, size_t query_length, int k,
+                             knn_idx_t* merged_indices, float* merged_distances) {
+    KNN_STATS_BEGIN(KNN_PHASE_MERGE);
+    for (size_t q = 0; q < query_length; q++) {
+        knn_idx_t*       old_idx = &dst_indices[q * k];
+        float*           old_dst = &dst_distances[q * k];
+        const knn_idx_t* new_idx = &src_indices[q * k];
+        const float*     new_dst = &src_distances[q * k];
+        int i = 0, j = 0;
+
+        for (int l = 0; l < k; l++) {
+            if (j >= k || (i < k && (old_dst[i] < new_dst[j] || (old_dst[i] == new_dst[j] && old_idx[i] <= new_idx[j])))) {
+                merged_distances[l] = old_dst[i];
+                merged_indices[l]   = old_idx[i];
+                i++;
+            } else {
+                merged_distances[l] = new_dst[j];
+                merged_indices[l]   = new_idx[j];
+                j++;
+            }
+        }
+
+        memcpy(old_idx, merged_indices, k * sizeof(knn_idx_t));
+        memcpy(old_dst, merged_distances, k * sizeof(float));
+    }
+    KNN_STATS_END(KNN_PHASE_MERGE, 4 * query_length * k * (sizeof(knn_idx_t) + sizeof(float)));
+}
+
+
+// Merge the lists of a tile into a view. The view takes the arrays of the tile if it is empty (no copy),
+// otherwise the arrays are merged and freed.
+static void topk_view_add(knn_topk_view_t* view, knn_idx_t* indices, float* distances, size_t query_length, int k) {
+    if (view->indices == NULL) {
+        view->indices      = indices;
+        view->distances    = distances;
+        view->query_length = query_length;
+        view->k            = k;
+        return;
+    }
+
+    knn_idx_t* merged_indices = (knn_idx_t*)malloc(k * sizeof(knn_idx_t));
+    float* merged_distances = (float*)malloc(k * sizeof(float));
+    if (!merged_indices || !merged_distances) {
+        view->failed = 1;
+    } else {
+        topk_merge_lists(view->indices, view->distances, indices, distances, query_length, k, merged_indices, merged_distances);
+    }
+    free(merged_indices);
+    free(merged_distances);
+    free(indices);
+    free(distances);
+}
+
+
+// Identity of the top-k reducer: an empty view (its arrays are taken from the first tile of the strand)
+static void topk_identity(void* view) {
+    memset(view, 0, sizeof(knn_topk_view_t));
+}
+
+
+// Reduction of the top-k reducer: the right view is merged into the left one and destroyed
+static void topk_reduce(void* left, void* right) {
+    knn_topk_view_t* l = (knn_topk_view_t*)left;
+    knn_topk_view_t* r = (knn_topk_view_t*)right;
+    l->failed |= r->failed;
+    if (r->indices != NULL) {
+        topk_view_add(l, r->indices, r->distances, r->query_length, r->k);
+    }
+    memset(r, 0, sizeof(knn_topk_view_t));
+}
+
+
+// Identity and reduction of the failure flag of the query chunks
+static void failed_identity(void* view) {
+    *(int*)view = 0;
+}
+
+
+static void failed_reduce(void* left, void* right) {
+    *(int*)left |= *(int*)right;
+}
+
+
+// Corpus-parallel decomposition: one task per corpus tile over all the queries, merged by the top-k reducer
+static int knn_exact_opencilk_tiles(const float* corpus, const float* query, int k, knn_idx_t* indices, float* distances,
+                                    size_t corpus_length, size_t query_length, int d, int num_of_threads, size_t tiles,
+                                    const knn_exact_config_t* config) {
+    knn_topk_view_t cilk_reducer(topk_identity, topk_reduce) topk;
+    topk_identity(&topk);
+
+    cilk_for (size_t t = 0; t < tiles; t++) {
+        // Split the corpus evenly, so that every tile holds at least `KNN_CILK_MIN_CORPUS_TILE` >= k rows
+        size_t c_start  = corpus_length * t / tiles;
+        size_t c_length = corpus_length * (t + 1) / tiles - c_start;
+
+        knn_idx_t* tile_indices = (knn_idx_t*)malloc(query_length * k * sizeof(knn_idx_t));
+        float* tile_distances = (float*)malloc(query_length * k * sizeof(float));
+        if (!tile_indices || !tile_distances) {
+            free(tile_indices);
+            free(tile_distances);
+            topk.failed = 1;
+        } else {
+            // Every strand may hold a distance matrix: `num_of_threads` splits the usable memory between them
+            if (knn_exact_serial_with_config(&corpus[c_start * d], query, k, tile_indices, tile_distances, c_length,
+                                             query_length, d, num_of_threads, config) != 0) {
+                topk.failed = 1;
+            }
+            for (size_t i = 0; i < query_length * k; i++) {
+                tile_indices[i] += (knn_idx_t)c_start;
+            }
+            topk_view_add(&topk, tile_indices, tile_distances, query_length, k);
+        }
+    }
+
+    // After the sync the leftmost view holds the lists of all the tiles
+    int failed = topk.failed || topk.indices == NULL;
+    if (!failed) {
+        memcpy(indices, topk.indices, query_length * k * sizeof(knn_idx_t));
+        memcpy(distances, topk.distances, query_length * k * sizeof(float));
+    }
+    free(topk.indices);
+    free(topk.distances);
+    return failed ? -1 : 0;
+}
+
+int knn_exact_opencilk_with_config(const float* corpus, const float* query, int k, knn_idx_t* indices, float* distances,
+                                   size_t corpus_length, size_t query_length, int d, int num_of_threads,
+                                   const knn_exact_config_t* config) {
+    if (knn_check_extents("knn_exact_opencilk", corpus_length, d, k) != 0) {
+        return -1;
+    }
+
+    // Small query batches over a large corpus: parallelize over corpus tiles, every strand with one BLAS thread
+    size_t max_tiles = corpus_length / ((k > KNN_CILK_MIN_CORPUS_TILE) ? (size_t)k : KNN_CILK_MIN_CORPUS_TILE);
+    if (num_of_threads > 1 && query_length < (size_t)num_of_threads * BLAS_MIN_ROWS_PER_WORKER && max_tiles >= 2) {
+        size_t tiles = (size_t)num_of_threads * KNN_CILK_TILES_PER_THREAD;
+        if (tiles > max_tiles) { tiles = max_tiles; }
+
+        blas_set_last_strategy(KNN_BLAS_SINGLE_PER_WORKER);
+        int blas_threads = blas_get_threads();
+        blas_set_threads(1);
+        int status = knn_exact_opencilk_tiles(corpus, query, k, indices, distances, corpus_length, query_length, d,
+                                              num_of_threads, tiles, config);
+        blas_set_threads(blas_threads);
+        if (status == 0) {
+            return 0;
         }
+        fprintf(stderr, "knn_exact_opencilk: The corpus tiles failed, running by query chunks\n");
+    }
+
+    // Small query batches: run a few big GEMMs and let OpenBLAS use the threads instead
+    knn_blas_strategy_t strategy = knn_exact_strategy(config, corpus_length, query_length, num_of_threads);
+    blas_set_last_strategy(strategy);
+    int blas_threads = blas_get_threads();
+
+    if (strategy == KNN_BLAS_MULTI_FEW_GEMMS) {
+        blas_set_threads(num_of_threads);
+        int status = knn_exact_serial_with_config(corpus, query, k, indices, distances, corpus_length, query_length, d, 1, config);
+        blas_set_threads(blas_threads);
+        return status;
+    }
+
+    // Every spawned task calls `cblas_sgemm`, so BLAS must not spawn its own threads (oversubscription)
+    blas_set_threads(1);
 
-        // Determine chunk length for this iteration
-        q_chunk_length = (q_start + max_chunk_length < query_length) ? max_chunk_length : (query_length - q_start);
+    // Calculate max_chunk_length based on the memory budget
+    long max_chunk_length = knn_exact_max_chunk_length(corpus_length, k, num_of_threads, 0.9, config);
 
-        // Allocate query chunk pointer
-        const float* query_chunk = &query[q_start * d];
-        int* chunk_indices = &indices[q_start * k];
-        float* chunk_distances = &distances[q_start * k];
+    // Ensure max_chunk_length is valid
+    if (max_chunk_length <= 0) {
+        max_chunk_length = 1;
+        fprintf(stderr, "knn_exact_opencilk: Run out of usable memory (usable memory has a margin, so the program may not fail)\n");
+    }
+
+    // One task per query chunk, the failures of the chunks are or-ed by a reducer
+    size_t chunks = (query_length + max_chunk_length - 1) / max_chunk_length;
+    int cilk_reducer(failed_identity, failed_reduce) failed = 0;
 
-        // Use OpenCilk's cilk_spawn to parallelize the k-NN search for this chunk
-        cilk_spawn knn_exact_serial_core(corpus, query_chunk, k, chunk_indices, chunk_distances, corpus_length, q_chunk_length, d);
+    cilk_for (size_t c = 0; c < chunks; c++) {
+        size_t q_start = c * (size_t)max_chunk_length;
+        size_t q_chunk_length = (q_start + max_chunk_length < query_length) ? (size_t)max_chunk_length : (query_length - q_start);
 
-        // Move to the next chunk
-        q_start += q_chunk_length;
+        if (knn_exact_serial_core(corpus, &query[q_start * d], k, &indices[q_start * k], &distances[q_start * k],
+                                  corpus_length, q_chunk_length, d) != 0) {
+            failed = 1;
+        }
     }
 
-    // Wait for all spawned tasks to complete
-    cilk_sync;
-}
\ No newline at end of file
+    blas_set_threads(blas_threads);
+    return failed ? -1 : 0;
+}
+
+
+void knn_exact_opencilk(const float* corpus, const float* query, int k, knn_idx_t* indices, float* distances, size_t corpus_length, size_t query_length, int d, int num_of_threads) {
+    knn_exact_opencilk_with_config(corpus, query, k, indices, distances, corpus_length, query_length, d, num_of_threads, NULL);
+}
@@ -1,24 +1,29 @@
 #include "../../include/exact/knn_exact_openmp.h"
 
-/**
- * Wrapper function to perform k-nearest neighbor search using an OpenMP-based parallel approach,
- * handling memory constraints by processing in blocks (if necessary).
- * 
- * @param corpus            Pointer to the corpus matrix (reference data points)
- * @param query             Pointer to the query matrix (data points to compare)
- * @param k                 Number of nearest neighbors to find
- * @param indices           Pre-allocated array to store indices of the k-nearest neighbors for each query (length `query_length x k`)
- * @param distances         Pre-allocated array to store the Euclidean distances to the k-nearest neighbors (length `query_length x k`)
- * @param corpus_length     Number of rows (data points) in the corpus
- * @param query_length      Number of rows (data points) in the query
- * @param d                 Dimensionality of each data point (number of columns in corpus/query)
- * @param num_of_threads    Number of threads to run the parallel search.
- * 
- * @return                  None (results are stored in the pre-allocated arrays `indices` and `distances`)
- */
-void knn_exact_openmp(const float* corpus, const float* query, int k, int* indices, float* distances, int corpus_length, int query_length, int d, int num_of_threads) {
+int knn_exact_openmp_with_config(const float* corpus, const float* query, int k, knn_idx_t* indices, float* distances,
+                                 size_t corpus_length, size_t query_length, int d, int num_of_threads,
+                                 const knn_exact_config_t* config) {
+    if (knn_check_extents("knn_exact_openmp", corpus_length, d, k) != 0) {
+        return -1;
+    }
+
+    // Small query batches: run a few big GEMMs and let OpenBLAS use the threads instead
+    knn_blas_strategy_t strategy = knn_exact_strategy(config, corpus_length, query_length, num_of_threads);
+    blas_set_last_strategy(strategy);
+    int blas_threads = blas_get_threads();
+
+    if (strategy == KNN_BLAS_MULTI_FEW_GEMMS) {
+        blas_set_threads(num_of_threads);
+        int status = knn_exact_serial_with_config(corpus, query, k, indices, distances, corpus_length, query_length, d, 1, config);
+        blas_set_threads(blas_threads);
+        return status;
+    }
+
+    // Every OpenMP thread calls `cblas_sgemm`, so BLAS must not spawn its own threads (oversubscription)
+    blas_set_threads(1);
+
     // Calculate the maximum chunk length based on available memory and other constraints
-    long max_chunk_length = (0.9 * get_usable_memory() / num_of_threads - 2 * corpus_length * sizeof(float) - k * sizeof(size_t)) / ((corpus_length + 1) * sizeof(float));
+    long max_chunk_length = knn_exact_max_chunk_length(corpus_length, k, num_of_threads, 0.9, config);
 
     // Ensure max_chunk_length is valid
     if (max_chunk_length <= 0) {
@@ -27,17 +32,42 @@ void knn_exact_openmp(const float* corpus, const float* query, int k, int* indic
     }
 
     // Parallelize the loop using OpenMP
-    #pragma omp parallel for num_threads(num_of_threads) schedule(dynamic) shared(corpus, query, indices, distances)
-    for (int q_start = 0; q_start < query_length; q_start += max_chunk_length) {
+    int failed = 0;
+    #pragma omp parallel for num_threads(num_of_threads) schedule(dynamic) shared(corpus, query, indices, distances) reduction(|:failed)
+    for (size_t q_start = 0; q_start < query_length; q_start += max_chunk_length) {
         // Determine chunk length for this iteration
-        int q_chunk_length = (q_start + max_chunk_length < query_length) ? max_chunk_length : (query_length - q_start);
+        size_t q_chunk_length = (q_start + max_chunk_length < query_length) ? (size_t)max_chunk_length : (query_length - q_start);
 
         // Allocate query chunk pointer
         const float* query_chunk = &query[q_start * d];
-        int* chunk_indices = &indices[q_start * k];
+        knn_idx_t* chunk_indices = &indices[q_start * k];
         float* chunk_distances = &distances[q_start * k];
 
         // Compute k-NN for this chunk
-        knn_exact_serial_core(corpus, query_chunk, k, chunk_indices, chunk_distances, corpus_length, q_chunk_length, d);
+        failed |= (knn_exact_serial_core(corpus, query_chunk, k, chunk_indices, chunk_distances, corpus_length, q_chunk_length, d) != 0);
     }
-}
\ No newline at end of file
+
+    blas_set_threads(blas_threads);
+    return failed ? -1 : 0;
+}
+
+
+/**
+ * Wrapper function to perform k-nearest neighbor search using an OpenMP-based parallel approach,
+ * handling memory constraints by processing in blocks (if necessary).
+ * 
+ * @param corpus            Pointer to the corpus matrix (reference data points)
+ * @param query             Pointer to the query matrix (data points to compare)
+ * @param k                 Number of nearest neighbors to find
+ * @param indices           Pre-allocated array to store indices of the k-nearest neighbors for each query (length `query_length x k`)
+ * @param distances         Pre-allocated array to store the Euclidean distances to the k-nearest neighbors (length `query_length x k`)
+ * @param corpus_length     Number of rows (data points) in the corpus
+ * @param query_length      Number of rows (data points) in the query
+ * @param d                 Dimensionality of each data point (number of columns in corpus/query)
+ * @param num_of_threads    Number of threads to run the parallel search.
+ * 
+ * @return                  None (results are stored in the pre-allocated arrays `indices` and `distances`)
+ */
+void knn_exact_openmp(const float* corpus, const float* query, int k, knn_idx_t* indices, float* distances, size_t corpus_length, size_t query_length, int d, int num_of_threads) {
+    knn_exact_openmp_with_config(corpus, query, k, indices, distances, corpus_length, query_length, d, num_of_threads, NULL);
+}
@@ -0,0 +1,600 @@
+#include "../../include/exact/knn_exact_pivot.h"
+
+// Relative slack of the lower bounds, for the rounding of the pivot distances (computed in double, stored in float)
+#define PIVOT_BOUND_SLACK 1e-6
+
+static knn_pivot_stats_t last_stats;
+
+// Corpus row (or query) sorted by its nearest pivot and its distance to it
+typedef struct {
+    int             pivot;
+    float           dist;
+    knn_idx_t       id;
+} pivot_entry_t;
+
+// Block of a query tile, sorted by its smallest pruning threshold
+typedef struct {
+    float           key;
+    size_t          block;
+} pivot_block_key_t;
+
+typedef struct {
+    const float*    corpus;
+    int             d;
+    const float*    pivots;
+    int             num_pivots;
+    int             p;                  // Pivot of the current farthest-first pass
+    float*          pivot_dist;         // corpus_length x num_pivots
+    double*         min_dist;           // Distance of every row to its nearest selected pivot
+    knn_pivot_index_t* index;
+} pivot_build_ctx_t;
+
+typedef struct {
+    const knn_pivot_index_t* index;
+    const float*    query;
+    size_t          query_length;
+    int             k;
+    knn_idx_t*      indices;
+    float*          distances;
+    double*         query_dist;         // query_length x num_pivots
+    double*         query_norms;
+    knn_idx_t*      query_order;        // Queries sorted by their nearest pivot (tiles of nearby queries)
+    knn_pivot_stats_t* stats;           // One per worker
+    int*            status;             // One per worker
+} pivot_search_ctx_t;
+
+
+static double row_distance(const float* a, const float* b, int d) {
+    double sum = 0.0;
+    for (int j = 0; j < d; j++) {
+        double diff = (double)a[j] - (double)b[j];
+        sum += diff * diff;
+    }
+    return sqrt(sum);
+}
+
+
+static int compare_entries(const void* a, const void* b) {
+    const pivot_entry_t* x = (const pivot_entry_t*)a;
+    const pivot_entry_t* y = (const pivot_entry_t*)b;
+    if (x->pivot != y->pivot) { return (x->pivot < y->pivot) ? -1 : 1; }
+    if (x->dist != y->dist)   { return (x->dist < y->dist) ? -1 : 1; }
+    return (x->id < y->id) ? -1 : (x->id > y->id);
+}
+
+
+static int compare_block_keys(const void* a, const void* b) {
+    const pivot_block_key_t* x = (const pivot_block_key_t*)a;
+    const pivot_block_key_t* y = (const pivot_block_key_t*)b;
+    if (x->key != y->key) { return (x->key < y->key) ? -1 : 1; }
+    return (x->block < y->block) ? -1 : (x->block > y->block);
+}
+
+
+// Farthest-first pass: the distances of the rows to the pivot `p`, and to their nearest selected pivot
+static void build_pivot_pass(void* ctx, int t, size_t start, size_t end) {
+    pivot_build_ctx_t* c = (pivot_build_ctx_t*)ctx;
+    const float* pivot = &c->pivots[(size_t)c->p * c->d];
+
+    for (size_t i = start; i < end; i++) {
+        double dist = row_distance(&c->corpus[i * c->d], pivot, c->d);
+        c->pivot_dist[i * c->num_pivots + c->p] = (float)dist;
+        if (c->p == 0 || dist < c->min_dist[i]) {
+            c->min_dist[i] = dist;
+        }
+    }
+}
+
+
+// Distance of the rows to the first row, to start the farthest-first selection away from the center of the corpus
+static void build_first_pass(void* ctx, int t, size_t start, size_t end) {
+    pivot_build_ctx_t* c = (pivot_build_ctx_t*)ctx;
+
+    for (size_t i = start; i < end; i++) {
+        c->min_dist[i] = row_distance(&c->corpus[i * c->d], c->corpus, c->d);
+    }
+}
+
+
+// Distance bounds and largest norm of the blocks [start, end)
+static void build_block_bounds(void* ctx, int t, size_t start, size_t end) {
+    pivot_build_ctx_t* c = (pivot_build_ctx_t*)ctx;
+    knn_pivot_index_t* index = c->index;
+
+    for (size_t b = start; b < end; b++) {
+        size_t row_start = b * index->block_rows;
+        size_t row_end   = (row_start + index->block_rows < index->corpus_length) ? row_start + index->block_rows : index->corpus_length;
+        float* bounds    = &index->bounds[b * index->num_pivots * 2];
+        double max_norm  = 0.0;
+
+        for (int p = 0; p < index->num_pivots; p++) {
+            bounds[2 * p]     = FLT_MAX;
+            bounds[2 * p + 1] = 0.0f;
+        }
+        for (size_t r = row_start; r < row_end; r++) {
+            size_t       id   = (size_t)index->order[r];
+            const float* row  = &c->corpus[id * c->d];
+            const float* dist = &c->pivot_dist[id * c->num_pivots];
+            double       norm = 0.0;
+
+            for (int p = 0; p < index->num_pivots; p++) {
+                if (dist[p] < bounds[2 * p])     { bounds[2 * p]     = dist[p]; }
+                if (dist[p] > bounds[2 * p + 1]) { bounds[2 * p + 1] = dist[p]; }
+            }
+            for (int j = 0; j < c->d; j++) {
+                norm += (double)row[j] * row[j];
+            }
+            if (norm > max_norm) { max_norm = norm; }
+        }
+        // Round outwards, so that the bounds still hold for the distances in double
+        for (int p = 0; p < index->num_pivots; p++) {
+            bounds[2 * p]     = nextafterf(bounds[2 * p], 0.0f);
+            bounds[2 * p + 1] = nextafterf(bounds[2 * p + 1], FLT_MAX);
+        }
+        index->max_norms[b] = nextafterf((float)max_norm, FLT_MAX);
+    }
+}
+
+
+knn_pivot_index_t* knn_pivot_build(const float* corpus, size_t corpus_length, int d, int num_pivots, size_t block_rows, int num_of_threads) {
+    if (knn_check_extents("knn_pivot_build", corpus_length, d, 1) != 0) {
+        return NULL;
+    }
+    if (num_pivots <= 0) { num_pivots = KNN_PIVOT_DEFAULT_PIVOTS; }
+    if ((size_t)num_pivots > corpus_length) { num_pivots = (int)corpus_length; }
+    if (block_rows == 0) { block_rows = KNN_PIVOT_BLOCK_ROWS; }
+    num_of_threads = knn_resolve_threads(num_of_threads);
+
+    knn_pivot_index_t* index  = (knn_pivot_index_t*)calloc(1, sizeof(knn_pivot_index_t));
+    float*  pivot_dist        = (float*)malloc(corpus_length * num_pivots * sizeof(float));
+    double* min_dist          = (double*)malloc(corpus_length * sizeof(double));
+    pivot_entry_t* entries    = (pivot_entry_t*)malloc(corpus_length * sizeof(pivot_entry_t));
+    if (index) {
+        index->pivots = (float*)malloc((size_t)num_pivots * d * sizeof(float));
+        index->order  = (knn_idx_t*)malloc(corpus_length * sizeof(knn_idx_t));
+    }
+    if (!index || !pivot_dist || !min_dist || !entries || !index->pivots || !index->order) {
+        fprintf(stderr, "knn_pivot_build: Memory allocation failed\n");
+        free(pivot_dist);
+        free(min_dist);
+        free(entries);
+        knn_pivot_free(index);
+        return NULL;
+    }
+    index->corpus        = corpus;
+    index->corpus_length = corpus_length;
+    index->d             = d;
+    index->block_rows    = block_rows;
+
+    pivot_build_ctx_t ctx = {
+        .corpus     = corpus,
+        .d          = d,
+        .pivots     = index->pivots,
+        .num_pivots = num_pivots,
+        .pivot_dist = pivot_dist,
+        .min_dist   = min_dist,
+        .index      = index,
+    };
+    int status = knn_parallel_ranges(build_first_pass, &ctx, corpus_length, num_of_threads);
+
+    // Farthest-first selection: every pivot is the row farthest from the pivots selected so far
+    int selected = 0;
+    while (status == 0 && selected < num_pivots) {
+        size_t farthest = 0;
+        for (size_t i = 1; i < corpus_length; i++) {
+            if (min_dist[i] > min_dist[farthest]) { farthest = i; }
+        }
+        if (selected > 0 && min_dist[farthest] == 0.0) {
+            break;      // Every row is already a pivot (duplicates)
+        }
+        memcpy(&index->pivots[(size_t)selected * d], &corpus[farthest * d], d * sizeof(float));
+        ctx.p  = selected++;
+        status = knn_parallel_ranges(build_pivot_pass, &ctx, corpus_length, num_of_threads);
+    }
+
+    // Compact the pivot distances if fewer pivots were selected
+    if (status == 0 && selected < num_pivots) {
+        for (size_t i = 0; i < corpus_length; i++) {
+            memmove(&pivot_dist[i * selected], &pivot_dist[i * num_pivots], selected * sizeof(float));
+        }
+        num_pivots     = selected;
+        ctx.num_pivots = selected;
+    }
+    index->num_pivots = num_pivots;
+
+    // Group the rows by their nearest pivot, in shells of increasing distance to it
+    for (size_t i = 0; status == 0 && i < corpus_length; i++) {
+        const float* dist = &pivot_dist[i * num_pivots];
+        int nearest = 0;
+        for (int p = 1; p < num_pivots; p++) {
+            if (dist[p] < dist[nearest]) { nearest = p; }
+        }
+        entries[i] = (pivot_entry_t){ .pivot = nearest, .dist = dist[nearest], .id = (knn_idx_t)i };
+    }
+    if (status == 0) {
+        qsort(entries, corpus_length, sizeof(pivot_entry_t), compare_entries);
+        for (size_t i = 0; i < corpus_length; i++) {
+            index->order[i] = entries[i].id;
+        }
+
+        index->num_blocks = (corpus_length + block_rows - 1) / block_rows;
+        index->bounds     = (float*)malloc(index->num_blocks * num_pivots * 2 * sizeof(float));
+        index->max_norms  = (float*)malloc(index->num_blocks * sizeof(float));
+        status = (index->bounds && index->max_norms) ? 0 : -1;
+        if (status == 0) {
+            status = knn_parallel_ranges(build_block_bounds, &ctx, index->num_blocks, num_of_threads);
+        } else {
+            fprintf(stderr, "knn_pivot_build: Memory allocation failed for the block bounds\n");
+        }
+    }
+
+    free(pivot_dist);
+    free(min_dist);
+    free(entries);
+    if (status != 0) {
+        knn_pivot_free(index);
+        return NULL;
+    }
+    return index;
+}
+
+
+// Parameters of a saved index (the META section)
+typedef struct {
+    uint32_t        id_bytes;           // sizeof(knn_idx_t) of the writer
+    int32_t         d;
+    int32_t         num_pivots;
+    int32_t         reserved;
+    uint64_t        corpus_length;
+    uint64_t        block_rows;
+    uint64_t        num_blocks;
+    uint64_t        corpus_hash;        // knn_hash_bytes of the corpus the index was built for
+} pivot_snapshot_meta_t;
+
+
+int knn_pivot_save(const knn_pivot_index_t* index, const char* filename) {
+    pivot_snapshot_meta_t meta = {
+        .id_bytes      = sizeof(knn_idx_t),
+        .d             = index->d,
+        .num_pivots    = index->num_pivots,
+        .corpus_length = index->corpus_length,
+        .block_rows    = index->block_rows,
+        .num_blocks    = index->num_blocks,
+        .corpus_hash   = knn_hash_bytes(index->corpus, index->corpus_length * index->d * sizeof(float), 0),
+    };
+    knn_snapshot_section_t sections[] = {
+        { KNN_SNAPSHOT_META,         &meta,            sizeof(meta) },
+        { KNN_SNAPSHOT_PIVOT_PIVOTS, index->pivots,    (size_t)index->num_pivots * index->d * sizeof(float) },
+        { KNN_SNAPSHOT_PIVOT_ORDER,  index->order,     index->corpus_length * sizeof(knn_idx_t) },
+        { KNN_SNAPSHOT_PIVOT_BOUNDS, index->bounds,    index->num_blocks * index->num_pivots * 2 * sizeof(float) },
+        { KNN_SNAPSHOT_PIVOT_NORMS,  index->max_norms, index->num_blocks * sizeof(float) },
+    };
+    return knn_snapshot_save(filename, KNN_SNAPSHOT_KIND_PIVOT, sections, (int)(sizeof(sections) / sizeof(sections[0])));
+}
+
+
+knn_pivot_index_t* knn_pivot_load(const char* filename, const float* corpus, size_t corpus_length, int d,
+                                  int verify, int num_of_threads) {
+    if (knn_check_extents("knn_pivot_load", corpus_length, d, 1) != 0) {
+        return NULL;
+    }
+    knn_snapshot_t* snapshot = knn_snapshot_open(filename, KNN_SNAPSHOT_KIND_PIVOT, verify);
+    if (snapshot == NULL) {
+        return NULL;
+    }
+    const pivot_snapshot_meta_t* meta = (const pivot_snapshot_meta_t*)knn_snapshot_section(snapshot, KNN_SNAPSHOT_META, sizeof(pivot_snapshot_meta_t));
+    const char* error = NULL;
+    if (meta == NULL) {
+        error = "missing parameters";
+    } else if (meta->id_bytes != sizeof(knn_idx_t)) {
+        error = "saved with another id width (IDX32)";
+    } else if (meta->corpus_length != corpus_length || meta->d != d) {
+        error = "built for a corpus of another shape";
+    } else if (meta->num_pivots <= 0 || meta->block_rows == 0 ||
+               meta->num_blocks != (corpus_length + meta->block_rows - 1) / meta->block_rows) {
+        error = "inconsistent parameters";
+    } else if (meta->corpus_hash != knn_hash_bytes(corpus, corpus_length * d * sizeof(float), num_of_threads)) {
+        error = "built for another corpus";
+    }
+    if (error != NULL) {
+        fprintf(stderr, "knn_pivot_load: %s: %s\n", filename, error);
+        knn_snapshot_close(snapshot);
+        return NULL;
+    }
+
+    knn_pivot_index_t* index = (knn_pivot_index_t*)calloc(1, sizeof(knn_pivot_index_t));
+    if (index == NULL) {
+        fprintf(stderr, "knn_pivot_load: Memory allocation failed\n");
+        knn_snapshot_close(snapshot);
+        return NULL;
+    }
+    index->corpus        = corpus;
+    index->corpus_length = corpus_length;
+    index->d             = d;
+    index->num_pivots    = meta->num_pivots;
+    index->block_rows    = meta->block_rows;
+    index->num_blocks    = meta->num_blocks;
+    index->snapshot      = snapshot;
+
+    // The arrays are read-only: the search never writes them
+    index->pivots    = (float*)knn_snapshot_section(snapshot, KNN_SNAPSHOT_PIVOT_PIVOTS, (size_t)index->num_pivots * d * sizeof(float));
+    index->order     = (knn_idx_t*)knn_snapshot_section(snapshot, KNN_SNAPSHOT_PIVOT_ORDER, corpus_length * sizeof(knn_idx_t));
+    index->bounds    = (float*)knn_snapshot_section(snapshot, KNN_SNAPSHOT_PIVOT_BOUNDS, index->num_blocks * index->num_pivots * 2 * sizeof(float));
+    index->max_norms = (float*)knn_snapshot_section(snapshot, KNN_SNAPSHOT_PIVOT_NORMS, index->num_blocks * sizeof(float));
+    if (!index->pivots || !index->order || !index->bounds || !index->max_norms) {
+        fprintf(stderr, "knn_pivot_load: %s: inconsistent sections\n", filename);
+        knn_pivot_free(index);
+        return NULL;
+    }
+    return index;
+}
+
+
+void knn_pivot_free(knn_pivot_index_t* index) {
+    if (index == NULL) { return; }
+    if (index->snapshot != NULL) {
+        knn_snapshot_close(index->snapshot);
+    } else {
+        free(index->pivots);
+        free(index->order);
+        free(index->bounds);
+        free(index->max_norms);
+    }
+    free(index);
+}
+
+
+// Distances of the queries [start, end) to the pivots, and their squared norms
+static void search_query_pass(void* ctx, int t, size_t start, size_t end) {
+    pivot_search_ctx_t* c = (pivot_search_ctx_t*)ctx;
+    const knn_pivot_index_t* index = c->index;
+
+    for (size_t q = start; q < end; q++) {
+        const float* row = &c->query[q * index->d];
+        double norm = 0.0;
+        for (int p = 0; p < index->num_pivots; p++) {
+            c->query_dist[q * index->num_pivots + p] = row_distance(row, &index->pivots[(size_t)p * index->d], index->d);
+        }
+        for (int j = 0; j < index->d; j++) {
+            norm += (double)row[j] * row[j];
+        }
+        c->query_norms[q] = norm;
+    }
+}
+
+
+// Search the query tiles [start, end): every tile visits the blocks by increasing lower bound, and searches
+// a block with one GEMM for the queries whose k-th distance is not below the bound of the block
+static void search_tiles(void* ctx, int t, size_t start, size_t end) {
+    pivot_search_ctx_t* c = (pivot_search_ctx_t*)ctx;
+    const knn_pivot_index_t* index = c->index;
+    int    d  = index->d;
+    int    k  = c->k;
+    int    K  = ((size_t)k + KNN_RERANK_MARGIN < index->corpus_length) ? k + KNN_RERANK_MARGIN : (int)index->corpus_length;
+    int    P  = index->num_pivots;
+    size_t B  = index->num_blocks;
+    size_t QT = KNN_PIVOT_QUERY_TILE;
+    size_t R  = index->block_rows;
+    knn_pivot_stats_t* stats = &c->stats[t];
+
+    float*      thresholds = (float*)malloc(QT * B * sizeof(float));
+    pivot_block_key_t* keys = (pivot_block_key_t*)malloc(B * sizeof(pivot_block_key_t));
+    float*      heap_dist  = (float*)malloc(QT * K * sizeof(float));      // K candidates, re-ranked by `distance_rerank`
+    knn_idx_t*  heap_ids   = (knn_idx_t*)malloc(QT * K * sizeof(knn_idx_t));
+    int*        heap_size  = (int*)malloc(QT * sizeof(int));
+    int*        active     = (int*)malloc(QT * sizeof(int));
+    float*      block      = (float*)malloc(R * d * sizeof(float));
+    float*      queries    = (float*)malloc(QT * d * sizeof(float));
+    float*      D          = (float*)malloc(QT * R * sizeof(float));
+    if (!thresholds || !keys || !heap_dist || !heap_ids || !heap_size || !active || !block || !queries || !D) {
+        fprintf(stderr, "knn_pivot_search: Memory allocation failed for the tile buffers\n");
+        c->status[t] = -1;
+        start = end;
+    }
+
+    for (size_t tile = start; tile < end; tile++) {
+        size_t q_start  = tile * QT;
+        size_t q_length = (q_start + QT < c->query_length) ? QT : (c->query_length - q_start);
+        const knn_idx_t* tile_queries = &c->query_order[q_start];
+
+        // Pruning threshold of every (query, block): the block cannot hold a neighbor of the query if the threshold
+        // is above the k-th squared distance of the query. The threshold is the squared triangle-inequality bound,
+        // minus the worst rounding error of the GEMM-based squared distances (qn + cn - 2 q.c in float).
+        for (size_t b = 0; b < B; b++) {
+            const float* bounds = &index->bounds[b * P * 2];
+            float key = INFINITY;
+            for (size_t i = 0; i < q_length; i++) {
+                size_t q = (size_t)tile_queries[i];
+                const double* qd = &c->query_dist[q * P];
+                double lb = 0.0;
+                for (int p = 0; p < P; p++) {
+                    double gap = (qd[p] > bounds[2 * p + 1]) ? qd[p] - bounds[2 * p + 1] :
+                                 (qd[p] < bounds[2 * p])     ? bounds[2 * p] - qd[p] : 0.0;
+                    if (gap > lb) { lb = gap; }
+                }
+                lb *= 1.0 - PIVOT_BOUND_SLACK;
+                double error = 2.0 * (d + 4) * FLT_EPSILON * (c->query_norms[q] + index->max_norms[b]);
+                double threshold = lb * lb - error;
+                thresholds[i * B + b] = (threshold > 0.0) ? (float)(threshold * (1.0 - PIVOT_BOUND_SLACK)) : -INFINITY;
+                if (thresholds[i * B + b] < key) { key = thresholds[i * B + b]; }
+            }
+            keys[b] = (pivot_block_key_t){ .key = key, .block = b };
+        }
+        qsort(keys, B, sizeof(pivot_block_key_t), compare_block_keys);
+
+        for (size_t i = 0; i < q_length; i++) { heap_size[i] = 0; }
+
+        for (size_t visit = 0; visit < B; visit++) {
+            size_t b = keys[visit].block;
+            stats->block_visits++;
+
+            // The queries for which the block may hold a neighbor
+            int    num_active = 0;
+            float  farthest   = -INFINITY;
+            for (size_t i = 0; i < q_length; i++) {
+                float kth = knn_heap_bound(&heap_dist[i * K], heap_size[i], K);
+                if (kth > farthest) { farthest = kth; }
+                if (thresholds[i * B + b] <= kth) { active[num_active++] = (int)i; }
+            }
+            if (num_active == 0) {
+                // The blocks are visited by increasing smallest threshold: none of the next blocks can hold a neighbor either
+                if (keys[visit].key > farthest) {
+                    stats->block_visits += B - visit - 1;
+                    break;
+                }
+                continue;
+            }
+
+            size_t row_start = b * R;
+            size_t rows = (row_start + R < index->corpus_length) ? R : (index->corpus_length - row_start);
+            for (size_t r = 0; r < rows; r++) {
+                memcpy(&block[r * d], &index->corpus[(size_t)index->order[row_start + r] * d], d * sizeof(float));
+            }
+            for (int a = 0; a < num_active; a++) {
+                memcpy(&queries[(size_t)a * d], &c->query[(size_t)tile_queries[active[a]] * d], d * sizeof(float));
+            }
+
+            KNN_PERF_BEGIN(KNN_PERF_DISTANCE);
+            distance_square_matrix(block, queries, D, rows, num_active, d);
+            KNN_PERF_END(KNN_PERF_DISTANCE);
+            stats->blocks_searched++;
+            stats->distances += rows * num_active;
+
+            KNN_PERF_BEGIN(KNN_PERF_SELECTION);
+            KNN_STATS_BEGIN(KNN_PHASE_SELECT);
+            for (int a = 0; a < num_active; a++) {
+                int i = active[a];
+                for (size_t r = 0; r < rows; r++) {
+                    knn_heap_push(&heap_dist[i * K], &heap_ids[i * K], &heap_size[i], K, D[a * rows + r], index->order[row_start + r]);
+                }
+            }
+            KNN_STATS_END(KNN_PHASE_SELECT, num_active * rows * sizeof(float));
+            KNN_PERF_END(KNN_PERF_SELECTION);
+        }
+
+        // Re-rank every heap like `knn_exact_serial` (nearest first) and write it back, in the position of the query
+        KNN_STATS_BEGIN(KNN_PHASE_WRITEBACK);
+        for (size_t i = 0; i < q_length; i++) {
+            size_t     q    = (size_t)tile_queries[i];
+            float*     dist = &heap_dist[i * K];
+            knn_idx_t* ids  = &heap_ids[i * K];
+            distance_rerank(index->corpus, &c->query[q * d], d, ids, dist, heap_size[i]);
+            memcpy(&c->indices[q * k], ids, k * sizeof(knn_idx_t));
+            memcpy(&c->distances[q * k], dist, k * sizeof(float));
+        }
+        KNN_STATS_END(KNN_PHASE_WRITEBACK, q_length * K * ((d + 2) * sizeof(float) + 2 * sizeof(knn_idx_t)));
+    }
+
+    free(thresholds);
+    free(keys);
+    free(heap_dist);
+    free(heap_ids);
+    free(heap_size);
+    free(active);
+    free(block);
+    free(queries);
+    free(D);
+}
+
+
+int knn_pivot_search(const knn_pivot_index_t* index, const float* query, int k, knn_idx_t* indices, float* distances,
+                     size_t query_length, int num_of_threads, knn_pivot_stats_t* stats) {
+    if (index == NULL || knn_check_extents("knn_pivot_search", index->corpus_length, index->d, k) != 0) {
+        return -1;
+    }
+    if (stats) {
+        *stats = (knn_pivot_stats_t){ .brute_force = query_length * index->corpus_length };
+    }
+    if (query_length == 0) {
+        return 0;
+    }
+    num_of_threads = knn_resolve_threads(num_of_threads);
+
+    size_t P = (size_t)index->num_pivots;
+    size_t num_tiles = (query_length + KNN_PIVOT_QUERY_TILE - 1) / KNN_PIVOT_QUERY_TILE;
+    int    workers   = ((size_t)num_of_threads < num_tiles) ? num_of_threads : (int)num_tiles;
+
+    pivot_search_ctx_t ctx = {
+        .index          = index,
+        .query          = query,
+        .query_length   = query_length,
+        .k              = k,
+        .indices        = indices,
+        .distances      = distances,
+        .query_dist     = (double*)malloc(query_length * P * sizeof(double)),
+        .query_norms    = (double*)malloc(query_length * sizeof(double)),
+        .query_order    = (knn_idx_t*)malloc(query_length * sizeof(knn_idx_t)),
+        .stats          = (knn_pivot_stats_t*)calloc(workers, sizeof(knn_pivot_stats_t)),
+        .status         = (int*)calloc(workers, sizeof(int)),
+    };
+    pivot_entry_t* entries = (pivot_entry_t*)malloc(query_length * sizeof(pivot_entry_t));
+    int status = (ctx.query_dist && ctx.query_norms && ctx.query_order && ctx.stats && ctx.status && entries) ? 0 : -1;
+    if (status != 0) {
+        fprintf(stderr, "knn_pivot_search: Memory allocation failed\n");
+    }
+
+    // Sort the queries like the corpus rows, so that the queries of a tile are close to each other
+    if (status == 0) {
+        status = knn_parallel_ranges(search_query_pass, &ctx, query_length, num_of_threads);
+    }
+    for (size_t q = 0; status == 0 && q < query_length; q++) {
+        const double* dist = &ctx.query_dist[q * P];
+        int nearest = 0;
+        for (size_t p = 1; p < P; p++) {
+            if (dist[p] < dist[nearest]) { nearest = (int)p; }
+        }
+        entries[q] = (pivot_entry_t){ .pivot = nearest, .dist = (float)dist[nearest], .id = (knn_idx_t)q };
+    }
+    if (status == 0) {
+        qsort(entries, query_length, sizeof(pivot_entry_t), compare_entries);
+        for (size_t q = 0; q < query_length; q++) {
+            ctx.query_order[q] = entries[q].id;
+        }
+
+        // Every worker calls `cblas_sgemm`, so BLAS must not spawn its own threads (oversubscription)
+        int blas_threads = blas_get_threads();
+        if (workers > 1) {
+            blas_set_threads(1);
+            blas_set_last_strategy(KNN_BLAS_SINGLE_PER_WORKER);
+        }
+        status = knn_parallel_ranges(search_tiles, &ctx, num_tiles, workers);
+        blas_set_threads(blas_threads);
+
+        for (int t = 0; t < workers; t++) {
+            if (ctx.status[t] != 0) { status = -1; }
+            if (stats) {
+                stats->block_visits    += ctx.stats[t].block_visits;
+                stats->blocks_searched += ctx.stats[t].blocks_searched;
+                stats->distances       += ctx.stats[t].distances;
+            }
+        }
+    }
+
+    free(ctx.query_dist);
+    free(ctx.query_norms);
+    free(ctx.query_order);
+    free(ctx.stats);
+    free(ctx.status);
+    free(entries);
+
+    return status;
+}
+
+
+void knn_exact_pivot(const float* corpus, const float* query, int k, knn_idx_t* indices, float* distances, size_t corpus_length, size_t query_length, int d, int num_of_threads) {
+    if (knn_check_extents("knn_exact_pivot", corpus_length, d, k) != 0) {
+        return;
+    }
+
+    knn_pivot_index_t* index = knn_pivot_build(corpus, corpus_length, d, KNN_PIVOT_DEFAULT_PIVOTS, KNN_PIVOT_BLOCK_ROWS, num_of_threads);
+    if (index == NULL) {
+        return;
+    }
+    knn_pivot_search(index, query, k, indices, distances, query_length, num_of_threads, &last_stats);
+    knn_pivot_free(index);
+}
+
+
+const knn_pivot_stats_t* knn_exact_pivot_last_stats(void) {
+    return &last_stats;
+}
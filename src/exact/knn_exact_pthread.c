@@ -3,16 +3,17 @@
 void* knn_exact_pthread_core(void* args) {
     knn_thread_args_t* thread_args = (knn_thread_args_t*)args;
 
-    // Calculate start index for the query chunk, handled by this thread
-    int chunk_size = (thread_args->query_length + thread_args->num_of_threads - 1) / thread_args->num_of_threads;  // Divide queries evenly
-    int q_start = thread_args->thread_id * chunk_size;
-    int q_chunk_length = (q_start + chunk_size < thread_args->query_length) ? chunk_size : (thread_args->query_length - q_start);
+    // Calculate the query chunk handled by this thread (even ranges: no chunk is empty or past the end, even when
+    // there are few queries per thread)
+    size_t q_start = thread_args->query_length * thread_args->thread_id / thread_args->num_of_threads;
+    size_t q_end   = thread_args->query_length * (thread_args->thread_id + 1) / thread_args->num_of_threads;
+    size_t q_chunk_length = q_end - q_start;
 
     // Allocate and load the query chunk
     const float* query_chunk = &thread_args->query[q_start * thread_args->d];
 
     // Perform k-NN search on the assigned query chunk
-    knn_exact_serial(
+    thread_args->status = knn_exact_serial_with_config(
         thread_args->corpus,
         query_chunk,
         thread_args->k,
@@ -21,22 +22,58 @@ void* knn_exact_pthread_core(void* args) {
         thread_args->corpus_length,
         q_chunk_length,
         thread_args->d,
-        thread_args->num_of_threads
+        thread_args->num_of_threads,
+        thread_args->config
     );
 
     pthread_exit(NULL);
 }
 
 
-void knn_exact_pthread(const float* corpus, const float* query, int k, int* indices, float* distances, int corpus_length, int query_length, int d, int num_of_threads) {
+int knn_exact_pthread_with_config(const float* corpus, const float* query, int k, knn_idx_t* indices, float* distances,
+                                  size_t corpus_length, size_t query_length, int d, int num_of_threads,
+                                  const knn_exact_config_t* config) {
+    if (knn_check_extents("knn_exact_pthread", corpus_length, d, k) != 0) {
+        return -1;
+    }
+    if (num_of_threads < 1) { num_of_threads = 1; }
+
+    // Small query batches: run a few big GEMMs and let OpenBLAS use the threads instead
+    knn_blas_strategy_t strategy = knn_exact_strategy(config, corpus_length, query_length, num_of_threads);
+    blas_set_last_strategy(strategy);
+    int blas_threads = blas_get_threads();
+
+    if (strategy == KNN_BLAS_MULTI_FEW_GEMMS) {
+        blas_set_threads(num_of_threads);
+        int status = knn_exact_serial_with_config(corpus, query, k, indices, distances, corpus_length, query_length, d, 1, config);
+        blas_set_threads(blas_threads);
+        return status;
+    }
+
+    // Every worker calls `cblas_sgemm`, so BLAS must not spawn its own threads (oversubscription)
+    blas_set_threads(1);
+
     // Check if there are more threads than queries
-    if (num_of_threads > query_length) { num_of_threads = query_length; }
+    if ((size_t)num_of_threads > query_length) { num_of_threads = (int)query_length; }
+    if (num_of_threads == 0) {
+        blas_set_threads(blas_threads);
+        return 0;
+    }
 
     // Array of thread handles
     pthread_t* threads = (pthread_t*)malloc(num_of_threads * sizeof(pthread_t));
     knn_thread_args_t* thread_args = (knn_thread_args_t*)malloc(num_of_threads * sizeof(knn_thread_args_t));
+    if (!threads || !thread_args) {
+        fprintf(stderr, "knn_exact_pthread: Memory allocation failed for the threads\n");
+        free(threads);
+        free(thread_args);
+        blas_set_threads(blas_threads);
+        return -1;
+    }
 
     // Initialize and create threads
+    int created = 0;
+    int status = 0;
     for (int i = 0; i < num_of_threads; ++i) {
         // Set up arguments for each thread
         thread_args[i].corpus           =   corpus;
@@ -49,22 +86,32 @@ void knn_exact_pthread(const float* corpus, const float* query, int k, int* indi
         thread_args[i].d                =   d;
         thread_args[i].thread_id        =   i;
         thread_args[i].num_of_threads   =   num_of_threads;
+        thread_args[i].config           =   config;
+        thread_args[i].status           =   0;
 
         // Create the thread
         if (pthread_create(&threads[i], NULL, knn_exact_pthread_core, &thread_args[i]) != 0) {
             fprintf(stderr, "knn_exact_pthread: Error creating thread %d\n", i);
-            free(threads);
-            free(thread_args);
-            return;
+            status = -1;
+            break;
         }
+        created++;
     }
 
     // Wait for all threads to finish
-    for (int i = 0; i < num_of_threads; ++i) {
+    for (int i = 0; i < created; ++i) {
         pthread_join(threads[i], NULL);
+        if (thread_args[i].status != 0) { status = -1; }
     }
 
     // Cleanup
     free(threads);
     free(thread_args);
+    blas_set_threads(blas_threads);
+    return status;
+}
+
+
+void knn_exact_pthread(const float* corpus, const float* query, int k, knn_idx_t* indices, float* distances, size_t corpus_length, size_t query_length, int d, int num_of_threads) {
+    knn_exact_pthread_with_config(corpus, query, k, indices, distances, corpus_length, query_length, d, num_of_threads, NULL);
 }
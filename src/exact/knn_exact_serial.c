@@ -1,59 +1,110 @@
 #include "../../include/exact/knn_exact_serial.h"
 
-void knn_exact_serial_core(const float* corpus, const float* query, int k, int* indices, float* distances, int corpus_length, int query_length, int d) {
+long knn_exact_max_chunk_length(size_t corpus_length, int k, int num_of_threads, double memory_ratio,
+                                const knn_exact_config_t* config) {
+    size_t memory_budget = (config && config->memory_budget > 0) ? config->memory_budget : get_usable_memory();
+    long max_chunk_length = (memory_ratio * memory_budget / num_of_threads - 2.0 * corpus_length * sizeof(float) - k * sizeof(size_t)) / ((corpus_length + 1) * sizeof(float));
+
+    if (config && config->query_tile > 0 && max_chunk_length > (long)config->query_tile) {
+        max_chunk_length = (long)config->query_tile;
+    }
+
+    return max_chunk_length;
+}
+
+
+knn_blas_strategy_t knn_exact_strategy(const knn_exact_config_t* config, size_t corpus_length, size_t query_length,
+                                       int num_of_threads) {
+    if (config && config->strategy != KNN_BLAS_INHERIT) {
+        return config->strategy;
+    }
+    return select_blas_strategy(corpus_length, query_length, num_of_threads);
+}
+
+
+int knn_exact_serial_core(const float* corpus, const float* query, int k, knn_idx_t* indices, float* distances, size_t corpus_length, size_t query_length, int d) {
     // Allocate memory for the distance matrix D
     float* D = (float*)malloc(corpus_length * query_length * sizeof(float));
     if (!D) {
         fprintf(stderr, "knn_exact_serial_core: Failed to allocate memory for the distance matrix D\n");
-        return;
+        return -1;
     }
 
     // Calculate the distance matrix D (squared Euclidean distances)
+    KNN_PERF_BEGIN(KNN_PERF_DISTANCE);
     distance_square_matrix(corpus, query, D, corpus_length, query_length, d);
+    KNN_PERF_END(KNN_PERF_DISTANCE);
 
-    // Temporary arrays for finding the k nearest neighbors
+    // Temporary arrays for finding the k nearest neighbors, among a few more candidates re-ranked by `distance_rerank`
+    int candidates = ((size_t)k + KNN_RERANK_MARGIN < corpus_length) ? k + KNN_RERANK_MARGIN : (int)corpus_length;
     float* tmp_distances = (float*)malloc(corpus_length * sizeof(float));
-    size_t* tmp_indices  = (size_t*)malloc(k * sizeof(size_t));
+    size_t* tmp_indices  = (size_t*)malloc(candidates * sizeof(size_t));
+    knn_idx_t* cand_ids  = (knn_idx_t*)malloc(candidates * sizeof(knn_idx_t));
+    float* cand_dist     = (float*)malloc(candidates * sizeof(float));
 
-    if (!tmp_distances || !tmp_indices) {
+    if (!tmp_distances || !tmp_indices || !cand_ids || !cand_dist) {
         fprintf(stderr, "knn_exact_serial_core: Failed to allocate temporary arrays for k-NN\n");
         free(D);
-        return;
+        free(tmp_distances);
+        free(tmp_indices);
+        free(cand_ids);
+        free(cand_dist);
+        return -1;
     }
 
     // For each query, find the top-k nearest neighbors using GSL's gsl_sort_smallest
     // Its a QuickSelect implementation, so it does't sort the whole array
-    for (int q = 0; q < query_length; q++) {
+    KNN_PERF_BEGIN(KNN_PERF_SELECTION);
+    for (size_t q = 0; q < query_length; q++) {
         // Copy the distances of the current query
+        KNN_STATS_BEGIN(KNN_PHASE_COPY);
         memcpy(tmp_distances, &D[q * corpus_length], corpus_length * sizeof(float));
+        KNN_STATS_END(KNN_PHASE_COPY, 2 * corpus_length * sizeof(float));
 
-        // Use GSL to find the indices of the k smallest distances
-        gsl_sort_float_smallest_index(tmp_indices, k, tmp_distances, 1, corpus_length);
+        // Use GSL to find the indices of the smallest distances
+        KNN_STATS_BEGIN(KNN_PHASE_SELECT);
+        gsl_sort_float_smallest_index(tmp_indices, candidates, tmp_distances, 1, corpus_length);
+        KNN_STATS_END(KNN_PHASE_SELECT, corpus_length * sizeof(float) + candidates * sizeof(size_t));
 
-        // Collect the top-k nearest neighbors (sorted)
-        for (int i = 0; i < k; ++i) {
-            indices[q * k + i] = (int)tmp_indices[i];
-            distances[q * k + i] = (float)sqrt( tmp_distances[tmp_indices[i]] );
+        // Collect the top-k nearest neighbors (sorted), at the distances that do not depend on the GEMM
+        KNN_STATS_BEGIN(KNN_PHASE_WRITEBACK);
+        for (int i = 0; i < candidates; ++i) {
+            cand_ids[i] = (knn_idx_t)tmp_indices[i];
         }
+        distance_rerank(corpus, &query[q * d], d, cand_ids, cand_dist, candidates);
+        memcpy(&indices[q * k], cand_ids, k * sizeof(knn_idx_t));
+        memcpy(&distances[q * k], cand_dist, k * sizeof(float));
+        KNN_STATS_END(KNN_PHASE_WRITEBACK, candidates * (sizeof(size_t) + (d + 1) * sizeof(float) + sizeof(knn_idx_t)));
     }
+    KNN_PERF_END(KNN_PERF_SELECTION);
 
     free(D);
     free(tmp_distances);
     free(tmp_indices);
+    free(cand_ids);
+    free(cand_dist);
+    return 0;
 }
 
 
-void knn_exact_serial(const float* corpus, const float* query, int k, int* indices, float* distances, int corpus_length, int query_length, int d, int num_of_threads) {
+int knn_exact_serial_with_config(const float* corpus, const float* query, int k, knn_idx_t* indices, float* distances,
+                                 size_t corpus_length, size_t query_length, int d, int num_of_threads,
+                                 const knn_exact_config_t* config) {
     long    max_chunk_length       =   0;
-    int     q_start                =   0;
-    int     q_chunk_length         =   0;
+    size_t  q_start                =   0;
+    size_t  q_chunk_length         =   0;
     float*  query_chunk            =   NULL;
+
+    if (knn_check_extents("knn_exact_serial", corpus_length, d, k) != 0) {
+        return -1;
+    }
+
     // Process query chunks/blocks iteratively
     while (q_start < query_length) {
         // Update usable memory status and evaluate max_chunk_length based on: 
         //  - all the memory allocations needs to be done inside knn_exact_serial_core
         // -  all the memory allocations needs to be done in every knn_exact_serial that runs in threads.
-        max_chunk_length = (get_usable_memory()/num_of_threads - 2*corpus_length*sizeof(float) - k*sizeof(size_t)) / ((corpus_length + 1)*sizeof(float));
+        max_chunk_length = knn_exact_max_chunk_length(corpus_length, k, num_of_threads, 1.0, config);
         
         // Check if max_chunk_length is valid:
         if (max_chunk_length <= 0) {
@@ -62,15 +113,24 @@ void knn_exact_serial(const float* corpus, const float* query, int k, int* indic
         }
         // printf("%ld\n", max_chunk_length);
 
-        q_chunk_length = (q_start + max_chunk_length < query_length) ? max_chunk_length : (query_length - q_start);
+        q_chunk_length = (q_start + max_chunk_length < query_length) ? (size_t)max_chunk_length : (query_length - q_start);
 
         // Allocate and load the query chunk
         query_chunk = (float*)&query[q_start * d];
 
         // The core function fills the indices and distances, chunk by chunk:
-        knn_exact_serial_core(corpus, query_chunk, k, (indices + q_start * k), (distances + q_start * k), corpus_length, q_chunk_length, d);
+        if (knn_exact_serial_core(corpus, query_chunk, k, (indices + q_start * k), (distances + q_start * k), corpus_length, q_chunk_length, d) != 0) {
+            return -1;
+        }
 
         query_chunk = NULL;
         q_start += max_chunk_length;
     }
+
+    return 0;
+}
+
+
+void knn_exact_serial(const float* corpus, const float* query, int k, knn_idx_t* indices, float* distances, size_t corpus_length, size_t query_length, int d, int num_of_threads) {
+    knn_exact_serial_with_config(corpus, query, k, indices, distances, corpus_length, query_length, d, num_of_threads, NULL);
 }
@@ -0,0 +1,466 @@
+#include "../../include/exact/knn_exact_tree.h"
+
+// Relative slack of the node bounds, for the rounding of the distances (computed in double, compared in float)
+#define TREE_BOUND_SLACK 1e-6
+
+// Number of subtrees per thread that the top levels are split into (more subtrees balance the threads better)
+#define TREE_TASKS_PER_THREAD 4
+
+static knn_tree_stats_t last_stats;
+
+// Subtree built by one thread
+typedef struct {
+    size_t          node;
+    size_t          start, end;
+} tree_task_t;
+
+typedef struct {
+    knn_tree_t*     tree;
+    const float*    corpus;
+    tree_task_t*    tasks;
+} tree_build_ctx_t;
+
+// Node in the queue of a best-first search
+typedef struct {
+    double          bound;              // Squared lower bound of the distances of the node's rows to the query
+    size_t          node;
+} tree_queue_item_t;
+
+typedef struct {
+    const knn_tree_t* tree;
+    const float*    query;
+    int             k;
+    knn_idx_t*      indices;
+    float*          distances;
+    knn_tree_stats_t* stats;            // One per worker
+    int*            status;             // One per worker
+} tree_search_ctx_t;
+
+
+// Number of nodes of a subtree with `rows` rows (the left child gets rows / 2)
+static size_t tree_count_nodes(size_t rows, size_t leaf_rows) {
+    if (rows <= leaf_rows) {
+        return 1;
+    }
+    return 1 + tree_count_nodes(rows / 2, leaf_rows) + tree_count_nodes(rows - rows / 2, leaf_rows);
+}
+
+
+static inline double tree_distance(const float* a, const float* b, int d) {
+    double sum = 0.0;
+    for (int j = 0; j < d; j++) {
+        double diff = (double)a[j] - (double)b[j];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+
+// Reorder ids[0, n) so that ids[nth] has the nth smallest coordinate `dim`, with no larger one before it
+// and no smaller one after it (quickselect)
+static void tree_select(knn_idx_t* ids, size_t n, size_t nth, const float* corpus, int d, int dim) {
+    #define TREE_VALUE(i) corpus[(size_t)ids[i] * d + dim]
+    long lo = 0, hi = (long)n - 1;
+
+    while (lo < hi) {
+        // Median of three as the pivot value
+        float a = TREE_VALUE(lo), b = TREE_VALUE(lo + (hi - lo) / 2), c = TREE_VALUE(hi);
+        float pivot = (a < b) ? ((b < c) ? b : ((a < c) ? c : a)) : ((a < c) ? a : ((b < c) ? c : b));
+
+        long i = lo, j = hi;
+        while (i <= j) {
+            while (TREE_VALUE(i) < pivot) { i++; }
+            while (TREE_VALUE(j) > pivot) { j--; }
+            if (i <= j) {
+                knn_idx_t tmp = ids[i]; ids[i] = ids[j]; ids[j] = tmp;
+                i++;
+                j--;
+            }
+        }
+        if ((long)nth <= j) {
+            hi = j;
+        } else if ((long)nth >= i) {
+            lo = i;
+        } else {
+            break;
+        }
+    }
+    #undef TREE_VALUE
+}
+
+
+// Build the subtree `node` over the rows [start, end) of the tree order. The nodes at depth `task_depth`
+// are not built but recorded as tasks (if `tasks` is not NULL).
+static void tree_build_node(tree_build_ctx_t* ctx, size_t node, size_t start, size_t end, int depth, int task_depth, size_t* num_tasks) {
+    knn_tree_t*  tree   = ctx->tree;
+    const float* corpus = ctx->corpus;
+    int          d      = tree->d;
+    size_t       rows   = end - start;
+
+    if (ctx->tasks != NULL && depth == task_depth) {
+        ctx->tasks[(*num_tasks)++] = (tree_task_t){ .node = node, .start = start, .end = end };
+        return;
+    }
+
+    // The center is the mean of the rows, the radius the largest distance of a row to the (float) center
+    float* center = &tree->centers[node * d];
+    for (int j = 0; j < d; j++) {
+        double sum = 0.0;
+        for (size_t r = start; r < end; r++) {
+            sum += corpus[(size_t)tree->ids[r] * d + j];
+        }
+        center[j] = (float)(sum / rows);
+    }
+    double radius = 0.0;
+    for (size_t r = start; r < end; r++) {
+        double dist = tree_distance(&corpus[(size_t)tree->ids[r] * d], center, d);
+        if (dist > radius) { radius = dist; }
+    }
+    tree->nodes[node] = (knn_tree_node_t){ .start = start, .end = end, .right = 0, .radius = nextafterf((float)sqrt(radius), FLT_MAX) };
+
+    if (rows <= tree->leaf_rows) {
+        // Leaf: copy its rows, so that they are contiguous
+        for (size_t r = start; r < end; r++) {
+            memcpy(&tree->points[r * d], &corpus[(size_t)tree->ids[r] * d], d * sizeof(float));
+        }
+        return;
+    }
+
+    // Split at the median of the dimension with the largest spread
+    int   split_dim = 0;
+    float split_spread = -1.0f;
+    for (int j = 0; j < d; j++) {
+        float low = FLT_MAX, high = -FLT_MAX;
+        for (size_t r = start; r < end; r++) {
+            float value = corpus[(size_t)tree->ids[r] * d + j];
+            if (value < low)  { low = value; }
+            if (value > high) { high = value; }
+        }
+        if (high - low > split_spread) {
+            split_spread = high - low;
+            split_dim = j;
+        }
+    }
+    size_t left_rows = rows / 2;
+    tree_select(&tree->ids[start], rows, left_rows, corpus, d, split_dim);
+
+    size_t right = node + 1 + tree_count_nodes(left_rows, tree->leaf_rows);
+    tree->nodes[node].right = right;
+    tree_build_node(ctx, node + 1, start, start + left_rows, depth + 1, task_depth, num_tasks);
+    tree_build_node(ctx, right, start + left_rows, end, depth + 1, task_depth, num_tasks);
+}
+
+
+static void tree_build_tasks(void* ctx, int t, size_t start, size_t end) {
+    tree_build_ctx_t* c = (tree_build_ctx_t*)ctx;
+    tree_build_ctx_t  subtree = { .tree = c->tree, .corpus = c->corpus, .tasks = NULL };
+
+    for (size_t i = start; i < end; i++) {
+        tree_build_node(&subtree, c->tasks[i].node, c->tasks[i].start, c->tasks[i].end, 0, -1, NULL);
+    }
+}
+
+
+knn_tree_t* knn_tree_build(const float* corpus, size_t corpus_length, int d, size_t leaf_rows, int num_of_threads) {
+    if (knn_check_extents("knn_tree_build", corpus_length, d, 1) != 0) {
+        return NULL;
+    }
+    if (leaf_rows == 0) { leaf_rows = KNN_TREE_LEAF_ROWS; }
+    num_of_threads = knn_resolve_threads(num_of_threads);
+
+    knn_tree_t* tree = (knn_tree_t*)calloc(1, sizeof(knn_tree_t));
+    if (tree == NULL) {
+        fprintf(stderr, "knn_tree_build: Memory allocation failed\n");
+        return NULL;
+    }
+    tree->corpus_length = corpus_length;
+    tree->d             = d;
+    tree->leaf_rows     = leaf_rows;
+    tree->num_nodes     = tree_count_nodes(corpus_length, leaf_rows);
+    tree->nodes         = (knn_tree_node_t*)malloc(tree->num_nodes * sizeof(knn_tree_node_t));
+    tree->centers       = (float*)malloc(tree->num_nodes * d * sizeof(float));
+    tree->points        = (float*)malloc(corpus_length * d * sizeof(float));
+    tree->ids           = (knn_idx_t*)malloc(corpus_length * sizeof(knn_idx_t));
+
+    // The top levels are split serially into (about) TREE_TASKS_PER_THREAD subtrees per thread
+    int task_depth = 0;
+    while (num_of_threads > 1 && ((size_t)1 << task_depth) < (size_t)num_of_threads * TREE_TASKS_PER_THREAD &&
+           (corpus_length >> task_depth) > 2 * leaf_rows) {
+        task_depth++;
+    }
+    tree_build_ctx_t ctx = {
+        .tree   = tree,
+        .corpus = corpus,
+        .tasks  = (tree_task_t*)malloc(((size_t)1 << task_depth) * sizeof(tree_task_t)),
+    };
+    if (!tree->nodes || !tree->centers || !tree->points || !tree->ids || !ctx.tasks) {
+        fprintf(stderr, "knn_tree_build: Memory allocation failed\n");
+        free(ctx.tasks);
+        knn_tree_free(tree);
+        return NULL;
+    }
+    for (size_t i = 0; i < corpus_length; i++) {
+        tree->ids[i] = (knn_idx_t)i;
+    }
+
+    size_t num_tasks = 0;
+    tree_build_node(&ctx, 0, 0, corpus_length, 0, task_depth, &num_tasks);
+    int status = knn_parallel_ranges(tree_build_tasks, &ctx, num_tasks, num_of_threads);
+
+    free(ctx.tasks);
+    if (status != 0) {
+        knn_tree_free(tree);
+        return NULL;
+    }
+    return tree;
+}
+
+
+// Parameters of a saved tree (the META section)
+typedef struct {
+    uint32_t        id_bytes;           // sizeof(knn_idx_t) of the writer
+    int32_t         d;
+    uint64_t        corpus_length;
+    uint64_t        leaf_rows;
+    uint64_t        num_nodes;
+} tree_snapshot_meta_t;
+
+
+int knn_tree_save(const knn_tree_t* tree, const char* filename) {
+    tree_snapshot_meta_t meta = {
+        .id_bytes      = sizeof(knn_idx_t),
+        .d             = tree->d,
+        .corpus_length = tree->corpus_length,
+        .leaf_rows     = tree->leaf_rows,
+        .num_nodes     = tree->num_nodes,
+    };
+    knn_snapshot_section_t sections[] = {
+        { KNN_SNAPSHOT_META,         &meta,         sizeof(meta) },
+        { KNN_SNAPSHOT_TREE_NODES,   tree->nodes,   tree->num_nodes * sizeof(knn_tree_node_t) },
+        { KNN_SNAPSHOT_TREE_CENTERS, tree->centers, tree->num_nodes * tree->d * sizeof(float) },
+        { KNN_SNAPSHOT_TREE_POINTS,  tree->points,  tree->corpus_length * tree->d * sizeof(float) },
+        { KNN_SNAPSHOT_TREE_IDS,     tree->ids,     tree->corpus_length * sizeof(knn_idx_t) },
+    };
+    return knn_snapshot_save(filename, KNN_SNAPSHOT_KIND_TREE, sections, (int)(sizeof(sections) / sizeof(sections[0])));
+}
+
+
+knn_tree_t* knn_tree_load(const char* filename, int verify) {
+    knn_snapshot_t* snapshot = knn_snapshot_open(filename, KNN_SNAPSHOT_KIND_TREE, verify);
+    if (snapshot == NULL) {
+        return NULL;
+    }
+    const tree_snapshot_meta_t* meta = (const tree_snapshot_meta_t*)knn_snapshot_section(snapshot, KNN_SNAPSHOT_META, sizeof(tree_snapshot_meta_t));
+    if (meta == NULL || meta->id_bytes != sizeof(knn_idx_t)) {
+        fprintf(stderr, "knn_tree_load: %s: %s\n", filename, meta ? "saved with another id width (IDX32)" : "missing parameters");
+        knn_snapshot_close(snapshot);
+        return NULL;
+    }
+
+    knn_tree_t* tree = (knn_tree_t*)calloc(1, sizeof(knn_tree_t));
+    if (tree == NULL) {
+        fprintf(stderr, "knn_tree_load: Memory allocation failed\n");
+        knn_snapshot_close(snapshot);
+        return NULL;
+    }
+    tree->corpus_length = meta->corpus_length;
+    tree->d             = meta->d;
+    tree->leaf_rows     = meta->leaf_rows;
+    tree->num_nodes     = meta->num_nodes;
+    tree->snapshot      = snapshot;
+
+    // The arrays are read-only: the search never writes them
+    tree->nodes   = (knn_tree_node_t*)knn_snapshot_section(snapshot, KNN_SNAPSHOT_TREE_NODES, tree->num_nodes * sizeof(knn_tree_node_t));
+    tree->centers = (float*)knn_snapshot_section(snapshot, KNN_SNAPSHOT_TREE_CENTERS, tree->num_nodes * tree->d * sizeof(float));
+    tree->points  = (float*)knn_snapshot_section(snapshot, KNN_SNAPSHOT_TREE_POINTS, tree->corpus_length * tree->d * sizeof(float));
+    tree->ids     = (knn_idx_t*)knn_snapshot_section(snapshot, KNN_SNAPSHOT_TREE_IDS, tree->corpus_length * sizeof(knn_idx_t));
+    if (knn_check_extents("knn_tree_load", tree->corpus_length, tree->d, 1) != 0 || tree->leaf_rows == 0 ||
+        tree->num_nodes != tree_count_nodes(tree->corpus_length, tree->leaf_rows) ||
+        !tree->nodes || !tree->centers || !tree->points || !tree->ids) {
+        fprintf(stderr, "knn_tree_load: %s: inconsistent sections\n", filename);
+        knn_tree_free(tree);
+        return NULL;
+    }
+    return tree;
+}
+
+
+void knn_tree_free(knn_tree_t* tree) {
+    if (tree == NULL) { return; }
+    if (tree->snapshot != NULL) {
+        knn_snapshot_close(tree->snapshot);
+    } else {
+        free(tree->nodes);
+        free(tree->centers);
+        free(tree->points);
+        free(tree->ids);
+    }
+    free(tree);
+}
+
+
+// Min-heap of the nodes to visit, by their lower bound
+static inline void tree_queue_push(tree_queue_item_t* queue, size_t* size, double bound, size_t node) {
+    size_t i = (*size)++;
+    while (i > 0 && queue[(i - 1) / 2].bound > bound) {
+        queue[i] = queue[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    queue[i] = (tree_queue_item_t){ .bound = bound, .node = node };
+}
+
+
+static inline tree_queue_item_t tree_queue_pop(tree_queue_item_t* queue, size_t* size) {
+    tree_queue_item_t top  = queue[0];
+    tree_queue_item_t last = queue[--(*size)];
+    size_t i = 0;
+    while (1) {
+        size_t child = 2 * i + 1;
+        if (child >= *size) { break; }
+        if (child + 1 < *size && queue[child + 1].bound < queue[child].bound) { child++; }
+        if (queue[child].bound >= last.bound) { break; }
+        queue[i] = queue[child];
+        i = child;
+    }
+    if (*size > 0) { queue[i] = last; }
+    return top;
+}
+
+
+// Squared lower bound of the distances of the rows of a node to a query
+static inline double tree_node_bound(const knn_tree_t* tree, size_t node, const float* query) {
+    double gap = sqrt(tree_distance(query, &tree->centers[node * tree->d], tree->d)) - tree->nodes[node].radius;
+    return (gap > 0.0) ? gap * gap * (1.0 - TREE_BOUND_SLACK) : 0.0;
+}
+
+
+static void tree_search_queries(void* ctx, int t, size_t start, size_t end) {
+    tree_search_ctx_t* c    = (tree_search_ctx_t*)ctx;
+    const knn_tree_t*  tree = c->tree;
+    int d = tree->d;
+    int k = c->k;
+    knn_tree_stats_t* stats = &c->stats[t];
+
+    // The queue holds at most one node per level below the visited nodes, plus their siblings: num_nodes is an upper bound
+    tree_queue_item_t* queue = (tree_queue_item_t*)malloc(tree->num_nodes * sizeof(tree_queue_item_t));
+    if (queue == NULL) {
+        fprintf(stderr, "knn_tree_search: Memory allocation failed for the node queue\n");
+        c->status[t] = -1;
+        return;
+    }
+
+    for (size_t q = start; q < end; q++) {
+        const float* query  = &c->query[q * d];
+        float*       dist   = &c->distances[q * k];
+        knn_idx_t*   ids    = &c->indices[q * k];
+        int          size   = 0;
+        size_t       queued = 0;
+
+        // The heap of the neighbors keeps the squared distances, in the output arrays of the query
+        tree_queue_push(queue, &queued, 0.0, 0);
+        while (queued > 0) {
+            tree_queue_item_t item = tree_queue_pop(queue, &queued);
+            if (item.bound > knn_heap_bound(dist, size, k)) {
+                break;      // The nearest unvisited node cannot hold a neighbor: neither can the others
+            }
+
+            const knn_tree_node_t* node = &tree->nodes[item.node];
+            if (node->right == 0) {
+                KNN_STATS_BEGIN(KNN_PHASE_SELECT);
+                for (size_t r = node->start; r < node->end; r++) {
+                    float candidate = (float)tree_distance(query, &tree->points[r * d], d);
+                    knn_heap_push(dist, ids, &size, k, candidate, tree->ids[r]);
+                }
+                KNN_STATS_END(KNN_PHASE_SELECT, (node->end - node->start) * d * sizeof(float));
+                stats->leaves_searched++;
+                stats->distances += node->end - node->start;
+                continue;
+            }
+
+            size_t children[2] = { item.node + 1, node->right };
+            for (int i = 0; i < 2; i++) {
+                double bound = tree_node_bound(tree, children[i], query);
+                if (bound <= knn_heap_bound(dist, size, k)) {
+                    tree_queue_push(queue, &queued, bound, children[i]);
+                }
+            }
+        }
+
+        knn_heap_sort(dist, ids, k);
+        for (int j = 0; j < k; j++) {
+            dist[j] = (float)sqrt(dist[j]);
+        }
+    }
+
+    free(queue);
+}
+
+
+int knn_tree_search(const knn_tree_t* tree, const float* query, int k, knn_idx_t* indices, float* distances,
+                    size_t query_length, int num_of_threads, knn_tree_stats_t* stats) {
+    if (tree == NULL || knn_check_extents("knn_tree_search", tree->corpus_length, tree->d, k) != 0) {
+        return -1;
+    }
+    if (stats) {
+        *stats = (knn_tree_stats_t){ .brute_force = query_length * tree->corpus_length };
+    }
+    if (query_length == 0) {
+        return 0;
+    }
+    num_of_threads = knn_resolve_threads(num_of_threads);
+    if ((size_t)num_of_threads > query_length) { num_of_threads = (int)query_length; }
+
+    tree_search_ctx_t ctx = {
+        .tree       = tree,
+        .query      = query,
+        .k          = k,
+        .indices    = indices,
+        .distances  = distances,
+        .stats      = (knn_tree_stats_t*)calloc(num_of_threads, sizeof(knn_tree_stats_t)),
+        .status     = (int*)calloc(num_of_threads, sizeof(int)),
+    };
+    int status = (ctx.stats && ctx.status) ? 0 : -1;
+    if (status != 0) {
+        fprintf(stderr, "knn_tree_search: Memory allocation failed\n");
+    } else {
+        status = knn_parallel_ranges(tree_search_queries, &ctx, query_length, num_of_threads);
+    }
+
+    for (int t = 0; status == 0 && t < num_of_threads; t++) {
+        if (ctx.status[t] != 0) { status = -1; }
+        if (stats) {
+            stats->leaves_searched += ctx.stats[t].leaves_searched;
+            stats->distances       += ctx.stats[t].distances;
+        }
+    }
+
+    free(ctx.stats);
+    free(ctx.status);
+    return status;
+}
+
+
+void knn_exact_tree(const float* corpus, const float* query, int k, knn_idx_t* indices, float* distances, size_t corpus_length, size_t query_length, int d, int num_of_threads) {
+    if (knn_check_extents("knn_exact_tree", corpus_length, d, k) != 0) {
+        return;
+    }
+
+    // Above KNN_TREE_MAX_USEFUL_DIM the balls overlap too much to prune: the brute force (GEMM) is faster
+    if (d > KNN_TREE_MAX_USEFUL_DIM) {
+        knn_search(corpus, query, k, indices, distances, corpus_length, query_length, d, num_of_threads);
+        last_stats = (knn_tree_stats_t){ .distances = query_length * corpus_length, .brute_force = query_length * corpus_length };
+        return;
+    }
+
+    knn_tree_t* tree = knn_tree_build(corpus, corpus_length, d, KNN_TREE_LEAF_ROWS, num_of_threads);
+    if (tree == NULL) {
+        return;
+    }
+    knn_tree_search(tree, query, k, indices, distances, query_length, num_of_threads, &last_stats);
+    knn_tree_free(tree);
+}
+
+
+const knn_tree_stats_t* knn_exact_tree_last_stats(void) {
+    return &last_stats;
+}
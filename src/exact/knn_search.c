@@ -0,0 +1,267 @@
+#include "../../include/exact/knn_search.h"
+
+// GEMM throughput for a tile of `q` query rows: interpolated (in log scale) between the thin and the fat calibration shapes
+static double plan_gemm_gflops(const knn_profile_t* profile, size_t q, int multi) {
+    double thin = multi ? profile->gemm_gflops_thin_multi : profile->gemm_gflops_thin;
+    double fat  = multi ? profile->gemm_gflops_fat_multi  : profile->gemm_gflops_fat;
+
+    if (q <= 8)   { return thin; }
+    if (q >= 256) { return fat; }
+    return thin + (fat - thin) * log2(q / 8.0) / 5.0;   // log2(256 / 8) == 5
+}
+
+
+// Time of one `knn_exact_serial_core` call for a `q x c` distance matrix
+static double plan_tile_time(const knn_profile_t* profile, size_t q, size_t c, int d, int k, int multi) {
+    double gemm  = 2.0 * q * c * d / (plan_gemm_gflops(profile, q, multi) * 1e9);
+    double norms = (double)(q + c) * d * profile->copy_ns * 1e-9;
+    double pass  = (double)q * c * (2 * profile->copy_ns + profile->select_ns_base + profile->select_ns_per_k * k) * 1e-9;
+
+    return gemm + norms + pass;
+}
+
+
+static double plan_cost(const knn_profile_t* profile, size_t corpus_length, size_t query_length, int d, int k,
+                        knn_backend_t backend, int num_of_threads, size_t query_tile, size_t corpus_tile) {
+    int     workers         = (backend == KNN_BACKEND_SERIAL || backend == KNN_BACKEND_BLAS) ? 1 : num_of_threads;
+    int     multi           = (backend == KNN_BACKEND_BLAS);
+    size_t  corpus_tiles    = (corpus_length + corpus_tile - 1) / corpus_tile;
+    size_t  query_tiles     = (query_length + query_tile - 1) / query_tile;
+    size_t  rounds          = (query_tiles + workers - 1) / workers;
+    size_t  q               = (query_length + query_tiles - 1) / query_tiles;
+    size_t  c               = (corpus_length + corpus_tiles - 1) / corpus_tiles;
+
+    double  search          = (double)corpus_tiles * rounds * plan_tile_time(profile, q, c, d, k, multi);
+    double  spawn           = (workers > 1) ? (double)corpus_tiles * workers * profile->spawn_us * 1e-6 : 0;
+    double  merge           = (corpus_tiles > 1) ? corpus_tiles * (double)query_length * k * 2 * profile->copy_ns * 1e-9 : 0;
+
+    return search + spawn + merge;
+}
+
+
+int knn_search_plan(size_t corpus_length, size_t query_length, int d, int k, int cores, size_t memory_budget,
+                    const knn_profile_t* profile, knn_plan_t* plan) {
+#ifdef __cilk
+    const knn_backend_t parallel_backend = KNN_BACKEND_OPENCILK;
+#else
+    const knn_backend_t parallel_backend = KNN_BACKEND_PTHREAD;
+#endif
+    int found = 0;
+
+    if (cores < 1) { cores = 1; }
+
+    // Fallback: the smallest tiles, a single thread
+    plan->backend           = KNN_BACKEND_SERIAL;
+    plan->num_of_threads    = 1;
+    plan->query_tile        = 1;
+    plan->corpus_tile       = corpus_length;
+    plan->memory_budget     = memory_budget;
+    plan->predicted_time    = -1;
+
+    for (int threads = 1; threads <= cores; threads = (threads * 2 > cores && threads < cores) ? cores : threads * 2) {
+        knn_backend_t backends[2] = { KNN_BACKEND_BLAS, parallel_backend };
+        int num_of_backends = 2;
+        if (blas_threads_pinned()) {
+            // A single-threaded BLAS cannot run the few big GEMMs in parallel
+            backends[0] = (threads == 1) ? KNN_BACKEND_SERIAL : parallel_backend;
+            num_of_backends = 1;
+        } else if (threads == 1) {
+            backends[0] = KNN_BACKEND_SERIAL;
+            num_of_backends = 1;
+        }
+
+        for (int b = 0; b < num_of_backends; b++) {
+            int workers = (backends[b] == parallel_backend) ? threads : 1;
+
+            // The corpus is processed as a whole or in halving tiles (each tile must hold at least 2k rows)
+            for (size_t corpus_tile = corpus_length; ; corpus_tile = (corpus_tile + 1) / 2) {
+                int  tiled = (corpus_tile < corpus_length);
+                long merge_bytes = tiled ? (long)(query_length * k * (sizeof(knn_idx_t) + sizeof(float))) : 0;
+                long worker_bytes = ((long)memory_budget - merge_bytes) / workers;
+
+                // Same memory formula as `knn_exact_max_chunk_length`
+                long max_query_tile = (worker_bytes - 2 * (long)corpus_tile * (long)sizeof(float) - k * (long)sizeof(size_t))
+                                      / (((long)corpus_tile + 1) * (long)sizeof(float));
+
+                if (max_query_tile >= 1) {
+                    size_t per_worker = (query_length + workers - 1) / workers;
+                    size_t query_tile = ((size_t)max_query_tile < per_worker) ? (size_t)max_query_tile : per_worker;
+                    double cost = plan_cost(profile, corpus_length, query_length, d, k,
+                                            backends[b], threads, query_tile, corpus_tile);
+
+                    if (!found || cost < plan->predicted_time) {
+                        plan->backend           = backends[b];
+                        plan->num_of_threads    = threads;
+                        plan->query_tile        = query_tile;
+                        plan->corpus_tile       = corpus_tile;
+                        plan->predicted_time    = cost;
+                        found = 1;
+                    }
+                }
+
+                if (corpus_tile < 2 * KNN_SEARCH_MIN_CORPUS_TILE || corpus_tile < 4 * (size_t)k) { break; }
+            }
+        }
+
+        if (threads == cores) { break; }
+    }
+
+    return found ? 0 : -1;
+}
+
+
+// Run the backend of the plan for the whole query set and a corpus (tile)
+static int knn_search_run_backend(const float* corpus, const float* query, int k, knn_idx_t* indices, float* distances,
+                                  size_t corpus_length, size_t query_length, int d, const knn_plan_t* plan) {
+    // The parallel backends must not switch to their own strategy
+    knn_exact_config_t config = {
+        .query_tile     = plan->query_tile,
+        .memory_budget  = plan->memory_budget,
+        .strategy       = KNN_BLAS_SINGLE_PER_WORKER
+    };
+    int blas_threads = blas_get_threads();
+    int status;
+
+    switch (plan->backend) {
+        case KNN_BACKEND_SERIAL:
+            blas_set_threads(1);
+            blas_set_last_strategy(KNN_BLAS_SINGLE_PER_WORKER);
+            status = knn_exact_serial_with_config(corpus, query, k, indices, distances, corpus_length, query_length, d, 1, &config);
+            break;
+
+        case KNN_BACKEND_BLAS:
+            blas_set_threads(plan->num_of_threads);
+            blas_set_last_strategy(KNN_BLAS_MULTI_FEW_GEMMS);
+            status = knn_exact_serial_with_config(corpus, query, k, indices, distances, corpus_length, query_length, d, 1, &config);
+            break;
+
+        default:
+#ifdef __cilk
+            status = knn_exact_opencilk_with_config(corpus, query, k, indices, distances, corpus_length, query_length, d,
+                                                    plan->num_of_threads, &config);
+#else
+            status = knn_exact_pthread_with_config(corpus, query, k, indices, distances, corpus_length, query_length, d,
+                                                   plan->num_of_threads, &config);
+#endif
+            break;
+    }
+
+    blas_set_threads(blas_threads);
+    return status;
+}
+
+
+int knn_search_with_plan(const float* corpus, const float* query, int k, knn_idx_t* indices, float* distances,
+                         size_t corpus_length, size_t query_length, int d, const knn_plan_t* plan) {
+    if (knn_check_extents("knn_search", corpus_length, d, k) != 0) {
+        return -1;
+    }
+
+    // Untiled corpus: the backend writes the results directly
+    if (plan->corpus_tile >= corpus_length) {
+        return knn_search_run_backend(corpus, query, k, indices, distances, corpus_length, query_length, d, plan);
+    }
+
+    knn_idx_t* tile_indices     = (knn_idx_t*)malloc(query_length * k * sizeof(knn_idx_t));
+    float*     tile_distances   = (float*)malloc(query_length * k * sizeof(float));
+    knn_idx_t* merged_indices   = (knn_idx_t*)malloc(k * sizeof(knn_idx_t));
+    float*     merged_distances = (float*)malloc(k * sizeof(float));
+    if (!tile_indices || !tile_distances || !merged_indices || !merged_distances) {
+        fprintf(stderr, "knn_search: Memory allocation failed for the corpus tiles, running without corpus tiles\n");
+        free(tile_indices);
+        free(tile_distances);
+        free(merged_indices);
+        free(merged_distances);
+        return knn_search_run_backend(corpus, query, k, indices, distances, corpus_length, query_length, d, plan);
+    }
+
+    // Split the corpus evenly, so that every tile holds at least `corpus_tile / 2 >= k` rows
+    size_t corpus_tiles = (corpus_length + plan->corpus_tile - 1) / plan->corpus_tile;
+    int status = 0;
+
+    for (size_t t = 0; t < corpus_tiles && status == 0; t++) {
+        size_t c_start  = corpus_length * t / corpus_tiles;
+        size_t c_length = corpus_length * (t + 1) / corpus_tiles - c_start;
+
+        if (t == 0) {
+            status = knn_search_run_backend(corpus, query, k, indices, distances, c_length, query_length, d, plan);
+            continue;
+        }
+
+        status = knn_search_run_backend(&corpus[c_start * d], query, k, tile_indices, tile_distances, c_length, query_length, d, plan);
+        if (status != 0) {
+            break;
+        }
+
+        // Merge the sorted results of the tile into the results so far
+        KNN_STATS_BEGIN(KNN_PHASE_MERGE);
+        KNN_PERF_BEGIN(KNN_PERF_MERGE);
+        for (size_t q = 0; q < query_length; q++) {
+            const knn_idx_t* old_idx = &indices[q * k];
+            const float*     old_dst = &distances[q * k];
+            const knn_idx_t* new_idx = &tile_indices[q * k];
+            const float*     new_dst = &tile_distances[q * k];
+            int i = 0, j = 0;
+
+            for (int l = 0; l < k; l++) {
+                if (j >= k || (i < k && old_dst[i] <= new_dst[j])) {
+                    merged_distances[l] = old_dst[i];
+                    merged_indices[l]   = old_idx[i];
+                    i++;
+                } else {
+                    merged_distances[l] = new_dst[j];
+                    merged_indices[l]   = (knn_idx_t)c_start + new_idx[j];
+                    j++;
+                }
+            }
+
+            memcpy(&indices[q * k], merged_indices, k * sizeof(knn_idx_t));
+            memcpy(&distances[q * k], merged_distances, k * sizeof(float));
+        }
+        KNN_PERF_END(KNN_PERF_MERGE);
+        KNN_STATS_END(KNN_PHASE_MERGE, 4 * query_length * k * (sizeof(knn_idx_t) + sizeof(float)));
+    }
+
+    free(tile_indices);
+    free(tile_distances);
+    free(merged_indices);
+    free(merged_distances);
+    return status;
+}
+
+
+int knn_search_select(size_t corpus_length, size_t query_length, int d, int k, int num_of_threads, knn_plan_t* plan) {
+    const knn_profile_t* profile = knn_profile_get();
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores < 1) { cores = 1; }
+#ifdef __cilk
+    // The number of Cilk workers is set by `CILK_NWORKERS`
+    if (__cilkrts_get_nworkers() < cores) { cores = __cilkrts_get_nworkers(); }
+#endif
+    if (num_of_threads > 0 && num_of_threads < cores) { cores = num_of_threads; }
+
+    return knn_search_plan(corpus_length, query_length, d, k, (int)cores, get_usable_memory(), profile, plan);
+}
+
+
+void knn_search(const float* corpus, const float* query, int k, knn_idx_t* indices, float* distances, size_t corpus_length, size_t query_length, int d, int num_of_threads) {
+    knn_plan_t plan;
+
+    if (knn_search_select(corpus_length, query_length, d, k, num_of_threads, &plan) != 0) {
+        fprintf(stderr, "knn_search: Run out of usable memory (usable memory has a margin, so the program may not fail)\n");
+    }
+
+    knn_search_with_plan(corpus, query, k, indices, distances, corpus_length, query_length, d, &plan);
+}
+
+
+const char* knn_backend_name(knn_backend_t backend) {
+    switch (backend) {
+        case KNN_BACKEND_SERIAL:    return "knn_exact_serial";
+        case KNN_BACKEND_BLAS:      return "knn_exact_serial (multi-threaded BLAS)";
+        case KNN_BACKEND_PTHREAD:   return "knn_exact_pthread";
+        case KNN_BACKEND_OPENCILK:  return "knn_exact_opencilk";
+        default:                    return "unknown";
+    }
+}
@@ -0,0 +1,291 @@
+#include "../../include/exact/knn_shards.h"
+
+// Alignment of the sections of the shared memory
+#define SHARDS_ALIGN 64
+
+typedef enum {
+    SHARDS_SEARCH = 0,      // Search the `rows` queries of the shared query buffer
+    SHARDS_QUIT             // Stop the worker
+} shards_op_t;
+
+// Command of the coordinator to a worker
+typedef struct {
+    int             op;
+    int             k;
+    size_t          rows;
+} shards_command_t;
+
+
+static size_t shards_align(size_t bytes) {
+    return (bytes + SHARDS_ALIGN - 1) / SHARDS_ALIGN * SHARDS_ALIGN;
+}
+
+
+static size_t shards_query_bytes(const knn_shards_t* shards) {
+    return shards_align(shards->max_batch * shards->d * sizeof(float));
+}
+
+
+static size_t shards_slot_bytes(const knn_shards_t* shards) {
+    return shards_align(shards->max_batch * shards->max_k * sizeof(knn_idx_t)) +
+           shards_align(shards->max_batch * shards->max_k * sizeof(float));
+}
+
+
+// Result slot of the shard s: the ids, then the distances
+static knn_idx_t* shards_slot_ids(const knn_shards_t* shards, int s) {
+    return (knn_idx_t*)((char*)shards->shared + shards_query_bytes(shards) + s * shards_slot_bytes(shards));
+}
+
+
+static float* shards_slot_distances(const knn_shards_t* shards, int s) {
+    return (float*)((char*)shards_slot_ids(shards, s) + shards_align(shards->max_batch * shards->max_k * sizeof(knn_idx_t)));
+}
+
+
+// Read or write a whole message (a socket may transfer it in parts)
+static int shards_transfer(int fd, void* buffer, size_t bytes, int write_op) {
+    char* data = (char*)buffer;
+    while (bytes > 0) {
+        ssize_t done = write_op ? send(fd, data, bytes, MSG_NOSIGNAL) : recv(fd, data, bytes, 0);
+        if (done < 0 && errno == EINTR) {
+            continue;
+        }
+        if (done <= 0) {
+            return -1;
+        }
+        data  += done;
+        bytes -= (size_t)done;
+    }
+    return 0;
+}
+
+
+// Main loop of a worker process: search its shard for every broadcast batch, until SHARDS_QUIT or until the
+// coordinator is gone
+static void shards_worker(const knn_shards_t* shards, const float* corpus, int s, int channel, int threads_per_shard) {
+    size_t       start  = shards->shard_start[s];
+    size_t       length = shards->shard_start[s + 1] - start;
+    const float* shard  = &corpus[start * shards->d];
+    const float* query  = (const float*)shards->shared;
+    knn_idx_t*   ids    = shards_slot_ids(shards, s);
+    float*       dist   = shards_slot_distances(shards, s);
+    shards_command_t command;
+
+    // All the workers search at the same time, so each one gets 1/S of the usable memory
+    knn_exact_config_t config = { .query_tile = 0, .memory_budget = get_usable_memory() / shards->num_shards,
+                                  .strategy = KNN_BLAS_INHERIT };
+
+    while (shards_transfer(channel, &command, sizeof(command), 0) == 0 && command.op == SHARDS_SEARCH) {
+        // A shard shorter than k returns all its rows
+        int shard_k = ((size_t)command.k < length) ? command.k : (int)length;
+        int status = knn_exact_pthread_with_config(shard, query, shard_k, ids, dist, length, command.rows, shards->d,
+                                                   threads_per_shard, &config);
+        if (status == 0) {
+            for (size_t i = 0; i < command.rows * shard_k; i++) {
+                ids[i] += (knn_idx_t)start;
+            }
+        }
+
+        // The coordinator merges the slots only if every worker succeeded
+        if (shards_transfer(channel, &status, sizeof(status), 1) != 0) {
+            break;
+        }
+    }
+    close(channel);
+    _exit(0);
+}
+
+
+knn_shards_t* knn_shards_create(const float* corpus, size_t corpus_length, int d, int num_shards, int threads_per_shard,
+                                int max_k, size_t max_batch) {
+    if (knn_check_extents("knn_shards_create", corpus_length, d, max_k) != 0) {
+        return NULL;
+    }
+    if (num_shards <= 0) { num_shards = KNN_SHARDS_DEFAULT_SHARDS; }
+    if ((size_t)num_shards > corpus_length) { num_shards = (int)corpus_length; }
+    if (threads_per_shard <= 0) { threads_per_shard = 1; }
+    if (max_batch == 0) { max_batch = KNN_SHARDS_BATCH_ROWS; }
+
+    knn_shards_t* shards = (knn_shards_t*)calloc(1, sizeof(knn_shards_t));
+    if (shards == NULL) {
+        fprintf(stderr, "knn_shards_create: Memory allocation failed\n");
+        return NULL;
+    }
+    shards->num_shards    = num_shards;
+    shards->corpus_length = corpus_length;
+    shards->d             = d;
+    shards->max_k         = max_k;
+    shards->max_batch     = max_batch;
+    shards->shard_start   = (size_t*)malloc((num_shards + 1) * sizeof(size_t));
+    shards->pids          = (pid_t*)calloc(num_shards, sizeof(pid_t));
+    shards->channels      = (int*)malloc(num_shards * sizeof(int));
+    shards->shared_bytes  = shards_query_bytes(shards) + num_shards * shards_slot_bytes(shards);
+    shards->shared        = mmap(NULL, shards->shared_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shards->shared == MAP_FAILED) {
+        shards->shared = NULL;
+    }
+    if (!shards->shard_start || !shards->pids || !shards->channels || !shards->shared) {
+        fprintf(stderr, "knn_shards_create: Failed to allocate the shards (%zu bytes of shared memory)\n", shards->shared_bytes);
+        shards->num_shards = 0;
+        knn_shards_destroy(shards);
+        return NULL;
+    }
+    for (int s = 0; s <= num_shards; s++) {
+        shards->shard_start[s] = corpus_length * s / num_shards;
+    }
+
+    // Buffered output would be written again by every worker
+    fflush(stdout);
+    fflush(stderr);
+
+    for (int s = 0; s < num_shards; s++) {
+        int pair[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0) {
+            fprintf(stderr, "knn_shards_create: Failed to create the channel of shard %d\n", s);
+            shards->num_shards = s;
+            knn_shards_destroy(shards);
+            return NULL;
+        }
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            // Worker: keep only its own end of its channel
+            for (int i = 0; i < s; i++) {
+                close(shards->channels[i]);
+            }
+            close(pair[0]);
+            shards_worker(shards, corpus, s, pair[1], threads_per_shard);
+        }
+
+        close(pair[1]);
+        if (pid < 0) {
+            fprintf(stderr, "knn_shards_create: Failed to start the worker of shard %d\n", s);
+            close(pair[0]);
+            shards->num_shards = s;
+            knn_shards_destroy(shards);
+            return NULL;
+        }
+        shards->pids[s]     = pid;
+        shards->channels[s] = pair[0];
+    }
+
+    return shards;
+}
+
+
+int knn_shards_search(knn_shards_t* shards, const float* query, int k, knn_idx_t* indices, float* distances, size_t query_length) {
+    if (shards == NULL || knn_check_extents("knn_shards_search", shards->corpus_length, shards->d, k) != 0) {
+        return -1;
+    }
+    if (k > shards->max_k) {
+        fprintf(stderr, "knn_shards_search: k = %d is larger than the k of the shards (%d)\n", k, shards->max_k);
+        return -1;
+    }
+
+    int S = shards->num_shards;
+    int d = shards->d;
+    int* heads = (int*)malloc(S * sizeof(int));
+    int* shard_k = (int*)malloc(S * sizeof(int));
+    if (!heads || !shard_k) {
+        fprintf(stderr, "knn_shards_search: Memory allocation failed\n");
+        free(heads);
+        free(shard_k);
+        return -1;
+    }
+    for (int s = 0; s < S; s++) {
+        size_t length = shards->shard_start[s + 1] - shards->shard_start[s];
+        shard_k[s] = ((size_t)k < length) ? k : (int)length;
+    }
+
+    int status = 0;
+    for (size_t q_start = 0; status == 0 && q_start < query_length; q_start += shards->max_batch) {
+        size_t rows = (q_start + shards->max_batch < query_length) ? shards->max_batch : (query_length - q_start);
+
+        // Broadcast the batch: all the workers search at the same time
+        memcpy(shards->shared, &query[q_start * d], rows * d * sizeof(float));
+        shards_command_t command = { .op = SHARDS_SEARCH, .k = k, .rows = rows };
+        for (int s = 0; s < S; s++) {
+            if (shards_transfer(shards->channels[s], &command, sizeof(command), 1) != 0) {
+                status = -1;
+            }
+        }
+        for (int s = 0; s < S; s++) {
+            int reply = -1;
+            if (shards_transfer(shards->channels[s], &reply, sizeof(reply), 0) != 0 || reply != 0) {
+                status = -1;
+            }
+        }
+        if (status != 0) {
+            fprintf(stderr, "knn_shards_search: A worker failed or exited\n");
+            break;
+        }
+
+        // k-way merge of the sorted per-shard lists of every query
+        for (size_t q = 0; q < rows; q++) {
+            for (int s = 0; s < S; s++) { heads[s] = 0; }
+
+            for (int j = 0; j < k; j++) {
+                int       best = -1;
+                float     best_dist = 0.0f;
+                knn_idx_t best_id = 0;
+                for (int s = 0; s < S; s++) {
+                    if (heads[s] == shard_k[s]) { continue; }
+                    float     dist = shards_slot_distances(shards, s)[q * shard_k[s] + heads[s]];
+                    knn_idx_t id   = shards_slot_ids(shards, s)[q * shard_k[s] + heads[s]];
+                    if (best < 0 || dist < best_dist || (dist == best_dist && id < best_id)) {
+                        best      = s;
+                        best_dist = dist;
+                        best_id   = id;
+                    }
+                }
+                heads[best]++;
+                indices[(q_start + q) * k + j]   = best_id;
+                distances[(q_start + q) * k + j] = best_dist;
+            }
+        }
+    }
+
+    free(heads);
+    free(shard_k);
+    return status;
+}
+
+
+void knn_shards_destroy(knn_shards_t* shards) {
+    if (shards == NULL) { return; }
+
+    shards_command_t command = { .op = SHARDS_QUIT, .k = 0, .rows = 0 };
+    for (int s = 0; s < shards->num_shards; s++) {
+        shards_transfer(shards->channels[s], &command, sizeof(command), 1);
+        close(shards->channels[s]);
+    }
+    for (int s = 0; s < shards->num_shards; s++) {
+        waitpid(shards->pids[s], NULL, 0);
+    }
+
+    if (shards->shared) {
+        munmap(shards->shared, shards->shared_bytes);
+    }
+    free(shards->shard_start);
+    free(shards->pids);
+    free(shards->channels);
+    free(shards);
+}
+
+
+void knn_exact_sharded(const float* corpus, const float* query, int k, knn_idx_t* indices, float* distances, size_t corpus_length, size_t query_length, int d, int num_of_threads) {
+    if (num_of_threads <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        num_of_threads = (cores > 0) ? (int)cores : 1;
+    }
+    int num_shards = (num_of_threads < KNN_SHARDS_DEFAULT_SHARDS) ? num_of_threads : KNN_SHARDS_DEFAULT_SHARDS;
+
+    size_t        batch  = (query_length < KNN_SHARDS_BATCH_ROWS) ? query_length : KNN_SHARDS_BATCH_ROWS;
+    knn_shards_t* shards = knn_shards_create(corpus, corpus_length, d, num_shards, num_of_threads / num_shards, k, batch);
+    if (shards == NULL) {
+        return;
+    }
+    knn_shards_search(shards, query, k, indices, distances, query_length);
+    knn_shards_destroy(shards);
+}
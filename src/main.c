@@ -2,14 +2,31 @@
 #include <stdio.h>
 #include <string.h>
 #include "../include/utils/data_io.h"
+#include "../include/utils/data_gen.h"
 #include "../include/exact/knn_exact_serial.h"
 #include "../include/exact/knn_exact_pthread.h"
 #include "../include/exact/knn_exact_openmp.h"
+#include "../include/exact/knn_search.h"
+#include "../include/exact/knn_exact_pivot.h"
+#include "../include/exact/knn_exact_tree.h"
+#include "../include/exact/knn_shards.h"
 #include "../include/approximate/knn_approx_serial.h"
 #include "../include/approximate/knn_approx_pthread.h"
 #include "../include/approximate/knn_approx_openmp.h"
 #include "../include/tests/tests.h"
 
+// `knn_search` that also prints the plan it runs
+static void knn_search_verbose(const float* corpus, const float* query, int k, knn_idx_t* indices, float* distances,
+                               size_t corpus_length, size_t query_length, int d, int num_of_threads) {
+    knn_plan_t plan;
+    if (knn_search_select(corpus_length, query_length, d, k, num_of_threads, &plan) != 0) {
+        fprintf(stderr, "knn_search: Run out of usable memory (usable memory has a margin, so the program may not fail)\n");
+    }
+    printf("Selected plan: %s, %d threads, query tile = %zu, corpus tile = %zu, predicted time: %lf seconds\n ",
+           knn_backend_name(plan.backend), plan.num_of_threads, plan.query_tile, plan.corpus_tile, plan.predicted_time);
+    knn_search_with_plan(corpus, query, k, indices, distances, corpus_length, query_length, d, &plan);
+}
+
 int main(int argc, char* argv[]) {
     if (argc < 7) {
         fprintf(stderr, "Usage: %s [method] [num_of_threads] [data_path] [corpus_name] [query_name] [k] [compare_results (optional)] [neighbors (optional)] [distances (optional)]\n", argv[0]);
@@ -27,16 +44,21 @@ int main(int argc, char* argv[]) {
     const char*     neighbors       = (argc > 7) ? argv[8] : NULL;
     const char*     distances       = (argc > 7) ? argv[9] : NULL;
 
-    int     data_length = 0;
-    int     dim         = 0;
-    float*  M           = NULL;
+    size_t              data_length = 0;
+    int                 dim         = 0;
+    knn_gen_config_t    config;
 
     
     // 0 - Run all the *exact* knn functions and evaluate/compare the results based on the given dataset
     // 1 - Run all the *approx* knn functions and evaluate/compare the results (based on the exact results of an exact knn)
+    //     Modes 1-3 reuse the exact results from results/data_knn/cache when the dataset has not changed
     //     Keep in mind that the approximate solutions solve only the all-to-all k-NN problem in which C == Q
     // 2 - Random Data Test for knn_approx_pthread (Playground)
     // 3 - You can add your own custom tests here!
+    // 4 - 64-bit extents: the exact knn functions on a corpus with more than 2^31 floats (n x d > 2^31)
+    // 5 - libfastknn: concurrent searches on the same index
+    // 6 - Filtered exact knn: the gather and the scan plans against brute force plus post-filtering
+    // 7 - Snapshots: save/load round trips of the tree, the pivot index and the projection
     switch (method) {
         case 0:    // Runs all the exact knn functions and evaluates/compares the results based on a given dataset
             // To run the exact methods you can set the `USABLE_MEM_PREDICTION` inside the mem_info.h up to
@@ -54,6 +76,29 @@ int main(int argc, char* argv[]) {
             printf("Running knn_exact_openmp with %d threads:\n", num_of_threads);
             generate_knn_exact_results(knn_exact_openmp, data_path, corpus_name, query_name, k, num_of_threads, 3);
             printf("\n");
+
+            printf("Running knn_search with up to %d threads:\n", num_of_threads);
+            generate_knn_exact_results(knn_search_verbose, data_path, corpus_name, query_name, k, num_of_threads, 9);
+            printf("\n");
+
+            printf("Running knn_exact_pivot with %d threads:\n", num_of_threads);
+            generate_knn_exact_results(knn_exact_pivot, data_path, corpus_name, query_name, k, num_of_threads, 10);
+            printf("Pivot pruning: %zu of %zu blocks searched, %lf of the brute-force distances computed\n",
+                   knn_exact_pivot_last_stats()->blocks_searched, knn_exact_pivot_last_stats()->block_visits,
+                   (double)knn_exact_pivot_last_stats()->distances / knn_exact_pivot_last_stats()->brute_force);
+            printf("\n");
+
+            // For d > KNN_TREE_MAX_USEFUL_DIM it runs knn_search instead
+            printf("Running knn_exact_tree with %d threads:\n", num_of_threads);
+            generate_knn_exact_results(knn_exact_tree, data_path, corpus_name, query_name, k, num_of_threads, 11);
+            printf("Ball tree: %zu leaves searched, %lf of the brute-force distances computed\n",
+                   knn_exact_tree_last_stats()->leaves_searched,
+                   (double)knn_exact_tree_last_stats()->distances / knn_exact_tree_last_stats()->brute_force);
+            printf("\n");
+
+            printf("Running knn_exact_sharded with %d threads (%d worker processes at most):\n", num_of_threads, KNN_SHARDS_DEFAULT_SHARDS);
+            generate_knn_exact_results(knn_exact_sharded, data_path, corpus_name, query_name, k, num_of_threads, 12);
+            printf("\n");
             printf("\n");
 
             // The results of knn_exact_serial have also been tested, using the julia algorithm or via MATLABS knnsearch
@@ -68,6 +113,22 @@ int main(int argc, char* argv[]) {
             printf("Compare knn_exact_openmp results with expected:\n");
             compare_knn_exact_results(compare_results, neighbors, distances,
                                       "results/data_knn/knn_exact_openmp.hdf5", "neighbors", "distances");
+
+            printf("Compare knn_search results with expected:\n");
+            compare_knn_exact_results(compare_results, neighbors, distances,
+                                      "results/data_knn/knn_search.hdf5", "neighbors", "distances");
+
+            printf("Compare knn_exact_pivot results with expected:\n");
+            compare_knn_exact_results(compare_results, neighbors, distances,
+                                      "results/data_knn/knn_exact_pivot.hdf5", "neighbors", "distances");
+
+            printf("Compare knn_exact_tree results with expected:\n");
+            compare_knn_exact_results(compare_results, neighbors, distances,
+                                      "results/data_knn/knn_exact_tree.hdf5", "neighbors", "distances");
+
+            printf("Compare knn_exact_sharded results with expected:\n");
+            compare_knn_exact_results(compare_results, neighbors, distances,
+                                      "results/data_knn/knn_exact_sharded.hdf5", "neighbors", "distances");
             printf("\n");
 
             break;
@@ -77,22 +138,19 @@ int main(int argc, char* argv[]) {
 
             // In case the program crashes the `USABLE_MEM_PREDICTION` inside the mem_info.h should become even lower. 
             // For the given `data_length` and `dim`: USABLE_MEM_PREDICTION = 5000000 is a safe choice for a 16GB-memeory system.
-            srand(time(NULL));
-            data_length = 100000 + rand() % 50000;
-            dim = 150 + rand() % 50;
-            M = (float*)malloc(data_length * dim * sizeof(float));
+            // The dataset is the same on every run (fixed seed), so the exact results are reused from the cache
+            data_length = 100000 + knn_gen_random(KNN_GEN_DEFAULT_SEED, 0) % 50000;
+            dim = 150 + knn_gen_random(KNN_GEN_DEFAULT_SEED, 1) % 50;
+            knn_gen_default_config(&config, KNN_GEN_UNIFORM, data_length, dim, KNN_GEN_DEFAULT_SEED);
+            config.low  = 100;
+            config.high = 400;
             
-            printf("data_length = %d, ", data_length);
+            printf("data_length = %zu, ", data_length);
             printf("dim = %d\n\n", dim);
-            for (int i = 0; i < data_length; i++) {
-                for (int j = 0; j < dim; j++) {
-                    M[i * dim + j] = 100 + rand() % 300;
-                }
-            }
-            save_float_hdf5("data/random_dataset/test_corpus.hdf5", "test", M, data_length, dim);
+            knn_gen_to_hdf5(&config, "data/random_dataset/test_corpus.hdf5", "test", num_of_threads);
 
             printf("Running knn_exact_pthread with %d threads:\n", num_of_threads);
-            generate_knn_exact_results(knn_exact_pthread, "data/random_dataset/test_corpus.hdf5", "test", "test", k, num_of_threads, 2);
+            generate_knn_exact_results_cached(knn_exact_pthread, "data/random_dataset/test_corpus.hdf5", "test", "test", k, num_of_threads, 2);
             printf("\n");
 
             printf("Running knn_approx_serial:\n");
@@ -128,22 +186,19 @@ int main(int argc, char* argv[]) {
 
             // In case the program crashes the `USABLE_MEM_PREDICTION` inside the mem_info.h should become even lower.
             // For the given `data_length` and `dim`: USABLE_MEM_PREDICTION = 5000000 is a safe choice for a 16GB-memeory system.
-            srand(time(NULL));
-            data_length = 100000 + rand() % 50000;
-            dim = 150 + rand() % 50;
-            M = (float*)malloc(data_length * dim * sizeof(float));
+            // The dataset is the same on every run (fixed seed), so the exact results are reused from the cache
+            data_length = 100000 + knn_gen_random(KNN_GEN_DEFAULT_SEED, 0) % 50000;
+            dim = 150 + knn_gen_random(KNN_GEN_DEFAULT_SEED, 1) % 50;
+            knn_gen_default_config(&config, KNN_GEN_UNIFORM, data_length, dim, KNN_GEN_DEFAULT_SEED);
+            config.low  = 100;
+            config.high = 400;
             
-            printf("data_length = %d, ", data_length);
+            printf("data_length = %zu, ", data_length);
             printf("dim = %d\n\n", dim);
-            for (int i = 0; i < data_length; i++) {
-                for (int j = 0; j < dim; j++) {
-                    M[i * dim + j] = 100 + rand() % 300;
-                }
-            }
-            save_float_hdf5("data/random_dataset/test_corpus.hdf5", "test", M, data_length, dim);
+            knn_gen_to_hdf5(&config, "data/random_dataset/test_corpus.hdf5", "test", num_of_threads);
 
             printf("Running knn_exact_pthread with %d threads:\n", num_of_threads);
-            generate_knn_exact_results(knn_exact_pthread, "data/random_dataset/test_corpus.hdf5", "test", "test", k, num_of_threads, 2);
+            generate_knn_exact_results_cached(knn_exact_pthread, "data/random_dataset/test_corpus.hdf5", "test", "test", k, num_of_threads, 2);
             printf("\n");
 
             printf("Running knn_approx_pthread with %d threads:\n", num_of_threads);
@@ -167,7 +222,7 @@ int main(int argc, char* argv[]) {
             // In case the program crashes the `USABLE_MEM_PREDICTION` should become even lower. 
 
             printf("Running knn_exact_pthread with %d threads:\n", num_of_threads);
-            generate_knn_exact_results(knn_exact_pthread, "data/sift-128-euclidean.hdf5", "train", "train", k, num_of_threads, 2);
+            generate_knn_exact_results_cached(knn_exact_pthread, "data/sift-128-euclidean.hdf5", "train", "train", k, num_of_threads, 2);
             printf("\n");
 
             printf("Running knn_approx_serial:\n");
@@ -200,6 +255,52 @@ int main(int argc, char* argv[]) {
             break;
 
 
+        case 4:  // The corpus is mapped from a small repeated block (see `test_knn_large_extents`), so it needs
+                 // about `USABLE_MEM_PREDICTION` of memory for the distance matrices instead of n x d x 4 bytes.
+            data_length = ((size_t)1 << 31) / 64 + ((size_t)1 << 16);
+            dim = 64;
+
+            printf("Running knn_exact_serial on large extents:\n");
+            test_knn_large_extents(knn_exact_serial, data_length, dim, k, 8, 1);
+            printf("\n");
+
+            printf("Running knn_exact_pthread with %d threads on large extents:\n", num_of_threads);
+            test_knn_large_extents(knn_exact_pthread, data_length, dim, k, 8, num_of_threads);
+            printf("\n");
+
+            printf("Running knn_search with up to %d threads on large extents:\n", num_of_threads);
+            test_knn_large_extents(knn_search, data_length, dim, k, 8, num_of_threads);
+            printf("\n");
+
+            break;
+
+
+        case 5:  // The public API on seeded synthetic data (no dataset file is read)
+            printf("Running concurrent libfastknn searches with %d threads:\n", num_of_threads);
+            test_fastknn_concurrent(20000, 16, k, num_of_threads);
+            test_fastknn_coalescer(20000, 16, k, num_of_threads);
+            test_fastknn_cache(20000, 16, k, num_of_threads);
+            printf("\n");
+
+            break;
+
+
+        case 6:  // Seeded synthetic data (no dataset file is read)
+            printf("Running knn_exact_filtered with %d threads:\n", num_of_threads);
+            test_knn_filtered(20000, 16, k, num_of_threads);
+            printf("\n");
+
+            break;
+
+
+        case 7:  // Seeded synthetic data (no dataset file is read); the snapshots are temporary files
+            printf("Running the snapshot round trips with %d threads:\n", num_of_threads);
+            test_knn_snapshots(20000, 8, k, num_of_threads);
+            printf("\n");
+
+            break;
+
+
         default:
             printf("Unknown method for main.c: %d\n", method);
     }
@@ -63,6 +63,14 @@ int main(int argc, char* argv[]) {
             break;
 
 
+        case 4:
+            printf("Running knn_exact_opencilk with %d threads on large extents:\n", num_of_threads);
+            test_knn_large_extents(knn_exact_opencilk, ((size_t)1 << 31) / 64 + ((size_t)1 << 16), 64, k, 8, num_of_threads);
+            printf("\n");
+
+            break;
+
+
         default:
             printf("Unknown method for main_opencilk.c: %d\n", method);
     }
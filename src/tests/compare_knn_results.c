@@ -1,26 +1,27 @@
 #include "../../include/tests/tests.h"
 
 int compare_knn_exact_results(const char* data_path1, const char* neighbors_name1, const char* distances_name1, const char* data_path2, const char* neighbors_name2, const char* distances_name2) {
-    int k1, query_length1, k2, query_length2;
+    size_t query_length1, query_length2;
+    int k1, k2;
 
     // Load ground truth neighbors and distances
-    float* idx1 = load_hdf5(data_path1, neighbors_name1, &query_length1, &k1);
+    knn_idx_t* idx1 = load_idx_hdf5(data_path1, neighbors_name1, &query_length1, &k1);
     if (idx1 == NULL) {
-        fprintf(stderr, "compare_knn_approx_results: Failed to load the %s data from %s.\n", neighbors_name1, data_path1);
+        fprintf(stderr, "compare_knn_exact_results: Failed to load the %s data from %s.\n", neighbors_name1, data_path1);
         return -1;
     }
 
     float* dst1 = load_hdf5(data_path1, distances_name1, &query_length1, &k1);
     if (dst1 == NULL) {
-        fprintf(stderr, "compare_knn_approx_results: Failed to load the %s data from %s.\n", distances_name1, data_path1);
+        fprintf(stderr, "compare_knn_exact_results: Failed to load the %s data from %s.\n", distances_name1, data_path1);
         free(idx1);
         return -1;
     }
 
     // Load approximate neighbors and distances
-    float* idx2 = load_hdf5(data_path2, neighbors_name2, &query_length2, &k2);
+    knn_idx_t* idx2 = load_idx_hdf5(data_path2, neighbors_name2, &query_length2, &k2);
     if (idx2 == NULL) {
-        fprintf(stderr, "compare_knn_approx_results: Failed to load the %s data from %s.\n", neighbors_name2, data_path2);
+        fprintf(stderr, "compare_knn_exact_results: Failed to load the %s data from %s.\n", neighbors_name2, data_path2);
         free(idx1);
         free(dst1);
         return -1;
@@ -28,7 +29,7 @@ int compare_knn_exact_results(const char* data_path1, const char* neighbors_name
 
     float* dst2 = load_hdf5(data_path2, distances_name2, &query_length2, &k2);
     if (dst2 == NULL) {
-        fprintf(stderr, "compare_knn_approx_results: Failed to load the %s data from %s.\n", distances_name2, data_path2);
+        fprintf(stderr, "compare_knn_exact_results: Failed to load the %s data from %s.\n", distances_name2, data_path2);
         free(idx1);
         free(dst1);
         free(idx2);
@@ -37,7 +38,7 @@ int compare_knn_exact_results(const char* data_path1, const char* neighbors_name
 
     // Ensure that datasets are compatible
     if (query_length1 != query_length2 || k1 != k2) {
-        fprintf(stderr, "compare_knn_approx_results: Dataset dimensions do not match: k1=%d, k2=%d, query_length1=%d, query_length2=%d\n", 
+        fprintf(stderr, "compare_knn_exact_results: Dataset dimensions do not match: k1=%d, k2=%d, query_length1=%zu, query_length2=%zu\n", 
                     k1, k2, query_length1, query_length2);
         free(idx1);
         free(dst1);
@@ -46,17 +47,17 @@ int compare_knn_exact_results(const char* data_path1, const char* neighbors_name
         return -1;
     }
 
-    long int query_length = query_length1;
+    size_t query_length = query_length1;
     int k = k1;
 
     // Exact compare neighbors (indices) and distances:
-    int neighbor_errors = 0, distance_errors = 0;
-    for (int i = 0; i < query_length; i++) {
+    size_t neighbor_errors = 0, distance_errors = 0;
+    for (size_t i = 0; i < query_length; i++) {
         for (int j = 0; j < k; j++) {
-            int idx_pos = i * k + j;
+            size_t idx_pos = i * k + j;
             
             // Check neighbors (integer comparison)
-            if (abs((int)idx2[idx_pos] - (int)idx1[idx_pos]) > ZERO) {
+            if (idx2[idx_pos] != idx1[idx_pos]) {
                 neighbor_errors++;
             }
 
@@ -83,10 +84,11 @@ int compare_knn_exact_results(const char* data_path1, const char* neighbors_name
 
 int compare_knn_approx_results(const char* data_path1, const char* neighbors_name1, const char* distances_name1, 
                                 const char* data_path2, const char* neighbors_name2, const char* distances_name2) {
-    int k1, query_length1, k2, query_length2;
+    size_t query_length1, query_length2;
+    int k1, k2;
 
     // Load ground truth neighbors and distances
-    float* idx1 = load_hdf5(data_path1, neighbors_name1, &query_length1, &k1);
+    knn_idx_t* idx1 = load_idx_hdf5(data_path1, neighbors_name1, &query_length1, &k1);
     if (idx1 == NULL) {
         fprintf(stderr, "compare_knn_approx_results: Failed to load the %s data from %s.\n", neighbors_name1, data_path1);
         return -1;
@@ -100,7 +102,7 @@ int compare_knn_approx_results(const char* data_path1, const char* neighbors_nam
     }
 
     // Load approximate neighbors and distances
-    float* idx2 = load_hdf5(data_path2, neighbors_name2, &query_length2, &k2);
+    knn_idx_t* idx2 = load_idx_hdf5(data_path2, neighbors_name2, &query_length2, &k2);
     if (idx2 == NULL) {
         fprintf(stderr, "compare_knn_approx_results: Failed to load the %s data from %s.\n", neighbors_name2, data_path2);
         free(idx1);
@@ -117,9 +119,9 @@ int compare_knn_approx_results(const char* data_path1, const char* neighbors_nam
         return -1;
     }
 
-    // Ensure that datasets are compatible
-    if (query_length1 != query_length2 || k1 != k2) {
-        fprintf(stderr, "compare_knn_approx_results: Dataset dimensions do not match: k1=%d, k2=%d, query_length1=%d, query_length2=%d\n", 
+    // Ensure that datasets are compatible (the ground truth may have more neighbors per query)
+    if (query_length1 != query_length2 || k1 < k2) {
+        fprintf(stderr, "compare_knn_approx_results: Dataset dimensions do not match: k1=%d, k2=%d, query_length1=%zu, query_length2=%zu\n", 
                     k1, k2, query_length1, query_length2);
         free(idx1);
         free(dst1);
@@ -128,40 +130,30 @@ int compare_knn_approx_results(const char* data_path1, const char* neighbors_nam
         return -1;
     }
 
-    int query_length = query_length1;
-    int k = k1;
-
-    long int total_neighbors = query_length * k;
-    long int neighbor_hits = 0;
-
-    double total_exact_knn_dst = 0;
-    double total_approx_knn_dst = 0;
-    for (int i = 0; i < query_length; i++) {
-        for (int j = 0; j < k; j++) {
-            int idx1_pos = i * k + j;
-            int neighbor_found = 0;
-
-            total_exact_knn_dst  += (double)dst1[idx1_pos];
-            total_approx_knn_dst += (double)dst2[idx1_pos];
-
-            // Check if idx1[i][j] is present in idx2[i][:]
-            for (int l = 0; l < k; l++) {
-                int idx2_pos = i * k + l;
-                if ((int)idx1[idx1_pos] == (int)idx2[idx2_pos]) {
-                    neighbor_found = 1;
-                    break;
-                }
-            }
-
-            if (neighbor_found) {
-                neighbor_hits++;
-            }
-        }
+    // Evaluate in parallel (recall@k, recall@1..k, distance ratio, rank-weighted recall)
+    knn_eval_t eval;
+    if (knn_evaluate(idx1, dst1, k1, idx2, dst2, k2, query_length1, 0, &eval) != 0) {
+        free(idx1);
+        free(dst1);
+        free(idx2);
+        free(dst2);
+        return -1;
     }
 
     // Output approximate match statistics
-    printf("Approximate: Neighbors Hit Rate: %lf%%, ", 100 * neighbor_hits / (double)total_neighbors);
-    printf("k-NN Average Distances Rate (approx/exact): %lf\n", total_approx_knn_dst / total_exact_knn_dst);
+    printf("Approximate: Neighbors Hit Rate: %lf%%, ", 100 * eval.recall);
+    printf("k-NN Average Distances Rate (approx/exact): %lf\n", eval.distance_ratio);
+    printf("             Recall@1: %lf%%, Rank-Weighted Recall: %lf%%, Worst Query Recall: %lf%%, Perfect Queries: %lf%%\n",
+           100 * eval.recall_at[0], 100 * eval.rank_weighted, 100 * eval.min_query_recall, 100 * eval.perfect_queries / (double)query_length1);
+
+    // Machine-readable output next to the evaluated results
+    char json_path[1024];
+    size_t length = strlen(data_path2);
+    if (length > 5 && strcmp(&data_path2[length - 5], ".hdf5") == 0) { length -= 5; }
+    snprintf(json_path, sizeof(json_path), "%.*s_eval.json", (int)length, data_path2);
+    knn_eval_save_json(json_path, data_path2, &eval);
+
+    knn_eval_free(&eval);
 
     // Cleanup
     free(idx1);
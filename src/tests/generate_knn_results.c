@@ -1,7 +1,27 @@
 #include "../../include/tests/tests.h"
 
+const char* knn_results_path(int id) {
+    switch (id) {
+        case 1:  return "results/data_knn/knn_exact_serial.hdf5";
+        case 2:  return "results/data_knn/knn_exact_pthread.hdf5";
+        case 3:  return "results/data_knn/knn_exact_openmp.hdf5";
+        case 4:  return "results/data_knn/knn_exact_opencilk.hdf5";
+        case 5:  return "results/data_knn/knn_approx_serial.hdf5";
+        case 6:  return "results/data_knn/knn_approx_pthread.hdf5";
+        case 7:  return "results/data_knn/knn_approx_openmp.hdf5";
+        case 8:  return "results/data_knn/knn_approx_opencilk.hdf5";
+        case 9:  return "results/data_knn/knn_search.hdf5";
+        case 10: return "results/data_knn/knn_exact_pivot.hdf5";
+        case 11: return "results/data_knn/knn_exact_tree.hdf5";
+        case 12: return "results/data_knn/knn_exact_sharded.hdf5";
+        default: return NULL;
+    }
+}
+
+
 int generate_knn_exact_results(knn_exact_t knnsearch, const char* data_path, const char* corpus_name, const char* query_name, int k, int num_of_threads, int id) {
-    int corpus_length, query_length, d;
+    size_t corpus_length, query_length;
+    int d;
 
     // Load the corpus (training) set
     float* corpus = load_hdf5(data_path, corpus_name, &corpus_length, &d);
@@ -19,7 +39,7 @@ int generate_knn_exact_results(knn_exact_t knnsearch, const char* data_path, con
     }
 
     // Allocate memory for the k-NN results (indices and distances)
-    int* idx = (int*)malloc(query_length * k * sizeof(int));
+    knn_idx_t* idx = (knn_idx_t*)malloc(query_length * k * sizeof(knn_idx_t));
     float* dst = (float*)malloc(query_length * k * sizeof(float));
     if (idx == NULL || dst == NULL) {
         fprintf(stderr, "generate_knn_exact_results: Memory allocation failed for k-NN results.\n");
@@ -30,6 +50,9 @@ int generate_knn_exact_results(knn_exact_t knnsearch, const char* data_path, con
 
     // Timing the k-NN function
     struct timeval start, end;
+    blas_set_last_strategy(KNN_BLAS_INHERIT);
+    knn_stats_reset();
+    knn_perf_reset();
     gettimeofday(&start, NULL);
     knnsearch(corpus, query, k, idx, dst, corpus_length, query_length, d, num_of_threads);
     gettimeofday(&end, NULL);
@@ -37,6 +60,21 @@ int generate_knn_exact_results(knn_exact_t knnsearch, const char* data_path, con
     // Calculate elapsed time in seconds
     double time_taken = (end.tv_sec - start.tv_sec) + ((end.tv_usec - start.tv_usec) / 1e6);
     printf("Running time: %lf seconds, Queries per second: %lf\n ", time_taken, (query_length / time_taken));
+    printf("BLAS threads: %s (%d BLAS threads outside the search)\n ", blas_strategy_name(blas_get_last_strategy()), blas_get_threads());
+
+    // Time, bytes and calls of every phase (only with `KNN_STATS`)
+    knn_stats_t stats;
+    knn_stats_snapshot(&stats);
+    if (knn_stats_enabled()) {
+        knn_stats_print(stdout, &stats);
+    }
+
+    // Hardware counters of the distance, selection and merge phases (only with `KNN_PERF`)
+    if (knn_perf_enabled()) {
+        knn_perf_t perf;
+        knn_perf_snapshot(&perf);
+        knn_perf_print(stdout, &perf, query_length);
+    }
 
     // Cleanup test and train datasets
     free(corpus);
@@ -44,21 +82,14 @@ int generate_knn_exact_results(knn_exact_t knnsearch, const char* data_path, con
 
     
     // Save the results:
-    if (id == 1) {
-        save_int_hdf5("results/data_knn/knn_exact_serial.hdf5", "neighbors", idx, query_length, k);
-        save_float_hdf5("results/data_knn/knn_exact_serial.hdf5", "distances", dst, query_length, k);
-    } else
-    if (id == 2) {
-        save_int_hdf5("results/data_knn/knn_exact_pthread.hdf5", "neighbors", idx, query_length, k);
-        save_float_hdf5("results/data_knn/knn_exact_pthread.hdf5", "distances", dst, query_length, k);
-    } else
-    if (id == 3) {
-        save_int_hdf5("results/data_knn/knn_exact_openmp.hdf5", "neighbors", idx, query_length, k);
-        save_float_hdf5("results/data_knn/knn_exact_openmp.hdf5", "distances", dst, query_length, k);
-    } else
-    if (id == 4) {
-        save_int_hdf5("results/data_knn/knn_exact_opencilk.hdf5", "neighbors", idx, query_length, k);
-        save_float_hdf5("results/data_knn/knn_exact_opencilk.hdf5", "distances", dst, query_length, k);
+    const char* results_path = knn_results_path(id);
+
+    if (results_path != NULL) {
+        save_idx_hdf5(results_path, "neighbors", idx, query_length, k);
+        save_float_hdf5(results_path, "distances", dst, query_length, k);
+        if (knn_stats_enabled()) {
+            knn_stats_save_hdf5(results_path, &stats);
+        }
     }
     
 
@@ -70,7 +101,8 @@ int generate_knn_exact_results(knn_exact_t knnsearch, const char* data_path, con
 }
 
 int generate_knn_approx_results(knn_approx_t knnsearch, const char* data_path, const char* dataset_name, int k, int num_of_threads, int accuracy, int id) {
-    int dataset_length, d;
+    size_t dataset_length;
+    int d;
 
     // Load the corpus (training) set
     float* dataset = load_hdf5(data_path, dataset_name, &dataset_length, &d);
@@ -80,7 +112,7 @@ int generate_knn_approx_results(knn_approx_t knnsearch, const char* data_path, c
     }
 
     // Allocate memory for the k-NN results (indices and distances)
-    int* idx = (int*)malloc(dataset_length * k * sizeof(int));
+    knn_idx_t* idx = (knn_idx_t*)malloc(dataset_length * k * sizeof(knn_idx_t));
     float* dst = (float*)malloc(dataset_length * k * sizeof(float));
     if (idx == NULL || dst == NULL) {
         fprintf(stderr, "generate_knn_approx_results: Memory allocation failed for k-NN results.\n");
@@ -90,6 +122,9 @@ int generate_knn_approx_results(knn_approx_t knnsearch, const char* data_path, c
 
     // Timing the k-NN function
     struct timeval start, end;
+    blas_set_last_strategy(KNN_BLAS_INHERIT);
+    knn_stats_reset();
+    knn_perf_reset();
     gettimeofday(&start, NULL);
     knnsearch(dataset, k, idx, dst, dataset_length, d, num_of_threads, accuracy);
     gettimeofday(&end, NULL);
@@ -97,27 +132,35 @@ int generate_knn_approx_results(knn_approx_t knnsearch, const char* data_path, c
     // Calculate elapsed time in seconds
     double time_taken = (end.tv_sec - start.tv_sec) + ((end.tv_usec - start.tv_usec) / 1e6);
     printf("Running time: %lf seconds, Queries per second: %lf\n ", time_taken, (dataset_length / time_taken));
+    printf("BLAS threads: %s (%d BLAS threads outside the search)\n ", blas_strategy_name(blas_get_last_strategy()), blas_get_threads());
+
+    // Time, bytes and calls of every phase (only with `KNN_STATS`)
+    knn_stats_t stats;
+    knn_stats_snapshot(&stats);
+    if (knn_stats_enabled()) {
+        knn_stats_print(stdout, &stats);
+    }
+
+    // Hardware counters of the distance, selection and merge phases (only with `KNN_PERF`)
+    if (knn_perf_enabled()) {
+        knn_perf_t perf;
+        knn_perf_snapshot(&perf);
+        knn_perf_print(stdout, &perf, dataset_length);
+    }
 
     // Cleanup test and train datasets
     free(dataset);
 
     
-    // Save the results: 
-    if (id == 5) {
-        save_int_hdf5("results/data_knn/knn_approx_serial.hdf5", "neighbors", idx, dataset_length, k);
-        save_float_hdf5("results/data_knn/knn_approx_serial.hdf5", "distances", dst, dataset_length, k);
-    } else 
-    if (id == 6) {
-        save_int_hdf5("results/data_knn/knn_approx_pthread.hdf5", "neighbors", idx, dataset_length, k);
-        save_float_hdf5("results/data_knn/knn_approx_pthread.hdf5", "distances", dst, dataset_length, k);
-    } else 
-    if (id == 7) {
-        save_int_hdf5("results/data_knn/knn_approx_openmp.hdf5", "neighbors", idx, dataset_length, k);
-        save_float_hdf5("results/data_knn/knn_approx_openmp.hdf5", "distances", dst, dataset_length, k);
-    } else 
-    if (id == 8) {
-        save_int_hdf5("results/data_knn/knn_approx_opencilk.hdf5", "neighbors", idx, dataset_length, k);
-        save_float_hdf5("results/data_knn/knn_approx_opencilk.hdf5", "distances", dst, dataset_length, k);
+    // Save the results:
+    const char* results_path = knn_results_path(id);
+
+    if (results_path != NULL) {
+        save_idx_hdf5(results_path, "neighbors", idx, dataset_length, k);
+        save_float_hdf5(results_path, "distances", dst, dataset_length, k);
+        if (knn_stats_enabled()) {
+            knn_stats_save_hdf5(results_path, &stats);
+        }
     }
     
 
@@ -0,0 +1,515 @@
+#include "../../include/tests/tests.h"
+
+// The public API is built only with `Makefile.gcc` (see `make -f Makefile.gcc lib`)
+#ifndef __cilk
+
+#include "../../include/fastknn.h"
+#include "../../include/utils/data_gen.h"
+
+// Searches of every caller thread of `test_fastknn_concurrent` and `test_fastknn_coalescer`
+#define KNN_API_TEST_ROUNDS     8
+
+// Batches of the coalescer of `test_fastknn_coalescer`: small, with a long deadline, so the callers share them
+#define KNN_API_TEST_BATCH      16
+#define KNN_API_TEST_DEADLINE   2000
+
+// Cache of `test_fastknn_cache`: query rows, entries of the bounded cache and quantization step (a power of 2, so the
+// quantized rows and the rows shifted by a fraction of the step are exact)
+#define KNN_API_TEST_CACHE_ROWS     100
+#define KNN_API_TEST_CACHE_ENTRIES  32
+#define KNN_API_TEST_CACHE_STEP     0.25f
+
+// Relative tolerance of the distances of two searches (the GEMMs of different tiles may round differently)
+#define KNN_API_TEST_TOLERANCE  1e-4f
+
+
+// Same neighbors (an id may differ only between neighbors at equal distances) and distances. A tie at the k-th
+// distance may be broken either way (the query tiles of two searches round the distances differently), so an
+// expected neighbor within the tolerance of the k-th distance may be left out.
+static int api_results_match(const fastknn_id_t* expected_ids, const float* expected_dst, const fastknn_id_t* ids,
+                             const float* dst, size_t query_length, int k) {
+    for (size_t i = 0; i < query_length * (size_t)k; i++) {
+        float tolerance = KNN_API_TEST_TOLERANCE * (1.0f + fabsf(expected_dst[i]));
+        if (fabsf(dst[i] - expected_dst[i]) > tolerance) {
+            return 0;
+        }
+        if (ids[i] != expected_ids[i]) {
+            // A tie: the expected id must be among the neighbors of the query at the same distance, or tie
+            // with the last one
+            size_t q = i / k;
+            int found = (fabsf(dst[q * k + k - 1] - expected_dst[i]) <= tolerance);
+            for (int j = 0; j < k && !found; j++) {
+                found = (ids[q * k + j] == expected_ids[i] && fabsf(dst[q * k + j] - expected_dst[i]) <= tolerance);
+            }
+            if (!found) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+
+// Arguments of a caller thread of `test_fastknn_concurrent`
+typedef struct {
+    fastknn_index_t*    index;
+    const float*        query;
+    size_t              query_length;
+    int                 d;
+    const int*          ks;                 // The k of every reference
+    fastknn_id_t* const* expected_ids;      // Sequential results of every k
+    float* const*       expected_dst;
+    int                 num_ks;
+    int                 caller;
+    int                 submit;             // 1 to submit the searches to the pool of the index, 0 to search directly
+    fastknn_coalescer_t* coalescer;         // `api_coalesced_caller`: coalescer of the index
+    size_t              batched_rows;       // `api_coalesced_caller`: query rows of the requests that went through a batch
+    int                 mismatches;
+} api_caller_args_t;
+
+
+// Caller thread: searches with a different k and a different slice of the queries in every round
+static void* api_caller(void* args) {
+    api_caller_args_t* a = (api_caller_args_t*)args;
+
+    for (int round = 0; round < KNN_API_TEST_ROUNDS; round++) {
+        int    r     = (a->caller + round) % a->num_ks;
+        int    k     = a->ks[r];
+        size_t start = (size_t)(a->caller * 7 + round * 13) % a->query_length;
+        size_t rows  = a->query_length - start;
+
+        fastknn_id_t* ids = (fastknn_id_t*)malloc(rows * k * sizeof(fastknn_id_t));
+        float*        dst = (float*)malloc(rows * k * sizeof(float));
+        if (!ids || !dst) {
+            free(ids);
+            free(dst);
+            a->mismatches++;
+            continue;
+        }
+
+        fastknn_status_t status;
+        if (a->submit) {
+            fastknn_ticket_t* ticket = NULL;
+            status = fastknn_submit(a->index, &a->query[start * a->d], rows, k, ids, dst, 16, NULL, NULL, &ticket);
+            if (status == FASTKNN_OK) {
+                status = fastknn_wait(ticket);
+                fastknn_ticket_release(ticket);
+            }
+        } else {
+            status = fastknn_index_search(a->index, &a->query[start * a->d], rows, k, ids, dst);
+        }
+
+        if (status != FASTKNN_OK ||
+            !api_results_match(&a->expected_ids[r][start * k], &a->expected_dst[r][start * k], ids, dst, rows, k)) {
+            a->mismatches++;
+        }
+        free(ids);
+        free(dst);
+    }
+
+    return NULL;
+}
+
+
+// Caller thread of a coalescer: a few rows with a different k in every round (the first caller also sends one
+// request of a whole batch, which is searched directly)
+static void* api_coalesced_caller(void* args) {
+    api_caller_args_t* a = (api_caller_args_t*)args;
+
+    for (int round = 0; round < KNN_API_TEST_ROUNDS; round++) {
+        int    r     = (a->caller + round) % a->num_ks;
+        int    k     = a->ks[r];
+        size_t rows  = (a->caller == 0 && round == 0) ? KNN_API_TEST_BATCH : (size_t)(1 + (a->caller + round) % 3);
+        size_t start = (size_t)(a->caller * 7 + round * 13) % (a->query_length - rows + 1);
+
+        fastknn_id_t* ids = (fastknn_id_t*)malloc(rows * k * sizeof(fastknn_id_t));
+        float*        dst = (float*)malloc(rows * k * sizeof(float));
+        if (!ids || !dst ||
+            fastknn_coalescer_search(a->coalescer, &a->query[start * a->d], rows, k, ids, dst) != FASTKNN_OK ||
+            !api_results_match(&a->expected_ids[r][start * k], &a->expected_dst[r][start * k], ids, dst, rows, k)) {
+            a->mismatches++;
+        }
+        if (rows < KNN_API_TEST_BATCH) {
+            a->batched_rows += rows;
+        }
+        free(ids);
+        free(dst);
+    }
+
+    return NULL;
+}
+
+
+// One search through a cache: the results must match the expected ones (bit for bit if `same_bits`, e.g. the results
+// that were cached), and the counters must reach `hits` and `misses`
+static int cache_case(const char* name, fastknn_cache_t* cache, const fastknn_index_t* index, const float* query,
+                      size_t query_length, int k, fastknn_id_t* ids, float* dst, const fastknn_id_t* expected_ids,
+                      const float* expected_dst, int same_bits, size_t hits, size_t misses, fastknn_cache_stats_t* stats) {
+    if (fastknn_cache_search(cache, index, query, query_length, k, ids, dst) != FASTKNN_OK) {
+        printf("Cached searches (%s): %s\n", name, fastknn_last_error());
+        return -1;
+    }
+    int match = same_bits ? (memcmp(ids, expected_ids, query_length * k * sizeof(fastknn_id_t)) == 0 &&
+                             memcmp(dst, expected_dst, query_length * k * sizeof(float)) == 0)
+                          : api_results_match(expected_ids, expected_dst, ids, dst, query_length, k);
+    fastknn_cache_get_stats(cache, stats);
+
+    if (!match) {
+        printf("Cached searches (%s): the results differ from %s\n", name, same_bits ? "the cached ones" : "a fresh search");
+        return -1;
+    }
+    if (stats->hits != hits || stats->misses != misses) {
+        printf("Cached searches (%s): %zu hits and %zu misses instead of %zu and %zu\n", name, stats->hits,
+               stats->misses, hits, misses);
+        return -1;
+    }
+    return 0;
+}
+
+
+int test_fastknn_concurrent(size_t corpus_length, int d, int k, int num_of_threads) {
+    const fastknn_index_type_t types[] = { FASTKNN_INDEX_BRUTE_FORCE, FASTKNN_INDEX_PIVOT, FASTKNN_INDEX_TREE };
+    const char* type_names[] = { "brute force", "pivot", "tree" };
+    size_t query_length = 4 * BLAS_MIN_ROWS_PER_WORKER;
+    int    ks[3] = { 1, k, 2 * k };
+    int    callers = 2 * num_of_threads;
+    int    failures = 0;
+
+    if (num_of_threads < 1 || k < 1 || (size_t)(2 * k) > corpus_length) {
+        fprintf(stderr, "test_fastknn_concurrent: Invalid sizes: corpus_length = %zu, k = %d, num_of_threads = %d\n",
+                corpus_length, k, num_of_threads);
+        return -1;
+    }
+
+    // Clustered corpus and queries from the same distribution (the queries are the last rows)
+    knn_gen_config_t config;
+    knn_gen_default_config(&config, KNN_GEN_MIXTURE, corpus_length + query_length, d, KNN_GEN_DEFAULT_SEED);
+    float* points = knn_gen_dataset(&config, num_of_threads);
+    api_caller_args_t* args = (api_caller_args_t*)malloc(callers * sizeof(api_caller_args_t));
+    pthread_t* threads = (pthread_t*)malloc(callers * sizeof(pthread_t));
+    fastknn_id_t* expected_ids[3] = { NULL };
+    float* expected_dst[3] = { NULL };
+    if (!points || !args || !threads) {
+        fprintf(stderr, "test_fastknn_concurrent: Memory allocation failed\n");
+        free(points);
+        free(args);
+        free(threads);
+        return -1;
+    }
+    const float* query = &points[corpus_length * d];
+
+    for (int t = 0; t < 3; t++) {
+        // A budget of about 32 query rows per thread: every search runs in several query tiles
+        fastknn_index_options_t options;
+        fastknn_index_options_init(&options);
+        options.type          = types[t];
+        options.num_threads   = num_of_threads;
+        options.copy_corpus   = 0;
+        options.memory_budget = (size_t)num_of_threads * 34 * (corpus_length + 1) * sizeof(float);
+
+        fastknn_index_t* index = NULL;
+        if (fastknn_index_create(points, corpus_length, d, &options, &index) != FASTKNN_OK) {
+            fprintf(stderr, "test_fastknn_concurrent: %s index: %s\n", type_names[t], fastknn_last_error());
+            failures++;
+            continue;
+        }
+
+        // Sequential references
+        int ready = 1;
+        for (int r = 0; r < 3; r++) {
+            expected_ids[r] = (fastknn_id_t*)malloc(query_length * ks[r] * sizeof(fastknn_id_t));
+            expected_dst[r] = (float*)malloc(query_length * ks[r] * sizeof(float));
+            if (!expected_ids[r] || !expected_dst[r] ||
+                fastknn_index_search(index, query, query_length, ks[r], expected_ids[r], expected_dst[r]) != FASTKNN_OK) {
+                ready = 0;
+            }
+        }
+
+        // Direct searches and submitted searches of all the callers at the same time
+        int mismatches = 0;
+        int started = 0;
+        for (int c = 0; c < callers && ready; c++) {
+            args[c] = (api_caller_args_t){
+                .index = index, .query = query, .query_length = query_length, .d = d, .ks = ks,
+                .expected_ids = expected_ids, .expected_dst = expected_dst, .num_ks = 3,
+                .caller = c, .submit = (c % 4 == 3), .coalescer = NULL, .batched_rows = 0, .mismatches = 0
+            };
+            if (pthread_create(&threads[c], NULL, api_caller, &args[c]) != 0) {
+                mismatches++;
+                break;
+            }
+            started++;
+        }
+        for (int c = 0; c < started; c++) {
+            pthread_join(threads[c], NULL);
+            mismatches += args[c].mismatches;
+        }
+
+        if (!ready) {
+            fprintf(stderr, "test_fastknn_concurrent: %s index: The sequential searches failed\n", type_names[t]);
+            failures++;
+        } else if (mismatches > 0) {
+            printf("Concurrent searches (%s index): %d of %d searches differ from the sequential ones\n",
+                   type_names[t], mismatches, callers * KNN_API_TEST_ROUNDS);
+            failures++;
+        } else {
+            printf("Concurrent searches (%s index): %d threads x %d searches, same results as the sequential ones\n",
+                   type_names[t], callers, KNN_API_TEST_ROUNDS);
+        }
+
+        for (int r = 0; r < 3; r++) {
+            free(expected_ids[r]);
+            free(expected_dst[r]);
+            expected_ids[r] = NULL;
+            expected_dst[r] = NULL;
+        }
+        fastknn_index_destroy(index);
+    }
+
+    free(points);
+    free(args);
+    free(threads);
+    return (failures == 0) ? 0 : -1;
+}
+
+int test_fastknn_coalescer(size_t corpus_length, int d, int k, int num_of_threads) {
+    size_t query_length = 4 * BLAS_MIN_ROWS_PER_WORKER;
+    int    ks[3] = { 1, k, 2 * k };
+    int    callers = 2 * num_of_threads + 2;
+    int    status = 0;
+
+    if (num_of_threads < 1 || k < 1 || (size_t)(2 * k) > corpus_length) {
+        fprintf(stderr, "test_fastknn_coalescer: Invalid sizes: corpus_length = %zu, k = %d, num_of_threads = %d\n",
+                corpus_length, k, num_of_threads);
+        return -1;
+    }
+
+    // Clustered corpus and queries from the same distribution (the queries are the last rows)
+    knn_gen_config_t config;
+    knn_gen_default_config(&config, KNN_GEN_MIXTURE, corpus_length + query_length, d, KNN_GEN_DEFAULT_SEED);
+    float* points = knn_gen_dataset(&config, num_of_threads);
+    api_caller_args_t* args = (api_caller_args_t*)malloc(callers * sizeof(api_caller_args_t));
+    pthread_t* threads = (pthread_t*)malloc(callers * sizeof(pthread_t));
+    fastknn_id_t* expected_ids[3] = { NULL };
+    float* expected_dst[3] = { NULL };
+    fastknn_index_t* index = NULL;
+    fastknn_coalescer_t* coalescer = NULL;
+    const float* query = points ? &points[corpus_length * d] : NULL;
+
+    fastknn_index_options_t options;
+    fastknn_index_options_init(&options);
+    options.type        = FASTKNN_INDEX_BRUTE_FORCE;
+    options.num_threads = num_of_threads;
+    options.copy_corpus = 0;
+    if (!points || !args || !threads ||
+        fastknn_index_create(points, corpus_length, d, &options, &index) != FASTKNN_OK ||
+        fastknn_coalescer_create(index, KNN_API_TEST_BATCH, KNN_API_TEST_DEADLINE, &coalescer) != FASTKNN_OK) {
+        fprintf(stderr, "test_fastknn_coalescer: %s\n", fastknn_last_error());
+        status = -1;
+    }
+
+    // Direct searches of all the queries, for every k
+    for (int r = 0; r < 3 && status == 0; r++) {
+        expected_ids[r] = (fastknn_id_t*)malloc(query_length * ks[r] * sizeof(fastknn_id_t));
+        expected_dst[r] = (float*)malloc(query_length * ks[r] * sizeof(float));
+        if (!expected_ids[r] || !expected_dst[r] ||
+            fastknn_index_search(index, query, query_length, ks[r], expected_ids[r], expected_dst[r]) != FASTKNN_OK) {
+            fprintf(stderr, "test_fastknn_coalescer: The direct searches failed\n");
+            status = -1;
+        }
+    }
+
+    // Requests of mixed k and sizes from all the callers at the same time, so they share batches
+    int mismatches = 0;
+    int started = 0;
+    size_t batched_rows = 0;
+    for (int c = 0; c < callers && status == 0; c++) {
+        args[c] = (api_caller_args_t){
+            .index = index, .query = query, .query_length = query_length, .d = d, .ks = ks,
+            .expected_ids = expected_ids, .expected_dst = expected_dst, .num_ks = 3,
+            .caller = c, .submit = 0, .coalescer = coalescer, .batched_rows = 0, .mismatches = 0
+        };
+        if (pthread_create(&threads[c], NULL, api_coalesced_caller, &args[c]) != 0) {
+            mismatches++;
+            break;
+        }
+        started++;
+    }
+    for (int c = 0; c < started; c++) {
+        pthread_join(threads[c], NULL);
+        mismatches += args[c].mismatches;
+        batched_rows += args[c].batched_rows;
+    }
+
+    // Every request went through a batch, except the one of a whole batch
+    fastknn_coalescer_stats_t stats = { 0 };
+    if (status == 0) {
+        fastknn_coalescer_get_stats(coalescer, &stats);
+        if (mismatches > 0) {
+            printf("Coalesced searches: %d of %d requests differ from the direct searches\n",
+                   mismatches, callers * KNN_API_TEST_ROUNDS);
+            status = -1;
+        } else if (started < callers || stats.direct != 1 || stats.requests + stats.direct != (size_t)callers * KNN_API_TEST_ROUNDS ||
+                   stats.queries != batched_rows || stats.batches == 0 || stats.batches > stats.requests ||
+                   stats.full_batches > stats.batches) {
+            printf("Coalesced searches: unexpected counters (%zu requests, %zu rows, %zu batches, %zu full, %zu direct)\n",
+                   stats.requests, stats.queries, stats.batches, stats.full_batches, stats.direct);
+            status = -1;
+        } else {
+            printf("Coalesced searches: %d threads x %d requests of k = 1, %d, %d in %zu batches (mean %.1f rows), "
+                   "same results as the direct searches\n", callers, KNN_API_TEST_ROUNDS, k, 2 * k, stats.batches,
+                   (double)stats.queries / stats.batches);
+        }
+    }
+
+    for (int r = 0; r < 3; r++) {
+        free(expected_ids[r]);
+        free(expected_dst[r]);
+    }
+    fastknn_coalescer_destroy(coalescer);
+    fastknn_index_destroy(index);
+    free(points);
+    free(args);
+    free(threads);
+    return status;
+}
+
+int test_fastknn_cache(size_t corpus_length, int d, int k, int num_of_threads) {
+    size_t m = KNN_API_TEST_CACHE_ROWS;
+    size_t size = m * 2 * k;                // Results of the largest k
+    float  step = KNN_API_TEST_CACHE_STEP;
+    int    failures = 0;
+
+    if (num_of_threads < 1 || k < 1 || (size_t)(2 * k) > corpus_length) {
+        fprintf(stderr, "test_fastknn_cache: Invalid sizes: corpus_length = %zu, k = %d, num_of_threads = %d\n",
+                corpus_length, k, num_of_threads);
+        return -1;
+    }
+
+    // Clustered corpus and queries from the same distribution (the queries are the last rows), the queries quantized
+    // to multiples of the step, and the quantized queries shifted by a fifth of the step
+    knn_gen_config_t config;
+    knn_gen_default_config(&config, KNN_GEN_MIXTURE, corpus_length + m, d, KNN_GEN_DEFAULT_SEED);
+    float*        points     = knn_gen_dataset(&config, num_of_threads);
+    float*        quantized  = (float*)malloc(2 * m * d * sizeof(float));
+    fastknn_id_t* ids        = (fastknn_id_t*)malloc(5 * size * sizeof(fastknn_id_t));
+    float*        dst        = (float*)malloc(5 * size * sizeof(float));
+    fastknn_index_t* index   = NULL;
+    fastknn_index_t* other   = NULL;
+    fastknn_cache_t* cache   = NULL;
+    fastknn_cache_t* rounded = NULL;
+    fastknn_cache_t* bounded = NULL;
+
+    fastknn_index_options_t options;
+    fastknn_index_options_init(&options);
+    options.type        = FASTKNN_INDEX_BRUTE_FORCE;
+    options.num_threads = num_of_threads;
+    options.copy_corpus = 0;
+    if (!points || !quantized || !ids || !dst ||
+        fastknn_index_create(points, corpus_length, d, &options, &index) != FASTKNN_OK ||
+        fastknn_index_create(points, corpus_length, d, &options, &other) != FASTKNN_OK ||
+        fastknn_cache_create(0, 4, 0.0f, &cache) != FASTKNN_OK ||
+        fastknn_cache_create(0, 4, step, &rounded) != FASTKNN_OK ||
+        fastknn_cache_create(KNN_API_TEST_CACHE_ENTRIES, 1, 0.0f, &bounded) != FASTKNN_OK) {
+        fprintf(stderr, "test_fastknn_cache: %s\n", fastknn_last_error());
+        failures++;
+    }
+
+    if (failures == 0) {
+        const float* query   = &points[corpus_length * d];
+        float*       shifted = &quantized[m * d];
+        for (size_t i = 0; i < m * d; i++) {
+            quantized[i] = step * (float)lrintf(query[i] / step);
+            shifted[i]   = quantized[i] + 0.2f * step;
+        }
+
+        // Fresh searches of k and 2k, of the quantized queries, and the results of the cached searches
+        fastknn_id_t* fresh_ids[3] = { ids, ids + size, ids + 2 * size };
+        float*        fresh_dst[3] = { dst, dst + size, dst + 2 * size };
+        fastknn_id_t* first_ids = ids + 3 * size;
+        float*        first_dst = dst + 3 * size;
+        fastknn_id_t* next_ids  = ids + 4 * size;
+        float*        next_dst  = dst + 4 * size;
+        if (fastknn_index_search(index, query, m, k, fresh_ids[0], fresh_dst[0]) != FASTKNN_OK ||
+            fastknn_index_search(index, query, m, 2 * k, fresh_ids[1], fresh_dst[1]) != FASTKNN_OK ||
+            fastknn_index_search(index, quantized, m, k, fresh_ids[2], fresh_dst[2]) != FASTKNN_OK) {
+            fprintf(stderr, "test_fastknn_cache: The fresh searches failed: %s\n", fastknn_last_error());
+            failures++;
+        }
+
+        // A cold cache searches every row and caches it, then answers the same rows from the cache; another k,
+        // an invalidated cache and another index miss again
+        fastknn_cache_stats_t stats;
+        if (failures == 0 &&
+            cache_case("cold", cache, index, query, m, k, first_ids, first_dst, fresh_ids[0], fresh_dst[0], 0,
+                       0, m, &stats) != 0) {
+            failures++;
+        } else if (failures == 0 && (stats.insertions != m || stats.entries != m || stats.bytes == 0)) {
+            printf("Cached searches (cold): %zu insertions and %zu entries of %zu bytes after %zu rows\n",
+                   stats.insertions, stats.entries, stats.bytes, m);
+            failures++;
+        }
+        failures += (failures == 0 &&
+                     cache_case("warm", cache, index, query, m, k, next_ids, next_dst, first_ids, first_dst, 1,
+                                m, m, &stats) != 0);
+        failures += (failures == 0 &&
+                     cache_case("another k", cache, index, query, m, 2 * k, next_ids, next_dst, fresh_ids[1],
+                                fresh_dst[1], 0, m, 2 * m, &stats) != 0);
+
+        if (failures == 0) {
+            size_t entries   = stats.entries;
+            size_t evictions = stats.evictions;
+            fastknn_cache_invalidate(cache);
+            fastknn_cache_get_stats(cache, &stats);
+            if (stats.entries != 0 || stats.bytes != 0 || stats.evictions != evictions + entries) {
+                printf("Cached searches (invalidated): %zu entries of %zu bytes and %zu evictions left instead of 0 and %zu\n",
+                       stats.entries, stats.bytes, stats.evictions, evictions + entries);
+                failures++;
+            }
+        }
+        failures += (failures == 0 &&
+                     cache_case("invalidated", cache, index, query, m, k, next_ids, next_dst, fresh_ids[0],
+                                fresh_dst[0], 0, m, 3 * m, &stats) != 0);
+        failures += (failures == 0 &&
+                     cache_case("another index", cache, other, query, m, k, next_ids, next_dst, fresh_ids[0],
+                                fresh_dst[0], 0, m, 4 * m, &stats) != 0);
+
+        // Quantized queries: the shifted rows share the cached results of the rows they round to
+        failures += (failures == 0 &&
+                     cache_case("quantized", rounded, index, quantized, m, k, first_ids, first_dst, fresh_ids[2],
+                                fresh_dst[2], 0, 0, m, &stats) != 0);
+        failures += (failures == 0 &&
+                     cache_case("near-identical", rounded, index, shifted, m, k, next_ids, next_dst, first_ids,
+                                first_dst, 1, m, m, &stats) != 0);
+
+        // Bounded cache: every row past the capacity evicts one
+        if (failures == 0 &&
+            cache_case("bounded", bounded, index, query, m, k, next_ids, next_dst, fresh_ids[0], fresh_dst[0], 0,
+                       0, m, &stats) != 0) {
+            failures++;
+        } else if (failures == 0 &&
+                   (stats.entries > KNN_API_TEST_CACHE_ENTRIES || stats.evictions < m - KNN_API_TEST_CACHE_ENTRIES)) {
+            printf("Cached searches (bounded): %zu entries and %zu evictions for %zu rows in %d entries\n",
+                   stats.entries, stats.evictions, m, KNN_API_TEST_CACHE_ENTRIES);
+            failures++;
+        }
+
+        if (failures == 0) {
+            printf("Cached searches: %zu rows, hits equal to fresh searches; another k, another index and an invalidated "
+                   "cache miss; quantized and bounded caches as documented\n", m);
+        }
+    }
+
+    fastknn_cache_destroy(cache);
+    fastknn_cache_destroy(rounded);
+    fastknn_cache_destroy(bounded);
+    fastknn_index_destroy(index);
+    fastknn_index_destroy(other);
+    free(points);
+    free(quantized);
+    free(ids);
+    free(dst);
+    return (failures == 0) ? 0 : -1;
+}
+
+#endif // __cilk
@@ -0,0 +1,212 @@
+#include "../../include/tests/tests.h"
+
+// Description of a cached exact result (the .meta sidecar of the .hdf5 file)
+typedef struct {
+    int         version;
+    char        metric[32];
+    uint64_t    corpus_hash;
+    size_t      corpus_length;
+    int         d;
+    int         k;
+    size_t      query_length;
+    uint64_t    query_hash;     // Hash of the `query_length` cached query rows
+} knn_cache_meta_t;
+
+
+static int knn_cache_load_meta(const char* filename, knn_cache_meta_t* meta) {
+    FILE* file = fopen(filename, "r");
+    if (file == NULL) {
+        return -1;
+    }
+
+    char line[256];
+    int fields = 0;
+    unsigned long long corpus_hash = 0, query_hash = 0;
+    memset(meta, 0, sizeof(knn_cache_meta_t));
+
+    while (fgets(line, sizeof(line), file)) {
+        if (line[0] == '#') { continue; }
+
+        fields += sscanf(line, "version %d", &meta->version);
+        fields += sscanf(line, "metric %31s", meta->metric);
+        fields += sscanf(line, "corpus_hash %llx", &corpus_hash);
+        fields += sscanf(line, "corpus_length %zu", &meta->corpus_length);
+        fields += sscanf(line, "d %d", &meta->d);
+        fields += sscanf(line, "k %d", &meta->k);
+        fields += sscanf(line, "query_length %zu", &meta->query_length);
+        fields += sscanf(line, "query_hash %llx", &query_hash);
+    }
+
+    fclose(file);
+
+    meta->corpus_hash = corpus_hash;
+    meta->query_hash  = query_hash;
+
+    return (fields == 8 && meta->version == KNN_CACHE_VERSION) ? 0 : -1;
+}
+
+
+static int knn_cache_save_meta(const char* filename, const knn_cache_meta_t* meta) {
+    FILE* file = fopen(filename, "w");
+    if (file == NULL) {
+        fprintf(stderr, "knn_cache_save_meta: Error creating file: %s\n", filename);
+        return -1;
+    }
+
+    fprintf(file, "# FastParallelKNN exact k-NN cache entry (delete it together with the .hdf5 file to recompute)\n");
+    fprintf(file, "version %d\n", meta->version);
+    fprintf(file, "metric %s\n", meta->metric);
+    fprintf(file, "corpus_hash %016llx\n", (unsigned long long)meta->corpus_hash);
+    fprintf(file, "corpus_length %zu\n", meta->corpus_length);
+    fprintf(file, "d %d\n", meta->d);
+    fprintf(file, "k %d\n", meta->k);
+    fprintf(file, "query_length %zu\n", meta->query_length);
+    fprintf(file, "query_hash %016llx\n", (unsigned long long)meta->query_hash);
+
+    fclose(file);
+    return 0;
+}
+
+
+// Create every directory of a path (like `mkdir -p`)
+static void knn_cache_mkdir(const char* path) {
+    char buffer[1024];
+    snprintf(buffer, sizeof(buffer), "%s", path);
+
+    for (char* c = buffer + 1; *c != '\0'; c++) {
+        if (*c == '/') {
+            *c = '\0';
+            mkdir(buffer, 0755);
+            *c = '/';
+        }
+    }
+    mkdir(buffer, 0755);
+}
+
+
+int generate_knn_exact_results_cached(knn_exact_t knnsearch, const char* data_path, const char* corpus_name, const char* query_name, int k, int num_of_threads, int id) {
+    size_t corpus_length, query_length;
+    int d, query_d;
+
+    // Load the corpus (training) set
+    float* corpus = load_hdf5(data_path, corpus_name, &corpus_length, &d);
+    if (corpus == NULL) {
+        fprintf(stderr, "generate_knn_exact_results_cached: Failed to load the %s data of %s.\n", corpus_name, data_path);
+        return -1;
+    }
+
+    // Load the query (test) set
+    float* query = load_hdf5(data_path, query_name, &query_length, &query_d);
+    if (query == NULL || query_d != d) {
+        fprintf(stderr, "generate_knn_exact_results_cached: Failed to load the %s data of %s.\n", query_name, data_path);
+        free(corpus);
+        free(query);
+        return -1;
+    }
+
+    // The cache entry is addressed by the content of the corpus and the metric (not by the file name)
+    uint64_t corpus_hash = knn_hash_bytes(corpus, corpus_length * d * sizeof(float), num_of_threads);
+    corpus_hash = knn_hash_combine(knn_hash_combine(corpus_hash, corpus_length), (uint64_t)d);
+
+    char cache_path[1024], meta_path[1024];
+    knn_cache_mkdir(KNN_CACHE_DIR);
+    snprintf(cache_path, sizeof(cache_path), "%s/%016llx_%s.hdf5", KNN_CACHE_DIR, (unsigned long long)corpus_hash, KNN_CACHE_METRIC);
+    snprintf(meta_path, sizeof(meta_path), "%s/%016llx_%s.meta", KNN_CACHE_DIR, (unsigned long long)corpus_hash, KNN_CACHE_METRIC);
+
+    // Find how many query rows can be reused: the cached queries must be a prefix of the requested ones,
+    // with at least k neighbors each. A larger k needs a new pass over the corpus for every query.
+    knn_cache_meta_t meta;
+    size_t reused = 0;
+    if (knn_cache_load_meta(meta_path, &meta) == 0 && meta.corpus_hash == corpus_hash && strcmp(meta.metric, KNN_CACHE_METRIC) == 0 &&
+        meta.corpus_length == corpus_length && meta.d == d && meta.k >= k && meta.query_length <= query_length &&
+        knn_hash_bytes(query, meta.query_length * d * sizeof(float), num_of_threads) == meta.query_hash) {
+        reused = meta.query_length;
+    }
+    int cache_k = (reused > 0) ? meta.k : k;
+
+    // Allocate memory for the k-NN results (indices and distances) with the k of the cache
+    knn_idx_t* idx = (knn_idx_t*)malloc(query_length * cache_k * sizeof(knn_idx_t));
+    float* dst = (float*)malloc(query_length * cache_k * sizeof(float));
+    if (idx == NULL || dst == NULL) {
+        fprintf(stderr, "generate_knn_exact_results_cached: Memory allocation failed for k-NN results.\n");
+        free(corpus);
+        free(query);
+        free(idx);
+        free(dst);
+        return -1;
+    }
+
+    if (reused > 0) {
+        size_t cached_length;
+        int cached_k;
+        knn_idx_t* cached_idx = load_idx_hdf5(cache_path, "neighbors", &cached_length, &cached_k);
+        float* cached_dst = load_hdf5(cache_path, "distances", &cached_length, &cached_k);
+        if (cached_idx == NULL || cached_dst == NULL || cached_length != reused || cached_k != cache_k) {
+            // The cache entry is broken: recompute everything
+            reused = 0;
+        } else {
+            memcpy(idx, cached_idx, reused * cache_k * sizeof(knn_idx_t));
+            memcpy(dst, cached_dst, reused * cache_k * sizeof(float));
+        }
+        free(cached_idx);
+        free(cached_dst);
+    }
+
+    printf("Ground truth cache: %zu of %zu queries reused (k = %d)\n ", reused, query_length, cache_k);
+
+    // Compute only the missing query rows
+    if (reused < query_length) {
+        struct timeval start, end;
+        blas_set_last_strategy(KNN_BLAS_INHERIT);
+        gettimeofday(&start, NULL);
+        knnsearch(corpus, &query[reused * d], cache_k, &idx[reused * cache_k], &dst[reused * cache_k],
+                  corpus_length, query_length - reused, d, num_of_threads);
+        gettimeofday(&end, NULL);
+
+        double time_taken = (end.tv_sec - start.tv_sec) + ((end.tv_usec - start.tv_usec) / 1e6);
+        printf("Running time: %lf seconds, Queries per second: %lf\n ", time_taken, ((query_length - reused) / time_taken));
+
+        // Update the cache entry (the hdf5 file first, so that a crash leaves a stale meta that does not match)
+        remove(meta_path);
+        remove(cache_path);
+        save_idx_hdf5(cache_path, "neighbors", idx, query_length, cache_k);
+        save_float_hdf5(cache_path, "distances", dst, query_length, cache_k);
+
+        meta = (knn_cache_meta_t){
+            .version        = KNN_CACHE_VERSION,
+            .corpus_hash    = corpus_hash,
+            .corpus_length  = corpus_length,
+            .d              = d,
+            .k              = cache_k,
+            .query_length   = query_length,
+            .query_hash     = knn_hash_bytes(query, query_length * d * sizeof(float), num_of_threads),
+        };
+        snprintf(meta.metric, sizeof(meta.metric), "%s", KNN_CACHE_METRIC);
+        knn_cache_save_meta(meta_path, &meta);
+    }
+
+    // Cleanup test and train datasets
+    free(corpus);
+    free(query);
+
+    // Keep the first k neighbors of every query (they are sorted)
+    if (cache_k > k) {
+        for (size_t q = 0; q < query_length; q++) {
+            memmove(&idx[q * k], &idx[q * cache_k], k * sizeof(knn_idx_t));
+            memmove(&dst[q * k], &dst[q * cache_k], k * sizeof(float));
+        }
+    }
+
+    // Save the results where the uncached harness would (the comparisons read them from there)
+    const char* results_path = knn_results_path(id);
+    if (results_path != NULL) {
+        save_idx_hdf5(results_path, "neighbors", idx, query_length, k);
+        save_float_hdf5(results_path, "distances", dst, query_length, k);
+    }
+
+    // Cleanup
+    free(idx);
+    free(dst);
+
+    return 0;
+}
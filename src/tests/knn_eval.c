@@ -0,0 +1,223 @@
+#include "../../include/tests/tests.h"
+
+// Arguments of an evaluation worker (one contiguous block of queries)
+typedef struct {
+    const knn_idx_t* truth_idx;
+    const float*    truth_dst;
+    int             truth_k;
+    const knn_idx_t* approx_idx;
+    const float*    approx_dst;
+    int             approx_k;
+    size_t          q_start;
+    size_t          q_end;
+    // Partial results of the block
+    long*           hits_at;            // hits_at[r] = pairs that enter the top-(r+1) of both lists
+    double          truth_dst_sum;
+    double          approx_dst_sum;
+    double          rank_weighted;
+    double          min_query_recall;
+    long            perfect_queries;
+} knn_eval_args_t;
+
+
+static void* knn_eval_worker(void* args) {
+    knn_eval_args_t* a = (knn_eval_args_t*)args;
+    int k = a->approx_k;
+
+    // Open addressing hash set of the approximate ids of a query: id -> rank.
+    // The `stamp` of a slot tells if it belongs to the current query, so the table is never cleared.
+    int size = 1;
+    while (size < 2 * k) { size <<= 1; }
+    knn_idx_t* keys  = (knn_idx_t*)malloc(size * sizeof(knn_idx_t));
+    int*       ranks = (int*)malloc(size * sizeof(int));
+    size_t*    stamp = (size_t*)malloc(size * sizeof(size_t));
+    if (!keys || !ranks || !stamp) {
+        fprintf(stderr, "knn_eval_worker: Memory allocation failed for the hash set\n");
+        free(keys);
+        free(ranks);
+        free(stamp);
+        return (void*)-1;
+    }
+    for (int s = 0; s < size; s++) { stamp[s] = SIZE_MAX; }
+
+    // Weights of the rank-weighted recall (1/log2(rank + 2), as in DCG)
+    double weight_sum = 0;
+    for (int i = 0; i < k; i++) { weight_sum += 1.0 / log2(i + 2.0); }
+
+    a->min_query_recall = 1.0;
+
+    for (size_t q = a->q_start; q < a->q_end; q++) {
+        const knn_idx_t* approx = &a->approx_idx[q * k];
+        const knn_idx_t* truth  = &a->truth_idx[q * a->truth_k];
+
+        for (int j = 0; j < k; j++) {
+            unsigned int s = (unsigned int)(((uint64_t)approx[j] * 0x9E3779B97F4A7C15ULL) >> 32) & (size - 1);
+            while (stamp[s] == q && keys[s] != approx[j]) { s = (s + 1) & (size - 1); }
+            if (stamp[s] != q) {    // Keep the best rank of duplicated ids
+                stamp[s] = q;
+                keys[s]  = approx[j];
+                ranks[s] = j;
+            }
+        }
+
+        int hits = 0;
+        double weighted = 0;
+        for (int i = 0; i < k; i++) {
+            unsigned int s = (unsigned int)(((uint64_t)truth[i] * 0x9E3779B97F4A7C15ULL) >> 32) & (size - 1);
+            while (stamp[s] == q && keys[s] != truth[i]) { s = (s + 1) & (size - 1); }
+            if (stamp[s] != q) {
+                continue;
+            }
+
+            // The pair is in the top-r of both lists for every r > max(i, j)
+            int j = ranks[s];
+            a->hits_at[(i > j) ? i : j]++;
+            hits++;
+            weighted += 1.0 / log2(i + 2.0);
+        }
+
+        double query_recall = (double)hits / k;
+        if (query_recall < a->min_query_recall) { a->min_query_recall = query_recall; }
+        a->perfect_queries += (hits == k);
+        a->rank_weighted   += weighted / weight_sum;
+
+        if (a->truth_dst != NULL && a->approx_dst != NULL) {
+            for (int i = 0; i < k; i++) {
+                a->truth_dst_sum  += a->truth_dst[q * a->truth_k + i];
+                a->approx_dst_sum += a->approx_dst[q * k + i];
+            }
+        }
+    }
+
+    free(keys);
+    free(ranks);
+    free(stamp);
+    return NULL;
+}
+
+
+int knn_evaluate(const knn_idx_t* truth_idx, const float* truth_dst, int truth_k,
+                 const knn_idx_t* approx_idx, const float* approx_dst, int approx_k,
+                 size_t query_length, int num_of_threads, knn_eval_t* eval) {
+    memset(eval, 0, sizeof(knn_eval_t));
+
+    if (approx_k <= 0 || truth_k < approx_k) {
+        fprintf(stderr, "knn_evaluate: The ground truth has %d neighbors per query, at least %d are needed\n", truth_k, approx_k);
+        return -1;
+    }
+
+    if (num_of_threads <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        num_of_threads = (cores > 0) ? (int)cores : 1;
+    }
+    if ((size_t)num_of_threads > query_length) { num_of_threads = (query_length > 0) ? (int)query_length : 1; }
+
+    pthread_t*       threads = (pthread_t*)malloc(num_of_threads * sizeof(pthread_t));
+    knn_eval_args_t* args    = (knn_eval_args_t*)calloc(num_of_threads, sizeof(knn_eval_args_t));
+    long*            hits_at = (long*)calloc((size_t)num_of_threads * approx_k, sizeof(long));
+    eval->recall_at          = (double*)malloc(approx_k * sizeof(double));
+    if (!threads || !args || !hits_at || !eval->recall_at) {
+        fprintf(stderr, "knn_evaluate: Memory allocation failed\n");
+        free(threads);
+        free(args);
+        free(hits_at);
+        free(eval->recall_at);
+        eval->recall_at = NULL;
+        return -1;
+    }
+
+    // Contiguous blocks of queries (the cost of every query is the same)
+    for (int t = 0; t < num_of_threads; t++) {
+        args[t] = (knn_eval_args_t){
+            .truth_idx  = truth_idx,    .truth_dst  = truth_dst,    .truth_k  = truth_k,
+            .approx_idx = approx_idx,   .approx_dst = approx_dst,   .approx_k = approx_k,
+            .q_start    = query_length * t / num_of_threads,
+            .q_end      = query_length * (t + 1) / num_of_threads,
+            .hits_at    = &hits_at[(size_t)t * approx_k],
+        };
+    }
+
+    int status = 0, created = 0;
+    for (; created < num_of_threads - 1; created++) {
+        if (pthread_create(&threads[created], NULL, knn_eval_worker, &args[created]) != 0) {
+            fprintf(stderr, "knn_evaluate: Error creating thread %d\n", created);
+            status = -1;
+            break;
+        }
+    }
+    if (status == 0 && knn_eval_worker(&args[num_of_threads - 1]) != NULL) {
+        status = -1;
+    }
+    for (int t = 0; t < created; t++) {
+        void* result = NULL;
+        pthread_join(threads[t], &result);
+        if (result != NULL) { status = -1; }
+    }
+
+    if (status == 0) {
+        // Reduce the partial results
+        double truth_dst_sum = 0, approx_dst_sum = 0;
+        eval->query_length     = query_length;
+        eval->k                = approx_k;
+        eval->min_query_recall = 1.0;
+        for (int t = 0; t < num_of_threads; t++) {
+            truth_dst_sum          += args[t].truth_dst_sum;
+            approx_dst_sum         += args[t].approx_dst_sum;
+            eval->rank_weighted    += args[t].rank_weighted;
+            eval->perfect_queries  += args[t].perfect_queries;
+            if (args[t].min_query_recall < eval->min_query_recall) { eval->min_query_recall = args[t].min_query_recall; }
+        }
+        eval->rank_weighted  = (query_length > 0) ? eval->rank_weighted / query_length : 0.0;
+        eval->distance_ratio = (truth_dst != NULL && approx_dst != NULL && truth_dst_sum > 0) ? approx_dst_sum / truth_dst_sum : -1;
+
+        // recall@r from the prefix sums of the hits
+        long hits = 0;
+        for (int r = 0; r < approx_k; r++) {
+            for (int t = 0; t < num_of_threads; t++) {
+                hits += hits_at[(size_t)t * approx_k + r];
+            }
+            eval->recall_at[r] = (query_length > 0) ? (double)hits / ((double)query_length * (r + 1)) : 0.0;
+        }
+        eval->recall = eval->recall_at[approx_k - 1];
+    } else {
+        free(eval->recall_at);
+        eval->recall_at = NULL;
+    }
+
+    free(threads);
+    free(args);
+    free(hits_at);
+
+    return status;
+}
+
+
+void knn_eval_free(knn_eval_t* eval) {
+    free(eval->recall_at);
+    eval->recall_at = NULL;
+}
+
+
+int knn_eval_save_json(const char* filename, const char* name, const knn_eval_t* eval) {
+    FILE* file = fopen(filename, "w");
+    if (file == NULL) {
+        fprintf(stderr, "knn_eval_save_json: Error creating file: %s\n", filename);
+        return -1;
+    }
+
+    fprintf(file, "{\"name\": \"%s\", \"query_length\": %zu, \"k\": %d, \"recall\": %lf, ", name, eval->query_length, eval->k, eval->recall);
+    if (eval->distance_ratio >= 0) {
+        fprintf(file, "\"distance_ratio\": %lf, ", eval->distance_ratio);
+    } else {
+        fprintf(file, "\"distance_ratio\": null, ");
+    }
+    fprintf(file, "\"rank_weighted_recall\": %lf, \"min_query_recall\": %lf, \"perfect_queries\": %ld,\n \"recall_at\": [",
+            eval->rank_weighted, eval->min_query_recall, eval->perfect_queries);
+    for (int r = 0; r < eval->k; r++) {
+        fprintf(file, "%s%lf", r ? ", " : "", eval->recall_at[r]);
+    }
+    fprintf(file, "]}\n");
+
+    fclose(file);
+    return 0;
+}
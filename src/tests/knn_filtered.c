@@ -0,0 +1,223 @@
+#include "../../include/tests/tests.h"
+
+// The filtered search is built only with `Makefile.gcc`
+#ifndef __cilk
+
+#include "../../include/exact/knn_exact_filtered.h"
+#include "../../include/utils/data_gen.h"
+
+// Relative tolerance of the distances (the search expands |q - c|^2 with a GEMM in float, the reference is in double)
+#define KNN_FILTERED_TEST_TOLERANCE 1e-3
+
+
+// Brute force over all the rows, then the rows that are not allowed dropped: the k nearest allowed rows of every
+// query (in double precision), -1 at INFINITY after the last allowed one
+static void filtered_reference(const float* corpus, const float* query, int k, knn_idx_t* indices, double* distances,
+                               size_t corpus_length, size_t query_length, int d, const uint64_t* bitmap) {
+    double* all = (double*)malloc(corpus_length * sizeof(double));
+
+    for (size_t q = 0; q < query_length; q++) {
+        for (size_t i = 0; i < corpus_length; i++) {
+            double sum = 0.0;
+            for (int j = 0; j < d; j++) {
+                double diff = (double)query[q * d + j] - (double)corpus[i * d + j];
+                sum += diff * diff;
+            }
+            all[i] = sqrt(sum);
+        }
+
+        // Insertion into the sorted list of the k nearest allowed rows
+        int size = 0;
+        for (size_t i = 0; i < corpus_length; i++) {
+            if (!knn_filter_test(bitmap, i)) { continue; }
+            if (size == k && all[i] >= distances[q * k + k - 1]) { continue; }
+            int j = (size < k) ? size++ : k - 1;
+            while (j > 0 && distances[q * k + j - 1] > all[i]) {
+                distances[q * k + j] = distances[q * k + j - 1];
+                indices[q * k + j]   = indices[q * k + j - 1];
+                j--;
+            }
+            distances[q * k + j] = all[i];
+            indices[q * k + j]   = (knn_idx_t)i;
+        }
+        for (int j = size; j < k; j++) {
+            indices[q * k + j]   = -1;
+            distances[q * k + j] = INFINITY;
+        }
+    }
+
+    free(all);
+}
+
+
+// Same neighbors as the reference, up to rows at equal distances: every found row is allowed, found once, at its
+// true distance, and no farther than the reference neighbor of the same rank; the padding matches exactly
+static size_t filtered_mismatches(const float* corpus, const float* query, int k, const knn_idx_t* indices,
+                                  const float* distances, const knn_idx_t* ref_indices, const double* ref_distances,
+                                  size_t corpus_length, size_t query_length, int d, const uint64_t* bitmap) {
+    size_t mismatches = 0;
+
+    for (size_t q = 0; q < query_length; q++) {
+        for (int j = 0; j < k; j++) {
+            knn_idx_t id   = indices[q * k + j];
+            double    ref  = ref_distances[q * k + j];
+            double    tol  = KNN_FILTERED_TEST_TOLERANCE * (1.0 + (isinf(ref) ? 0.0 : ref));
+
+            if (ref_indices[q * k + j] < 0) {
+                mismatches += (id != -1 || !isinf(distances[q * k + j]));
+                continue;
+            }
+            if (id < 0 || (size_t)id >= corpus_length || !knn_filter_test(bitmap, (size_t)id)) {
+                mismatches++;
+                continue;
+            }
+            int repeated = 0;
+            for (int i = 0; i < j; i++) {
+                repeated |= (indices[q * k + i] == id);
+            }
+
+            double sum = 0.0;
+            for (int c = 0; c < d; c++) {
+                double diff = (double)query[q * d + c] - (double)corpus[(size_t)id * d + c];
+                sum += diff * diff;
+            }
+            double true_dist = sqrt(sum);
+            if (repeated || fabs(distances[q * k + j] - true_dist) > tol || true_dist > ref + tol) {
+                mismatches++;
+            }
+        }
+    }
+    return mismatches;
+}
+
+
+// One filtered search against the reference; `expected_plan` < 0 accepts either plan
+static int filtered_case(const char* name, const float* corpus, const float* query, int k, size_t corpus_length,
+                         size_t query_length, int d, const uint64_t* bitmap, int num_of_threads, int expected_plan,
+                         knn_filter_stats_t* stats) {
+    knn_idx_t* indices       = (knn_idx_t*)malloc(query_length * k * sizeof(knn_idx_t));
+    float*     distances     = (float*)malloc(query_length * k * sizeof(float));
+    knn_idx_t* ref_indices   = (knn_idx_t*)malloc(query_length * k * sizeof(knn_idx_t));
+    double*    ref_distances = (double*)malloc(query_length * k * sizeof(double));
+    if (!indices || !distances || !ref_indices || !ref_distances) {
+        fprintf(stderr, "test_knn_filtered: Memory allocation failed\n");
+        free(indices);
+        free(distances);
+        free(ref_indices);
+        free(ref_distances);
+        return -1;
+    }
+
+    int status = knn_exact_filtered(corpus, query, k, indices, distances, corpus_length, query_length, d, bitmap,
+                                    num_of_threads, stats);
+    size_t mismatches = 0;
+    if (status == 0) {
+        filtered_reference(corpus, query, k, ref_indices, ref_distances, corpus_length, query_length, d, bitmap);
+        mismatches = filtered_mismatches(corpus, query, k, indices, distances, ref_indices, ref_distances,
+                                         corpus_length, query_length, d, bitmap);
+    }
+
+    if (status != 0) {
+        printf("Filtered search (%s): the search failed\n", name);
+    } else if (expected_plan >= 0 && (int)stats->plan != expected_plan) {
+        printf("Filtered search (%s): %s plan instead of the %s plan\n", name,
+               (stats->plan == KNN_FILTER_PLAN_GATHER) ? "gather" : "scan",
+               (expected_plan == KNN_FILTER_PLAN_GATHER) ? "gather" : "scan");
+        status = -1;
+    } else if (mismatches > 0) {
+        printf("Filtered search (%s): %zu of %zu neighbors differ from brute force plus post-filtering\n",
+               name, mismatches, query_length * k);
+        status = -1;
+    } else {
+        printf("Filtered search (%s, %s plan): %zu of %zu rows allowed, same neighbors as brute force plus post-filtering\n",
+               name, (stats->plan == KNN_FILTER_PLAN_GATHER) ? "gather" : "scan", stats->allowed, corpus_length);
+    }
+
+    free(indices);
+    free(distances);
+    free(ref_indices);
+    free(ref_distances);
+    return status;
+}
+
+
+int test_knn_filtered(size_t corpus_length, int d, int k, int num_of_threads) {
+    size_t query_length = 2 * KNN_FILTER_QUERY_TILE + 5;     // Two full query tiles and a partial one
+    size_t num_tiles    = (corpus_length + KNN_FILTER_TILE_ROWS - 1) / KNN_FILTER_TILE_ROWS;
+
+    if (k < 1 || d < 1 || num_tiles < 3 || (size_t)k * 40 > corpus_length) {
+        fprintf(stderr, "test_knn_filtered: Invalid sizes: corpus_length = %zu (at least 3 tiles of %d rows and 40 x k), d = %d, k = %d\n",
+                corpus_length, KNN_FILTER_TILE_ROWS, d, k);
+        return -1;
+    }
+
+    // Clustered corpus and queries from the same distribution (the queries are the last rows)
+    knn_gen_config_t config;
+    knn_gen_default_config(&config, KNN_GEN_MIXTURE, corpus_length + query_length, d, KNN_GEN_DEFAULT_SEED);
+    float*    points = knn_gen_dataset(&config, num_of_threads);
+    int32_t*  labels = (int32_t*)malloc(corpus_length * sizeof(int32_t));
+    uint64_t* bitmap = (uint64_t*)calloc(knn_filter_words(corpus_length), sizeof(uint64_t));
+    if (!points || !labels || !bitmap) {
+        fprintf(stderr, "test_knn_filtered: Memory allocation failed\n");
+        free(points);
+        free(labels);
+        free(bitmap);
+        return -1;
+    }
+    const float* query = &points[corpus_length * d];
+    int failures = 0;
+    knn_filter_stats_t stats;
+
+    // Gather plan: one label of 32 (about 3% of the rows) is allowed
+    for (size_t i = 0; i < corpus_length; i++) {
+        labels[i] = (int32_t)((i * 7) % 32);
+    }
+    int32_t allowed_label = 5;
+    uint64_t* by_label = knn_filter_from_labels(labels, corpus_length, &allowed_label, 1);
+    if (by_label == NULL ||
+        filtered_case("one label of 32", points, query, k, corpus_length, query_length, d, by_label, num_of_threads,
+                      KNN_FILTER_PLAN_GATHER, &stats) != 0) {
+        failures++;
+    }
+    free(by_label);
+
+    // Scan plan: the tiles cycle through no allowed row (skipped), every 4th row (gathered) and all the rows (dense)
+    for (size_t i = 0; i < corpus_length; i++) {
+        size_t pattern = (i / KNN_FILTER_TILE_ROWS) % 3;
+        if (pattern == 2 || (pattern == 1 && i % 4 == 0)) {
+            bitmap[i / 64] |= 1ULL << (i % 64);
+        }
+    }
+    if (filtered_case("skipped, gathered and dense tiles", points, query, k, corpus_length, query_length, d, bitmap,
+                      num_of_threads, KNN_FILTER_PLAN_SCAN, &stats) != 0) {
+        failures++;
+    } else if (stats.tiles_skipped == 0 || stats.tiles_gathered == 0 ||
+               stats.tiles_skipped + stats.tiles_gathered == stats.tile_visits) {
+        printf("Filtered search (skipped, gathered and dense tiles): %zu tiles skipped and %zu gathered of %zu\n",
+               stats.tiles_skipped, stats.tiles_gathered, stats.tile_visits);
+        failures++;
+    }
+
+    // Fewer than k allowed rows, with both plans: the last neighbors are padded with -1 at INFINITY
+    size_t small_length = (size_t)8 * k;                      // k - 1 allowed rows are more than 5% of it: the scan plan
+    memset(bitmap, 0, knn_filter_words(corpus_length) * sizeof(uint64_t));
+    for (int j = 0; j < k - 1; j++) {
+        size_t row = 3 + (size_t)j * 7;
+        bitmap[row / 64] |= 1ULL << (row % 64);
+    }
+    if (filtered_case("fewer than k rows of a large corpus", points, query, k, corpus_length, query_length, d, bitmap,
+                      num_of_threads, KNN_FILTER_PLAN_GATHER, &stats) != 0) {
+        failures++;
+    }
+    if (filtered_case("fewer than k rows of a small corpus", points, query, k, small_length, query_length, d, bitmap,
+                      num_of_threads, (k > 1) ? KNN_FILTER_PLAN_SCAN : -1, &stats) != 0) {
+        failures++;
+    }
+
+    free(points);
+    free(labels);
+    free(bitmap);
+    return (failures == 0) ? 0 : -1;
+}
+
+#endif // __cilk
@@ -0,0 +1,140 @@
+#include "../../include/tests/tests.h"
+#include "../../include/utils/data_gen.h"
+#include <sys/mman.h>
+
+// The background of the corpus is a block of at least this size, mapped over and over
+#define KNN_LARGE_BLOCK_BYTES   ((size_t)16 << 20)
+
+// Distance between the planted neighbors of a query: the i-th one is at (i + 1) * KNN_LARGE_STEP
+#define KNN_LARGE_STEP          0.1f
+
+
+static size_t gcd_size(size_t a, size_t b) {
+    while (b != 0) {
+        size_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+
+int test_knn_large_extents(knn_exact_t knnsearch, size_t corpus_length, int d, int k, size_t query_length, int num_of_threads) {
+    if (d <= 0 || k <= 0 || query_length == 0 || query_length > (size_t)d || query_length * k > corpus_length) {
+        fprintf(stderr, "test_knn_large_extents: Invalid sizes: corpus_length = %zu, d = %d, k = %d, query_length = %zu (query_length <= d)\n",
+                corpus_length, d, k, query_length);
+        return -1;
+    }
+
+    // The block is made of whole rows and whole pages, so that it can be mapped at any block boundary
+    size_t row_bytes = (size_t)d * sizeof(float);
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t block = row_bytes / gcd_size(row_bytes, page) * page;
+    block *= (KNN_LARGE_BLOCK_BYTES + block - 1) / block;
+
+    size_t planted = query_length * k;
+    size_t blocks = (corpus_length * row_bytes + block - 1) / block;
+    size_t tail_blocks = (planted * row_bytes + block - 1) / block + 1;     // Private blocks at the end of the corpus
+    if (tail_blocks > blocks) { tail_blocks = blocks; }
+    size_t shared_blocks = blocks - tail_blocks;
+
+    // Reserve the address space of the whole corpus
+    unsigned char* base = (unsigned char*)mmap(NULL, blocks * block, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "test_knn_large_extents: Failed to reserve %zu bytes of address space\n", blocks * block);
+        return -1;
+    }
+
+    // Background rows: far away from the queries (uniform in [50, 60)^d), the same for every block
+    knn_gen_config_t config;
+    knn_gen_default_config(&config, KNN_GEN_UNIFORM, block / row_bytes, d, KNN_GEN_DEFAULT_SEED);
+    config.low  = 50;
+    config.high = 60;
+
+    FILE* block_file = tmpfile();
+    int status = (block_file != NULL && ftruncate(fileno(block_file), block) == 0) ? 0 : -1;
+    if (status == 0) {
+        float* rows = (float*)mmap(NULL, block, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(block_file), 0);
+        status = (rows != MAP_FAILED && knn_gen_fill(&config, rows, 0, block / row_bytes, num_of_threads) == 0) ? 0 : -1;
+        if (rows != MAP_FAILED) { munmap(rows, block); }
+    }
+    for (size_t b = 0; status == 0 && b < shared_blocks; b++) {
+        if (mmap(base + b * block, block, PROT_READ, MAP_SHARED | MAP_FIXED, fileno(block_file), 0) == MAP_FAILED) {
+            status = -1;
+        }
+    }
+
+    // The tail is private memory with the same background, where the neighbors of the queries are planted
+    unsigned char* tail = base + shared_blocks * block;
+    if (status == 0 && (mmap(tail, tail_blocks * block, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED ||
+                        knn_gen_fill(&config, (float*)tail, 0, tail_blocks * (block / row_bytes), num_of_threads) != 0)) {
+        status = -1;
+    }
+    if (status != 0) {
+        fprintf(stderr, "test_knn_large_extents: Failed to map the corpus (%zu blocks of %zu bytes)\n", blocks, block);
+        munmap(base, blocks * block);
+        if (block_file != NULL) { fclose(block_file); }
+        return -1;
+    }
+
+    // Query q is s * e_q (the queries are s * sqrt(2) apart, more than twice their farthest planted neighbor).
+    // Its i-th neighbor is the row `corpus_length - planted + q * k + i` = query + (i + 1) * KNN_LARGE_STEP * e_{q + 1}.
+    float* corpus = (float*)base;
+    float  s = 2.0f * (k + 1) * KNN_LARGE_STEP;
+    float* query = (float*)calloc(query_length * d, sizeof(float));
+    knn_idx_t* idx = (knn_idx_t*)malloc(query_length * k * sizeof(knn_idx_t));
+    float* dst = (float*)malloc(query_length * k * sizeof(float));
+    if (!query || !idx || !dst) {
+        fprintf(stderr, "test_knn_large_extents: Memory allocation failed\n");
+        free(query);
+        free(idx);
+        free(dst);
+        munmap(base, blocks * block);
+        fclose(block_file);
+        return -1;
+    }
+
+    for (size_t q = 0; q < query_length; q++) {
+        query[q * d + q] = s;
+        for (int i = 0; i < k; i++) {
+            float* row = &corpus[(corpus_length - planted + q * k + i) * d];
+            memcpy(row, &query[q * d], row_bytes);
+            row[(q + 1) % d] += (i + 1) * KNN_LARGE_STEP;
+        }
+    }
+
+    printf("Corpus: %zu x %d = %.2lf G floats (%s 2^31), planted neighbors from row %zu (element %zu)\n ",
+           corpus_length, d, corpus_length * (double)d / 1e9, (corpus_length * d > ((size_t)1 << 31)) ? "more than" : "NOT more than",
+           corpus_length - planted, (corpus_length - planted) * d);
+
+    struct timeval start, end;
+    gettimeofday(&start, NULL);
+    knnsearch(corpus, query, k, idx, dst, corpus_length, query_length, d, num_of_threads);
+    gettimeofday(&end, NULL);
+
+    double time_taken = (end.tv_sec - start.tv_sec) + ((end.tv_usec - start.tv_usec) / 1e6);
+    printf("Running time: %lf seconds, Queries per second: %lf\n ", time_taken, (query_length / time_taken));
+
+    // Every neighbor must be its planted row, at its planted distance
+    size_t neighbor_errors = 0, distance_errors = 0;
+    for (size_t q = 0; q < query_length; q++) {
+        for (int i = 0; i < k; i++) {
+            if (idx[q * k + i] != (knn_idx_t)(corpus_length - planted + q * k + i)) {
+                neighbor_errors++;
+            }
+            if (fabs(dst[q * k + i] - (i + 1) * KNN_LARGE_STEP) > ZERO) {
+                distance_errors++;
+            }
+        }
+    }
+    printf("Large extents: Neighbors Mismatch Percentage: %f%%, ", 100 * neighbor_errors / (float)planted);
+    printf("Distances Mismatch Percentage: %f%%\n", 100 * distance_errors / (float)planted);
+
+    free(query);
+    free(idx);
+    free(dst);
+    munmap(base, blocks * block);
+    fclose(block_file);
+
+    return (neighbor_errors == 0 && distance_errors == 0) ? 0 : -1;
+}
@@ -0,0 +1,363 @@
+#include "../../include/tests/tests.h"
+
+// The tree, pivot and projection searches are built only with `Makefile.gcc`
+#ifndef __cilk
+
+#include "../../include/fastknn.h"
+#include "../../include/exact/knn_exact_tree.h"
+#include "../../include/exact/knn_exact_pivot.h"
+#include "../../include/approximate/knn_approx_projection.h"
+#include "../../include/utils/data_gen.h"
+
+// Layout of a snapshot file (see include/utils/knn_snapshot.h): a 64-byte header whose number of sections, table
+// CRC and header CRC are at these offsets, then a table of 32-byte entries { type, crc, offset, bytes, reserved }
+#define SNAPSHOT_TEST_HEADER_BYTES  64
+#define SNAPSHOT_TEST_NUM_SECTIONS  20
+#define SNAPSHOT_TEST_TABLE_CRC     32
+#define SNAPSHOT_TEST_HEADER_CRC    36
+#define SNAPSHOT_TEST_ENTRY_BYTES   32
+
+// A structure under test, behind the same signatures
+typedef struct {
+    const char*     name;
+    uint32_t        data_section;       // A large data section, corrupted by the test
+    int             has_ids;            // 1 if the META section starts with the id width of the writer
+    void*         (*build)(const float* corpus, size_t corpus_length, int d, int num_of_threads);
+    int           (*save)(const void* structure, const char* filename);
+    void*         (*load)(const char* filename, const float* corpus, size_t corpus_length, int d, int num_of_threads);
+    int           (*search)(const void* structure, const float* query, int k, knn_idx_t* indices, float* distances,
+                            size_t query_length, int num_of_threads);
+    void          (*destroy)(void* structure);
+} snapshot_test_kind_t;
+
+
+static void* tree_build(const float* corpus, size_t corpus_length, int d, int num_of_threads) {
+    return knn_tree_build(corpus, corpus_length, d, 0, num_of_threads);
+}
+static int tree_save(const void* tree, const char* filename) {
+    return knn_tree_save((const knn_tree_t*)tree, filename);
+}
+static void* tree_load(const char* filename, const float* corpus, size_t corpus_length, int d, int num_of_threads) {
+    (void)corpus; (void)corpus_length; (void)d; (void)num_of_threads;
+    return knn_tree_load(filename, 1);
+}
+static int tree_search(const void* tree, const float* query, int k, knn_idx_t* indices, float* distances,
+                       size_t query_length, int num_of_threads) {
+    return knn_tree_search((const knn_tree_t*)tree, query, k, indices, distances, query_length, num_of_threads, NULL);
+}
+static void tree_destroy(void* tree) {
+    knn_tree_free((knn_tree_t*)tree);
+}
+
+static void* pivot_build(const float* corpus, size_t corpus_length, int d, int num_of_threads) {
+    return knn_pivot_build(corpus, corpus_length, d, 0, 0, num_of_threads);
+}
+static int pivot_save(const void* index, const char* filename) {
+    return knn_pivot_save((const knn_pivot_index_t*)index, filename);
+}
+static void* pivot_load(const char* filename, const float* corpus, size_t corpus_length, int d, int num_of_threads) {
+    return knn_pivot_load(filename, corpus, corpus_length, d, 1, num_of_threads);
+}
+static int pivot_search(const void* index, const float* query, int k, knn_idx_t* indices, float* distances,
+                        size_t query_length, int num_of_threads) {
+    return knn_pivot_search((const knn_pivot_index_t*)index, query, k, indices, distances, query_length, num_of_threads, NULL);
+}
+static void pivot_destroy(void* index) {
+    knn_pivot_free((knn_pivot_index_t*)index);
+}
+
+static void* projection_build(const float* corpus, size_t corpus_length, int d, int num_of_threads) {
+    return knn_projection_build(corpus, corpus_length, d, 0, KNN_PROJECTION_PCA, num_of_threads);
+}
+static int projection_save(const void* projection, const char* filename) {
+    return knn_projection_save((const knn_projection_t*)projection, filename);
+}
+static void* projection_load(const char* filename, const float* corpus, size_t corpus_length, int d, int num_of_threads) {
+    return knn_projection_load(filename, corpus, corpus_length, d, 1, num_of_threads);
+}
+static int projection_search(const void* projection, const float* query, int k, knn_idx_t* indices, float* distances,
+                             size_t query_length, int num_of_threads) {
+    return knn_projection_search((const knn_projection_t*)projection, query, k, 0, indices, distances, query_length, num_of_threads);
+}
+static void projection_destroy(void* projection) {
+    knn_projection_free((knn_projection_t*)projection);
+}
+
+
+static unsigned char* snapshot_read_file(const char* filename, size_t* bytes) {
+    FILE* file = fopen(filename, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    unsigned char* data = (length > 0) ? (unsigned char*)malloc((size_t)length) : NULL;
+    if (data != NULL && fread(data, 1, (size_t)length, file) != (size_t)length) {
+        free(data);
+        data = NULL;
+    }
+    fclose(file);
+    *bytes = (data != NULL) ? (size_t)length : 0;
+    return data;
+}
+
+
+static int snapshot_write_file(const char* filename, const unsigned char* data, size_t bytes) {
+    FILE* file = fopen(filename, "wb");
+    if (file == NULL) {
+        return -1;
+    }
+    int ok = fwrite(data, 1, bytes, file) == bytes;
+    return (fclose(file) == 0 && ok) ? 0 : -1;
+}
+
+
+// Table entry of the section `type`, or NULL
+static unsigned char* snapshot_entry(unsigned char* data, size_t bytes, uint32_t type) {
+    uint32_t num_sections;
+    memcpy(&num_sections, &data[SNAPSHOT_TEST_NUM_SECTIONS], sizeof(num_sections));
+    for (uint32_t s = 0; s < num_sections; s++) {
+        unsigned char* entry = &data[SNAPSHOT_TEST_HEADER_BYTES + (size_t)s * SNAPSHOT_TEST_ENTRY_BYTES];
+        uint32_t entry_type;
+        if (entry + SNAPSHOT_TEST_ENTRY_BYTES > data + bytes) {
+            return NULL;
+        }
+        memcpy(&entry_type, entry, sizeof(entry_type));
+        if (entry_type == type) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+
+// A valid snapshot (every checksum updated) whose META section says that it was written with the other id width
+static int snapshot_forge_id_width(unsigned char* data, size_t bytes) {
+    unsigned char* entry = snapshot_entry(data, bytes, KNN_SNAPSHOT_META);
+    if (entry == NULL) {
+        return -1;
+    }
+    uint64_t offset, section_bytes;
+    uint32_t num_sections;
+    memcpy(&offset, &entry[8], sizeof(offset));
+    memcpy(&section_bytes, &entry[16], sizeof(section_bytes));
+    memcpy(&num_sections, &data[SNAPSHOT_TEST_NUM_SECTIONS], sizeof(num_sections));
+
+    uint32_t id_bytes = (sizeof(knn_idx_t) == 8) ? 4 : 8;
+    memcpy(&data[offset], &id_bytes, sizeof(id_bytes));
+    uint32_t crc = knn_crc32(0, &data[offset], section_bytes);
+    memcpy(&entry[4], &crc, sizeof(crc));
+    crc = knn_crc32(0, &data[SNAPSHOT_TEST_HEADER_BYTES], (size_t)num_sections * SNAPSHOT_TEST_ENTRY_BYTES);
+    memcpy(&data[SNAPSHOT_TEST_TABLE_CRC], &crc, sizeof(crc));
+    crc = knn_crc32(0, data, SNAPSHOT_TEST_HEADER_CRC);
+    memcpy(&data[SNAPSHOT_TEST_HEADER_CRC], &crc, sizeof(crc));
+    return 0;
+}
+
+
+// A byte in the middle of the section `type` flipped (its checksum no longer matches)
+static int snapshot_corrupt(unsigned char* data, size_t bytes, uint32_t type) {
+    unsigned char* entry = snapshot_entry(data, bytes, type);
+    if (entry == NULL) {
+        return -1;
+    }
+    uint64_t offset, section_bytes;
+    memcpy(&offset, &entry[8], sizeof(offset));
+    memcpy(&section_bytes, &entry[16], sizeof(section_bytes));
+    data[offset + section_bytes / 2] ^= 0x5A;
+    return 0;
+}
+
+
+// Save, load and search one structure, then reject a corrupted section, another corpus and another id width
+static int snapshot_case(const snapshot_test_kind_t* kind, const char* filename, const float* corpus, const float* other,
+                         const float* query, size_t corpus_length, size_t query_length, int d, int k, int num_of_threads) {
+    knn_idx_t* fresh_ids  = (knn_idx_t*)malloc(query_length * k * sizeof(knn_idx_t));
+    float*     fresh_dst  = (float*)malloc(query_length * k * sizeof(float));
+    knn_idx_t* loaded_ids = (knn_idx_t*)malloc(query_length * k * sizeof(knn_idx_t));
+    float*     loaded_dst = (float*)malloc(query_length * k * sizeof(float));
+    void*      fresh      = kind->build(corpus, corpus_length, d, num_of_threads);
+    void*      loaded     = NULL;
+    const char* failure   = NULL;
+
+    if (!fresh_ids || !fresh_dst || !loaded_ids || !loaded_dst || !fresh) {
+        failure = "the build failed";
+    } else if (kind->save(fresh, filename) != 0) {
+        failure = "the save failed";
+    } else if ((loaded = kind->load(filename, corpus, corpus_length, d, num_of_threads)) == NULL) {
+        failure = "the load failed";
+    } else if (kind->search(fresh, query, k, fresh_ids, fresh_dst, query_length, num_of_threads) != 0 ||
+               kind->search(loaded, query, k, loaded_ids, loaded_dst, query_length, num_of_threads) != 0) {
+        failure = "the search failed";
+    } else if (memcmp(fresh_ids, loaded_ids, query_length * k * sizeof(knn_idx_t)) != 0 ||
+               memcmp(fresh_dst, loaded_dst, query_length * k * sizeof(float)) != 0) {
+        failure = "the loaded results differ from the fresh ones";
+    }
+    if (loaded != NULL) {
+        kind->destroy(loaded);
+        loaded = NULL;
+    }
+
+    // The rejected loads print their reason
+    size_t bytes = 0;
+    unsigned char* saved = (failure == NULL) ? snapshot_read_file(filename, &bytes) : NULL;
+    unsigned char* copy  = (saved != NULL) ? (unsigned char*)malloc(bytes) : NULL;
+    if (failure == NULL && (saved == NULL || copy == NULL)) {
+        failure = "the snapshot could not be read back";
+    }
+
+    if (failure == NULL) {
+        memcpy(copy, saved, bytes);
+        if (snapshot_corrupt(copy, bytes, kind->data_section) != 0 || snapshot_write_file(filename, copy, bytes) != 0) {
+            failure = "the corrupted snapshot could not be written";
+        } else if ((loaded = kind->load(filename, corpus, corpus_length, d, num_of_threads)) != NULL) {
+            failure = "a corrupted section was loaded";
+        }
+    }
+    if (failure == NULL && other != NULL) {
+        if (snapshot_write_file(filename, saved, bytes) != 0) {
+            failure = "the snapshot could not be written back";
+        } else if ((loaded = kind->load(filename, other, corpus_length, d, num_of_threads)) != NULL) {
+            failure = "a snapshot of another corpus was loaded";
+        }
+    }
+    if (failure == NULL && kind->has_ids) {
+        memcpy(copy, saved, bytes);
+        if (snapshot_forge_id_width(copy, bytes) != 0 || snapshot_write_file(filename, copy, bytes) != 0) {
+            failure = "the snapshot of another id width could not be written";
+        } else if ((loaded = kind->load(filename, corpus, corpus_length, d, num_of_threads)) != NULL) {
+            failure = "a snapshot of another id width was loaded";
+        }
+    }
+
+    if (failure != NULL) {
+        printf("Snapshot round trip (%s): %s\n", kind->name, failure);
+    } else {
+        printf("Snapshot round trip (%s): same results as the fresh one; rejected a corrupted section%s%s\n", kind->name,
+               (other != NULL) ? ", another corpus" : "", kind->has_ids ? ", another id width" : "");
+    }
+
+    if (loaded != NULL) {
+        kind->destroy(loaded);
+    }
+    if (fresh != NULL) {
+        kind->destroy(fresh);
+    }
+    remove(filename);
+    free(saved);
+    free(copy);
+    free(fresh_ids);
+    free(fresh_dst);
+    free(loaded_ids);
+    free(loaded_dst);
+    return (failure == NULL) ? 0 : -1;
+}
+
+
+// A tree keeps its own rows, so only the index checks that a tree snapshot holds its corpus: an index over another
+// corpus must rebuild the tree instead of loading it
+static int snapshot_tree_index(const char* filename, const float* corpus, const float* other, const float* query,
+                               size_t corpus_length, size_t query_length, int d, int k, int num_of_threads) {
+    fastknn_id_t* warm_ids  = (fastknn_id_t*)malloc(query_length * k * sizeof(fastknn_id_t));
+    fastknn_id_t* fresh_ids = (fastknn_id_t*)malloc(query_length * k * sizeof(fastknn_id_t));
+    float*        warm_dst  = (float*)malloc(query_length * k * sizeof(float));
+    float*        fresh_dst = (float*)malloc(query_length * k * sizeof(float));
+    fastknn_index_t* saved = NULL;
+    fastknn_index_t* warm  = NULL;
+    fastknn_index_t* fresh = NULL;
+    int status = (warm_ids && fresh_ids && warm_dst && fresh_dst) ? 0 : -1;
+
+    fastknn_index_options_t options;
+    fastknn_index_options_init(&options);
+    options.type          = FASTKNN_INDEX_TREE;
+    options.num_threads   = num_of_threads;
+    options.snapshot_path = filename;
+
+    // The first index saves the snapshot, the second one finds it but is over another corpus
+    status = (status == 0 &&
+              fastknn_index_create(corpus, corpus_length, d, &options, &saved) == FASTKNN_OK &&
+              fastknn_index_create(other, corpus_length, d, &options, &warm) == FASTKNN_OK) ? 0 : -1;
+    options.snapshot_path = NULL;
+    status = (status == 0 &&
+              fastknn_index_create(other, corpus_length, d, &options, &fresh) == FASTKNN_OK &&
+              fastknn_index_search(warm, query, query_length, k, warm_ids, warm_dst) == FASTKNN_OK &&
+              fastknn_index_search(fresh, query, query_length, k, fresh_ids, fresh_dst) == FASTKNN_OK) ? 0 : -1;
+
+    if (status != 0) {
+        printf("Snapshot round trip (tree index): %s\n", fastknn_last_error());
+    } else if (memcmp(warm_ids, fresh_ids, query_length * k * sizeof(fastknn_id_t)) != 0 ||
+               memcmp(warm_dst, fresh_dst, query_length * k * sizeof(float)) != 0) {
+        printf("Snapshot round trip (tree index): the tree of another corpus was loaded\n");
+        status = -1;
+    } else {
+        printf("Snapshot round trip (tree index): the snapshot of another corpus was rebuilt\n");
+    }
+
+    fastknn_index_destroy(saved);
+    fastknn_index_destroy(warm);
+    fastknn_index_destroy(fresh);
+    remove(filename);
+    free(warm_ids);
+    free(fresh_ids);
+    free(warm_dst);
+    free(fresh_dst);
+    return status;
+}
+
+
+int test_knn_snapshots(size_t corpus_length, int d, int k, int num_of_threads) {
+    const snapshot_test_kind_t kinds[] = {
+        { "tree",       KNN_SNAPSHOT_TREE_POINTS,        1, tree_build,       tree_save,       tree_load,
+                        tree_search,       tree_destroy },
+        { "pivot",      KNN_SNAPSHOT_PIVOT_ORDER,        1, pivot_build,      pivot_save,      pivot_load,
+                        pivot_search,      pivot_destroy },
+        { "projection", KNN_SNAPSHOT_PROJECTION_CORPUS,  0, projection_build, projection_save, projection_load,
+                        projection_search, projection_destroy },
+    };
+    size_t query_length = 200;
+
+    if (k < 1 || d < 1 || (size_t)k > corpus_length) {
+        fprintf(stderr, "test_knn_snapshots: Invalid sizes: corpus_length = %zu, d = %d, k = %d\n", corpus_length, d, k);
+        return -1;
+    }
+
+    // Clustered corpus and queries from the same distribution (the queries are the last rows); the other corpus
+    // differs from it in one row, a copy of the first query (so its results differ too)
+    knn_gen_config_t config;
+    knn_gen_default_config(&config, KNN_GEN_MIXTURE, corpus_length + query_length, d, KNN_GEN_DEFAULT_SEED);
+    float* points = knn_gen_dataset(&config, num_of_threads);
+    float* other  = (float*)malloc(corpus_length * d * sizeof(float));
+    char   filename[] = "/tmp/knn_snapshot_XXXXXX";
+    int    fd = mkstemp(filename);
+    if (!points || !other || fd < 0) {
+        fprintf(stderr, "test_knn_snapshots: Failed to allocate the data or to create a temporary file\n");
+        free(points);
+        free(other);
+        if (fd >= 0) { close(fd); remove(filename); }
+        return -1;
+    }
+    close(fd);
+    const float* query = &points[corpus_length * d];
+    memcpy(other, points, corpus_length * d * sizeof(float));
+    memcpy(&other[(corpus_length / 2) * d], query, d * sizeof(float));
+
+    int failures = 0;
+    for (size_t i = 0; i < sizeof(kinds) / sizeof(kinds[0]); i++) {
+        // A tree snapshot does not reference the corpus, so another corpus is checked through the index below
+        const float* other_corpus = (kinds[i].build == tree_build) ? NULL : other;
+        if (snapshot_case(&kinds[i], filename, points, other_corpus, query, corpus_length, query_length, d, k,
+                          num_of_threads) != 0) {
+            failures++;
+        }
+    }
+    if (snapshot_tree_index(filename, points, other, query, corpus_length, query_length, d, k, num_of_threads) != 0) {
+        failures++;
+    }
+
+    free(points);
+    free(other);
+    return (failures == 0) ? 0 : -1;
+}
+
+#endif // __cilk
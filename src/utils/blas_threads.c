@@ -0,0 +1,68 @@
+#include "../../include/utils/blas_threads.h"
+
+static knn_blas_strategy_t last_strategy = KNN_BLAS_INHERIT;
+static int single_thread_pinned = 0;
+
+void blas_set_threads(int num_of_threads) {
+    if (single_thread_pinned) { return; }
+    if (num_of_threads < 1) { num_of_threads = 1; }
+    openblas_set_num_threads(num_of_threads);
+}
+
+
+void blas_pin_single_thread(void) {
+    openblas_set_num_threads(1);
+    single_thread_pinned = 1;
+}
+
+
+int blas_threads_pinned(void) {
+    return single_thread_pinned;
+}
+
+
+int blas_get_threads(void) {
+    return openblas_get_num_threads();
+}
+
+
+knn_blas_strategy_t select_blas_strategy(size_t corpus_length, size_t query_length, int num_of_threads) {
+    // A pinned single-threaded BLAS cannot run the few big GEMMs in parallel
+    if (single_thread_pinned) {
+        return KNN_BLAS_SINGLE_PER_WORKER;
+    }
+
+    // A single worker gains nothing from splitting, let OpenBLAS use the threads instead
+    if (num_of_threads <= 1) {
+        return KNN_BLAS_MULTI_FEW_GEMMS;
+    }
+
+    // Too few query rows per worker: the per-worker GEMMs would be thin (GEMV-like)
+    // and only a big corpus makes it worth to parallelize inside the GEMM
+    if (query_length < (size_t)num_of_threads * BLAS_MIN_ROWS_PER_WORKER && corpus_length >= query_length) {
+        return KNN_BLAS_MULTI_FEW_GEMMS;
+    }
+
+    return KNN_BLAS_SINGLE_PER_WORKER;
+}
+
+
+void blas_set_last_strategy(knn_blas_strategy_t strategy) {
+    // Concurrent searches would race on the record, and there is only one strategy once BLAS is pinned
+    if (single_thread_pinned) { return; }
+    last_strategy = strategy;
+}
+
+
+knn_blas_strategy_t blas_get_last_strategy(void) {
+    return last_strategy;
+}
+
+
+const char* blas_strategy_name(knn_blas_strategy_t strategy) {
+    switch (strategy) {
+        case KNN_BLAS_SINGLE_PER_WORKER:    return "single-threaded BLAS per worker";
+        case KNN_BLAS_MULTI_FEW_GEMMS:      return "few GEMMs with multi-threaded BLAS";
+        default:                            return "inherited BLAS threads";
+    }
+}
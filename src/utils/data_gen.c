@@ -0,0 +1,332 @@
+#include "../../include/utils/data_gen.h"
+
+// Independent streams of the generator (derived from the seed of the dataset)
+#define GEN_SALT_ROWS       0x243F6A8885A308D3ULL
+#define GEN_SALT_DUPLICATE  0x13198A2E03707344ULL
+#define GEN_SALT_CENTERS    0xA4093822299F31D0ULL
+#define GEN_SALT_BASIS      0x082EFA98EC4E6C89ULL
+
+typedef struct {
+    const knn_gen_config_t* config;
+    const float*            basis;      // KNN_GEN_LOW_DIM: d x intrinsic_dim
+    float*                  data;
+    size_t                  row_start;
+    size_t                  row_end;
+    size_t                  offset;     // First row of `data`
+} knn_gen_args_t;
+
+
+static uint64_t splitmix64(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+
+uint64_t knn_gen_random(uint64_t seed, uint64_t counter) {
+    return splitmix64(splitmix64(seed) + (counter + 1) * 0x9E3779B97F4A7C15ULL);
+}
+
+
+// Uniform in [0, 1)
+static inline double gen_uniform(uint64_t stream, uint64_t counter) {
+    return (knn_gen_random(stream, counter) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+
+// Standard normal (Box-Muller, two draws per value)
+static inline double gen_normal(uint64_t stream, uint64_t counter) {
+    double u1 = 1.0 - gen_uniform(stream, 2 * counter);     // (0, 1]
+    double u2 = gen_uniform(stream, 2 * counter + 1);
+    return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+
+static void gen_row(const knn_gen_config_t* config, const float* basis, size_t row, float* out) {
+    int d = config->d;
+
+    // Duplicates are copies of an earlier row, which is generated again (rows do not depend on each other)
+    while (row > 0 && gen_uniform(config->seed ^ GEN_SALT_DUPLICATE, 2 * row) < config->duplicate_fraction) {
+        row = knn_gen_random(config->seed ^ GEN_SALT_DUPLICATE, 2 * row + 1) % row;
+    }
+
+    uint64_t stream = knn_gen_random(config->seed ^ GEN_SALT_ROWS, row);
+
+    switch (config->distribution) {
+        case KNN_GEN_MIXTURE: {
+            int clusters = (config->clusters > 0) ? config->clusters : 1;
+            uint64_t center = knn_gen_random(config->seed ^ GEN_SALT_CENTERS, knn_gen_random(stream, 0) % clusters);
+            for (int j = 0; j < d; j++) {
+                out[j] = (float)(config->low + (config->high - config->low) * gen_uniform(center, j) + config->cluster_std * gen_normal(stream, j + 1));
+            }
+            break;
+        }
+        case KNN_GEN_ANISOTROPIC:
+            for (int j = 0; j < d; j++) {
+                out[j] = (float)(config->scale / pow(j + 1.0, config->anisotropy) * gen_normal(stream, j));
+            }
+            break;
+        case KNN_GEN_LOW_DIM: {
+            int r_dim = config->intrinsic_dim;
+            double z[r_dim];
+            for (int r = 0; r < r_dim; r++) {
+                z[r] = gen_normal(stream, d + r);
+            }
+            for (int j = 0; j < d; j++) {
+                double x = 0;
+                for (int r = 0; r < r_dim; r++) {
+                    x += basis[j * r_dim + r] * z[r];
+                }
+                out[j] = (float)(config->scale * x + config->noise * gen_normal(stream, j));
+            }
+            break;
+        }
+        case KNN_GEN_UNIFORM:
+        default:
+            for (int j = 0; j < d; j++) {
+                out[j] = (float)(config->low + (config->high - config->low) * gen_uniform(stream, j));
+            }
+            break;
+    }
+}
+
+
+static void* gen_thread(void* args) {
+    knn_gen_args_t* a = (knn_gen_args_t*)args;
+
+    for (size_t row = a->row_start; row < a->row_end; row++) {
+        gen_row(a->config, a->basis, row, &a->data[(row - a->offset) * a->config->d]);
+    }
+
+    return NULL;
+}
+
+
+void knn_gen_default_config(knn_gen_config_t* config, knn_gen_dist_t distribution, size_t n, int d, uint64_t seed) {
+    memset(config, 0, sizeof(knn_gen_config_t));
+    config->distribution        = distribution;
+    config->seed                = seed;
+    config->n                   = n;
+    config->d                   = d;
+    config->low                 = 0.0f;
+    config->high                = 1.0f;
+    config->clusters            = 32;
+    config->cluster_std         = 0.05f;
+    config->scale               = 1.0f;
+    config->anisotropy          = 1.0f;
+    config->intrinsic_dim       = (d / 8 > 2) ? d / 8 : ((d < 2) ? d : 2);
+    config->noise               = 0.01f;
+    config->duplicate_fraction  = 0.0f;
+}
+
+
+int knn_gen_fill(const knn_gen_config_t* config, float* data, size_t row_start, size_t rows, int num_of_threads) {
+    float* basis = NULL;
+
+    if (config->distribution == KNN_GEN_LOW_DIM) {
+        if (config->intrinsic_dim <= 0 || config->intrinsic_dim > config->d) {
+            fprintf(stderr, "knn_gen_fill: The intrinsic dimension must be in [1, d]\n");
+            return -1;
+        }
+
+        // Random Gaussian basis of the subspace, scaled so that the points have unit variance per axis
+        basis = (float*)malloc((size_t)config->d * config->intrinsic_dim * sizeof(float));
+        if (basis == NULL) {
+            fprintf(stderr, "knn_gen_fill: Memory allocation failed for the basis\n");
+            return -1;
+        }
+        for (size_t i = 0; i < (size_t)config->d * config->intrinsic_dim; i++) {
+            basis[i] = (float)(gen_normal(config->seed ^ GEN_SALT_BASIS, i) / sqrt((double)config->intrinsic_dim));
+        }
+    }
+
+    if (num_of_threads <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        num_of_threads = (cores > 0) ? (int)cores : 1;
+    }
+    if ((size_t)num_of_threads > rows / 1024 + 1) { num_of_threads = (int)(rows / 1024 + 1); }
+
+    pthread_t*      threads = (pthread_t*)malloc(num_of_threads * sizeof(pthread_t));
+    knn_gen_args_t* args    = (knn_gen_args_t*)malloc(num_of_threads * sizeof(knn_gen_args_t));
+    if (!threads || !args) {
+        fprintf(stderr, "knn_gen_fill: Memory allocation failed for the threads\n");
+        free(threads);
+        free(args);
+        free(basis);
+        return -1;
+    }
+
+    int created = 0;
+    for (int t = 0; t < num_of_threads; t++) {
+        args[t] = (knn_gen_args_t){
+            .config     = config,
+            .basis      = basis,
+            .data       = data,
+            .row_start  = row_start + rows * t / num_of_threads,
+            .row_end    = row_start + rows * (t + 1) / num_of_threads,
+            .offset     = row_start,
+        };
+        // The last block (or any block whose thread cannot be created) runs on the calling thread
+        if (t == num_of_threads - 1 || pthread_create(&threads[created], NULL, gen_thread, &args[t]) != 0) {
+            gen_thread(&args[t]);
+        } else {
+            created++;
+        }
+    }
+    for (int t = 0; t < created; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    free(threads);
+    free(args);
+    free(basis);
+
+    return 0;
+}
+
+
+float* knn_gen_dataset(const knn_gen_config_t* config, int num_of_threads) {
+    float* data = (float*)malloc(config->n * config->d * sizeof(float));
+    if (data == NULL) {
+        fprintf(stderr, "knn_gen_dataset: Memory allocation failed for %zu x %d floats\n", config->n, config->d);
+        return NULL;
+    }
+
+    if (knn_gen_fill(config, data, 0, config->n, num_of_threads) != 0) {
+        free(data);
+        return NULL;
+    }
+
+    return data;
+}
+
+
+int knn_gen_to_hdf5(const knn_gen_config_t* config, const char* filename, const char* dataset_name, int num_of_threads) {
+    hid_t file_id, dataset_id, filespace_id, memspace_id, plist_id;
+    hsize_t dims[2]  = { config->n, config->d };
+    hsize_t chunk[2] = { (config->n < KNN_GEN_CHUNK_ROWS) ? config->n : KNN_GEN_CHUNK_ROWS, config->d };
+
+    if (config->n == 0 || config->d <= 0) {
+        fprintf(stderr, "knn_gen_to_hdf5: Empty dataset\n");
+        return -1;
+    }
+
+    // Open the file if it exists (and replace the dataset), otherwise create it
+    struct stat buffer;
+    if (stat(filename, &buffer) == 0) {
+        file_id = H5Fopen(filename, H5F_ACC_RDWR, H5P_DEFAULT);
+    } else {
+        file_id = H5Fcreate(filename, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+    }
+    if (file_id < 0) {
+        fprintf(stderr, "knn_gen_to_hdf5: Error opening file: %s\n", filename);
+        return -1;
+    }
+
+    if (H5Lexists(file_id, dataset_name, H5P_DEFAULT) > 0 && H5Ldelete(file_id, dataset_name, H5P_DEFAULT) < 0) {
+        fprintf(stderr, "knn_gen_to_hdf5: Error deleting old dataset: %s in file: %s\n", dataset_name, filename);
+        H5Fclose(file_id);
+        return -1;
+    }
+
+    // Chunked dataset, written one chunk at a time
+    filespace_id = H5Screate_simple(2, dims, NULL);
+    plist_id = H5Pcreate(H5P_DATASET_CREATE);
+    H5Pset_chunk(plist_id, 2, chunk);
+    dataset_id = H5Dcreate2(file_id, dataset_name, H5T_NATIVE_FLOAT, filespace_id, H5P_DEFAULT, plist_id, H5P_DEFAULT);
+    H5Pclose(plist_id);
+    if (dataset_id < 0) {
+        fprintf(stderr, "knn_gen_to_hdf5: Error creating dataset: %s\n", dataset_name);
+        H5Sclose(filespace_id);
+        H5Fclose(file_id);
+        return -1;
+    }
+
+    float* rows = (float*)malloc(chunk[0] * config->d * sizeof(float));
+    int status = (rows != NULL) ? 0 : -1;
+
+    for (size_t start = 0; status == 0 && start < config->n; start += chunk[0]) {
+        hsize_t offset[2] = { start, 0 };
+        hsize_t count[2]  = { (start + chunk[0] < config->n) ? chunk[0] : config->n - start, config->d };
+
+        status = knn_gen_fill(config, rows, start, count[0], num_of_threads);
+        if (status != 0) { break; }
+
+        memspace_id = H5Screate_simple(2, count, NULL);
+        H5Sselect_hyperslab(filespace_id, H5S_SELECT_SET, offset, NULL, count, NULL);
+        if (H5Dwrite(dataset_id, H5T_NATIVE_FLOAT, memspace_id, filespace_id, H5P_DEFAULT, rows) < 0) {
+            fprintf(stderr, "knn_gen_to_hdf5: Error writing rows %zu-%zu of dataset: %s\n", start, (size_t)(start + count[0]), dataset_name);
+            status = -1;
+        }
+        H5Sclose(memspace_id);
+    }
+
+    if (rows == NULL) {
+        fprintf(stderr, "knn_gen_to_hdf5: Memory allocation failed for the chunk buffer\n");
+    }
+
+    free(rows);
+    H5Dclose(dataset_id);
+    H5Sclose(filespace_id);
+    H5Fclose(file_id);
+
+    return status;
+}
+
+
+int knn_gen_to_fbin(const knn_gen_config_t* config, const char* filename, int num_of_threads) {
+    if (config->n > UINT32_MAX) {
+        fprintf(stderr, "knn_gen_to_fbin: The .fbin header holds at most 2^32 - 1 rows\n");
+        return -1;
+    }
+
+    FILE* file = fopen(filename, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "knn_gen_to_fbin: Error creating file: %s\n", filename);
+        return -1;
+    }
+
+    uint32_t header[2] = { (uint32_t)config->n, (uint32_t)config->d };
+    size_t chunk_rows = KNN_GEN_CHUNK_ROWS;
+    float* rows = (float*)malloc(chunk_rows * config->d * sizeof(float));
+    int status = (rows != NULL && fwrite(header, sizeof(uint32_t), 2, file) == 2) ? 0 : -1;
+
+    for (size_t start = 0; status == 0 && start < config->n; start += chunk_rows) {
+        size_t count = (start + chunk_rows < config->n) ? chunk_rows : config->n - start;
+
+        status = knn_gen_fill(config, rows, start, count, num_of_threads);
+        if (status == 0 && fwrite(rows, sizeof(float) * config->d, count, file) != count) {
+            status = -1;
+        }
+    }
+
+    if (fclose(file) != 0) { status = -1; }
+    if (status != 0) {
+        fprintf(stderr, "knn_gen_to_fbin: Error writing file: %s\n", filename);
+    }
+
+    free(rows);
+    return status;
+}
+
+
+int knn_gen_parse_distribution(const char* name, knn_gen_dist_t* distribution) {
+    for (int i = KNN_GEN_UNIFORM; i <= KNN_GEN_LOW_DIM; i++) {
+        if (strcmp(name, knn_gen_distribution_name((knn_gen_dist_t)i)) == 0) {
+            *distribution = (knn_gen_dist_t)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+
+const char* knn_gen_distribution_name(knn_gen_dist_t distribution) {
+    switch (distribution) {
+        case KNN_GEN_UNIFORM:       return "uniform";
+        case KNN_GEN_MIXTURE:       return "mixture";
+        case KNN_GEN_ANISOTROPIC:   return "anisotropic";
+        case KNN_GEN_LOW_DIM:       return "lowdim";
+        default:                    return "unknown";
+    }
+}
@@ -1,19 +1,34 @@
 #include "../../include/utils/distance.h"
 
-void distance_square_matrix(const float* corpus, const float* query, float* D, int corpus_length, int query_length, int d) {
+void distance_square_matrix(const float* corpus, const float* query, float* D, size_t corpus_length, size_t query_length, int d) {
     // Step 1: Compute -2 * (Q * C^T)
     // Use OpenBLAS to perform the matrix multiplication
     // D = -2 * Q * C^T
     // Q is of size (query_length x d) and C^T is of size (d x corpus_length)
     // Resulting matrix D will be of size (query_length x corpus_length)
-    cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans,
-                query_length, corpus_length, d,
-                -2.0f, query, d, corpus, d,
-                0.0f, D, corpus_length);
+    // The sizes and the leading dimensions of `cblas_sgemm` are int: a corpus with more than KNN_BLAS_MAX_DIM rows
+    // (ldc == corpus_length would overflow) is multiplied one query row at a time, in blocks of corpus rows.
+    KNN_STATS_BEGIN(KNN_PHASE_GEMM);
+    size_t q_block = (corpus_length <= KNN_BLAS_MAX_DIM) ? KNN_BLAS_MAX_DIM : 1;
+    for (size_t q = 0; q < query_length; q += q_block) {
+        size_t q_length = (q + q_block < query_length) ? q_block : (query_length - q);
+
+        for (size_t c = 0; c < corpus_length; c += KNN_BLAS_MAX_DIM) {
+            size_t c_length = (c + KNN_BLAS_MAX_DIM < corpus_length) ? KNN_BLAS_MAX_DIM : (corpus_length - c);
+            int    ldc      = (int)((corpus_length <= KNN_BLAS_MAX_DIM) ? corpus_length : c_length);
+
+            cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans,
+                        (int)q_length, (int)c_length, d,
+                        -2.0f, &query[q * d], d, &corpus[c * d], d,
+                        0.0f, &D[q * corpus_length + c], ldc);
+        }
+    }
+    KNN_STATS_END(KNN_PHASE_GEMM, (query_length * d + corpus_length * d + query_length * corpus_length) * sizeof(float));
     
     // Step 2: Compute squared norms for the query rows
+    KNN_STATS_BEGIN(KNN_PHASE_NORMS);
     float* query_norms = (float*)malloc(query_length * sizeof(float));
-    for (int i = 0; i < query_length; i++) {
+    for (size_t i = 0; i < query_length; i++) {
         query_norms[i] = 0.0f;
         for (int k = 0; k < d; k++) {
             query_norms[i] += query[i * d + k] * query[i * d + k];
@@ -22,21 +37,54 @@ void distance_square_matrix(const float* corpus, const float* query, float* D, i
 
     // Step 3: Compute squared norms for the corpus rows
     float* corpus_norms = (float*)malloc(corpus_length * sizeof(float));
-    for (int i = 0; i < corpus_length; i++) {
+    for (size_t i = 0; i < corpus_length; i++) {
         corpus_norms[i] = 0.0f;
         for (int k = 0; k < d; k++) {
             corpus_norms[i] += corpus[i * d + k] * corpus[i * d + k];
         }
     }
+    KNN_STATS_END(KNN_PHASE_NORMS, (query_length + corpus_length) * (d + 1) * sizeof(float));
 
     // Step 4: Add the norms to the result matrix D
     // D[i, j] correspond to the distance between the j-th corpus sample and i-th query sample
-    for (int i = 0; i < query_length; i++) {
-        for (int j = 0; j < corpus_length; j++) {
+    KNN_STATS_BEGIN(KNN_PHASE_NORM_ADD);
+    for (size_t i = 0; i < query_length; i++) {
+        for (size_t j = 0; j < corpus_length; j++) {
             D[i * corpus_length + j] += query_norms[i] + corpus_norms[j];
         }
     }
+    KNN_STATS_END(KNN_PHASE_NORM_ADD, 2 * query_length * corpus_length * sizeof(float));
 
     free(corpus_norms);
     free(query_norms);
 }
+
+
+float distance_square_exact(const float* a, const float* b, int d) {
+    double sum = 0.0;
+    for (int j = 0; j < d; j++) {
+        double diff = (double)a[j] - (double)b[j];
+        sum += diff * diff;
+    }
+    return (float)sum;
+}
+
+
+void distance_rerank(const float* corpus, const float* query, int d, knn_idx_t* ids, float* distances, int candidates) {
+    // Insertion sort by (squared distance, id): there are only k + KNN_RERANK_MARGIN candidates
+    for (int i = 0; i < candidates; i++) {
+        knn_idx_t id   = ids[i];
+        float     dist = distance_square_exact(query, &corpus[(size_t)id * d], d);
+        int j = i;
+        while (j > 0 && (distances[j - 1] > dist || (distances[j - 1] == dist && ids[j - 1] > id))) {
+            distances[j] = distances[j - 1];
+            ids[j]       = ids[j - 1];
+            j--;
+        }
+        distances[j] = dist;
+        ids[j]       = id;
+    }
+    for (int i = 0; i < candidates; i++) {
+        distances[i] = (float)sqrt(distances[i]);
+    }
+}
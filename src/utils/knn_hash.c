@@ -0,0 +1,126 @@
+#include "../../include/utils/knn_hash.h"
+
+#define HASH_PRIME_1 0x9E3779B185EBCA87ULL
+#define HASH_PRIME_2 0xC2B2AE3D27D4EB4FULL
+
+typedef struct {
+    const unsigned char*    data;
+    size_t                  bytes;
+    size_t                  chunk_start;
+    size_t                  chunk_end;
+    uint64_t*               chunk_hashes;
+} knn_hash_args_t;
+
+
+static uint64_t hash_mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= HASH_PRIME_2;
+    h ^= h >> 29;
+    h *= HASH_PRIME_1;
+    h ^= h >> 32;
+    return h;
+}
+
+
+uint64_t knn_hash_combine(uint64_t hash, uint64_t value) {
+    return hash_mix(hash ^ (value * HASH_PRIME_1 + HASH_PRIME_2 + (hash << 6) + (hash >> 2)));
+}
+
+
+// Hash of one chunk, 8 bytes at a time
+static uint64_t hash_chunk(const unsigned char* data, size_t bytes, uint64_t seed) {
+    uint64_t h = seed ^ (bytes * HASH_PRIME_1);
+    size_t i = 0;
+
+    for (; i + 8 <= bytes; i += 8) {
+        uint64_t word;
+        memcpy(&word, &data[i], 8);
+        h = (h ^ hash_mix(word)) * HASH_PRIME_1 + HASH_PRIME_2;
+    }
+    if (i < bytes) {
+        uint64_t word = 0;
+        memcpy(&word, &data[i], bytes - i);
+        h = (h ^ hash_mix(word)) * HASH_PRIME_1 + HASH_PRIME_2;
+    }
+
+    return hash_mix(h);
+}
+
+
+static void* hash_thread(void* args) {
+    knn_hash_args_t* a = (knn_hash_args_t*)args;
+
+    for (size_t c = a->chunk_start; c < a->chunk_end; c++) {
+        size_t start = c * KNN_HASH_CHUNK;
+        size_t bytes = (start + KNN_HASH_CHUNK < a->bytes) ? KNN_HASH_CHUNK : (a->bytes - start);
+        a->chunk_hashes[c] = hash_chunk(&a->data[start], bytes, c);
+    }
+
+    return NULL;
+}
+
+
+uint64_t knn_hash_bytes(const void* data, size_t bytes, int num_of_threads) {
+    size_t chunks = (bytes + KNN_HASH_CHUNK - 1) / KNN_HASH_CHUNK;
+    if (chunks <= 1) {
+        return knn_hash_combine(bytes, hash_chunk((const unsigned char*)data, bytes, 0));
+    }
+
+    if (num_of_threads <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        num_of_threads = (cores > 0) ? (int)cores : 1;
+    }
+    if ((size_t)num_of_threads > chunks) { num_of_threads = (int)chunks; }
+
+    uint64_t*        chunk_hashes = (uint64_t*)malloc(chunks * sizeof(uint64_t));
+    pthread_t*       threads      = (pthread_t*)malloc(num_of_threads * sizeof(pthread_t));
+    knn_hash_args_t* args         = (knn_hash_args_t*)malloc(num_of_threads * sizeof(knn_hash_args_t));
+    if (!chunk_hashes || !threads || !args) {
+        fprintf(stderr, "knn_hash_bytes: Memory allocation failed, hashing with 1 thread\n");
+        free(chunk_hashes);
+        free(threads);
+        free(args);
+        num_of_threads = 0;
+    }
+
+    uint64_t hash = bytes;
+    if (num_of_threads == 0) {
+        // Same chunking as the parallel path, so the hash is the same
+        for (size_t c = 0; c < chunks; c++) {
+            size_t start = c * KNN_HASH_CHUNK;
+            size_t length = (start + KNN_HASH_CHUNK < bytes) ? KNN_HASH_CHUNK : (bytes - start);
+            hash = knn_hash_combine(hash, hash_chunk((const unsigned char*)data + start, length, c));
+        }
+        return hash;
+    }
+
+    int created = 0;
+    for (int t = 0; t < num_of_threads; t++) {
+        args[t] = (knn_hash_args_t){
+            .data           = (const unsigned char*)data,
+            .bytes          = bytes,
+            .chunk_start    = chunks * t / num_of_threads,
+            .chunk_end      = chunks * (t + 1) / num_of_threads,
+            .chunk_hashes   = chunk_hashes,
+        };
+        // The last block (or any block whose thread cannot be created) runs on the calling thread
+        if (t == num_of_threads - 1 || pthread_create(&threads[created], NULL, hash_thread, &args[t]) != 0) {
+            hash_thread(&args[t]);
+        } else {
+            created++;
+        }
+    }
+    for (int t = 0; t < created; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    for (size_t c = 0; c < chunks; c++) {
+        hash = knn_hash_combine(hash, chunk_hashes[c]);
+    }
+
+    free(chunk_hashes);
+    free(threads);
+    free(args);
+
+    return hash;
+}
@@ -0,0 +1,62 @@
+#include "../../include/utils/knn_parallel.h"
+
+typedef struct {
+    knn_range_fn    fn;
+    void*           ctx;
+    int             t;
+    size_t          start, end;
+} knn_range_args_t;
+
+
+static void* knn_range_worker(void* args) {
+    knn_range_args_t* a = (knn_range_args_t*)args;
+    a->fn(a->ctx, a->t, a->start, a->end);
+    return NULL;
+}
+
+
+int knn_resolve_threads(int num_of_threads) {
+    if (num_of_threads <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        num_of_threads = (cores > 0) ? (int)cores : 1;
+    }
+    return num_of_threads;
+}
+
+
+int knn_parallel_ranges(knn_range_fn fn, void* ctx, size_t items, int num_of_threads) {
+    num_of_threads = knn_resolve_threads(num_of_threads);
+    if ((size_t)num_of_threads > items) { num_of_threads = (items > 0) ? (int)items : 1; }
+
+    pthread_t*        threads = (pthread_t*)malloc(num_of_threads * sizeof(pthread_t));
+    knn_range_args_t* args    = (knn_range_args_t*)malloc(num_of_threads * sizeof(knn_range_args_t));
+    if (!threads || !args) {
+        fprintf(stderr, "knn_parallel_ranges: Memory allocation failed for the threads\n");
+        free(threads);
+        free(args);
+        return -1;
+    }
+
+    int created = 0;
+    for (int t = 0; t < num_of_threads; t++) {
+        args[t] = (knn_range_args_t){
+            .fn     = fn,
+            .ctx    = ctx,
+            .t      = t,
+            .start  = items * t / num_of_threads,
+            .end    = items * (t + 1) / num_of_threads,
+        };
+        if (t == num_of_threads - 1 || pthread_create(&threads[created], NULL, knn_range_worker, &args[t]) != 0) {
+            knn_range_worker(&args[t]);
+        } else {
+            created++;
+        }
+    }
+    for (int t = 0; t < created; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    free(threads);
+    free(args);
+    return 0;
+}
@@ -0,0 +1,223 @@
+#include "../../include/utils/knn_profile.h"
+
+// Every measurement is repeated until it takes at least this many seconds
+#define CALIBRATION_MIN_TIME 0.02
+
+// Shapes of the calibration problems
+#define CALIBRATION_C   4096
+#define CALIBRATION_D   128
+#define CALIBRATION_THIN_Q  8
+#define CALIBRATION_FAT_Q   256
+
+static double wall_time(void) {
+    struct timeval t;
+    gettimeofday(&t, NULL);
+    return t.tv_sec + t.tv_usec / 1e6;
+}
+
+
+static double measure_gemm_gflops(const float* A, const float* B, float* C, int q, int c, int d) {
+    int repeats = 0;
+    double start = wall_time(), elapsed = 0;
+
+    do {
+        cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans, q, c, d, -2.0f, A, d, B, d, 0.0f, C, c);
+        repeats++;
+        elapsed = wall_time() - start;
+    } while (elapsed < CALIBRATION_MIN_TIME);
+
+    return 2.0 * q * c * d * repeats / elapsed / 1e9;
+}
+
+
+static double measure_select_ns(const float* src, float* tmp, size_t* idx, int n, int k) {
+    int repeats = 0;
+    double start = wall_time(), elapsed = 0;
+
+    do {
+        // Same work as `knn_exact_serial_core` does for every query row
+        memcpy(tmp, src, n * sizeof(float));
+        gsl_sort_float_smallest_index(idx, k, tmp, 1, n);
+        repeats++;
+        elapsed = wall_time() - start;
+    } while (elapsed < CALIBRATION_MIN_TIME);
+
+    return elapsed * 1e9 / ((double)repeats * n);
+}
+
+
+static void* empty_thread(void* args) {
+    return args;
+}
+
+
+int knn_profile_calibrate(knn_profile_t* profile) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int c = CALIBRATION_C, d = CALIBRATION_D;
+
+    float*  A   = (float*)malloc((size_t)CALIBRATION_FAT_Q * d * sizeof(float));
+    float*  B   = (float*)malloc((size_t)c * d * sizeof(float));
+    float*  C   = (float*)malloc((size_t)CALIBRATION_FAT_Q * c * sizeof(float));
+    size_t* idx = (size_t*)malloc(100 * sizeof(size_t));
+    if (!A || !B || !C || !idx) {
+        fprintf(stderr, "knn_profile_calibrate: Memory allocation failed for the calibration matrices\n");
+        free(A);
+        free(B);
+        free(C);
+        free(idx);
+        return -1;
+    }
+
+    // Deterministic data (no special values, so that BLAS does not take any shortcuts)
+    for (int i = 0; i < CALIBRATION_FAT_Q * d; i++) { A[i] = (float)((i * 7919L) % 1000) / 1000.0f; }
+    for (int i = 0; i < c * d; i++)                 { B[i] = (float)((i * 104729L) % 1000) / 1000.0f; }
+
+    profile->version = KNN_PROFILE_VERSION;
+    profile->cores   = (cores > 0) ? (int)cores : 1;
+
+    // GEMM throughput with a single-threaded and a multi-threaded BLAS
+    int blas_threads = blas_get_threads();
+    blas_set_threads(1);
+    profile->gemm_gflops_thin = measure_gemm_gflops(A, B, C, CALIBRATION_THIN_Q, c, d);
+    profile->gemm_gflops_fat  = measure_gemm_gflops(A, B, C, CALIBRATION_FAT_Q, c, d);
+    blas_set_threads(profile->cores);
+    profile->gemm_gflops_thin_multi = measure_gemm_gflops(A, B, C, CALIBRATION_THIN_Q, c, d);
+    profile->gemm_gflops_fat_multi  = measure_gemm_gflops(A, B, C, CALIBRATION_FAT_Q, c, d);
+    blas_set_threads(blas_threads);
+
+    // Selection cost (GSL's selection is linear in k), measured on the GEMM output
+    double select_k1   = measure_select_ns(C, C + c, idx, c, 1);
+    double select_k100 = measure_select_ns(C, C + c, idx, c, 100);
+    profile->select_ns_per_k = (select_k100 > select_k1) ? (select_k100 - select_k1) / 99.0 : 0.0;
+    profile->select_ns_base  = select_k1 - profile->select_ns_per_k;
+    if (profile->select_ns_base < 0) { profile->select_ns_base = 0; }
+
+    // Streaming pass cost
+    int repeats = 0;
+    double start = wall_time(), elapsed = 0;
+    do {
+        memcpy(C, C + (size_t)CALIBRATION_FAT_Q * c / 2, (size_t)CALIBRATION_FAT_Q * c / 2 * sizeof(float));
+        repeats++;
+        elapsed = wall_time() - start;
+    } while (elapsed < CALIBRATION_MIN_TIME);
+    profile->copy_ns = elapsed * 1e9 / ((double)repeats * CALIBRATION_FAT_Q * c / 2);
+
+    // Thread creation and join cost
+    repeats = 0;
+    start = wall_time();
+    do {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, empty_thread, NULL) == 0) {
+            pthread_join(thread, NULL);
+        }
+        repeats++;
+        elapsed = wall_time() - start;
+    } while (elapsed < CALIBRATION_MIN_TIME);
+    profile->spawn_us = elapsed * 1e6 / repeats;
+
+    free(A);
+    free(B);
+    free(C);
+    free(idx);
+
+    return 0;
+}
+
+
+int knn_profile_load(const char* filename, knn_profile_t* profile) {
+    FILE* file = fopen(filename, "r");
+    if (file == NULL) {
+        return -1;
+    }
+
+    char line[256];
+    int fields = 0;
+    memset(profile, 0, sizeof(knn_profile_t));
+
+    while (fgets(line, sizeof(line), file)) {
+        if (line[0] == '#') { continue; }
+
+        fields += sscanf(line, "version %d", &profile->version);
+        fields += sscanf(line, "cores %d", &profile->cores);
+        fields += sscanf(line, "gemm_gflops_thin %lf", &profile->gemm_gflops_thin);
+        fields += sscanf(line, "gemm_gflops_fat %lf", &profile->gemm_gflops_fat);
+        fields += sscanf(line, "gemm_gflops_thin_multi %lf", &profile->gemm_gflops_thin_multi);
+        fields += sscanf(line, "gemm_gflops_fat_multi %lf", &profile->gemm_gflops_fat_multi);
+        fields += sscanf(line, "select_ns_base %lf", &profile->select_ns_base);
+        fields += sscanf(line, "select_ns_per_k %lf", &profile->select_ns_per_k);
+        fields += sscanf(line, "copy_ns %lf", &profile->copy_ns);
+        fields += sscanf(line, "spawn_us %lf", &profile->spawn_us);
+    }
+
+    fclose(file);
+
+    if (fields != 10 || profile->version != KNN_PROFILE_VERSION) {
+        return -1;
+    }
+
+    return 0;
+}
+
+
+int knn_profile_save(const char* filename, const knn_profile_t* profile) {
+    FILE* file = fopen(filename, "w");
+    if (file == NULL) {
+        fprintf(stderr, "knn_profile_save: Error creating file: %s\n", filename);
+        return -1;
+    }
+
+    fprintf(file, "# FastParallelKNN cost profile (delete this file to re-calibrate)\n");
+    fprintf(file, "version %d\n", profile->version);
+    fprintf(file, "cores %d\n", profile->cores);
+    fprintf(file, "gemm_gflops_thin %lf\n", profile->gemm_gflops_thin);
+    fprintf(file, "gemm_gflops_fat %lf\n", profile->gemm_gflops_fat);
+    fprintf(file, "gemm_gflops_thin_multi %lf\n", profile->gemm_gflops_thin_multi);
+    fprintf(file, "gemm_gflops_fat_multi %lf\n", profile->gemm_gflops_fat_multi);
+    fprintf(file, "select_ns_base %lf\n", profile->select_ns_base);
+    fprintf(file, "select_ns_per_k %lf\n", profile->select_ns_per_k);
+    fprintf(file, "copy_ns %lf\n", profile->copy_ns);
+    fprintf(file, "spawn_us %lf\n", profile->spawn_us);
+
+    fclose(file);
+
+    return 0;
+}
+
+
+void knn_profile_defaults(knn_profile_t* profile) {
+    profile->version = KNN_PROFILE_VERSION;
+    profile->cores = 1;
+    profile->gemm_gflops_thin = profile->gemm_gflops_thin_multi = 1.0;
+    profile->gemm_gflops_fat  = profile->gemm_gflops_fat_multi  = 10.0;
+    profile->select_ns_base = 1.0;
+    profile->select_ns_per_k = 0.1;
+    profile->copy_ns = 0.2;
+    profile->spawn_us = 20.0;
+}
+
+
+static knn_profile_t   host_profile;
+static pthread_once_t  host_profile_once = PTHREAD_ONCE_INIT;
+
+static void host_profile_init(void) {
+    const char* filename = getenv("KNN_PROFILE_PATH");
+    if (filename == NULL) { filename = KNN_PROFILE_PATH; }
+
+    if (knn_profile_load(filename, &host_profile) == 0) {
+        return;
+    }
+
+    if (knn_profile_calibrate(&host_profile) != 0) {
+        // Conservative defaults, so that the planner still works
+        knn_profile_defaults(&host_profile);
+        return;
+    }
+
+    knn_profile_save(filename, &host_profile);
+}
+
+
+const knn_profile_t* knn_profile_get(void) {
+    pthread_once(&host_profile_once, host_profile_init);
+    return &host_profile;
+}
@@ -0,0 +1,210 @@
+#include "../../include/utils/knn_snapshot.h"
+
+#include <stddef.h>
+#include <pthread.h>
+
+#define SNAPSHOT_BYTE_ORDER 0x01020304u
+
+typedef struct {
+    char        magic[8];
+    uint32_t    version;
+    uint32_t    byte_order;         // SNAPSHOT_BYTE_ORDER as written by the host
+    uint32_t    kind;
+    uint32_t    num_sections;
+    uint64_t    file_bytes;
+    uint32_t    table_crc;          // CRC of the section table
+    uint32_t    header_crc;         // CRC of the header up to this field
+    uint8_t     reserved[24];
+} snapshot_header_t;
+
+typedef struct {
+    uint32_t    type;
+    uint32_t    crc;
+    uint64_t    offset;
+    uint64_t    bytes;
+    uint64_t    reserved;
+} snapshot_entry_t;
+
+_Static_assert(sizeof(snapshot_header_t) == 64, "The snapshot header must be 64 bytes");
+_Static_assert(sizeof(snapshot_entry_t) == 32, "The snapshot table entries must be 32 bytes");
+
+
+static uint32_t crc_table[256];
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;
+
+static void crc_table_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int b = 0; b < 8; b++) {
+            c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+        }
+        crc_table[i] = c;
+    }
+}
+
+
+uint32_t knn_crc32(uint32_t crc, const void* data, size_t bytes) {
+    pthread_once(&crc_table_once, crc_table_init);
+    const unsigned char* p = (const unsigned char*)data;
+    crc = ~crc;
+    for (size_t i = 0; i < bytes; i++) {
+        crc = crc_table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+
+static size_t snapshot_align(size_t bytes) {
+    return (bytes + KNN_SNAPSHOT_ALIGN - 1) / KNN_SNAPSHOT_ALIGN * KNN_SNAPSHOT_ALIGN;
+}
+
+
+int knn_snapshot_save(const char* filename, uint32_t kind, const knn_snapshot_section_t* sections, int num_sections) {
+    snapshot_entry_t* table = (snapshot_entry_t*)calloc(num_sections, sizeof(snapshot_entry_t));
+    size_t tmp_length = strlen(filename) + 5;
+    char* tmp_name = (char*)malloc(tmp_length);
+    if (!table || !tmp_name) {
+        fprintf(stderr, "knn_snapshot_save: Memory allocation failed\n");
+        free(table);
+        free(tmp_name);
+        return -1;
+    }
+    snprintf(tmp_name, tmp_length, "%s.tmp", filename);
+
+    size_t offset = snapshot_align(sizeof(snapshot_header_t) + num_sections * sizeof(snapshot_entry_t));
+    for (int s = 0; s < num_sections; s++) {
+        table[s].type   = sections[s].type;
+        table[s].crc    = knn_crc32(0, sections[s].data, sections[s].bytes);
+        table[s].offset = offset;
+        table[s].bytes  = sections[s].bytes;
+        offset = snapshot_align(offset + sections[s].bytes);
+    }
+
+    snapshot_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, KNN_SNAPSHOT_MAGIC, sizeof(KNN_SNAPSHOT_MAGIC));
+    header.version      = KNN_SNAPSHOT_VERSION;
+    header.byte_order   = SNAPSHOT_BYTE_ORDER;
+    header.kind         = kind;
+    header.num_sections = (uint32_t)num_sections;
+    header.file_bytes   = offset;
+    header.table_crc    = knn_crc32(0, table, num_sections * sizeof(snapshot_entry_t));
+    header.header_crc   = knn_crc32(0, &header, offsetof(snapshot_header_t, header_crc));
+
+    FILE* file = fopen(tmp_name, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "knn_snapshot_save: Failed to create %s\n", tmp_name);
+        free(table);
+        free(tmp_name);
+        return -1;
+    }
+
+    static const char padding[KNN_SNAPSHOT_ALIGN] = { 0 };
+    size_t written = sizeof(header) + num_sections * sizeof(snapshot_entry_t);
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+             (num_sections == 0 || fwrite(table, sizeof(snapshot_entry_t), num_sections, file) == (size_t)num_sections);
+    for (int s = 0; ok && s < num_sections; s++) {
+        ok = fwrite(padding, 1, table[s].offset - written, file) == table[s].offset - written &&
+             fwrite(sections[s].data, 1, sections[s].bytes, file) == sections[s].bytes;
+        written = table[s].offset + sections[s].bytes;
+    }
+    ok = ok && fwrite(padding, 1, header.file_bytes - written, file) == header.file_bytes - written;
+    ok = (fclose(file) == 0) && ok;
+
+    if (!ok || rename(tmp_name, filename) != 0) {
+        fprintf(stderr, "knn_snapshot_save: Failed to write %s\n", filename);
+        remove(tmp_name);
+        free(table);
+        free(tmp_name);
+        return -1;
+    }
+
+    free(table);
+    free(tmp_name);
+    return 0;
+}
+
+
+knn_snapshot_t* knn_snapshot_open(const char* filename, uint32_t kind, int verify) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "knn_snapshot_open: Failed to open %s\n", filename);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(snapshot_header_t)) {
+        fprintf(stderr, "knn_snapshot_open: %s is not a snapshot\n", filename);
+        close(fd);
+        return NULL;
+    }
+    size_t bytes = (size_t)st.st_size;
+    void* mapping = mmap(NULL, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "knn_snapshot_open: Failed to map %s\n", filename);
+        return NULL;
+    }
+
+    const snapshot_header_t* header = (const snapshot_header_t*)mapping;
+    const snapshot_entry_t*  table  = (const snapshot_entry_t*)(header + 1);
+    const char* error = NULL;
+    if (memcmp(header->magic, KNN_SNAPSHOT_MAGIC, sizeof(KNN_SNAPSHOT_MAGIC)) != 0) {
+        error = "not a snapshot";
+    } else if (header->byte_order != SNAPSHOT_BYTE_ORDER) {
+        error = "written by a host of another byte order";
+    } else if (header->header_crc != knn_crc32(0, header, offsetof(snapshot_header_t, header_crc))) {
+        error = "corrupted header";
+    } else if (header->version != KNN_SNAPSHOT_VERSION) {
+        error = "snapshot version not supported (rebuild it)";
+    } else if (header->kind != kind) {
+        error = "snapshot of another structure";
+    } else if (header->file_bytes != bytes ||
+               sizeof(snapshot_header_t) + (size_t)header->num_sections * sizeof(snapshot_entry_t) > bytes) {
+        error = "truncated file";
+    } else if (header->table_crc != knn_crc32(0, table, header->num_sections * sizeof(snapshot_entry_t))) {
+        error = "corrupted section table";
+    }
+    for (uint32_t s = 0; error == NULL && s < header->num_sections; s++) {
+        if (table[s].offset % KNN_SNAPSHOT_ALIGN != 0 || table[s].offset > bytes || table[s].bytes > bytes - table[s].offset) {
+            error = "section out of the file";
+        } else if (verify && table[s].crc != knn_crc32(0, (const char*)mapping + table[s].offset, table[s].bytes)) {
+            error = "corrupted section (checksum mismatch)";
+        }
+    }
+    if (error != NULL) {
+        fprintf(stderr, "knn_snapshot_open: %s: %s\n", filename, error);
+        munmap(mapping, bytes);
+        return NULL;
+    }
+
+    knn_snapshot_t* snapshot = (knn_snapshot_t*)malloc(sizeof(knn_snapshot_t));
+    if (snapshot == NULL) {
+        fprintf(stderr, "knn_snapshot_open: Memory allocation failed\n");
+        munmap(mapping, bytes);
+        return NULL;
+    }
+    snapshot->mapping      = mapping;
+    snapshot->bytes        = bytes;
+    snapshot->kind         = header->kind;
+    snapshot->num_sections = header->num_sections;
+    snapshot->table        = table;
+    return snapshot;
+}
+
+
+const void* knn_snapshot_section(const knn_snapshot_t* snapshot, uint32_t type, size_t bytes) {
+    const snapshot_entry_t* table = (const snapshot_entry_t*)snapshot->table;
+    for (uint32_t s = 0; s < snapshot->num_sections; s++) {
+        if (table[s].type == type) {
+            return (table[s].bytes == bytes) ? (const char*)snapshot->mapping + table[s].offset : NULL;
+        }
+    }
+    return NULL;
+}
+
+
+void knn_snapshot_close(knn_snapshot_t* snapshot) {
+    if (snapshot == NULL) { return; }
+    munmap(snapshot->mapping, snapshot->bytes);
+    free(snapshot);
+}
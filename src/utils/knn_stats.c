@@ -0,0 +1,153 @@
+#include "../../include/utils/knn_stats.h"
+#include "../../include/utils/data_io.h"
+
+// Counters of one thread. Each thread writes only its own counters, so no synchronization is needed
+// in the hot path; the list is only locked when a thread registers, exits, or a snapshot is taken.
+typedef struct knn_thread_stats {
+    uint64_t                    ns[KNN_NUM_PHASES];
+    uint64_t                    bytes[KNN_NUM_PHASES];
+    uint64_t                    calls[KNN_NUM_PHASES];
+    struct knn_thread_stats*    next;
+} knn_thread_stats_t;
+
+static pthread_mutex_t      stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static knn_thread_stats_t*  stats_threads = NULL;       // Live threads
+static knn_stats_t          stats_retired;              // Threads that have exited
+static pthread_key_t        stats_key;
+static pthread_once_t       stats_key_once = PTHREAD_ONCE_INIT;
+static __thread knn_thread_stats_t* stats_local = NULL;
+
+
+// Add the counters of a thread to a snapshot
+static void stats_accumulate(knn_stats_t* stats, const knn_thread_stats_t* thread) {
+    int used = 0;
+
+    for (int p = 0; p < KNN_NUM_PHASES; p++) {
+        double seconds = thread->ns[p] / 1e9;
+        stats->phase[p].seconds += seconds;
+        stats->phase[p].bytes   += thread->bytes[p];
+        stats->phase[p].calls   += thread->calls[p];
+        if (seconds > stats->phase[p].max_seconds) { stats->phase[p].max_seconds = seconds; }
+        used |= (thread->calls[p] > 0);
+    }
+
+    stats->threads += used;
+}
+
+
+// Thread exit: keep its counters and unregister it
+static void stats_thread_exit(void* args) {
+    knn_thread_stats_t* thread = (knn_thread_stats_t*)args;
+
+    pthread_mutex_lock(&stats_lock);
+    stats_accumulate(&stats_retired, thread);
+    for (knn_thread_stats_t** node = &stats_threads; *node != NULL; node = &(*node)->next) {
+        if (*node == thread) {
+            *node = thread->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&stats_lock);
+
+    free(thread);
+}
+
+
+static void stats_key_init(void) {
+    pthread_key_create(&stats_key, stats_thread_exit);
+}
+
+
+void knn_stats_add(knn_phase_t phase, uint64_t ns, uint64_t bytes) {
+    if (stats_local == NULL) {
+        knn_thread_stats_t* thread = (knn_thread_stats_t*)calloc(1, sizeof(knn_thread_stats_t));
+        if (thread == NULL) {
+            return;
+        }
+
+        pthread_once(&stats_key_once, stats_key_init);
+        pthread_setspecific(stats_key, thread);
+
+        pthread_mutex_lock(&stats_lock);
+        thread->next = stats_threads;
+        stats_threads = thread;
+        pthread_mutex_unlock(&stats_lock);
+
+        stats_local = thread;
+    }
+
+    stats_local->ns[phase]    += ns;
+    stats_local->bytes[phase] += bytes;
+    stats_local->calls[phase] += 1;
+}
+
+
+int knn_stats_enabled(void) {
+    return KNN_STATS;
+}
+
+
+void knn_stats_reset(void) {
+    pthread_mutex_lock(&stats_lock);
+    for (knn_thread_stats_t* thread = stats_threads; thread != NULL; thread = thread->next) {
+        memset(thread->ns, 0, sizeof(thread->ns));
+        memset(thread->bytes, 0, sizeof(thread->bytes));
+        memset(thread->calls, 0, sizeof(thread->calls));
+    }
+    memset(&stats_retired, 0, sizeof(stats_retired));
+    pthread_mutex_unlock(&stats_lock);
+}
+
+
+void knn_stats_snapshot(knn_stats_t* stats) {
+    pthread_mutex_lock(&stats_lock);
+    *stats = stats_retired;
+    for (knn_thread_stats_t* thread = stats_threads; thread != NULL; thread = thread->next) {
+        stats_accumulate(stats, thread);
+    }
+    pthread_mutex_unlock(&stats_lock);
+}
+
+
+void knn_stats_print(FILE* file, const knn_stats_t* stats) {
+    double total = 0;
+    for (int p = 0; p < KNN_NUM_PHASES; p++) {
+        total += stats->phase[p].seconds;
+    }
+
+    fprintf(file, "Phase timers (%d threads):\n", stats->threads);
+    for (int p = 0; p < KNN_NUM_PHASES; p++) {
+        const knn_phase_stats_t* phase = &stats->phase[p];
+        fprintf(file, "  %-10s %12lf s (%6.2lf%%), max/thread %12lf s, %14.3lf MB, %12llu calls\n",
+                knn_phase_name((knn_phase_t)p), phase->seconds, (total > 0) ? 100 * phase->seconds / total : 0.0,
+                phase->max_seconds, phase->bytes / 1e6, (unsigned long long)phase->calls);
+    }
+}
+
+
+int knn_stats_save_hdf5(const char* filename, const knn_stats_t* stats) {
+    float data[KNN_NUM_PHASES * 4];
+
+    for (int p = 0; p < KNN_NUM_PHASES; p++) {
+        data[p * 4 + 0] = (float)stats->phase[p].seconds;
+        data[p * 4 + 1] = (float)stats->phase[p].max_seconds;
+        data[p * 4 + 2] = (float)stats->phase[p].bytes;
+        data[p * 4 + 3] = (float)stats->phase[p].calls;
+    }
+
+    return save_float_hdf5(filename, "phase_stats", data, KNN_NUM_PHASES, 4);
+}
+
+
+const char* knn_phase_name(knn_phase_t phase) {
+    switch (phase) {
+        case KNN_PHASE_GEMM:        return "gemm";
+        case KNN_PHASE_NORMS:       return "norms";
+        case KNN_PHASE_NORM_ADD:    return "norm_add";
+        case KNN_PHASE_COPY:        return "copy";
+        case KNN_PHASE_SELECT:      return "select";
+        case KNN_PHASE_WRITEBACK:   return "writeback";
+        case KNN_PHASE_MERGE:       return "merge";
+        default:                    return "unknown";
+    }
+}
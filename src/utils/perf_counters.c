@@ -0,0 +1,252 @@
+#include "../../include/utils/perf_counters.h"
+
+// Counters of one thread (each thread reads only its own file descriptors)
+typedef struct knn_thread_perf {
+    int                     fd[KNN_PERF_NUM_EVENTS];
+    uint64_t                start[KNN_PERF_NUM_PHASES][KNN_PERF_NUM_EVENTS];
+    uint64_t                start_ns[KNN_PERF_NUM_PHASES];
+    uint64_t                count[KNN_PERF_NUM_PHASES][KNN_PERF_NUM_EVENTS];
+    uint64_t                ns[KNN_PERF_NUM_PHASES];
+    struct knn_thread_perf* next;
+} knn_thread_perf_t;
+
+static const uint64_t perf_configs[KNN_PERF_NUM_EVENTS] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_REFERENCES,
+    PERF_COUNT_HW_CACHE_MISSES
+};
+
+static const char* perf_event_names[KNN_PERF_NUM_EVENTS] = { "cycles", "instructions", "LLC references", "LLC misses" };
+
+static pthread_mutex_t      perf_lock = PTHREAD_MUTEX_INITIALIZER;
+static knn_thread_perf_t*   perf_threads = NULL;                // Live threads
+static knn_perf_t           perf_retired;                       // Threads that have exited
+static int                  perf_status[KNN_PERF_NUM_EVENTS];   // 0: not tried, 1: counted, -1: not permitted
+static int                  perf_warned = 0;
+static pthread_key_t        perf_key;
+static pthread_once_t       perf_key_once = PTHREAD_ONCE_INIT;
+static __thread knn_thread_perf_t* perf_local = NULL;
+
+
+static int perf_open(uint64_t config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type           = PERF_TYPE_HARDWARE;
+    attr.size           = sizeof(attr);
+    attr.config         = config;
+    attr.exclude_kernel = 1;    // User space only, so that it works with perf_event_paranoid <= 2
+    attr.exclude_hv     = 1;
+
+    // Count the calling thread on any CPU
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+
+static uint64_t perf_read(int fd) {
+    uint64_t value = 0;
+    if (fd < 0 || read(fd, &value, sizeof(value)) != sizeof(value)) {
+        return 0;
+    }
+    return value;
+}
+
+
+// Add the counts of a thread to a snapshot
+static void perf_accumulate(knn_perf_t* perf, const knn_thread_perf_t* thread) {
+    int used = 0;
+
+    for (int p = 0; p < KNN_PERF_NUM_PHASES; p++) {
+        for (int e = 0; e < KNN_PERF_NUM_EVENTS; e++) {
+            perf->count[p][e] += thread->count[p][e];
+        }
+        perf->seconds[p] += thread->ns[p] / 1e9;
+        used |= (thread->ns[p] > 0);
+    }
+
+    perf->threads += used;
+}
+
+
+// Thread exit: keep its counts, close its counters and unregister it
+static void perf_thread_exit(void* args) {
+    knn_thread_perf_t* thread = (knn_thread_perf_t*)args;
+
+    pthread_mutex_lock(&perf_lock);
+    perf_accumulate(&perf_retired, thread);
+    for (knn_thread_perf_t** node = &perf_threads; *node != NULL; node = &(*node)->next) {
+        if (*node == thread) {
+            *node = thread->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&perf_lock);
+
+    for (int e = 0; e < KNN_PERF_NUM_EVENTS; e++) {
+        if (thread->fd[e] >= 0) { close(thread->fd[e]); }
+    }
+    free(thread);
+}
+
+
+static void perf_key_init(void) {
+    pthread_key_create(&perf_key, perf_thread_exit);
+}
+
+
+static knn_thread_perf_t* perf_thread_init(void) {
+    knn_thread_perf_t* thread = (knn_thread_perf_t*)calloc(1, sizeof(knn_thread_perf_t));
+    if (thread == NULL) {
+        return NULL;
+    }
+
+    pthread_once(&perf_key_once, perf_key_init);
+    pthread_setspecific(perf_key, thread);
+
+    pthread_mutex_lock(&perf_lock);
+    int error = 0;
+    for (int e = 0; e < KNN_PERF_NUM_EVENTS; e++) {
+        // An event that failed once is not tried again (the result would be the same on every thread)
+        thread->fd[e] = (perf_status[e] >= 0) ? perf_open(perf_configs[e]) : -1;
+        if (thread->fd[e] < 0) {
+            if (perf_status[e] == 0) { error = errno; }
+            perf_status[e] = -1;
+        } else {
+            perf_status[e] = 1;
+        }
+    }
+    if (error != 0 && !perf_warned) {
+        fprintf(stderr, "perf_counters: Some hardware counters are n/a (perf_event_open: %s), "
+                        "check /proc/sys/kernel/perf_event_paranoid\n", strerror(error));
+        perf_warned = 1;
+    }
+    thread->next = perf_threads;
+    perf_threads = thread;
+    pthread_mutex_unlock(&perf_lock);
+
+    return thread;
+}
+
+
+void knn_perf_begin(knn_perf_phase_t phase) {
+    if (perf_local == NULL) {
+        perf_local = perf_thread_init();
+        if (perf_local == NULL) {
+            return;
+        }
+    }
+
+    for (int e = 0; e < KNN_PERF_NUM_EVENTS; e++) {
+        perf_local->start[phase][e] = perf_read(perf_local->fd[e]);
+    }
+    perf_local->start_ns[phase] = knn_stats_now();
+}
+
+
+void knn_perf_end(knn_perf_phase_t phase) {
+    if (perf_local == NULL) {
+        return;
+    }
+
+    perf_local->ns[phase] += knn_stats_now() - perf_local->start_ns[phase];
+    for (int e = 0; e < KNN_PERF_NUM_EVENTS; e++) {
+        perf_local->count[phase][e] += perf_read(perf_local->fd[e]) - perf_local->start[phase][e];
+    }
+}
+
+
+int knn_perf_enabled(void) {
+    return KNN_PERF;
+}
+
+
+void knn_perf_reset(void) {
+    pthread_mutex_lock(&perf_lock);
+    for (knn_thread_perf_t* thread = perf_threads; thread != NULL; thread = thread->next) {
+        memset(thread->count, 0, sizeof(thread->count));
+        memset(thread->ns, 0, sizeof(thread->ns));
+    }
+    memset(&perf_retired, 0, sizeof(perf_retired));
+    pthread_mutex_unlock(&perf_lock);
+}
+
+
+void knn_perf_snapshot(knn_perf_t* perf) {
+    pthread_mutex_lock(&perf_lock);
+    *perf = perf_retired;
+    for (knn_thread_perf_t* thread = perf_threads; thread != NULL; thread = thread->next) {
+        perf_accumulate(perf, thread);
+    }
+    for (int e = 0; e < KNN_PERF_NUM_EVENTS; e++) {
+        perf->available[e] = (perf_status[e] == 1);
+    }
+    pthread_mutex_unlock(&perf_lock);
+}
+
+
+// Sum of an event over one phase (phase >= 0) or all the phases (phase == -1)
+static double perf_sum(const knn_perf_t* perf, int phase, knn_perf_event_t event) {
+    double sum = 0;
+    for (int p = 0; p < KNN_PERF_NUM_PHASES; p++) {
+        if (phase < 0 || phase == p) { sum += perf->count[p][event]; }
+    }
+    return sum;
+}
+
+
+double knn_perf_ipc(const knn_perf_t* perf, int phase) {
+    if (!perf->available[KNN_PERF_CYCLES] || !perf->available[KNN_PERF_INSTRUCTIONS]) {
+        return -1;
+    }
+
+    double cycles = perf_sum(perf, phase, KNN_PERF_CYCLES);
+    return (cycles > 0) ? perf_sum(perf, phase, KNN_PERF_INSTRUCTIONS) / cycles : 0.0;
+}
+
+
+double knn_perf_misses_per_query(const knn_perf_t* perf, int phase, long queries) {
+    if (!perf->available[KNN_PERF_CACHE_MISSES]) {
+        return -1;
+    }
+
+    return (queries > 0) ? perf_sum(perf, phase, KNN_PERF_CACHE_MISSES) / queries : 0.0;
+}
+
+
+void knn_perf_print(FILE* file, const knn_perf_t* perf, long queries) {
+    fprintf(file, "Hardware counters (%d threads):\n", perf->threads);
+
+    for (int p = -1; p < KNN_PERF_NUM_PHASES; p++) {
+        double seconds = 0;
+        for (int q = 0; q < KNN_PERF_NUM_PHASES; q++) {
+            if (p < 0 || p == q) { seconds += perf->seconds[q]; }
+        }
+
+        fprintf(file, "  %-10s", (p < 0) ? "total" : knn_perf_phase_name((knn_perf_phase_t)p));
+        for (int e = 0; e < KNN_PERF_NUM_EVENTS; e++) {
+            if (perf->available[e]) {
+                fprintf(file, " %s %.0lf,", perf_event_names[e], perf_sum(perf, p, e));
+            } else {
+                fprintf(file, " %s n/a,", perf_event_names[e]);
+            }
+        }
+
+        double ipc = knn_perf_ipc(perf, p);
+        double misses = knn_perf_misses_per_query(perf, p, queries);
+        if (ipc >= 0)    { fprintf(file, " IPC %.3lf,", ipc); }
+        else             { fprintf(file, " IPC n/a,"); }
+        if (misses >= 0) { fprintf(file, " misses/query %.1lf, bandwidth proxy %.3lf GB/s per thread\n", misses,
+                                   (seconds > 0) ? perf_sum(perf, p, KNN_PERF_CACHE_MISSES) * KNN_PERF_CACHE_LINE / seconds / 1e9 : 0.0); }
+        else             { fprintf(file, " misses/query n/a, bandwidth proxy n/a\n"); }
+    }
+}
+
+
+const char* knn_perf_phase_name(knn_perf_phase_t phase) {
+    switch (phase) {
+        case KNN_PERF_DISTANCE:     return "distance";
+        case KNN_PERF_SELECTION:    return "selection";
+        case KNN_PERF_MERGE:        return "merge";
+        default:                    return "unknown";
+    }
+}